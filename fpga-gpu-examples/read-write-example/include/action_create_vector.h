@@ -25,7 +25,12 @@ extern "C" {
 
 /* This number is unique and is declared in ~snap/ActionTypes.md */
 #define PARALLEL_MEMCPY_ACTION_TYPE 0x1014100F
-#define MAX_SIZE 1024*128
+#define MAX_SIZE (1024*128)
+
+/* Transfer modes (mode field of the job) */
+#define PARALLEL_MEMCPY_MODE_FLAGS	0	/* read_flag/write_flag protocol (FPGA image) */
+#define PARALLEL_MEMCPY_MODE_RING	1	/* descriptor ring in queue (software action only) */
+#define PARALLEL_MEMCPY_MODE_BATCH	2	/* job table in queue, one pass per start (software action only) */
 
 /* Data structure used to exchange information between action and application */
 /* Size limit is 108 Bytes */
@@ -36,8 +41,38 @@ typedef struct parallel_memcpy_job {
 	struct snap_addr read;
 	struct snap_addr read_flag;
 	struct snap_addr write_flag;
+	uint64_t mode;		/* PARALLEL_MEMCPY_MODE_* */
+	struct snap_addr queue;	/* struct desc_ring (MODE_RING) or parallel_memcpy_table (MODE_BATCH) */
 } parallel_memcpy_job_t;
 
+/*
+ * Batch job table (MODE_BATCH), in host memory : the job only holds its
+ * address, so one start moves any number of vectors. The action copies
+ * each entry from src to dst (at most vector_size elements), sets its
+ * status (DESC_STATUS_DONE or DESC_STATUS_ERROR of desc_ring.h) and writes
+ * done = count once the whole table is processed.
+ */
+struct parallel_memcpy_entry {
+	uint64_t src;
+	uint64_t dst;
+	uint32_t length;	/* bytes */
+	uint32_t status;
+};
+
+struct parallel_memcpy_table {
+	uint64_t count;
+	uint64_t done;		/* written last by the action */
+	struct parallel_memcpy_entry entry[];
+};
+
+/*
+ * Returns once the software action has no thread left : a thread goes on
+ * for a while after its last completion (trace, wake-up of the host). The
+ * host calls it before freeing anything the action uses. Returns at once
+ * when the action runs on the card.
+ */
+void parallel_memcpy_wait_idle(void);
+
 #ifdef __cplusplus
 }
 #endif
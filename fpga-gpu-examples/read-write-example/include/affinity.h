@@ -0,0 +1,80 @@
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process wide placement of the threads and of the buffer pool.
+ *
+ * Each thread role gets a CPU list, the NUMA node of the device or "near" :
+ * the CPUs sharing the last level cache (core complex) with the first CPU of
+ * the device node. The HOST thread and the device thread (FPGA emulator,
+ * software action) are pinned to one CPU each, distinct when the lists allow
+ * it, workers are spread over the rest of their list. The device node comes
+ * from sysfs (CAPI / OpenCAPI card) unless given. Nothing is pinned and the
+ * pool is not bound when no placement is configured.
+ */
+
+#define AFFINITY_SPEC_LEN	64
+
+enum affinity_role {
+	AFFINITY_HOST = 0,	/* polling / main thread */
+	AFFINITY_DEVICE,	/* FPGA emulator or software action */
+	AFFINITY_WORKERS,	/* compute worker pool */
+	AFFINITY_ROLES
+};
+
+struct affinity_config {
+	char cpus[AFFINITY_ROLES][AFFINITY_SPEC_LEN];	/* "" : not pinned */
+	char mem[AFFINITY_SPEC_LEN];			/* "" or off, near, node<N> */
+	int device_node;				/* -1 : from sysfs */
+};
+
+void affinity_config_init(struct affinity_config *cfg);
+
+/*
+ * One item per call (the -A option can be repeated) :
+ * host=, device=, workers= with a CPU list (0-3,8), node<N> or near,
+ * mem=off|near|node<N>, device_node=<N>, and auto for near everywhere.
+ */
+int affinity_parse(const char *item, struct affinity_config *cfg);
+
+/* Resolves the lists and pins the calling (HOST) thread */
+int affinity_init(const struct affinity_config *cfg);
+
+/* Node the buffer pool is bound to, -1 for none */
+int affinity_numa_node(void);
+
+/* Pins a thread of a role, index spreads the workers */
+int affinity_pin(pthread_t thread, enum affinity_role role, int index);
+
+/* Placement requested and observed, sample is a pool buffer (or NULL) */
+void affinity_report(const void *sample, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __AFFINITY_H__ */
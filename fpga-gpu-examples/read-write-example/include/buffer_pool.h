@@ -0,0 +1,90 @@
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process wide pool of transfer buffers.
+ *
+ * Buffers are carved from large chunks (2 MB, or 1 GB with 1G pages) and sorted
+ * in power of two size classes, from 64 bytes (flags, FPGA alignment) up to
+ * 512 KB (MAX_SIZE uint32_t). Bigger requests get a chunk of their own.
+ * A released buffer goes back to the free list of its class and is handed out
+ * again by the next request of the same class, within a run or across runs.
+ *
+ * Chunks are pre-faulted (no first touch fault in the timed iterations),
+ * optionally backed by huge pages and mlocked. Buffers are returned zeroed.
+ */
+
+#define BUFFER_POOL_ALIGN		64
+#define BUFFER_POOL_MIN_SHIFT		6	/* 64 bytes */
+#define BUFFER_POOL_MAX_SHIFT		19	/* 512 KB */
+#define BUFFER_POOL_CLASSES		(BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1)
+#define BUFFER_POOL_CHUNK		(2ul << 20)
+
+enum buffer_pool_pages {
+	PAGES_DEFAULT = 0,	/* base pages, transparent huge pages requested */
+	PAGES_HUGE_2M,		/* hugetlbfs 2 MB pages */
+	PAGES_HUGE_1G,		/* hugetlbfs 1 GB pages */
+	PAGES_MAX
+};
+
+struct buffer_pool_config {
+	enum buffer_pool_pages pages;
+	bool prefault;
+	bool lock;		/* mlock the chunks */
+	int numa_node;		/* chunks bound to this node, -1 : first touch */
+};
+
+/* Default : base pages + THP, pre-faulted, not locked, no NUMA binding */
+void buffer_pool_config_init(struct buffer_pool_config *cfg);
+
+/* Comma separated list : thp, 2m, 1g, prefault, noprefault, mlock */
+int buffer_pool_parse(const char *spec, struct buffer_pool_config *cfg);
+
+/* Must be called before the first buffer_pool_get() to change the defaults */
+int buffer_pool_init(const struct buffer_pool_config *cfg);
+
+void *buffer_pool_get(size_t size);
+void buffer_pool_put(void *buffer);
+
+/*
+ * Page aligned buffer padded to whole base pages, for the buffers given to
+ * cudaHostRegister() : pages are pinned once, two small buffers sharing one
+ * would fail the second registration. Released with buffer_pool_put().
+ */
+void *buffer_pool_get_pages(size_t size);
+
+void buffer_pool_report(FILE *out);
+
+/* Unmaps all the chunks, outstanding buffers included */
+void buffer_pool_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __BUFFER_POOL_H__ */
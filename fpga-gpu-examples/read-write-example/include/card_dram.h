@@ -0,0 +1,99 @@
+#ifndef __CARD_DRAM_H__
+#define __CARD_DRAM_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process wide emulation of the DRAM of the card (software action).
+ *
+ * A fixed size arena cut in slots of one input : the host gives the slot
+ * size, the largest transfer of its run. Inputs the action reads
+ * from the host are kept in the slots, so a job reading the same input
+ * again is served by the card without using the host link. A resident
+ * input is found by its key :
+ *   - hash : content of the input, computed where the data is. Changed
+ *     data gets a new key, the old copy ages out. The host would compute
+ *     it next to its data; here the action does, the time is reported.
+ *   - addr : host address and length. No hashing, but the host must evict
+ *     a buffer before rewriting it.
+ *
+ * Slots are recycled least recently used first. The host can also upload
+ * an input explicitly : it is pinned and stays resident until it is
+ * evicted. Inputs bigger than a slot bypass the card DRAM.
+ */
+
+#define CARD_DRAM_DEFAULT_SIZE	(64ul << 20)
+#define CARD_DRAM_DEFAULT_SLOT	(512ul << 10)	/* MAX_SIZE uint32_t */
+#define CARD_DRAM_MAX_SLOTS	(1u << 30)
+
+enum card_dram_key {
+	CARD_DRAM_KEY_HASH = 0,
+	CARD_DRAM_KEY_ADDR,
+	CARD_DRAM_KEY_MAX
+};
+
+/* Result of card_dram_read() */
+enum card_dram_result {
+	CARD_DRAM_HIT = 0,	/* served by the card, no host read */
+	CARD_DRAM_MISS,		/* read from the host, resident from now on */
+	CARD_DRAM_BYPASS,	/* read from the host, not cached */
+};
+
+struct card_dram_config {
+	size_t size;		/* bytes, at least one slot */
+	size_t slot_size;	/* bytes, largest input cached */
+	enum card_dram_key key;
+};
+
+/* Default : 64 MB in slots of 512 KB, content hash */
+void card_dram_config_init(struct card_dram_config *cfg);
+
+/* Comma separated list : size=<bytes>[K|M|G], key=hash|addr */
+int card_dram_parse(const char *spec, struct card_dram_config *cfg);
+
+/* After buffer_pool_init() : the arena comes from the pool */
+int card_dram_init(const struct card_dram_config *cfg);
+bool card_dram_enabled(void);
+
+/* Device : length bytes at src into dst, from the card when resident */
+enum card_dram_result card_dram_read(void *dst, const void *src, uint32_t length);
+
+/* Host : pins a copy of an input in the card, -1 if every slot is pinned */
+int card_dram_upload(const void *src, uint32_t length);
+
+/* Host : forgets an input, -1 if it was not resident */
+int card_dram_evict(const void *src, uint32_t length);
+
+/* Hits, misses, evictions and host link bytes saved */
+void card_dram_report(FILE *out);
+
+void card_dram_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __CARD_DRAM_H__ */
@@ -0,0 +1,80 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Transfer encoding of the uint32_t vectors : delta + bit packing.
+ *
+ * Vectors are cut in blocks of CODEC_BLOCK elements, in the 4 lanes layout
+ * of SIMD-BP128 (element 4j + l is in lane l) :
+ *  - delta of each element with the one 4 positions before (the first 4
+ *    with the first element of the block), zigzag encoded,
+ *  - all deltas packed on the bit width b of the biggest one : 4 * b words.
+ * A block is { b, first element, 4 * b packed words }. Blocks that do not
+ * shrink are stored { CODEC_RAW, 128 elements }, the last partial block is
+ * always stored as is. The encoded size is always a number of words.
+ */
+#define CODEC_BLOCK	128
+#define CODEC_RAW	0xffffffffu
+
+struct codec_stats {
+	uint64_t vectors;
+	uint64_t raw_bytes;		/* before encoding */
+	uint64_t wire_bytes;		/* after encoding */
+	uint64_t blocks;
+	uint64_t raw_blocks;		/* incompressible blocks */
+	uint64_t encode_ns;
+	uint64_t decode_ns;
+	uint64_t errors;		/* malformed input of codec_decode() */
+};
+
+/* Biggest encoded size of a vector of n elements, in bytes */
+static inline size_t codec_bound(size_t n)
+{
+	return (n + n / CODEC_BLOCK) * sizeof(uint32_t);
+}
+
+/* Encodes n elements into out (codec_bound(n) bytes), returns the encoded size in bytes */
+size_t codec_encode(const uint32_t *in, size_t n, uint32_t *out, struct codec_stats *stats);
+
+/* Decodes bytes of in into n elements, returns -1 if in is not a vector of n elements */
+int codec_decode(const uint32_t *in, size_t bytes, uint32_t *out, size_t n,
+		struct codec_stats *stats);
+
+/* "sse2" or "scalar" */
+const char *codec_name(void);
+
+void codec_stats_init(struct codec_stats *stats);
+
+/* Ratio, CPU cost and, over elapsed_us, the effective (decoded) and wire throughput */
+void codec_report(const struct codec_stats *stats, double elapsed_us, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __CODEC_H__ */
@@ -0,0 +1,64 @@
+#ifndef __CPU_KERNEL_H__
+#define __CPU_KERNEL_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CPU version of the vector_add kernel (out[i] = in[i] + in[i]).
+ *
+ * Vectorized variants are built with per function target attributes and
+ * the best one supported by the running CPU is picked at runtime (cpuid on
+ * x86, AT_HWCAP on POWER). A selected variant is first checked against the
+ * scalar reference, it falls back to scalar if the results differ.
+ */
+enum cpu_isa {
+	CPU_ISA_SCALAR = 0,
+	CPU_ISA_SSE4,
+	CPU_ISA_AVX2,
+	CPU_ISA_AVX512,
+	CPU_ISA_VSX,
+	CPU_ISA_MAX
+};
+
+/* Selects the kernel by name ("scalar", "sse4", "avx2", "avx512", "vsx"),
+ * NULL for the best supported one. Returns -1 if unknown or not supported */
+int cpu_kernel_select(const char *isa);
+const char *cpu_kernel_name(void);
+
+struct worker_pool;
+
+/* Splits the kernels over the threads of pool (NULL : calling thread only) */
+void cpu_kernel_set_pool(struct worker_pool *pool);
+
+/* Dispatched kernel (selects the best variant on first use) */
+void cpu_vector_add(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size);
+
+/* Reference implementation */
+void cpu_vector_add_scalar(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __CPU_KERNEL_H__ */
@@ -0,0 +1,173 @@
+#ifndef __DESC_RING_H__
+#define __DESC_RING_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Single producer / single consumer descriptor ring stored in host memory.
+ *
+ * The host (producer) fills descriptors and publishes them by moving head,
+ * the device (consumer) processes them in order and moves tail. head and
+ * tail are free running 64-bit counters : descriptor n is stored at index
+ * n & mask and its sequence number is n. Each index lives on its own cache
+ * line (128 bytes, the POWER9 line size) with a cached copy of the other one
+ * so that producer and consumer only share a line when the ring looks
+ * full or empty.
+ *
+ * Several DMA engines can share the consumer side : they claim descriptors
+ * in order with desc_ring_claim() and complete them in any order (see
+ * reorder.h). The host then retires the descriptors in order itself.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DESC_RING_CACHE_LINE	128
+#define DESC_RING_DEFAULT_SIZE	64
+
+#define DESC_STATUS_FREE	0
+#define DESC_STATUS_POSTED	1
+#define DESC_STATUS_DONE	2
+#define DESC_STATUS_ERROR	3
+
+/* One transfer : device reads length bytes at src and writes them at dst */
+struct desc_ring_desc {
+	uint64_t sequence;
+	uint64_t src;
+	uint64_t dst;
+	uint32_t length;
+	uint32_t status;
+};
+
+struct desc_ring {
+	/* producer (host) cache line */
+	uint64_t head __attribute__((aligned(DESC_RING_CACHE_LINE)));
+	uint64_t tail_cache;
+
+	/* consumer (device) cache line */
+	uint64_t tail __attribute__((aligned(DESC_RING_CACHE_LINE)));
+	uint64_t head_cache;
+	uint64_t fetch;			/* next descriptor claimed by the engines */
+
+	/* read only after allocation */
+	uint32_t size __attribute__((aligned(DESC_RING_CACHE_LINE)));
+	uint32_t mask;
+
+	struct desc_ring_desc desc[] __attribute__((aligned(DESC_RING_CACHE_LINE)));
+};
+
+/* size is rounded up to a power of 2 */
+struct desc_ring *desc_ring_alloc(uint32_t size);
+void desc_ring_free(struct desc_ring *ring);
+
+/*-----------------------------------------------
+ *            Producer side (host)
+ *-----------------------------------------------*/
+
+/* Post one transfer. Returns its sequence number or -1 if the ring is full */
+static inline int64_t desc_ring_post(struct desc_ring *ring,
+		const void *src, void *dst, uint32_t length)
+{
+	uint64_t head = ring->head;
+	struct desc_ring_desc *desc;
+
+	if (head - ring->tail_cache >= ring->size) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - ring->tail_cache >= ring->size)
+			return -1;
+	}
+
+	desc = &ring->desc[head & ring->mask];
+	desc->sequence = head;
+	desc->src = (unsigned long)src;
+	desc->dst = (unsigned long)dst;
+	desc->length = length;
+	desc->status = DESC_STATUS_POSTED;
+
+	// descriptor content must be visible before the device sees the new head
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return (int64_t)head;
+}
+
+/* Number of descriptors completed by the device since allocation */
+static inline uint64_t desc_ring_completed(struct desc_ring *ring)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Several engines : frees the oldest descriptor once its completion is consumed */
+static inline void desc_ring_retire(struct desc_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Status of a completed descriptor (valid until the slot is reused) */
+static inline uint32_t desc_ring_status(struct desc_ring *ring, uint64_t sequence)
+{
+	return __atomic_load_n(&ring->desc[sequence & ring->mask].status,
+			__ATOMIC_ACQUIRE);
+}
+
+/*-----------------------------------------------
+ *            Consumer side (device)
+ *-----------------------------------------------*/
+
+/* Next descriptor to process or NULL if the ring is empty */
+static inline struct desc_ring_desc *desc_ring_peek(struct desc_ring *ring)
+{
+	uint64_t tail = ring->tail;
+
+	if (tail == ring->head_cache) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail == ring->head_cache)
+			return NULL;
+	}
+	return &ring->desc[tail & ring->mask];
+}
+
+/* Retire the descriptor returned by desc_ring_peek() */
+static inline void desc_ring_complete(struct desc_ring *ring,
+		struct desc_ring_desc *desc, uint32_t status)
+{
+	desc->status = status;
+	// data written at dst and status must be visible before the new tail
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Several engines : claims the next posted descriptor below limit, NULL if none */
+static inline struct desc_ring_desc *desc_ring_claim(struct desc_ring *ring, uint64_t limit)
+{
+	uint64_t seq = __atomic_load_n(&ring->fetch, __ATOMIC_RELAXED);
+
+	do {
+		if ((seq >= limit) || (seq == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)))
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&ring->fetch, &seq, seq + 1, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	return &ring->desc[seq & ring->mask];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __DESC_RING_H__ */
@@ -0,0 +1,99 @@
+#ifndef __DEVICE_MODEL_H__
+#define __DEVICE_MODEL_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Timing model of a software device (FPGA emulator, software action).
+ *
+ * A transfer reads read_bytes from the host and writes write_bytes back.
+ * Both directions of the link are used at the same time, so a transfer takes :
+ *
+ *   latency + max(read_bytes / read_bw, write_bytes / write_bw) + process + jitter
+ *
+ * The device starts its real copies at the beginning of the transfer and then
+ * waits until the deadline : the copies are part of the modeled time, they are
+ * not added to it.
+ *
+ * Models are given as a comma separated list of presets and key=value pairs,
+ * later items overriding earlier ones :
+ *   ad9v3,jitter=exp:500ns
+ *   latency=1us,bw=4,process=10us
+ */
+
+/* AD9V3 (CAPI2) FPGA only rows of README.md : 4.8 us @ 4 KB, 277 us @ 512 KB */
+#define DEVICE_MODEL_AD9V3_LATENCY_NS	2660
+#define DEVICE_MODEL_AD9V3_GBPS		1.91
+
+#define DEVICE_MODEL_ENV		"PARALLEL_MEMCPY_MODEL"
+
+enum device_jitter {
+	JITTER_NONE = 0,
+	JITTER_UNIFORM,		/* uniform in [0, jitter_ns] */
+	JITTER_NORMAL,		/* gaussian, standard deviation jitter_ns */
+	JITTER_EXP,		/* exponential, mean jitter_ns (long tail) */
+	JITTER_MAX
+};
+
+struct device_model {
+	uint64_t latency_ns;		/* fixed cost of each transfer */
+	double read_gbps;		/* host to device, 0 is infinite */
+	double write_gbps;		/* device to host, 0 is infinite */
+	uint64_t process_ns;		/* device processing time of each transfer */
+	enum device_jitter jitter;
+	uint64_t jitter_ns;
+	uint64_t spin_ns;
+	uint64_t seed;
+
+	/* statistics */
+	uint64_t transfers;
+	uint64_t late;			/* real copies slower than the model */
+	uint64_t late_ns;
+};
+
+/* Infinitely fast device : no wait at all */
+void device_model_init(struct device_model *m);
+int device_model_parse(const char *spec, struct device_model *m);
+static inline int device_model_enabled(const struct device_model *m)
+{
+	return (m->latency_ns != 0) || (m->read_gbps != 0.0) ||
+		(m->write_gbps != 0.0) || (m->process_ns != 0) ||
+		(m->jitter != JITTER_NONE);
+}
+
+/* Modeled duration of one transfer (draws the jitter) */
+uint64_t device_model_transfer_ns(struct device_model *m,
+		uint64_t read_bytes, uint64_t write_bytes);
+
+/* Sleeps then spins until the deadline (CLOCK_MONOTONIC) */
+void device_model_wait(struct device_model *m, uint64_t deadline_ns);
+
+void device_model_print(const struct device_model *m, FILE *out);
+void device_model_report(const struct device_model *m, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __DEVICE_MODEL_H__ */
@@ -0,0 +1,158 @@
+#ifndef __JOB_SCHED_H__
+#define __JOB_SCHED_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <desc_ring.h>
+#include <latency_histogram.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process scheduler sharing one device across many clients.
+ *
+ * The descriptor ring has a single producer : clients do not post to it,
+ * they queue requests on their own submission queue and a dispatcher thread
+ * moves them to the ring, at most depth descriptors in flight. The device
+ * completes descriptors in order, so the dispatcher retires them in the
+ * order it posted them and marks each request done.
+ *
+ * The next request is chosen among the heads of the client queues (a client
+ * is always served in submission order) :
+ *  - fair     : deficit round robin on the bytes, each client gets a share
+ *               proportional to its weight whatever its request size,
+ *  - priority : the non empty queue with the lowest priority value first,
+ *               round robin between equal priorities.
+ * With small=<bytes>, requests up to that size are taken before any other
+ * (still charged to the client share) and bulk requests may only fill
+ * depth - 1 descriptors, so a small one never waits behind a full ring of
+ * bulk tiles.
+ */
+
+#define SCHED_MAX_CLIENTS	16
+#define SCHED_DEFAULT_DEPTH	8
+/* Bytes added to the deficit of a client per round and per unit of weight */
+#define SCHED_QUANTUM		(64 << 10)
+
+enum sched_policy {
+	SCHED_FAIR = 0,
+	SCHED_PRIORITY,
+	SCHED_POLICY_MAX
+};
+
+struct job_sched_config {
+	enum sched_policy policy;
+	uint32_t small_bytes;		/* 0 : no bypass */
+	uint32_t depth;			/* descriptors in flight */
+};
+
+struct sched_client;
+
+/* Owned by the client, untouched until done is set */
+struct sched_request {
+	const void *src;
+	void *dst;
+	uint32_t length;
+	uint32_t status;		/* DESC_STATUS_DONE or DESC_STATUS_ERROR */
+	uint64_t submit_ns;
+	uint64_t post_ns;
+	int done;
+	struct sched_client *client;
+	struct sched_request *next;
+};
+
+struct sched_client {
+	char name[24];
+	int priority;			/* lower first */
+	uint32_t weight;		/* share of the bytes */
+
+	/* submission queue, shared with the dispatcher */
+	pthread_mutex_t lock;
+	struct sched_request *head, *tail;
+
+	/* dispatcher only */
+	int64_t deficit;
+	uint64_t completed;
+	uint64_t bytes;
+	uint64_t bypassed;		/* small requests taken first */
+	uint64_t errors;
+	uint64_t last_ns;		/* last completion */
+	struct latency_histogram latency;	/* submission to completion */
+	struct latency_histogram queue;		/* submission to post */
+};
+
+struct job_sched {
+	struct job_sched_config cfg;
+	struct desc_ring *ring;
+	int num_clients;
+	struct sched_client *clients[SCHED_MAX_CLIENTS];
+
+	/* dispatcher only */
+	int cursor;			/* next client of the round robin */
+	int small_cursor;
+	uint64_t posted, retired;
+	uint32_t bulk_in_flight;
+	struct sched_request **in_flight;	/* ring size entries, by sequence */
+
+	pthread_t thread;
+	int running;
+	int stop;
+	uint64_t start_ns;
+};
+
+/* Fair share, no bypass, SCHED_DEFAULT_DEPTH descriptors in flight */
+void job_sched_config_init(struct job_sched_config *cfg);
+
+/* Comma separated list : fair or priority, small=<bytes>, depth=<N> */
+int job_sched_parse(const char *spec, struct job_sched_config *cfg);
+
+struct job_sched *job_sched_create(struct desc_ring *ring, const struct job_sched_config *cfg);
+
+/* Clients are added before job_sched_start(), weight 0 is taken as 1 */
+struct sched_client *job_sched_add_client(struct job_sched *s, const char *name,
+		int priority, uint32_t weight);
+
+int job_sched_start(struct job_sched *s);
+
+/* Any thread, one thread per client */
+void job_sched_submit(struct sched_client *c, struct sched_request *req,
+		const void *src, void *dst, uint32_t length);
+
+/* Returns the status of the request once the device is done with it */
+uint32_t job_sched_wait(struct sched_request *req);
+
+/* Returns once every submitted request is done, then stops the dispatcher */
+void job_sched_stop(struct job_sched *s);
+void job_sched_destroy(struct job_sched *s);
+
+const char *job_sched_policy_name(enum sched_policy policy);
+
+/* Requests, throughput and latency of every client */
+void job_sched_report(const struct job_sched *s, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __JOB_SCHED_H__ */
@@ -10,7 +10,12 @@
 #include <getopt.h>
 #include <string.h>
 #include <sys/time.h>
-#define MAX_STREAMS 1
+
+#include <cpu_kernel.h>
+#include <buffer_pool.h>
+
+/* Maximum pipeline depth : number of buffer slots that can be in flight */
+#define MAX_STREAMS 8
 
 #define timediff_usec(t0, t1)						\
 	((double)(((t0)->tv_sec * 1000000 + (t0)->tv_usec) -		\
@@ -20,13 +25,58 @@
 extern "C" {
 #endif
 
-void memory_allocation_host(uint32_t *buffer[MAX_STREAMS], size_t size);
-void memory_allocation_gpu(uint32_t *buffer[MAX_STREAMS], size_t size);
-void init_buffers(uint32_t *buffer[MAX_STREAMS], int vector_size);
+void memory_allocation_host(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams);
+void memory_allocation_gpu(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams);
+void init_buffers(uint32_t *buffer[MAX_STREAMS], int vector_size, int num_streams);
 void run_new_stream_v1(uint32_t *bufferA, uint32_t *bufferB, uint32_t *ibuff, uint32_t *obuff, int vector_size);
 void run_new_stream_v2(uint32_t *ibuff, uint32_t *obuff, int vector_size);
-void free_host(uint32_t *buffer[MAX_STREAMS]);
-void free_device(uint32_t *buffer[MAX_STREAMS]);
+void free_host(uint32_t *buffer[MAX_STREAMS], int num_streams);
+void free_device(uint32_t *buffer[MAX_STREAMS], int num_streams);
+
+/*
+ * Compute backends : same interface as the functions above, the runners
+ * select one at runtime (-c). The GPU backend is left out of builds
+ * without CUDA (make NO_CUDA=1), the CPU backend is always available.
+ */
+struct compute_backend {
+	const char *name;
+	void (*memory_allocation_host)(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams);
+	void (*memory_allocation_device)(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams);
+	void (*init_buffers)(uint32_t *buffer[MAX_STREAMS], int vector_size, int num_streams);
+	void (*run_new_stream_v1)(uint32_t *bufferA, uint32_t *bufferB, uint32_t *ibuff, uint32_t *obuff, int vector_size);
+	void (*run_new_stream_v2)(uint32_t *ibuff, uint32_t *obuff, int vector_size);
+	void (*free_host)(uint32_t *buffer[MAX_STREAMS], int num_streams);
+	void (*free_device)(uint32_t *buffer[MAX_STREAMS], int num_streams);
+};
+
+#ifndef NO_CUDA
+extern const struct compute_backend gpu_backend;
+#endif
+extern const struct compute_backend cpu_backend;
+
+/*
+ * "gpu", "cpu" or "cpu:<isa>", NULL for the default backend (GPU when
+ * built with CUDA). Returns NULL for unknown or unsupported backends.
+ */
+static inline const struct compute_backend *compute_backend_lookup(const char *name)
+{
+	if (name == NULL) {
+#ifndef NO_CUDA
+		return &gpu_backend;
+#else
+		return cpu_kernel_select(NULL) ? NULL : &cpu_backend;
+#endif
+	}
+#ifndef NO_CUDA
+	if (strcmp(name, "gpu") == 0)
+		return &gpu_backend;
+#endif
+	if (strcmp(name, "cpu") == 0)
+		return cpu_kernel_select(NULL) ? NULL : &cpu_backend;
+	if (strncmp(name, "cpu:", 4) == 0)
+		return cpu_kernel_select(name + 4) ? NULL : &cpu_backend;
+	return NULL;
+}
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,98 @@
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear (HDR style) latency histogram in nanoseconds.
+ *
+ * Values below 2^LATENCY_HIST_SUB_BITS are stored exactly. Above, every power
+ * of two is split in 2^LATENCY_HIST_SUB_BITS linear buckets, so a value is
+ * known with a relative error below 1/32 (~3 %) from 1 ns up to 2^40 ns.
+ * Counts are stored inline : recording never allocates and only costs a
+ * count leading zeros and a few adds.
+ */
+#define LATENCY_HIST_SUB_BITS	5
+#define LATENCY_HIST_SUB_COUNT	(1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS	40
+#define LATENCY_HIST_BUCKETS \
+	((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 2) * LATENCY_HIST_SUB_COUNT)
+
+struct latency_histogram {
+	const char *name;
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t counts[LATENCY_HIST_BUCKETS];
+};
+
+void latency_hist_init(struct latency_histogram *h, const char *name);
+void latency_hist_reset(struct latency_histogram *h);
+
+/* Adds the samples of src to dst */
+void latency_hist_merge(struct latency_histogram *dst, const struct latency_histogram *src);
+
+/* Smallest value v such that at least p % of the samples are <= v */
+uint64_t latency_hist_percentile(const struct latency_histogram *h, double p);
+
+/* One line : count, mean, min, p50, p90, p99, p99.9 and max in usec */
+void latency_hist_report(const struct latency_histogram *h, FILE *out);
+
+/* Non empty buckets with their value range, count and cumulative percentage */
+void latency_hist_dump(const struct latency_histogram *h, FILE *out);
+
+/* Bucket holding value ns */
+static inline uint32_t latency_hist_bucket(uint64_t ns)
+{
+	uint32_t msb, group;
+
+	if (ns >= (1ull << LATENCY_HIST_MAX_BITS))
+		ns = (1ull << LATENCY_HIST_MAX_BITS) - 1;
+	if (ns < LATENCY_HIST_SUB_COUNT)
+		return (uint32_t)ns;
+
+	// group g >= 1 holds [2^(g+SUB_BITS-1), 2^(g+SUB_BITS)[ with a step of 2^(g-1)
+	msb = 63 - __builtin_clzll(ns);
+	group = msb - LATENCY_HIST_SUB_BITS + 1;
+	return group * LATENCY_HIST_SUB_COUNT +
+		(uint32_t)(ns >> (group - 1)) - LATENCY_HIST_SUB_COUNT;
+}
+
+static inline void latency_hist_record(struct latency_histogram *h, uint64_t ns)
+{
+	h->counts[latency_hist_bucket(ns)]++;
+	h->count++;
+	h->sum_ns += ns;
+	if (ns < h->min_ns)
+		h->min_ns = ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __LATENCY_HISTOGRAM_H__ */
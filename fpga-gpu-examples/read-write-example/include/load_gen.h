@@ -0,0 +1,106 @@
+#ifndef __LOAD_GEN_H__
+#define __LOAD_GEN_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <run_stats.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open loop arrivals.
+ *
+ * Iterations are requested at a target rate whatever the runner is doing :
+ * the schedule of intended issue times is fixed when the run starts (constant
+ * interval or Poisson process) and never waits for a completion. Latencies
+ * are taken from the intended issue time, so an iteration delayed by the
+ * previous ones is charged for its wait (no coordinated omission).
+ *
+ * Specs are a comma separated list : the rate in iterations per second
+ * (k and M suffixes allowed), constant (default) or poisson, seed=<N>.
+ *   20000
+ *   50k,poisson
+ */
+
+enum load_arrival {
+	ARRIVAL_CONSTANT = 0,
+	ARRIVAL_POISSON,
+	ARRIVAL_MAX
+};
+
+struct load_gen {
+	double rate;			/* iterations per second, 0 : closed loop */
+	enum load_arrival arrival;
+	uint64_t seed;
+
+	uint64_t start_ns;
+	double offset_ns;		/* next arrival, from start_ns */
+	uint64_t next_ns;		/* intended issue time of the next arrival */
+
+	/* statistics */
+	uint64_t issued;
+	uint64_t behind;		/* issued more than one interval late */
+	uint64_t last_ns;		/* last completion */
+};
+
+void load_gen_init(struct load_gen *gen);
+int load_gen_parse(const char *spec, struct load_gen *gen);
+
+static inline bool load_gen_enabled(const struct load_gen *gen)
+{
+	return gen->rate > 0.0;
+}
+
+/* Sets the schedule : the first arrival is at now */
+void load_gen_start(struct load_gen *gen, uint64_t now);
+
+/*
+ * Issues the next arrival at now : records its wait in the QUEUE phase,
+ * draws the following one and returns its intended issue time
+ */
+uint64_t load_gen_pop(struct load_gen *gen, struct run_stats *stats, uint64_t now);
+
+/* Sleeps then spins until the next arrival is due */
+void load_gen_wait(const struct load_gen *gen);
+
+/* Records the completion of an arrival in the RESPONSE phase */
+void load_gen_complete(struct load_gen *gen, struct run_stats *stats,
+		uint64_t intended_ns, uint64_t now);
+
+void load_gen_print(const struct load_gen *gen, FILE *out);
+
+/* Offered and achieved rates, arrivals served late */
+void load_gen_report(const struct load_gen *gen, FILE *out);
+
+/*
+ * Machine readable line of the open loop run, parsed by bench_sweep :
+ * LOAD offered=N achieved=N resp_p50_ns=N resp_p90_ns=N resp_p99_ns=N
+ * resp_p999_ns=N resp_max_ns=N queue_p99_ns=N
+ */
+void load_gen_summary(const struct load_gen *gen, const struct run_stats *stats, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __LOAD_GEN_H__ */
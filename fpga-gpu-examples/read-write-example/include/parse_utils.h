@@ -0,0 +1,67 @@
+#ifndef __PARSE_UTILS_H__
+#define __PARSE_UTILS_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * "4096", "0x1000", "4k", "512M", "8G" : K, M and G (either case) are
+ * powers of 1024. -1 when s is not a number, has trailing characters or
+ * does not fit in 64 bits once multiplied.
+ */
+static inline int parse_size(const char *s, uint64_t *value)
+{
+	char *end;
+	unsigned long long v;
+	unsigned int shift = 0;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if ((errno != 0) || (end == s) || (*s == '-'))
+		return -1;
+	switch (*end) {
+	case 'G': case 'g':
+		shift += 10;
+		/* fall through */
+	case 'M': case 'm':
+		shift += 10;
+		/* fall through */
+	case 'K': case 'k':
+		shift += 10;
+		end++;
+		break;
+	default:
+		break;
+	}
+	if ((*end != '\0') || (v > (UINT64_MAX >> shift)))
+		return -1;
+	*value = (uint64_t)v << shift;
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __PARSE_UTILS_H__ */
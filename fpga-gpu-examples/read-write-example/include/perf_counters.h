@@ -0,0 +1,79 @@
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hardware (and software) counters of the calling thread, through
+ * perf_event_open(). All the counters that can be opened are put in a single
+ * group so that one read() returns all of them for the same time window.
+ *
+ * Counters that the CPU, the hypervisor or the container do not provide are
+ * left out : with none of them, perf_counters_open() fails and the runners go
+ * on without counters.
+ */
+
+enum perf_counter {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_CONTEXT_SWITCHES,
+	PERF_COUNTER_MAX
+};
+
+struct perf_values {
+	uint64_t count[PERF_COUNTER_MAX];
+};
+
+struct perf_counters {
+	int group_fd;
+	int fd[PERF_COUNTER_MAX];	/* -1 : not available */
+	int slot[PERF_COUNTER_MAX];	/* position in the group read */
+	int nr;				/* counters in the group */
+	bool user_only;			/* kernel excluded (perf_event_paranoid) */
+	bool multiplexed;		/* group was not always on the PMU, values are scaled */
+};
+
+const char *perf_counter_name(enum perf_counter c);
+
+/* Opens and starts the counters, returns -1 (with the reason printed) if none is available */
+int perf_counters_open(struct perf_counters *pc, FILE *out);
+
+static inline bool perf_counter_available(const struct perf_counters *pc, enum perf_counter c)
+{
+	return pc->fd[c] >= 0;
+}
+
+/* Current totals since perf_counters_open(), scaled if the group was multiplexed */
+int perf_counters_read(struct perf_counters *pc, struct perf_values *v);
+
+void perf_counters_close(struct perf_counters *pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __PERF_COUNTERS_H__ */
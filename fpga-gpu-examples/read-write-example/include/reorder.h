@@ -0,0 +1,145 @@
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <desc_ring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Out of order completions of the descriptor ring.
+ *
+ * With several DMA engines, descriptors are claimed in sequence order but
+ * complete in any order : a small transfer can overtake a large one. Each
+ * engine pushes a completion tagged with the 64-bit sequence number of its
+ * descriptor to a completion queue (many producers, one consumer). The host
+ * drains it into a reorder buffer of window entries, which releases the
+ * transfers to the consumer in sequence order and retires their
+ * descriptors.
+ *
+ * The window also holds the engines back : a descriptor is only claimed
+ * once its reorder buffer entry is free (sequence < released + window), so
+ * a completion always has an entry and the queue never holds more than
+ * window records.
+ */
+
+#define REORDER_MAX_WINDOW	DESC_RING_DEFAULT_SIZE
+
+/* Written by an engine, ready is set last */
+struct completion {
+	uint64_t sequence;
+	uint32_t status;		/* DESC_STATUS_DONE or DESC_STATUS_ERROR */
+	uint32_t engine;
+	uint64_t ready;			/* position in the queue + 1 */
+};
+
+struct completion_queue {
+	/* engines (producers) cache line */
+	uint64_t head __attribute__((aligned(DESC_RING_CACHE_LINE)));
+
+	/* host (consumer) cache line */
+	uint64_t tail __attribute__((aligned(DESC_RING_CACHE_LINE)));
+
+	/* read only after allocation */
+	uint32_t size __attribute__((aligned(DESC_RING_CACHE_LINE)));
+	uint32_t mask;
+
+	struct completion entry[] __attribute__((aligned(DESC_RING_CACHE_LINE)));
+};
+
+struct reorder_entry {
+	uint32_t status;
+	uint16_t valid;
+	uint16_t ahead;			/* arrived before an older transfer */
+	uint64_t arrival_ns;
+};
+
+/* Host only */
+struct reorder_buf {
+	uint32_t window;		/* power of 2 */
+	uint32_t mask;
+	uint64_t next;			/* next sequence to release */
+	uint64_t expected;		/* oldest sequence not arrived yet */
+	struct reorder_entry *entry;
+
+	/* statistics */
+	uint64_t arrived;
+	uint64_t out_of_order;		/* arrived before an older transfer */
+	uint64_t max_distance;		/* farthest arrival ahead of expected */
+	uint64_t hold_ns;		/* arrival to release, out of order ones */
+	uint64_t rejected;		/* outside the window */
+};
+
+/* size is rounded up to a power of 2 */
+struct completion_queue *completion_queue_alloc(uint32_t size);
+void completion_queue_free(struct completion_queue *cq);
+
+/* Any engine */
+static inline void completion_push(struct completion_queue *cq,
+		uint64_t sequence, uint32_t status, uint32_t engine)
+{
+	uint64_t pos = __atomic_fetch_add(&cq->head, 1, __ATOMIC_RELAXED);
+	struct completion *c = &cq->entry[pos & cq->mask];
+
+	c->sequence = sequence;
+	c->status = status;
+	c->engine = engine;
+	// data written at dst and the record must be visible before ready
+	__atomic_store_n(&c->ready, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Host : next completion in arrival order, false if none is ready */
+static inline bool completion_pop(struct completion_queue *cq, struct completion *out)
+{
+	struct completion *c = &cq->entry[cq->tail & cq->mask];
+
+	if (__atomic_load_n(&c->ready, __ATOMIC_ACQUIRE) != cq->tail + 1)
+		return false;
+	*out = *c;
+	cq->tail++;
+	return true;
+}
+
+/* window is rounded up to a power of 2, up to REORDER_MAX_WINDOW */
+int reorder_init(struct reorder_buf *rob, uint32_t window);
+void reorder_free(struct reorder_buf *rob);
+
+/* Stores a completion until its turn, -1 if it is outside the window */
+int reorder_insert(struct reorder_buf *rob, const struct completion *c, uint64_t now);
+
+/*
+ * Drains the completion queue into the reorder buffer, then releases the
+ * next transfer if it has arrived : its descriptor is retired and its
+ * status returned in *status
+ */
+bool reorder_release(struct reorder_buf *rob, struct completion_queue *cq,
+		struct desc_ring *ring, uint32_t *status);
+
+void reorder_report(const struct reorder_buf *rob, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __REORDER_H__ */
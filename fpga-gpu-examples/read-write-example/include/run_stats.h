@@ -0,0 +1,130 @@
+#ifndef __RUN_STATS_H__
+#define __RUN_STATS_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <latency_histogram.h>
+#include <perf_counters.h>
+#include <time_utils.h>
+#include <trace.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Phases of one iteration of the runners, each one has its own histogram :
+ *  - ITERATION   : whole iteration
+ *  - WAIT        : host waiting for the device (flags or descriptor ring)
+ *  - COMPUTE     : GPU kernel (or its CPU stand-in)
+ *  - FLAG_UPDATE : host giving the next buffers to the device
+ *  - DECODE      : host decoding what the device sent (link codec)
+ *  - ENCODE      : host encoding what it sends to the device (link codec)
+ *  - QUEUE       : open loop, intended issue time to actual issue
+ *  - RESPONSE    : open loop, intended issue time to completion
+ */
+enum run_phase {
+	PHASE_ITERATION = 0,
+	PHASE_WAIT,
+	PHASE_COMPUTE,
+	PHASE_FLAG_UPDATE,
+	PHASE_DECODE,
+	PHASE_ENCODE,
+	PHASE_QUEUE,
+	PHASE_RESPONSE,
+	PHASE_COUNT
+};
+
+struct run_stats {
+	struct latency_histogram phase[PHASE_COUNT];
+	// optional hardware counters, totals per phase
+	struct perf_counters *perf;
+	struct perf_values perf_phase[PHASE_COUNT];
+	struct perf_values perf_begin, perf_last;
+};
+
+void run_stats_init(struct run_stats *stats);
+
+/* Counters of the host thread are read at every mark and added to the phase */
+int run_stats_enable_perf(struct run_stats *stats, FILE *out);
+void run_stats_disable_perf(struct run_stats *stats);
+void run_stats_perf_begin(struct run_stats *stats);
+void run_stats_perf_mark(struct run_stats *stats, enum run_phase phase);
+const char *run_phase_name(enum run_phase phase);
+
+/* Percentiles of every phase with samples, plus the histograms if dump is set */
+void run_stats_report(const struct run_stats *stats, FILE *out, bool dump);
+
+/*
+ * Single machine readable line with the iteration latency (ns), parsed by
+ * bench_sweep :
+ * BENCH iterations=N mean_ns=N min_ns=N p50_ns=N p90_ns=N p99_ns=N p999_ns=N max_ns=N
+ */
+void run_stats_summary(const struct run_stats *stats, FILE *out);
+
+/* Adds the histograms of src to dst (runs of several devices), not the counters */
+void run_stats_merge(struct run_stats *dst, const struct run_stats *src);
+
+/* Start of an iteration : returns the current time */
+static inline uint64_t run_stats_begin(struct run_stats *stats)
+{
+	if (stats->perf != NULL)
+		run_stats_perf_begin(stats);
+	return monotonic_ns();
+}
+
+/*
+ * Records the time spent in phase since start (and traces it when tracing is
+ * on) and returns the current time, so that consecutive phases can be chained :
+ *	iteration_start = t = run_stats_begin(&stats);
+ *	...
+ *	t = run_stats_mark(&stats, PHASE_WAIT, t);
+ *	...
+ *	run_stats_mark(&stats, PHASE_ITERATION, iteration_start);
+ */
+static inline uint64_t run_stats_mark(struct run_stats *stats,
+		enum run_phase phase, uint64_t start)
+{
+	uint64_t now = monotonic_ns();
+
+	latency_hist_record(&stats->phase[phase], now - start);
+	trace_complete(phase, start, now, 0);
+	if (stats->perf != NULL)
+		run_stats_perf_mark(stats, phase);
+	return now;
+}
+
+/*
+ * Records an interval that is not a step of the iteration (it may start
+ * before the iteration or overlap other phases) : counters are not read.
+ */
+static inline void run_stats_record(struct run_stats *stats,
+		enum run_phase phase, uint64_t start, uint64_t end)
+{
+	latency_hist_record(&stats->phase[phase], end - start);
+	trace_complete(phase, start, end, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __RUN_STATS_H__ */
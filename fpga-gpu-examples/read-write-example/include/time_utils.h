@@ -0,0 +1,103 @@
+#ifndef __TIME_UTILS_H__
+#define __TIME_UTILS_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Monotonic time in nanoseconds (vDSO, no syscall) */
+static inline uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* CPU time consumed by the calling thread in nanoseconds */
+static inline uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Busy-wait hint : lets the sibling SMT threads run while we poll */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__powerpc64__) || defined(__powerpc__)
+	/* low then medium SMT priority, as done by the kernel on POWER */
+	__asm__ __volatile__("or 1,1,1\n\tor 2,2,2" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Remaining time below which sleep_until_ns() spins instead of sleeping */
+#define SLEEP_SPIN_NS	50000
+
+/* Returns at deadline_ns (monotonic) : sleeps, then spins the last spin_ns */
+static inline void sleep_until_ns(uint64_t deadline_ns, uint64_t spin_ns)
+{
+	uint64_t now = monotonic_ns();
+
+	if (now >= deadline_ns)
+		return;
+
+	// sleep is only accurate to tens of microseconds, spin the end
+	if (deadline_ns - now > spin_ns) {
+		uint64_t wake = deadline_ns - spin_ns;
+		struct timespec ts = {
+			.tv_sec = wake / 1000000000ull,
+			.tv_nsec = wake % 1000000000ull,
+		};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	while (monotonic_ns() < deadline_ns)
+		cpu_relax();
+}
+
+/* xorshift64* : uniform in [0, 1), state is never 0 and owned by one thread */
+static inline double xorshift_uniform01(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return ((x * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __TIME_UTILS_H__ */
@@ -0,0 +1,125 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <time_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Timeline of the host, device and worker threads, dumped as a Chrome trace
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ * Each thread records its events in its own preallocated ring buffer : an
+ * event is a test of trace_on and four stores, the oldest events are
+ * overwritten when the ring is full. Nothing is recorded before trace_init().
+ */
+
+/* Events 0 to TRACE_PHASE_MAX - 1 are the run_phase of run_stats.h */
+#define TRACE_PHASE_MAX		8
+#define TRACE_DEFAULT_EVENTS	(1 << 16)	/* per thread */
+
+enum trace_event {
+	TRACE_FLAG_SET = TRACE_PHASE_MAX,	/* host hands buffers to the device */
+	TRACE_DEVICE_TRANSFER,			/* device : flags seen to flags cleared */
+	TRACE_DEVICE_COPY,			/* device : memcpy of the transfer */
+	TRACE_DEVICE_MODEL,			/* device : waiting for the model deadline */
+	TRACE_EVENT_MAX
+};
+
+struct trace_record {
+	uint64_t ts;
+	uint64_t dur;		/* 0 : instant event */
+	uint64_t arg;		/* iteration, slot or buffer address */
+	uint32_t event;
+	uint32_t pad;
+};
+
+struct trace_buffer {
+	struct trace_record *records;
+	uint64_t mask;
+	uint64_t head;
+	uint32_t tid;
+	char name[24];
+	struct trace_buffer *next;
+};
+
+extern bool trace_on;
+extern __thread struct trace_buffer *trace_local;
+
+/* events is rounded up to a power of two */
+int trace_init(uint32_t events);
+
+/* Names the calling thread and preallocates its buffer */
+void trace_thread_start(const char *name);
+
+struct trace_buffer *trace_thread_buffer(void);
+
+/* Writes the Chrome trace JSON of all threads, returns -1 on error */
+int trace_dump(const char *path);
+
+void trace_free(void);
+
+static inline void trace_record(uint32_t event, uint64_t ts, uint64_t dur, uint64_t arg)
+{
+	struct trace_buffer *tb = trace_local;
+	struct trace_record *r;
+
+	if ((tb == NULL) && ((tb = trace_thread_buffer()) == NULL))
+		return;
+	r = &tb->records[tb->head++ & tb->mask];
+	r->ts = ts;
+	r->dur = dur;
+	r->arg = arg;
+	r->event = event;
+}
+
+static inline void trace_complete(uint32_t event, uint64_t begin, uint64_t end, uint64_t arg)
+{
+	if (trace_on)
+		trace_record(event, begin, end - begin, arg);
+}
+
+static inline void trace_instant(uint32_t event, uint64_t arg)
+{
+	if (trace_on)
+		trace_record(event, monotonic_ns(), 0, arg);
+}
+
+/* Time of an event start, only read when tracing */
+static inline uint64_t trace_begin(void)
+{
+	return trace_on ? monotonic_ns() : 0;
+}
+
+static inline void trace_end(uint32_t event, uint64_t begin, uint64_t arg)
+{
+	if (trace_on)
+		trace_record(event, begin, monotonic_ns() - begin, arg);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __TRACE_H__ */
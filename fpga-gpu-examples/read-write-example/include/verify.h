@@ -0,0 +1,65 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Result checking of the vector_add kernel (out[i] = in[i] + in[i]) without
+ * printing in the loop.
+ *
+ * The checksum is linear : C(x) = sum(x[i] * w[i]) mod 2^32 with odd weights
+ * w[i] = (i * 0x9e3779b1) | 1, so the checksum of a correct output is known
+ * from the input one : C(out) = 2 * C(in). Any single wrong element changes
+ * C(out) (odd weight), moved elements are caught by the position dependent
+ * weights. Vectorized with the same runtime ISA dispatch as the CPU kernel.
+ */
+#define VERIFY_WEIGHT	0x9e3779b1u
+
+struct verify_stats {
+	uint64_t checked;
+	uint64_t mismatches;
+	uint64_t first_mismatch;	/* iteration */
+	uint64_t ns;			/* time spent checking */
+};
+
+void verify_init(struct verify_stats *v);
+
+/* Dispatched checksum (selects the best variant on first use) */
+uint32_t verify_checksum(const uint32_t *buff, size_t vector_size);
+uint32_t verify_checksum_scalar(const uint32_t *buff, size_t vector_size);
+const char *verify_checksum_name(void);
+
+/* Checks out against in for one iteration, returns false on a mismatch */
+bool verify_vector_add(struct verify_stats *v, const uint32_t *ibuff,
+		const uint32_t *obuff, size_t vector_size, uint64_t iteration);
+
+void verify_report(const struct verify_stats *v, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __VERIFY_H__ */
@@ -0,0 +1,104 @@
+#ifndef __WAIT_POLICY_H__
+#define __WAIT_POLICY_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <time_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Policies used by the host to wait for the FPGA (or its emulator) :
+ *  - spin    : poll with a pause / "or 1,1,1" hint, lowest latency, one core busy
+ *  - yield   : poll, then give the core away with sched_yield() (default)
+ *  - backoff : poll, then sleep with an exponentially growing delay
+ *  - block   : poll, then sleep on a futex. Software devices wake the host with
+ *              wait_policy_notify(). The sleep is bounded so that devices which
+ *              can not notify (FPGA) are still polled.
+ */
+enum wait_policy_type {
+	WAIT_SPIN = 0,
+	WAIT_SPIN_YIELD,
+	WAIT_BACKOFF,
+	WAIT_BLOCK,
+	WAIT_POLICY_MAX
+};
+
+struct wait_policy {
+	enum wait_policy_type type;
+	uint32_t spin_limit;		/* polls before yielding/sleeping */
+	uint32_t backoff_min_ns;	/* first backoff sleep */
+	uint32_t backoff_max_ns;	/* longest backoff sleep */
+	uint32_t block_timeout_ns;	/* longest futex sleep */
+
+	/* statistics */
+	uint64_t waits;
+	uint64_t polls;
+	uint64_t wait_ns;
+	uint64_t wake_samples;		/* waits ended by a device notification */
+	uint64_t wake_ns_total;
+	uint64_t wake_ns_max;
+	uint64_t run_start_ns;
+	uint64_t run_start_cpu_ns;
+	uint64_t run_ns;
+	uint64_t run_cpu_ns;
+};
+
+/* Per wait state, lives on the stack of the waiting thread */
+struct wait_state {
+	uint64_t start_ns;
+	uint32_t polls;
+	uint32_t sleep_ns;
+	uint32_t start_seq;
+	uint32_t seq;
+};
+
+void wait_policy_init(struct wait_policy *wp, enum wait_policy_type type);
+int wait_policy_parse(const char *name, enum wait_policy_type *type);
+const char *wait_policy_name(enum wait_policy_type type);
+
+/* CPU accounting of the waiting thread between start and stop */
+void wait_policy_start(struct wait_policy *wp);
+void wait_policy_stop(struct wait_policy *wp);
+void wait_policy_report(const struct wait_policy *wp, FILE *out);
+
+/* Called by software devices once a completion is visible in memory */
+void wait_policy_notify(void);
+
+void wait_begin(struct wait_policy *wp, struct wait_state *ws);
+void wait_relax(struct wait_policy *wp, struct wait_state *ws);
+void wait_end(struct wait_policy *wp, struct wait_state *ws);
+
+/* Wait until cond becomes true. cond is evaluated again after each relax. */
+#define wait_until(wp, cond) do {					\
+	struct wait_state __ws;						\
+	wait_begin((wp), &__ws);					\
+	while (!(cond))							\
+		wait_relax((wp), &__ws);				\
+	wait_end((wp), &__ws);						\
+} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __WAIT_POLICY_H__ */
@@ -0,0 +1,75 @@
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORKER_POOL_MAX_THREADS		64
+#define WORKER_POOL_CACHE_LINE		128
+/* Default chunk : 32 KB of uint32_t, fits in L1 with its output */
+#define WORKER_POOL_DEFAULT_CHUNK	8192
+/* Idle workers poll that long for the next job before sleeping on a futex */
+#define WORKER_POOL_SPIN_NS		50000
+
+/* Processes items [begin, end[ of a job */
+typedef void (*worker_fn)(void *arg, size_t begin, size_t end);
+
+/*
+ * Persistent pool of threads created once at startup.
+ *
+ * A job of n items is cut in chunks of chunk_items, chunks are claimed with
+ * an atomic counter by the workers and by the calling thread, which takes
+ * part in the job. The caller returns once every worker has reported it
+ * is done with the job, so no thread is ever created in the main loop.
+ */
+struct worker_pool {
+	int num_threads;		/* workers + calling thread */
+	size_t chunk_items;
+	pthread_t threads[WORKER_POOL_MAX_THREADS];
+
+	/* current job, written by the caller before generation is bumped */
+	worker_fn fn;
+	void *arg;
+	size_t items;
+	size_t chunks;
+	int stop;
+
+	uint32_t generation __attribute__((aligned(WORKER_POOL_CACHE_LINE)));
+	uint32_t sleepers;
+	size_t next_chunk __attribute__((aligned(WORKER_POOL_CACHE_LINE)));
+	uint32_t finished __attribute__((aligned(WORKER_POOL_CACHE_LINE)));
+};
+
+/* num_threads includes the calling thread, chunk_items 0 for the default */
+struct worker_pool *worker_pool_create(int num_threads, size_t chunk_items);
+void worker_pool_destroy(struct worker_pool *pool);
+
+/* Runs fn over [0, items[ and returns when all chunks are done */
+void worker_pool_run(struct worker_pool *pool, worker_fn fn, void *arg, size_t items);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __WORKER_POOL_H__ */
@@ -0,0 +1,841 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BENCHMARK SWEEP
+ *
+ * Runs kernel_runner and main_application over a grid of vector sizes,
+ * iteration counts, configs (host buffering on/off), pipeline depths, cpu
+ * compute threads and backends. Every point is run a few times to warm up, then repeated :
+ * the mean iteration time is reported with a 95 % confidence interval,
+ * along with the iteration percentiles and the throughput.
+ *
+ * The runners are started with -B and print their result on a single
+ * "BENCH key=value ..." line (see run_stats_summary()).
+ *
+ * When several thread counts are swept, the speedup of each point is given
+ * relative to the same point run with the first thread count of the list.
+ *
+ * With offered loads (-l), kernel_runner is run open loop at each rate and
+ * also prints a "LOAD key=value ..." line (see load_gen_summary()) : the
+ * response time percentiles against the offered rate give the latency /
+ * load curve, up to the rate the runner can no longer keep up with.
+ *
+ * Results are written as CSV, JSON or as the markdown tables of README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <action_create_vector.h>
+#include <worker_pool.h>
+#include <device_model.h>
+
+#define MAX_VALUES	64
+#define MAX_REPETITIONS	100
+
+/*
+ * Backends :
+ *  - gpu      : kernel_runner alone (GPU only)
+ *  - emulator : kernel_runner with its FPGA emulator thread
+ *  - cpu      : main_application with the software action (SNAP_CONFIG=CPU)
+ *  - fpga     : main_application with the FPGA (SNAP_CONFIG=FPGA)
+ *  - fpga_only: action_runner with the FPGA, no GPU (configs and pipeline
+ *               depths do not apply, it is run with the first ones only)
+ */
+enum backend {
+	BACKEND_GPU = 0,
+	BACKEND_EMULATOR,
+	BACKEND_CPU,
+	BACKEND_FPGA,
+	BACKEND_FPGA_ONLY,
+	BACKEND_MAX
+};
+
+static const char *backend_names[BACKEND_MAX] = {
+	[BACKEND_GPU]		= "gpu",
+	[BACKEND_EMULATOR]	= "emulator",
+	[BACKEND_CPU]		= "cpu",
+	[BACKEND_FPGA]		= "fpga",
+	[BACKEND_FPGA_ONLY]	= "fpga_only",
+};
+
+/* Mode column of the README tables */
+static const char *backend_modes[BACKEND_MAX] = {
+	[BACKEND_GPU]		= "GPU only",
+	[BACKEND_EMULATOR]	= "GPU+emulator",
+	[BACKEND_CPU]		= "FPGA(sw)+GPU",
+	[BACKEND_FPGA]		= "FPGA+GPU",
+	[BACKEND_FPGA_ONLY]	= "FPGA only",
+};
+
+/* One run of a runner, values in ns */
+struct run_result {
+	uint64_t iterations;
+	uint64_t mean_ns;
+	uint64_t min_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+	/* open loop only */
+	bool load;
+	double achieved;		/* iterations per second */
+	uint64_t resp_p50_ns;
+	uint64_t resp_p99_ns;
+	uint64_t resp_p999_ns;
+	uint64_t queue_p99_ns;
+};
+
+/* One point of the sweep, aggregated over the repetitions, values in usec */
+struct point {
+	enum backend backend;
+	int config;
+	int depth;
+	int threads;
+	long vector_size;
+	long iterations;
+	long rate;			/* offered iterations per second, 0 : closed loop */
+	int runs;
+	double mean_us;
+	double stddev_us;
+	double ci95_us;
+	double p50_us;
+	double p90_us;
+	double p99_us;
+	double p999_us;
+	double max_us;
+	double throughput_mbs;
+	double speedup;
+	double achieved;
+	double resp_p50_us;
+	double resp_p99_us;
+	double resp_p999_us;
+	double queue_p99_us;
+};
+
+struct sweep {
+	const char *bin_dir;
+	const char *wait_policy;
+	const char *compute;
+	const char *device_model;
+	const char *arrivals;
+	int warmup;
+	int repetitions;
+	bool verbose;
+};
+
+static void usage(const char *prog)
+{
+	printf("\n Usage: %s [-h] [-v, --verbose]\n"
+			"  -s, --sizes <list>          vector sizes (default 256:131072).\n"
+			"  -n, --iterations <list>     iterations per run (default 10000).\n"
+			"  -c, --configs <list>        1 (host buffering) and/or 2 (default 1,2).\n"
+			"  -p, --pipeline_depths <list> pipeline depths (default 1).\n"
+			"  -t, --threads <list>        threads of the cpu compute backend (default 1).\n"
+			"  -b, --backends <list>       gpu, emulator, cpu, fpga and/or fpga_only (default emulator,cpu).\n"
+			"  -l, --loads <list>          offered rates (iterations/s) of open loop gpu and emulator runs.\n"
+			"  -a, --arrivals <name>       constant (default) or poisson arrivals of the open loop runs.\n"
+			"  -w, --warmup <N>            runs discarded before measuring (default 1).\n"
+			"  -r, --repetitions <N>       measured runs per point (default 5).\n"
+			"  -W, --wait_policy <name>    wait policy given to the runners.\n"
+			"  -C, --compute <name>        compute backend given to the runners (gpu, cpu or cpu:<isa>).\n"
+			"  -m, --device_model <spec>   timing model of the emulator and of the software action.\n"
+			"  -f, --format <name>         csv (default), json or markdown.\n"
+			"  -o, --output <file>         results file (default is stdout).\n"
+			"  -d, --bin_dir <dir>         directory of the runners (default is the one of %s).\n"
+			"\n"
+			"Lists are comma separated (1024,4096) or a power of two range (256:131072).\n"
+			"\n"
+			"Example usage:\n"
+			"-----------------------\n"
+			"bench_sweep -b gpu,fpga -n 10000 -f markdown\n"
+			"bench_sweep -s 1024:131072 -p 1,2,4 -b emulator -r 10 -o sweep.csv\n"
+			"bench_sweep -s 131072 -t 1:16 -b gpu -C cpu -f json\n"
+			"bench_sweep -s 4096 -b emulator -m ad9v3 -C cpu -l 10000:320000 -a poisson -f markdown\n"
+			"\n",
+			prog, prog);
+}
+
+/* "a,b,c" or "min:max" (doubling). Returns the number of values or -1 */
+static int parse_list(const char *arg, long *values, int max)
+{
+	char *copy = strdup(arg), *tok, *save = NULL, *colon;
+	int count = 0;
+
+	if (copy == NULL)
+		return -1;
+
+	colon = strchr(copy, ':');
+	if (colon != NULL) {
+		long v = atol(copy), end = atol(colon + 1);
+
+		for (; (v > 0) && (v <= end) && (count < max); v *= 2)
+			values[count++] = v;
+	} else {
+		for (tok = strtok_r(copy, ",", &save); tok != NULL && count < max;
+				tok = strtok_r(NULL, ",", &save))
+			values[count++] = atol(tok);
+	}
+
+	free(copy);
+	for (int i = 0; i < count; i++) {
+		if (values[i] <= 0)
+			return -1;
+	}
+	return count ? count : -1;
+}
+
+static int parse_backends(const char *arg, enum backend *backends, int max)
+{
+	char *copy = strdup(arg), *tok, *save = NULL;
+	int count = 0;
+
+	if (copy == NULL)
+		return -1;
+
+	for (tok = strtok_r(copy, ",", &save); tok != NULL && count < max;
+			tok = strtok_r(NULL, ",", &save)) {
+		int b;
+
+		for (b = 0; b < BACKEND_MAX; b++) {
+			if (strcmp(tok, backend_names[b]) == 0)
+				break;
+		}
+		if (b == BACKEND_MAX) {
+			fprintf(stderr, "err: unknown backend %s\n", tok);
+			free(copy);
+			return -1;
+		}
+		backends[count++] = b;
+	}
+	free(copy);
+	return count ? count : -1;
+}
+
+/* Two sided 95 % Student t quantile for df degrees of freedom */
+static double student_t95(int df)
+{
+	static const double t[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+
+	if (df < 1)
+		return 0.0;
+	if (df <= (int)(sizeof(t)/sizeof(t[0])))
+		return t[df - 1];
+	return 1.96;
+}
+
+/*
+ * Runs one runner and parses its BENCH line.
+ * Returns 0 on success, -1 if the runner failed or printed no result.
+ */
+static int run_once(const struct sweep *sw, const struct point *pt, struct run_result *res)
+{
+	char prog[1024], size_arg[32], iter_arg[32], depth_arg[32], threads_arg[32], rate_arg[64];
+	enum backend backend = pt->backend;
+	const char *argv[24];
+	int argc = 0, fds[2], status;
+	bool found = false;
+	char *line = NULL;
+	size_t line_len = 0;
+	FILE *out;
+	pid_t pid;
+
+	snprintf(prog, sizeof(prog), "%s/%s", sw->bin_dir,
+			(backend == BACKEND_GPU || backend == BACKEND_EMULATOR) ? "kernel_runner" :
+			(backend == BACKEND_FPGA_ONLY) ? "action_runner" : "main_application");
+	snprintf(size_arg, sizeof(size_arg), "%ld", pt->vector_size);
+	snprintf(iter_arg, sizeof(iter_arg), "%ld", pt->iterations);
+	snprintf(depth_arg, sizeof(depth_arg), "%d", pt->depth);
+	snprintf(threads_arg, sizeof(threads_arg), "%d", pt->threads);
+	snprintf(rate_arg, sizeof(rate_arg), "%ld%s%s", pt->rate,
+			sw->arrivals ? "," : "", sw->arrivals ? sw->arrivals : "");
+
+	argv[argc++] = prog;
+	argv[argc++] = "-s";
+	argv[argc++] = size_arg;
+	argv[argc++] = "-n";
+	argv[argc++] = iter_arg;
+	if (backend != BACKEND_FPGA_ONLY) {
+		argv[argc++] = "-p";
+		argv[argc++] = depth_arg;
+		if (pt->config == 1)
+			argv[argc++] = "-H";
+	}
+	if (pt->threads > 1) {
+		argv[argc++] = "-t";
+		argv[argc++] = threads_arg;
+	}
+	if (backend == BACKEND_EMULATOR)
+		argv[argc++] = "-f";
+	if (sw->wait_policy != NULL) {
+		argv[argc++] = "-W";
+		argv[argc++] = sw->wait_policy;
+	}
+	if (sw->compute != NULL) {
+		argv[argc++] = "-c";
+		argv[argc++] = sw->compute;
+	}
+	if ((sw->device_model != NULL) && (backend == BACKEND_EMULATOR)) {
+		argv[argc++] = "-m";
+		argv[argc++] = sw->device_model;
+	}
+	if (pt->rate > 0) {
+		argv[argc++] = "-r";
+		argv[argc++] = rate_arg;
+	}
+	argv[argc++] = "-B";
+	argv[argc] = NULL;
+
+	if (sw->verbose) {
+		fprintf(stderr, "%s", (backend == BACKEND_CPU) ? "SNAP_CONFIG=CPU " :
+				(backend == BACKEND_GPU || backend == BACKEND_EMULATOR) ?
+				"" : "SNAP_CONFIG=FPGA ");
+		if (sw->device_model != NULL)
+			fprintf(stderr, "%s=%s ", DEVICE_MODEL_ENV, sw->device_model);
+		for (int i = 0; i < argc; i++)
+			fprintf(stderr, "%s ", argv[i]);
+		fprintf(stderr, "\n");
+	}
+
+	if (pipe(fds))
+		return -1;
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		if (!sw->verbose && (freopen("/dev/null", "w", stderr) == NULL))
+			_exit(127);
+		if (backend == BACKEND_CPU)
+			setenv("SNAP_CONFIG", "CPU", 1);
+		else if ((backend == BACKEND_FPGA) || (backend == BACKEND_FPGA_ONLY))
+			setenv("SNAP_CONFIG", "FPGA", 1);
+		if (sw->device_model != NULL)
+			setenv(DEVICE_MODEL_ENV, sw->device_model, 1);
+		execv(prog, (char * const *)argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	out = fdopen(fds[0], "r");
+	if (out == NULL) {
+		close(fds[0]);
+		waitpid(pid, &status, 0);
+		return -1;
+	}
+
+	res->load = false;
+	while (getline(&line, &line_len, out) != -1) {
+		unsigned long long v[8];
+		double offered;
+
+		if (sscanf(line, "BENCH iterations=%llu mean_ns=%llu min_ns=%llu "
+					"p50_ns=%llu p90_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu",
+					&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+			res->iterations = v[0];
+			res->mean_ns = v[1];
+			res->min_ns = v[2];
+			res->p50_ns = v[3];
+			res->p90_ns = v[4];
+			res->p99_ns = v[5];
+			res->p999_ns = v[6];
+			res->max_ns = v[7];
+			found = true;
+		}
+		if (sscanf(line, "LOAD offered=%lf achieved=%lf resp_p50_ns=%llu resp_p90_ns=%llu "
+					"resp_p99_ns=%llu resp_p999_ns=%llu resp_max_ns=%llu queue_p99_ns=%llu",
+					&offered, &res->achieved, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 8) {
+			res->resp_p50_ns = v[0];
+			res->resp_p99_ns = v[2];
+			res->resp_p999_ns = v[3];
+			res->queue_p99_ns = v[5];
+			res->load = true;
+		}
+	}
+	free(line);
+	fclose(out);
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0) || !found)
+		return -1;
+	if ((pt->rate > 0) && !res->load)
+		return -1;
+	return 0;
+}
+
+/* Warm-up + repetitions of one point. Returns 0 if at least one run succeeded */
+static int run_point(const struct sweep *sw, struct point *pt)
+{
+	struct run_result res[MAX_REPETITIONS];
+	double sum = 0.0, var = 0.0;
+	int n = 0;
+
+	for (int i = 0; i < sw->warmup; i++)
+		run_once(sw, pt, &res[0]);
+
+	for (int i = 0; i < sw->repetitions; i++) {
+		if (run_once(sw, pt, &res[n]) == 0)
+			n++;
+	}
+
+	pt->runs = n;
+	if (n == 0)
+		return -1;
+
+	for (int i = 0; i < n; i++) {
+		sum += res[i].mean_ns / 1000.0;
+		// percentiles are averaged over the runs, max is the worst run
+		pt->p50_us += res[i].p50_ns / 1000.0 / n;
+		pt->p90_us += res[i].p90_ns / 1000.0 / n;
+		pt->p99_us += res[i].p99_ns / 1000.0 / n;
+		pt->p999_us += res[i].p999_ns / 1000.0 / n;
+		if (res[i].max_ns / 1000.0 > pt->max_us)
+			pt->max_us = res[i].max_ns / 1000.0;
+		if (pt->rate > 0) {
+			pt->achieved += res[i].achieved / n;
+			pt->resp_p50_us += res[i].resp_p50_ns / 1000.0 / n;
+			pt->resp_p99_us += res[i].resp_p99_ns / 1000.0 / n;
+			pt->resp_p999_us += res[i].resp_p999_ns / 1000.0 / n;
+			pt->queue_p99_us += res[i].queue_p99_ns / 1000.0 / n;
+		}
+	}
+	pt->mean_us = sum / n;
+
+	for (int i = 0; i < n; i++) {
+		double d = res[i].mean_ns / 1000.0 - pt->mean_us;
+		var += d * d;
+	}
+	if (n > 1) {
+		pt->stddev_us = sqrt(var / (n - 1));
+		pt->ci95_us = student_t95(n - 1) * pt->stddev_us / sqrt(n);
+	}
+
+	// each iteration reads and writes one vector (bytes per usec = MB/s)
+	if (pt->mean_us > 0.0)
+		pt->throughput_mbs = 2.0 * pt->vector_size * sizeof(uint32_t) / pt->mean_us;
+	return 0;
+}
+
+static void print_csv(FILE *out, const struct point *pts, int count)
+{
+	fprintf(out, "backend,config,pipeline_depth,threads,vector_size,iterations,runs,"
+			"mean_us,stddev_us,ci95_us,p50_us,p90_us,p99_us,p999_us,max_us,"
+			"throughput_MBps,speedup,offered_rate,achieved_rate,resp_p50_us,resp_p99_us,"
+			"resp_p999_us,queue_p99_us\n");
+	for (int i = 0; i < count; i++) {
+		const struct point *pt = &pts[i];
+
+		fprintf(out, "%s,%d,%d,%d,%ld,%ld,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.2f,"
+				"%ld,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+				backend_names[pt->backend], pt->config, pt->depth, pt->threads,
+				pt->vector_size, pt->iterations, pt->runs,
+				pt->mean_us, pt->stddev_us, pt->ci95_us,
+				pt->p50_us, pt->p90_us, pt->p99_us, pt->p999_us, pt->max_us,
+				pt->throughput_mbs, pt->speedup, pt->rate, pt->achieved,
+				pt->resp_p50_us, pt->resp_p99_us, pt->resp_p999_us, pt->queue_p99_us);
+	}
+}
+
+static void print_json(FILE *out, const struct point *pts, int count)
+{
+	fprintf(out, "[\n");
+	for (int i = 0; i < count; i++) {
+		const struct point *pt = &pts[i];
+
+		fprintf(out, "  {\"backend\": \"%s\", \"config\": %d, \"pipeline_depth\": %d, \"threads\": %d, "
+				"\"vector_size\": %ld, \"iterations\": %ld, \"runs\": %d, "
+				"\"mean_us\": %.3f, \"stddev_us\": %.3f, \"ci95_us\": %.3f, "
+				"\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+				"\"p999_us\": %.3f, \"max_us\": %.3f, \"throughput_MBps\": %.1f, "
+				"\"speedup\": %.2f, \"offered_rate\": %ld, \"achieved_rate\": %.1f, "
+				"\"resp_p50_us\": %.3f, \"resp_p99_us\": %.3f, \"resp_p999_us\": %.3f, "
+				"\"queue_p99_us\": %.3f}%s\n",
+				backend_names[pt->backend], pt->config, pt->depth, pt->threads,
+				pt->vector_size, pt->iterations, pt->runs,
+				pt->mean_us, pt->stddev_us, pt->ci95_us,
+				pt->p50_us, pt->p90_us, pt->p99_us, pt->p999_us, pt->max_us,
+				pt->throughput_mbs, pt->speedup, pt->rate, pt->achieved,
+				pt->resp_p50_us, pt->resp_p99_us, pt->resp_p999_us, pt->queue_p99_us,
+				(i + 1 < count) ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+/* Speedup relative to the same point run with the first thread count */
+static void compute_speedup(struct point *pts, int count, int base_threads)
+{
+	for (int i = 0; i < count; i++) {
+		struct point *pt = &pts[i];
+
+		pt->speedup = 0.0;
+		for (int j = 0; j < count; j++) {
+			const struct point *base = &pts[j];
+
+			if ((base->threads != base_threads) || (base->backend != pt->backend) ||
+					(base->rate != pt->rate) ||
+					(base->config != pt->config) || (base->depth != pt->depth) ||
+					(base->vector_size != pt->vector_size) ||
+					(base->iterations != pt->iterations))
+				continue;
+			if ((base->runs > 0) && (pt->runs > 0) && (pt->mean_us > 0.0))
+				pt->speedup = base->mean_us / pt->mean_us;
+			break;
+		}
+	}
+}
+
+/* Latency / offered load curve of the open loop points */
+static void print_load_markdown(FILE *out, const struct point *pts, int count)
+{
+	const struct point *prev = NULL;
+
+	for (int i = 0; i < count; i++) {
+		const struct point *pt = &pts[i];
+
+		if (pt->rate == 0)
+			continue;
+		if ((prev == NULL) || (pt->backend != prev->backend) || (pt->config != prev->config) ||
+				(pt->depth != prev->depth) || (pt->threads != prev->threads) ||
+				(pt->vector_size != prev->vector_size)) {
+			fprintf(out, "\n### Open loop, %s, configuration %d (pipeline depth %d, "
+					"%d thread%s, vector size %ld)\n\n",
+					backend_modes[pt->backend], pt->config, pt->depth, pt->threads,
+					pt->threads > 1 ? "s" : "", pt->vector_size);
+			fprintf(out, "| Offered (iterations/s) | Achieved (iterations/s) | p50 response (us) "
+					"| p99 response (us) | p99.9 response (us) | p99 queue (us) |\n");
+			fprintf(out, "| ---------------------- | ----------------------- | ----------------- "
+					"| ----------------- | ------------------- | -------------- |\n");
+		}
+		fprintf(out, "| %ld | %.0f | %.1f | %.1f | %.1f | %.1f |\n",
+				pt->rate, pt->achieved, pt->resp_p50_us, pt->resp_p99_us,
+				pt->resp_p999_us, pt->queue_p99_us);
+		prev = pt;
+	}
+}
+
+/* Same layout as the Configuration tables of README.md */
+static void print_markdown(FILE *out, const struct point *pts, int count)
+{
+	const struct point *prev = NULL;
+
+	for (int i = 0; i < count; i++) {
+		const struct point *pt = &pts[i];
+		char throughput[32];
+
+		if (pt->rate > 0)
+			continue;
+		if ((prev == NULL) || (pt->config != prev->config) || (pt->depth != prev->depth) ||
+				(pt->threads != prev->threads)) {
+			fprintf(out, "%s### Configuration %d (pipeline depth %d, %d thread%s)\n\n",
+					prev ? "\n" : "", pt->config, pt->depth, pt->threads,
+					pt->threads > 1 ? "s" : "");
+			fprintf(out, "| Mode     |Action version| Vector size (uint32_t)   | Num Iterations "
+					"| Total data transfer (bytes)\\* | Average iteration time (us) "
+					"| p99 (us) | Throughput | Speedup |\n");
+			fprintf(out, "| -------- | ---------------- | ------------- | -------------- "
+					"| --------------------------- | --------------------------- "
+					"| -------- | ---------- | ------- |\n");
+		}
+
+		if (pt->throughput_mbs >= 1000.0)
+			snprintf(throughput, sizeof(throughput), "%.1f GB/s", pt->throughput_mbs / 1000.0);
+		else
+			snprintf(throughput, sizeof(throughput), "%.0f MB/s", pt->throughput_mbs);
+
+		if ((pt->backend == BACKEND_GPU) || (pt->backend == BACKEND_EMULATOR))
+			fprintf(out, "|%s |  N/A |", backend_modes[pt->backend]);
+		else
+			fprintf(out, "|%s |(0x%08x) |", backend_modes[pt->backend],
+					PARALLEL_MEMCPY_ACTION_TYPE);
+
+		fprintf(out, " %ld | %ld | %lu x 2 | %.1f +/- %.1f | %.1f | %s | %.2f |\n",
+				pt->vector_size, pt->iterations,
+				(unsigned long)(pt->vector_size * sizeof(uint32_t)),
+				pt->mean_us, pt->ci95_us, pt->p99_us, throughput, pt->speedup);
+		prev = pt;
+	}
+	print_load_markdown(out, pts, count);
+}
+
+/*-----------------------------------------------
+ *            Main application
+ * ----------------------------------------------
+ *
+ * Options that can be set using command line:
+ * 	- s : Vector sizes
+ * 	- n : Iterations per run
+ * 	- c : Configs (1 : host buffering, 2 : direct)
+ * 	- p : Pipeline depths
+ * 	- t : Threads of the cpu compute backend
+ * 	- b : Backends
+ * 	- l : Offered loads (open loop rates of kernel_runner)
+ * 	- a : Arrivals of the open loop runs (constant or poisson)
+ * 	- w : Warm-up runs
+ * 	- r : Measured runs per point
+ * 	- W : Wait policy of the runners
+ * 	- C : Compute backend of the runners
+ * 	- m : Timing model of the emulator and of the software action
+ * 	- f : Output format
+ * 	- o : Output file
+ * 	- d : Directory of the runners
+ */
+
+int main(int argc, char *argv[])
+{
+	long sizes[MAX_VALUES], iterations[MAX_VALUES], configs[MAX_VALUES], depths[MAX_VALUES];
+	long threads[MAX_VALUES], rates[MAX_VALUES] = { 0 };
+	enum backend backends[BACKEND_MAX];
+	int num_sizes, num_iterations, num_configs, num_depths, num_threads, num_backends;
+	int num_rates = 1;
+	const char *sizes_arg = "256:131072", *iterations_arg = "10000";
+	const char *configs_arg = "1,2", *depths_arg = "1", *backends_arg = "emulator,cpu";
+	const char *threads_arg = "1", *loads_arg = NULL;
+	const char *format = "csv", *output = NULL;
+	struct sweep sw = { .bin_dir = NULL, .wait_policy = NULL, .compute = NULL,
+		.arrivals = NULL, .warmup = 1, .repetitions = 5, .verbose = false };
+	struct point *pts;
+	int count = 0, failed = 0, ch;
+	char *self = strdup(argv[0]);
+	FILE *out = stdout;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{ "sizes",		required_argument, NULL, 's' },
+			{ "iterations",		required_argument, NULL, 'n' },
+			{ "configs",		required_argument, NULL, 'c' },
+			{ "pipeline_depths",	required_argument, NULL, 'p' },
+			{ "threads",		required_argument, NULL, 't' },
+			{ "backends",		required_argument, NULL, 'b' },
+			{ "loads",		required_argument, NULL, 'l' },
+			{ "arrivals",		required_argument, NULL, 'a' },
+			{ "warmup",		required_argument, NULL, 'w' },
+			{ "repetitions",	required_argument, NULL, 'r' },
+			{ "wait_policy",	required_argument, NULL, 'W' },
+			{ "compute",		required_argument, NULL, 'C' },
+			{ "device_model",	required_argument, NULL, 'm' },
+			{ "format",		required_argument, NULL, 'f' },
+			{ "output",		required_argument, NULL, 'o' },
+			{ "bin_dir",		required_argument, NULL, 'd' },
+			{ "verbose",		no_argument, NULL, 'v' },
+			{ "help", no_argument, NULL, 'h' },
+			{ 0, no_argument, NULL, 0 },};
+
+		ch = getopt_long(argc, argv,
+				"s:n:c:p:t:b:l:a:w:r:W:C:m:f:o:d:vh",
+				long_options, &option_index);
+		if (ch == -1)
+			break;
+
+		switch (ch) {
+			case 's':
+				sizes_arg = optarg;
+				break;
+			case 'n':
+				iterations_arg = optarg;
+				break;
+			case 'c':
+				configs_arg = optarg;
+				break;
+			case 'p':
+				depths_arg = optarg;
+				break;
+			case 't':
+				threads_arg = optarg;
+				break;
+			case 'b':
+				backends_arg = optarg;
+				break;
+			case 'l':
+				loads_arg = optarg;
+				break;
+			case 'a':
+				sw.arrivals = optarg;
+				break;
+			case 'w':
+				sw.warmup = atoi(optarg);
+				break;
+			case 'r':
+				sw.repetitions = atoi(optarg);
+				break;
+			case 'W':
+				sw.wait_policy = optarg;
+				break;
+			case 'C':
+				sw.compute = optarg;
+				break;
+			case 'm':
+				sw.device_model = optarg;
+				break;
+			case 'f':
+				format = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'd':
+				sw.bin_dir = optarg;
+				break;
+			case 'v':
+				sw.verbose = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(EXIT_SUCCESS);
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	num_sizes = parse_list(sizes_arg, sizes, MAX_VALUES);
+	num_iterations = parse_list(iterations_arg, iterations, MAX_VALUES);
+	num_configs = parse_list(configs_arg, configs, MAX_VALUES);
+	num_depths = parse_list(depths_arg, depths, MAX_VALUES);
+	num_threads = parse_list(threads_arg, threads, MAX_VALUES);
+	num_backends = parse_backends(backends_arg, backends, BACKEND_MAX);
+	// without -l, one closed loop point (rate 0)
+	if (loads_arg != NULL)
+		num_rates = parse_list(loads_arg, rates, MAX_VALUES);
+	if ((num_sizes < 0) || (num_iterations < 0) || (num_configs < 0) ||
+			(num_depths < 0) || (num_threads < 0) || (num_backends < 0) || (num_rates < 0)) {
+		printf("Invalid list argument\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		if ((threads[i] < 1) || (threads[i] > WORKER_POOL_MAX_THREADS)) {
+			printf("Threads should be between 1 and %d\n", WORKER_POOL_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < num_configs; i++) {
+		if ((configs[i] != 1) && (configs[i] != 2)) {
+			printf("Config should be 1 or 2\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if ((sw.warmup < 0) || (sw.repetitions < 1) || (sw.repetitions > MAX_REPETITIONS)) {
+		printf("Repetitions should be between 1 and %d\n", MAX_REPETITIONS);
+		exit(EXIT_FAILURE);
+	}
+	if ((sw.arrivals != NULL) && strcmp(sw.arrivals, "constant") && strcmp(sw.arrivals, "poisson")) {
+		printf("Arrivals should be constant or poisson\n");
+		exit(EXIT_FAILURE);
+	}
+	if (strcmp(format, "csv") && strcmp(format, "json") && strcmp(format, "markdown")) {
+		printf("Unknown format %s\n", format);
+		exit(EXIT_FAILURE);
+	}
+	if (sw.bin_dir == NULL)
+		sw.bin_dir = dirname(self);
+
+	pts = calloc(num_sizes * num_iterations * num_configs * num_depths * num_threads * num_backends *
+			num_rates, sizeof(*pts));
+	if (pts == NULL) {
+		fprintf(stderr, "err: failed to allocate results\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int c = 0; c < num_configs; c++)
+	for (int p = 0; p < num_depths; p++)
+	for (int t = 0; t < num_threads; t++)
+	for (int b = 0; b < num_backends; b++)
+	for (int s = 0; s < num_sizes; s++)
+	for (int n = 0; n < num_iterations; n++)
+	for (int l = 0; l < num_rates; l++) {
+		struct point *pt = &pts[count];
+		bool open_loop = (backends[b] == BACKEND_GPU) || (backends[b] == BACKEND_EMULATOR);
+
+		// action_runner has no config nor pipeline depth : run it once
+		if ((backends[b] == BACKEND_FPGA_ONLY) && ((c > 0) || (p > 0)))
+			continue;
+		// only kernel_runner has an open loop mode, the others run closed loop once
+		if (!open_loop && (l > 0))
+			continue;
+
+		pt->backend = backends[b];
+		pt->config = configs[c];
+		pt->depth = depths[p];
+		pt->threads = threads[t];
+		pt->vector_size = sizes[s];
+		pt->iterations = iterations[n];
+		pt->rate = open_loop ? rates[l] : 0;
+
+		fprintf(stderr, "%-8s config %d depth %d threads %d size %7ld iterations %ld ",
+				backend_names[pt->backend], pt->config, pt->depth, pt->threads,
+				pt->vector_size, pt->iterations);
+		if (pt->rate > 0)
+			fprintf(stderr, "rate %ld/s ", pt->rate);
+		fprintf(stderr, "... ");
+		if (run_point(&sw, pt)) {
+			fprintf(stderr, "failed\n");
+			failed++;
+			continue;
+		}
+		fprintf(stderr, "%.3f +/- %.3f usec\n", pt->mean_us, pt->ci95_us);
+		count++;
+	}
+	compute_speedup(pts, count, threads[0]);
+
+	if (output != NULL) {
+		out = fopen(output, "w");
+		if (out == NULL) {
+			fprintf(stderr, "err: failed to open %s\n", output);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (strcmp(format, "json") == 0)
+		print_json(out, pts, count);
+	else if (strcmp(format, "markdown") == 0)
+		print_markdown(out, pts, count);
+	else
+		print_csv(out, pts, count);
+
+	if (out != stdout)
+		fclose(out);
+	if (failed)
+		fprintf(stderr, "%d points failed\n", failed);
+
+	free(pts);
+	free(self);
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
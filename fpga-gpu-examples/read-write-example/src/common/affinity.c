@@ -0,0 +1,449 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * AFFINITY
+ *
+ * Topology comes from sysfs only (no libnuma / hwloc) :
+ *  - /sys/devices/system/node/node<N>/cpulist for the CPUs of a node,
+ *  - /sys/devices/system/cpu/cpu<N>/cache/index3/shared_cpu_list for the
+ *    CPUs sharing the last level cache,
+ *  - /sys/class/{cxl,ocxl}/<afu>/device/numa_node for the node of the card.
+ * The memory policy is read back with the get_mempolicy() system call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <affinity.h>
+
+/* <numaif.h> comes with libnuma, only the system call is used */
+#ifndef MPOL_F_NODE
+#define MPOL_F_NODE	(1 << 0)
+#define MPOL_F_ADDR	(1 << 1)
+#endif
+
+#define NODE_SYSFS	"/sys/devices/system/node"
+#define CPU_SYSFS	"/sys/devices/system/cpu"
+
+static const char *role_names[AFFINITY_ROLES] = {
+	[AFFINITY_HOST]		= "host",
+	[AFFINITY_DEVICE]	= "device",
+	[AFFINITY_WORKERS]	= "workers",
+};
+
+static bool pinned[AFFINITY_ROLES] = { false };
+static cpu_set_t role_cpus[AFFINITY_ROLES];
+static int host_cpu = -1, device_cpu = -1;
+static int worker_cpus[CPU_SETSIZE];
+static int num_worker_cpus = 0;
+static int device_node = -1, mem_node = -1;
+static const char *device_node_source = "";
+static int device_seen_cpu = -1;
+
+/*-----------------------------------------------
+ *            Topology
+ *-----------------------------------------------*/
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+	int rc = -1;
+
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, (int)len, f) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		rc = 0;
+	}
+	fclose(f);
+	return rc;
+}
+
+/* "0-3,8,10-11" */
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p) {
+		char *end;
+		long first = strtol(p, &end, 10), last;
+
+		if ((end == p) || (first < 0))
+			return -1;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			if ((end == p + 1) || (last < first))
+				return -1;
+			p = end;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -1;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static void print_cpulist(FILE *out, const cpu_set_t *set)
+{
+	const char *sep = "";
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		int last = cpu;
+
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		while ((last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, set))
+			last++;
+		if (last == cpu)
+			fprintf(out, "%s%d", sep, cpu);
+		else
+			fprintf(out, "%s%d-%d", sep, cpu, last);
+		sep = ",";
+		cpu = last;
+	}
+}
+
+static int first_cpu(const cpu_set_t *set)
+{
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, set))
+			return cpu;
+	}
+	return -1;
+}
+
+static bool node_exists(int node)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), NODE_SYSFS "/node%d", node);
+	// kernels without NUMA support have no node directory : node 0 only
+	if (access(NODE_SYSFS, F_OK))
+		return node == 0;
+	return access(path, F_OK) == 0;
+}
+
+static int node_cpus(int node, cpu_set_t *set)
+{
+	char path[128], list[1024];
+
+	snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", node);
+	if (read_line(path, list, sizeof(list)) == 0)
+		return parse_cpulist(list, set);
+	if (access(NODE_SYSFS, F_OK) || (node != 0))
+		return -1;
+	// no NUMA support : every CPU is on node 0
+	return sched_getaffinity(0, sizeof(*set), set);
+}
+
+/* CPUs sharing the last level cache with cpu, cpu alone if unknown */
+static void core_complex(int cpu, cpu_set_t *set)
+{
+	static const char *levels[] = { "index3", "index2" };
+	char path[128], list[1024];
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cache/%s/shared_cpu_list",
+				cpu, levels[l]);
+		if ((read_line(path, list, sizeof(list)) == 0) && (parse_cpulist(list, set) == 0))
+			return;
+	}
+	CPU_ZERO(set);
+	CPU_SET(cpu, set);
+}
+
+/* Node of the first CAPI / OpenCAPI card found, -1 if there is none */
+static int discover_device_node(void)
+{
+	static const char *patterns[] = {
+		"/sys/class/cxl/*/device/numa_node",
+		"/sys/class/ocxl/*/device/numa_node",
+	};
+	int node = -1;
+
+	for (size_t i = 0; (i < sizeof(patterns) / sizeof(patterns[0])) && (node < 0); i++) {
+		glob_t g;
+
+		if (glob(patterns[i], 0, NULL, &g))
+			continue;
+		for (size_t p = 0; (p < g.gl_pathc) && (node < 0); p++) {
+			char value[32];
+
+			// -1 : the platform does not tell
+			if (read_line(g.gl_pathv[p], value, sizeof(value)) == 0)
+				node = atoi(value);
+		}
+		globfree(&g);
+	}
+	return node;
+}
+
+/*-----------------------------------------------
+ *            Configuration
+ *-----------------------------------------------*/
+
+void affinity_config_init(struct affinity_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->device_node = -1;
+}
+
+static bool valid_node_spec(const char *spec)
+{
+	char *end;
+
+	if (strncmp(spec, "node", 4) || !spec[4])
+		return false;
+	return (strtol(spec + 4, &end, 10) >= 0) && (*end == '\0');
+}
+
+static bool valid_cpus_spec(const char *spec)
+{
+	cpu_set_t set;
+
+	return !strcmp(spec, "near") || valid_node_spec(spec) || (parse_cpulist(spec, &set) == 0);
+}
+
+int affinity_parse(const char *item, struct affinity_config *cfg)
+{
+	const char *value = strchr(item, '=');
+	size_t key_len = value ? (size_t)(value - item) : strlen(item);
+
+	if (!strcmp(item, "auto")) {
+		for (int r = 0; r < AFFINITY_ROLES; r++)
+			strcpy(cfg->cpus[r], "near");
+		strcpy(cfg->mem, "near");
+		return 0;
+	}
+	if ((value == NULL) || (strlen(++value) >= AFFINITY_SPEC_LEN))
+		return -1;
+
+	for (int r = 0; r < AFFINITY_ROLES; r++) {
+		if ((strlen(role_names[r]) == key_len) && !strncmp(item, role_names[r], key_len)) {
+			if (!valid_cpus_spec(value))
+				return -1;
+			strcpy(cfg->cpus[r], value);
+			return 0;
+		}
+	}
+	if (!strncmp(item, "mem", key_len) && (key_len == 3)) {
+		if (strcmp(value, "off") && strcmp(value, "near") && !valid_node_spec(value))
+			return -1;
+		strcpy(cfg->mem, value);
+		return 0;
+	}
+	if (!strncmp(item, "device_node", key_len) && (key_len == 11)) {
+		char *end;
+
+		cfg->device_node = (int)strtol(value, &end, 10);
+		return ((cfg->device_node < 0) || *end) ? -1 : 0;
+	}
+	return -1;
+}
+
+/*-----------------------------------------------
+ *            Placement
+ *-----------------------------------------------*/
+
+static bool needs_device_node(const struct affinity_config *cfg)
+{
+	for (int r = 0; r < AFFINITY_ROLES; r++) {
+		if (!strcmp(cfg->cpus[r], "near"))
+			return true;
+	}
+	return !strcmp(cfg->mem, "near");
+}
+
+static int resolve(const char *spec, const cpu_set_t *allowed, cpu_set_t *set)
+{
+	if (!strcmp(spec, "near")) {
+		cpu_set_t node;
+
+		if (node_cpus(device_node, &node))
+			return -1;
+		core_complex(first_cpu(&node), set);
+	} else if (valid_node_spec(spec)) {
+		if (node_cpus(atoi(spec + 4), set))
+			return -1;
+	} else if (parse_cpulist(spec, set)) {
+		return -1;
+	}
+	// outside of the cpuset of the process (taskset, container) : not usable
+	CPU_AND(set, set, allowed);
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+int affinity_init(const struct affinity_config *cfg)
+{
+	cpu_set_t allowed;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		fprintf(stderr, "err: sched_getaffinity failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	if (needs_device_node(cfg)) {
+		device_node = cfg->device_node;
+		device_node_source = "given";
+		if (device_node < 0) {
+			device_node = discover_device_node();
+			device_node_source = "sysfs";
+		}
+		if (device_node < 0) {
+			device_node = 0;
+			device_node_source = "no card found, node 0";
+		}
+	}
+
+	for (int r = 0; r < AFFINITY_ROLES; r++) {
+		pinned[r] = cfg->cpus[r][0] != '\0';
+		if (pinned[r] && resolve(cfg->cpus[r], &allowed, &role_cpus[r])) {
+			fprintf(stderr, "err: no usable CPU for %s=%s\n", role_names[r], cfg->cpus[r]);
+			return -1;
+		}
+	}
+
+	// polling threads : one CPU each, not the same one if the lists allow it
+	if (pinned[AFFINITY_HOST])
+		host_cpu = first_cpu(&role_cpus[AFFINITY_HOST]);
+	if (pinned[AFFINITY_DEVICE]) {
+		cpu_set_t others;
+
+		CPU_ZERO(&others);
+		CPU_OR(&others, &others, &role_cpus[AFFINITY_DEVICE]);
+		if (host_cpu >= 0)
+			CPU_CLR(host_cpu, &others);
+		device_cpu = first_cpu(CPU_COUNT(&others) ? &others : &role_cpus[AFFINITY_DEVICE]);
+	}
+	// workers : what is left of their list
+	if (pinned[AFFINITY_WORKERS]) {
+		for (int pass = 0; (pass < 2) && (num_worker_cpus == 0); pass++) {
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if (!CPU_ISSET(cpu, &role_cpus[AFFINITY_WORKERS]))
+					continue;
+				if ((pass == 0) && ((cpu == host_cpu) || (cpu == device_cpu)))
+					continue;
+				worker_cpus[num_worker_cpus++] = cpu;
+			}
+		}
+	}
+
+	if (!strcmp(cfg->mem, "near"))
+		mem_node = device_node;
+	else if (valid_node_spec(cfg->mem))
+		mem_node = atoi(cfg->mem + 4);
+	if ((mem_node >= 0) && !node_exists(mem_node)) {
+		fprintf(stderr, "err: unknown NUMA node %d\n", mem_node);
+		return -1;
+	}
+
+	// the HOST thread touches the pool first : its node backs unbound buffers
+	return affinity_pin(pthread_self(), AFFINITY_HOST, 0);
+}
+
+int affinity_numa_node(void)
+{
+	return mem_node;
+}
+
+int affinity_pin(pthread_t thread, enum affinity_role role, int index)
+{
+	cpu_set_t set;
+	int cpu, rc;
+
+	if ((role >= AFFINITY_ROLES) || !pinned[role])
+		return 0;
+
+	if (role == AFFINITY_HOST)
+		cpu = host_cpu;
+	else if (role == AFFINITY_DEVICE)
+		cpu = device_cpu;
+	else
+		cpu = worker_cpus[index % num_worker_cpus];
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (rc) {
+		fprintf(stderr, "warn: failed to pin %s thread to cpu %d (%s)\n",
+				role_names[role], cpu, strerror(rc));
+		return -1;
+	}
+	// the device thread runs in the background, keep where it ended up
+	if ((role == AFFINITY_DEVICE) && pthread_equal(thread, pthread_self()))
+		__atomic_store_n(&device_seen_cpu, sched_getcpu(), __ATOMIC_RELAXED);
+	return 0;
+}
+
+void affinity_report(const void *sample, FILE *out)
+{
+	int seen;
+
+	if (!pinned[AFFINITY_HOST] && !pinned[AFFINITY_DEVICE] &&
+			!pinned[AFFINITY_WORKERS] && (mem_node < 0))
+		return;
+
+	fprintf(out, "Affinity :");
+	if (device_node >= 0)
+		fprintf(out, " device node %d (%s),", device_node, device_node_source);
+	fprintf(out, " host ");
+	if (pinned[AFFINITY_HOST])
+		fprintf(out, "cpu %d (on %d)", host_cpu, sched_getcpu());
+	else
+		fprintf(out, "not pinned (on %d)", sched_getcpu());
+	if (pinned[AFFINITY_DEVICE]) {
+		seen = __atomic_load_n(&device_seen_cpu, __ATOMIC_RELAXED);
+		fprintf(out, ", device cpu %d", device_cpu);
+		if (seen >= 0)
+			fprintf(out, " (on %d)", seen);
+	}
+	if (pinned[AFFINITY_WORKERS]) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		for (int i = 0; i < num_worker_cpus; i++)
+			CPU_SET(worker_cpus[i], &set);
+		fprintf(out, ", workers cpus ");
+		print_cpulist(out, &set);
+	}
+	if (mem_node >= 0)
+		fprintf(out, ", buffers bound to node %d", mem_node);
+	if (sample != NULL) {
+		int node = -1;
+
+		// node of the page backing the sample, after the first touch
+		if (syscall(__NR_get_mempolicy, &node, NULL, 0, sample, MPOL_F_NODE | MPOL_F_ADDR) == 0)
+			fprintf(out, ", buffers on node %d", node);
+		else
+			fprintf(out, ", buffer node unknown (%s)", strerror(errno));
+	}
+	fprintf(out, "\n");
+}
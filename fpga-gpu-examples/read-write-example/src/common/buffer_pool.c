@@ -0,0 +1,494 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BUFFER POOL
+ *
+ * Size class allocator for the transfer buffers. Chunks are mmaped once and
+ * never given back before buffer_pool_destroy(), so that getting a buffer
+ * after the first run is a free list pop. All the bookkeeping is kept out of
+ * the chunks : buffers are naturally aligned (up to a page) and a 512 KB
+ * buffer does not spill on the next huge page because of a header. Released
+ * buffers are found back through a hash of their address.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <buffer_pool.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB	(21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB	(30 << MAP_HUGE_SHIFT)
+#endif
+/* <numaif.h> comes with libnuma, only the system call is used */
+#ifndef MPOL_BIND
+#define MPOL_BIND	2
+#endif
+
+struct pool_chunk {
+	char *base;
+	size_t size;
+	size_t used;
+	enum buffer_pool_pages pages;
+	struct pool_chunk *next;
+};
+
+struct pool_block {
+	void *addr;
+	size_t size;
+	int cls;			/* -1 : large buffer */
+	bool in_use;
+	struct pool_block *next;	/* all blocks */
+	struct pool_block *next_free;
+	struct pool_block *next_hash;
+};
+
+static const char *pages_names[PAGES_MAX] = { "thp", "2m", "1g" };
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct buffer_pool_config pool_cfg = { PAGES_DEFAULT, true, false, -1 };
+static bool pool_started = false;
+static struct pool_chunk *chunks = NULL;	/* chunks[0] is the one being carved */
+static struct pool_block *blocks = NULL;
+static struct pool_block **block_hash = NULL;	/* by address */
+static unsigned int hash_shift = 0;
+static size_t num_blocks = 0;
+static struct pool_block *free_lists[BUFFER_POOL_CLASSES];
+static struct pool_block *free_large = NULL;
+
+/* statistics */
+static uint64_t stat_gets, stat_reuses, stat_mapped, stat_fallbacks;
+static bool lock_failed = false, bind_failed = false;
+
+void buffer_pool_config_init(struct buffer_pool_config *cfg)
+{
+	cfg->pages = PAGES_DEFAULT;
+	cfg->prefault = true;
+	cfg->lock = false;
+	cfg->numa_node = -1;
+}
+
+int buffer_pool_parse(const char *spec, struct buffer_pool_config *cfg)
+{
+	char *copy, *item, *saveptr = NULL;
+	int rc = 0;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcmp(item, "thp"))
+			cfg->pages = PAGES_DEFAULT;
+		else if (!strcmp(item, "2m"))
+			cfg->pages = PAGES_HUGE_2M;
+		else if (!strcmp(item, "1g"))
+			cfg->pages = PAGES_HUGE_1G;
+		else if (!strcmp(item, "prefault"))
+			cfg->prefault = true;
+		else if (!strcmp(item, "noprefault"))
+			cfg->prefault = false;
+		else if (!strcmp(item, "mlock"))
+			cfg->lock = true;
+		else {
+			rc = -1;
+			break;
+		}
+	}
+	free(copy);
+	return rc;
+}
+
+int buffer_pool_init(const struct buffer_pool_config *cfg)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_started && memcmp(cfg, &pool_cfg, sizeof(*cfg))) {
+		fprintf(stderr, "err: buffer pool already in use, configuration not changed\n");
+		rc = -1;
+	} else {
+		pool_cfg = *cfg;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return rc;
+}
+
+static size_t page_size(enum buffer_pool_pages pages)
+{
+	switch (pages) {
+	case PAGES_HUGE_2M:
+		return 2ul << 20;
+	case PAGES_HUGE_1G:
+		return 1ul << 30;
+	default:
+		return (size_t)sysconf(_SC_PAGESIZE);
+	}
+}
+
+static size_t round_up(size_t v, size_t align)
+{
+	return (v + align - 1) & ~(align - 1);
+}
+
+/*
+ * Binds a chunk to the configured node before its first touch. If the
+ * policy cannot be set (no NUMA support, seccomp), pages land on the node
+ * of the thread touching them first.
+ */
+static void bind_chunk(void *p, size_t size)
+{
+	unsigned long mask[4] = { 0 };
+	int node = pool_cfg.numa_node;
+
+	if ((node < 0) || (node >= (int)(8*sizeof(mask))))
+		return;
+	mask[node / (8*sizeof(long))] = 1ul << (node % (8*sizeof(long)));
+	if (syscall(__NR_mbind, p, size, MPOL_BIND, mask, 8*sizeof(mask) + 1, 0) &&
+			!bind_failed) {
+		bind_failed = true;
+		fprintf(stderr, "warn: mbind of the buffer pool to node %d failed (%s), "
+				"first touch placement\n", node, strerror(errno));
+	}
+}
+
+/* Base pages : over-map to get a 2 MB aligned chunk that THP can back */
+static void *map_default(size_t size, int flags)
+{
+	char *p, *aligned;
+	size_t extra = BUFFER_POOL_CHUNK;
+
+	p = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	aligned = (char *)round_up((size_t)p, BUFFER_POOL_CHUNK);
+	if (aligned > p)
+		munmap(p, aligned - p);
+	if (aligned + size < p + size + extra)
+		munmap(aligned + size, (p + size + extra) - (aligned + size));
+
+	// touched after the THP request and the binding so that the faults
+	// get huge pages on the right node
+	madvise(aligned, size, MADV_HUGEPAGE);
+	bind_chunk(aligned, size);
+	if (flags & MAP_POPULATE) {
+		for (size_t offset = 0; offset < size; offset += page_size(PAGES_DEFAULT))
+			aligned[offset] = 0;
+	}
+	return aligned;
+}
+
+static struct pool_chunk *map_chunk(size_t min_size)
+{
+	enum buffer_pool_pages pages = pool_cfg.pages;
+	int flags = pool_cfg.prefault ? MAP_POPULATE : 0;
+	struct pool_chunk *chunk;
+	size_t size;
+	void *p = NULL;
+
+	if (pages != PAGES_DEFAULT) {
+		int huge = (pages == PAGES_HUGE_1G) ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+
+		size = round_up(min_size > page_size(pages) ? min_size : page_size(pages),
+				page_size(pages));
+		// with a node, pages are faulted once the chunk is bound
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge |
+				(pool_cfg.numa_node >= 0 ? 0 : flags), -1, 0);
+		if ((p != MAP_FAILED) && (pool_cfg.numa_node >= 0)) {
+			bind_chunk(p, size);
+			if (flags & MAP_POPULATE) {
+				for (size_t offset = 0; offset < size; offset += page_size(pages))
+					((char *)p)[offset] = 0;
+			}
+		}
+		if (p == MAP_FAILED) {
+			if (stat_fallbacks++ == 0)
+				fprintf(stderr, "warn: no %s huge page available (%s), "
+						"using base pages\n", pages_names[pages], strerror(errno));
+			p = NULL;
+			pages = PAGES_DEFAULT;
+		}
+	}
+	if (p == NULL) {
+		size = round_up(min_size > BUFFER_POOL_CHUNK ? min_size : BUFFER_POOL_CHUNK,
+				BUFFER_POOL_CHUNK);
+		p = map_default(size, flags);
+		if (p == NULL)
+			return NULL;
+	}
+
+	if (pool_cfg.lock && mlock(p, size) && !lock_failed) {
+		lock_failed = true;
+		fprintf(stderr, "warn: mlock of the buffer pool failed (%s), "
+				"check ulimit -l\n", strerror(errno));
+	}
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (chunk == NULL) {
+		munmap(p, size);
+		return NULL;
+	}
+	chunk->base = p;
+	chunk->size = size;
+	chunk->pages = pages;
+	stat_mapped += size;
+	return chunk;
+}
+
+static int size_class(size_t size)
+{
+	int cls = 0;
+
+	if (size > (1ul << BUFFER_POOL_MAX_SHIFT))
+		return -1;
+	while ((1ul << (cls + BUFFER_POOL_MIN_SHIFT)) < size)
+		cls++;
+	return cls;
+}
+
+static size_t hash_index(const void *addr, unsigned int shift)
+{
+	return (size_t)((((uintptr_t)addr >> BUFFER_POOL_MIN_SHIFT) *
+			0x9e3779b97f4a7c15ull) >> (64 - shift));
+}
+
+/* Rebuilds the table with twice the buckets once it holds a block per bucket */
+static void hash_grow(void)
+{
+	unsigned int shift = hash_shift ? hash_shift + 1 : 8;
+	struct pool_block **table;
+
+	table = calloc((size_t)1 << shift, sizeof(*table));
+	if (table == NULL)
+		return;		// longer chains, still correct
+	for (struct pool_block *block = blocks; block != NULL; block = block->next) {
+		size_t i = hash_index(block->addr, shift);
+
+		block->next_hash = table[i];
+		table[i] = block;
+	}
+	free(block_hash);
+	block_hash = table;
+	hash_shift = shift;
+}
+
+/* Takes a new block from the current chunk, or from a new one */
+static struct pool_block *carve(size_t size, int cls)
+{
+	size_t align = size < 4096 ? size : 4096;
+	struct pool_chunk *chunk = chunks;
+	struct pool_block *block, **bucket;
+	size_t offset = 0;
+
+	if (align < BUFFER_POOL_ALIGN)
+		align = BUFFER_POOL_ALIGN;
+
+	if (chunk != NULL)
+		offset = round_up(chunk->used, align);
+	if ((chunk == NULL) || (offset + size > chunk->size)) {
+		chunk = map_chunk(size);
+		if (chunk == NULL)
+			return NULL;
+		// a large buffer fills its own chunk, keep carving the current one
+		if ((cls < 0) && (chunks != NULL)) {
+			chunk->next = chunks->next;
+			chunks->next = chunk;
+		} else {
+			chunk->next = chunks;
+			chunks = chunk;
+		}
+		offset = 0;
+	}
+
+	if ((block_hash == NULL) || (num_blocks >= ((size_t)1 << hash_shift))) {
+		hash_grow();
+		if (block_hash == NULL)
+			return NULL;
+	}
+	block = calloc(1, sizeof(*block));
+	if (block == NULL)
+		return NULL;
+	block->addr = chunk->base + offset;
+	block->size = size;
+	block->cls = cls;
+	block->next = blocks;
+	blocks = block;
+	bucket = &block_hash[hash_index(block->addr, hash_shift)];
+	block->next_hash = *bucket;
+	*bucket = block;
+	num_blocks++;
+	chunk->used = offset + size;
+	return block;
+}
+
+static struct pool_block *pop_free(size_t size, int cls)
+{
+	struct pool_block **prev, *block;
+
+	if (cls >= 0) {
+		block = free_lists[cls];
+		if (block != NULL)
+			free_lists[cls] = block->next_free;
+		return block;
+	}
+
+	// large buffers : first one big enough without wasting half of it
+	for (prev = &free_large; (block = *prev) != NULL; prev = &block->next_free) {
+		if ((block->size >= size) && (block->size / 2 < size)) {
+			*prev = block->next_free;
+			return block;
+		}
+	}
+	return NULL;
+}
+
+void *buffer_pool_get(size_t size)
+{
+	struct pool_block *block;
+	bool zero = true;
+	int cls;
+
+	if (size == 0)
+		size = 1;
+	cls = size_class(size);
+
+	pthread_mutex_lock(&pool_lock);
+	pool_started = true;
+	stat_gets++;
+	block = pop_free(size, cls);
+	if (block != NULL) {
+		stat_reuses++;
+	} else {
+		size_t block_size = (cls >= 0) ? (1ul << (cls + BUFFER_POOL_MIN_SHIFT)) :
+			round_up(size, page_size(pool_cfg.pages));
+
+		block = carve(block_size, cls);
+		// fresh pre-faulted pages are still zero
+		zero = !pool_cfg.prefault;
+	}
+	if (block != NULL)
+		block->in_use = true;
+	pthread_mutex_unlock(&pool_lock);
+
+	if (block == NULL) {
+		fprintf(stderr, "err: buffer pool failed to allocate %zu bytes\n", size);
+		return NULL;
+	}
+	// also the first touch of fresh pages when they were not pre-faulted
+	if (zero)
+		memset(block->addr, 0, size);
+	return block->addr;
+}
+
+// size classes from a page up are page aligned, and so are large buffers
+void *buffer_pool_get_pages(size_t size)
+{
+	return buffer_pool_get(round_up(size ? size : 1, page_size(PAGES_DEFAULT)));
+}
+
+void buffer_pool_put(void *buffer)
+{
+	struct pool_block *block;
+
+	if (buffer == NULL)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	block = (block_hash != NULL) ? block_hash[hash_index(buffer, hash_shift)] : NULL;
+	while ((block != NULL) && (block->addr != buffer))
+		block = block->next_hash;
+	if ((block == NULL) || !block->in_use) {
+		pthread_mutex_unlock(&pool_lock);
+		fprintf(stderr, "err: %p was not given by the buffer pool\n", buffer);
+		return;
+	}
+	block->in_use = false;
+	if (block->cls >= 0) {
+		block->next_free = free_lists[block->cls];
+		free_lists[block->cls] = block;
+	} else {
+		block->next_free = free_large;
+		free_large = block;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void buffer_pool_report(FILE *out)
+{
+	unsigned long num_chunks = 0, huge_chunks = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for (struct pool_chunk *chunk = chunks; chunk != NULL; chunk = chunk->next) {
+		num_chunks++;
+		if (chunk->pages != PAGES_DEFAULT)
+			huge_chunks++;
+	}
+
+	fprintf(out, "Buffer pool (%s%s%s", pages_names[pool_cfg.pages],
+			pool_cfg.prefault ? ", prefault" : "",
+			pool_cfg.lock ? (lock_failed ? ", mlock failed" : ", mlock") : "");
+	if (pool_cfg.numa_node >= 0)
+		fprintf(out, ", node %d%s", pool_cfg.numa_node, bind_failed ? " first touch" : "");
+	fprintf(out, ") : %lu buffers in %lu chunks (%lu on huge pages), "
+			"%.1f MB mapped, %llu of %llu requests reused a buffer\n",
+			(unsigned long)num_blocks, num_chunks, huge_chunks, stat_mapped / 1048576.0,
+			(unsigned long long)stat_reuses, (unsigned long long)stat_gets);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void buffer_pool_destroy(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	while (chunks != NULL) {
+		struct pool_chunk *chunk = chunks;
+
+		chunks = chunk->next;
+		munmap(chunk->base, chunk->size);
+		free(chunk);
+	}
+	while (blocks != NULL) {
+		struct pool_block *block = blocks;
+
+		blocks = block->next;
+		free(block);
+	}
+	free(block_hash);
+	block_hash = NULL;
+	hash_shift = 0;
+	num_blocks = 0;
+	memset(free_lists, 0, sizeof(free_lists));
+	free_large = NULL;
+	stat_gets = stat_reuses = stat_mapped = stat_fallbacks = 0;
+	lock_failed = false;
+	pool_started = false;
+	pthread_mutex_unlock(&pool_lock);
+}
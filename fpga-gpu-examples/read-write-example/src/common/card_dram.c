@@ -0,0 +1,441 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * CARD DRAM
+ *
+ * Entry i describes slot i of the arena. Resident entries are chained in
+ * buckets by key; the unpinned ones are also on a least recently used list
+ * (head is the most recent), the free ones on a free list. All of it is
+ * behind one lock : the host uploads and evicts while the action thread
+ * reads.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <card_dram.h>
+#include <buffer_pool.h>
+#include <time_utils.h>
+#include <parse_utils.h>
+
+#define NONE	(-1)
+
+struct dram_entry {
+	uint64_t key;
+	uint32_t length;
+	bool used;
+	bool pinned;
+	int32_t hash_next;
+	int32_t lru_prev, lru_next;	/* also the free list */
+};
+
+static pthread_mutex_t dram_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct card_dram_config dram_cfg;
+static uint8_t *dram_arena = NULL;
+static struct dram_entry *dram_entry = NULL;
+static int32_t *dram_bucket = NULL;
+static uint32_t dram_slots, dram_bucket_mask;
+static size_t dram_slot_size;
+static int32_t lru_head = NONE, lru_tail = NONE, free_head = NONE;
+
+static struct {
+	uint64_t reads;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bypass;
+	uint64_t evictions;		/* least recently used slot reused */
+	uint64_t uploads, evicts;	/* explicit ones */
+	uint64_t bytes_saved;		/* host link bytes of the hits */
+	uint64_t bytes_loaded;		/* host link bytes into the card */
+	uint64_t hash_ns;
+} dram_stats;
+
+static const char *key_names[CARD_DRAM_KEY_MAX] = { "hash", "addr" };
+
+void card_dram_config_init(struct card_dram_config *cfg)
+{
+	cfg->size = CARD_DRAM_DEFAULT_SIZE;
+	cfg->slot_size = CARD_DRAM_DEFAULT_SLOT;
+	cfg->key = CARD_DRAM_KEY_HASH;
+}
+
+int card_dram_parse(const char *spec, struct card_dram_config *cfg)
+{
+	char *copy, *item, *saveptr = NULL;
+	uint64_t size;
+	int rc = 0;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)) {
+		if (!strncmp(item, "size=", 5)) {
+			if (parse_size(item + 5, &size) || (size > SIZE_MAX) || (size == 0)) {
+				rc = -1;
+				break;
+			}
+			cfg->size = size;
+		} else if (!strcmp(item, "key=hash")) {
+			cfg->key = CARD_DRAM_KEY_HASH;
+		} else if (!strcmp(item, "key=addr")) {
+			cfg->key = CARD_DRAM_KEY_ADDR;
+		} else {
+			rc = -1;
+			break;
+		}
+	}
+	free(copy);
+	return rc;
+}
+
+/*-----------------------------------------------
+ *            Keys
+ *-----------------------------------------------*/
+
+static inline uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+/* 8 bytes at a time, the tail byte by byte */
+static uint64_t content_hash(const void *src, uint32_t length)
+{
+	const uint8_t *p = src;
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	for (; i < length; i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return mix(h);
+}
+
+static uint64_t input_key(const void *src, uint32_t length)
+{
+	uint64_t t0, key;
+
+	if (dram_cfg.key == CARD_DRAM_KEY_ADDR)
+		return mix((uint64_t)(unsigned long)src ^ ((uint64_t)length << 40));
+	t0 = monotonic_ns();
+	key = content_hash(src, length);
+	dram_stats.hash_ns += monotonic_ns() - t0;
+	return key;
+}
+
+/*-----------------------------------------------
+ *            Slots
+ *-----------------------------------------------*/
+
+static void lru_unlink(int32_t i)
+{
+	struct dram_entry *e = &dram_entry[i];
+
+	if (e->lru_prev != NONE)
+		dram_entry[e->lru_prev].lru_next = e->lru_next;
+	else
+		lru_head = e->lru_next;
+	if (e->lru_next != NONE)
+		dram_entry[e->lru_next].lru_prev = e->lru_prev;
+	else
+		lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NONE;
+}
+
+static void lru_push(int32_t i)
+{
+	struct dram_entry *e = &dram_entry[i];
+
+	e->lru_prev = NONE;
+	e->lru_next = lru_head;
+	if (lru_head != NONE)
+		dram_entry[lru_head].lru_prev = i;
+	lru_head = i;
+	if (lru_tail == NONE)
+		lru_tail = i;
+}
+
+static int32_t lookup(uint64_t key, uint32_t length)
+{
+	int32_t i = dram_bucket[key & dram_bucket_mask];
+
+	while ((i != NONE) && ((dram_entry[i].key != key) || (dram_entry[i].length != length)))
+		i = dram_entry[i].hash_next;
+	return i;
+}
+
+static void remove_entry(int32_t i)
+{
+	struct dram_entry *e = &dram_entry[i];
+	int32_t *link = &dram_bucket[e->key & dram_bucket_mask];
+
+	while (*link != i)
+		link = &dram_entry[*link].hash_next;
+	*link = e->hash_next;
+	if (!e->pinned)
+		lru_unlink(i);
+	e->used = e->pinned = false;
+	e->lru_next = free_head;
+	free_head = i;
+}
+
+/* Free slot, else the least recently used one, NONE if every slot is pinned */
+static int32_t slot_alloc(void)
+{
+	int32_t i = free_head;
+
+	if (i != NONE) {
+		free_head = dram_entry[i].lru_next;
+	} else if (lru_tail != NONE) {
+		dram_stats.evictions++;
+		remove_entry(lru_tail);
+		i = free_head;
+		free_head = dram_entry[i].lru_next;
+	}
+	return i;
+}
+
+static int32_t insert(uint64_t key, const void *src, uint32_t length, bool pinned)
+{
+	int32_t i = slot_alloc();
+	struct dram_entry *e;
+
+	if (i == NONE)
+		return NONE;
+	e = &dram_entry[i];
+	e->key = key;
+	e->length = length;
+	e->used = true;
+	e->pinned = pinned;
+	e->hash_next = dram_bucket[key & dram_bucket_mask];
+	dram_bucket[key & dram_bucket_mask] = i;
+	e->lru_prev = e->lru_next = NONE;
+	if (!pinned)
+		lru_push(i);
+
+	// the only host link transfer of this input
+	memcpy(dram_arena + (size_t)i*dram_slot_size, src, length);
+	dram_stats.bytes_loaded += length;
+	return i;
+}
+
+/*-----------------------------------------------
+ *            Card DRAM
+ *-----------------------------------------------*/
+
+int card_dram_init(const struct card_dram_config *cfg)
+{
+	uint32_t buckets = 1;
+	int rc = 0;
+
+	pthread_mutex_lock(&dram_lock);
+	if (dram_arena != NULL) {
+		fprintf(stderr, "err: card DRAM already in use, configuration not changed\n");
+		rc = -1;
+		goto out;
+	}
+
+	// cache line aligned slots
+	dram_slot_size = (cfg->slot_size + 63) & ~(size_t)63;
+	if ((dram_slot_size == 0) || (cfg->size < dram_slot_size) ||
+			(cfg->size / dram_slot_size > CARD_DRAM_MAX_SLOTS)) {
+		fprintf(stderr, "err: card DRAM of %zu bytes cannot be cut in slots of %zu bytes "
+				"(1 to %u slots)\n", cfg->size, cfg->slot_size, CARD_DRAM_MAX_SLOTS);
+		rc = -1;
+		goto out;
+	}
+	dram_cfg = *cfg;
+	dram_slots = cfg->size / dram_slot_size;
+	while (buckets < 2*dram_slots)
+		buckets <<= 1;
+	dram_bucket_mask = buckets - 1;
+
+	dram_arena = buffer_pool_get((size_t)dram_slots * dram_slot_size);
+	dram_entry = calloc(dram_slots, sizeof(*dram_entry));
+	dram_bucket = malloc(buckets * sizeof(*dram_bucket));
+	if ((dram_slots == 0) || (dram_arena == NULL) || (dram_entry == NULL) ||
+			(dram_bucket == NULL)) {
+		fprintf(stderr, "err: failed to allocate %zu bytes of card DRAM\n", cfg->size);
+		buffer_pool_put(dram_arena);
+		free(dram_entry);
+		free(dram_bucket);
+		dram_arena = NULL;
+		dram_entry = NULL;
+		dram_bucket = NULL;
+		rc = -1;
+		goto out;
+	}
+
+	for (uint32_t b = 0; b < buckets; b++)
+		dram_bucket[b] = NONE;
+	lru_head = lru_tail = NONE;
+	free_head = NONE;
+	for (int32_t i = (int32_t)dram_slots - 1; i >= 0; i--) {
+		dram_entry[i].lru_next = free_head;
+		free_head = i;
+	}
+	memset(&dram_stats, 0, sizeof(dram_stats));
+out:
+	pthread_mutex_unlock(&dram_lock);
+	return rc;
+}
+
+bool card_dram_enabled(void)
+{
+	return __atomic_load_n(&dram_arena, __ATOMIC_ACQUIRE) != NULL;
+}
+
+enum card_dram_result card_dram_read(void *dst, const void *src, uint32_t length)
+{
+	enum card_dram_result result = CARD_DRAM_HIT;
+	uint64_t key;
+	int32_t i;
+
+	pthread_mutex_lock(&dram_lock);
+	dram_stats.reads++;
+	if ((dram_arena == NULL) || (length > dram_slot_size)) {
+		dram_stats.bypass++;
+		pthread_mutex_unlock(&dram_lock);
+		memcpy(dst, src, length);
+		return CARD_DRAM_BYPASS;
+	}
+
+	key = input_key(src, length);
+	i = lookup(key, length);
+	if (i != NONE) {
+		dram_stats.hits++;
+		dram_stats.bytes_saved += length;
+		if (!dram_entry[i].pinned) {
+			lru_unlink(i);
+			lru_push(i);
+		}
+	} else {
+		i = insert(key, src, length, false);
+		result = CARD_DRAM_MISS;
+	}
+
+	// every slot pinned : straight from the host
+	if (i == NONE) {
+		dram_stats.bypass++;
+		memcpy(dst, src, length);
+		result = CARD_DRAM_BYPASS;
+	} else {
+		dram_stats.misses += (result == CARD_DRAM_MISS);
+		memcpy(dst, dram_arena + (size_t)i*dram_slot_size, length);
+	}
+	pthread_mutex_unlock(&dram_lock);
+	return result;
+}
+
+int card_dram_upload(const void *src, uint32_t length)
+{
+	uint64_t key;
+	int32_t i;
+	int rc = 0;
+
+	pthread_mutex_lock(&dram_lock);
+	if ((dram_arena == NULL) || (length > dram_slot_size)) {
+		rc = -1;
+		goto out;
+	}
+	key = input_key(src, length);
+	i = lookup(key, length);
+	// already resident : pinned where it is
+	if (i != NONE) {
+		if (!dram_entry[i].pinned) {
+			lru_unlink(i);
+			dram_entry[i].pinned = true;
+		}
+	} else if (insert(key, src, length, true) == NONE) {
+		rc = -1;
+		goto out;
+	}
+	dram_stats.uploads++;
+out:
+	pthread_mutex_unlock(&dram_lock);
+	return rc;
+}
+
+int card_dram_evict(const void *src, uint32_t length)
+{
+	int32_t i;
+	int rc = -1;
+
+	pthread_mutex_lock(&dram_lock);
+	if ((dram_arena != NULL) && (length <= dram_slot_size)) {
+		i = lookup(input_key(src, length), length);
+		if (i != NONE) {
+			remove_entry(i);
+			dram_stats.evicts++;
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&dram_lock);
+	return rc;
+}
+
+void card_dram_report(FILE *out)
+{
+	uint32_t resident = 0, pinned = 0;
+
+	pthread_mutex_lock(&dram_lock);
+	if (dram_arena == NULL) {
+		pthread_mutex_unlock(&dram_lock);
+		return;
+	}
+	for (uint32_t i = 0; i < dram_slots; i++) {
+		resident += dram_entry[i].used;
+		pinned += dram_entry[i].pinned;
+	}
+	fprintf(out, "Card DRAM (%u slots of %.1f KB, key %s) : %llu reads, %llu hits (%.1f %%), "
+			"%llu misses, %llu bypass, %llu evictions, %u resident (%u pinned), "
+			"%.1f MB loaded, %.1f MB of host link saved",
+			dram_slots, dram_slot_size / 1024.0, key_names[dram_cfg.key],
+			(unsigned long long)dram_stats.reads, (unsigned long long)dram_stats.hits,
+			dram_stats.reads ? 100.0 * dram_stats.hits / dram_stats.reads : 0.0,
+			(unsigned long long)dram_stats.misses, (unsigned long long)dram_stats.bypass,
+			(unsigned long long)dram_stats.evictions, resident, pinned,
+			dram_stats.bytes_loaded / 1e6, dram_stats.bytes_saved / 1e6);
+	if (dram_cfg.key == CARD_DRAM_KEY_HASH)
+		fprintf(out, ", %.3f usec hashing per read",
+				dram_stats.reads ? dram_stats.hash_ns / 1e3 / dram_stats.reads : 0.0);
+	fprintf(out, "\n");
+	pthread_mutex_unlock(&dram_lock);
+}
+
+void card_dram_destroy(void)
+{
+	pthread_mutex_lock(&dram_lock);
+	buffer_pool_put(dram_arena);
+	free(dram_entry);
+	free(dram_bucket);
+	dram_arena = NULL;
+	dram_entry = NULL;
+	dram_bucket = NULL;
+	pthread_mutex_unlock(&dram_lock);
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * TRANSFER CODEC
+ *
+ * Delta + bit packing of the vectors crossing the HOST / device link. The
+ * block layout is the 4 lanes one of SIMD-BP128 : with SSE2 (always there on
+ * x86_64) a block is processed 4 elements at a time with no shuffle, the
+ * scalar version walks the lanes one after the other and produces the same
+ * bytes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <codec.h>
+#include <time_utils.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CODEC_SSE2
+#endif
+
+#define LANES		4
+#define BLOCK_ROWS	(CODEC_BLOCK / LANES)
+
+static inline uint32_t zigzag(uint32_t d)
+{
+	return (d << 1) ^ (uint32_t)((int32_t)d >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t z)
+{
+	return (z >> 1) ^ (0u - (z & 1));
+}
+
+static inline uint32_t bit_width(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/*-----------------------------------------------
+ *            Blocks
+ *-----------------------------------------------*/
+
+#ifdef CODEC_SSE2
+/* Zigzag deltas of a block into d, returns the OR of all of them */
+static uint32_t block_deltas(const uint32_t *in, uint32_t *d)
+{
+	__m128i prev = _mm_set1_epi32((int)in[0]);
+	__m128i any = _mm_setzero_si128();
+	uint32_t lanes[LANES];
+
+	for (int j = 0; j < BLOCK_ROWS; j++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + LANES*j));
+		__m128i delta = _mm_sub_epi32(v, prev);
+		__m128i z = _mm_xor_si128(_mm_slli_epi32(delta, 1), _mm_srai_epi32(delta, 31));
+
+		_mm_storeu_si128((__m128i *)(d + LANES*j), z);
+		any = _mm_or_si128(any, z);
+		prev = v;
+	}
+	_mm_storeu_si128((__m128i *)lanes, any);
+	return lanes[0] | lanes[1] | lanes[2] | lanes[3];
+}
+
+/*
+ * The loops below are fully unrolled for each bit width by block_pack() and
+ * block_unpack() : shifts and word boundaries become constants.
+ */
+static inline __attribute__((always_inline))
+void pack_width(const uint32_t *d, const uint32_t b, uint32_t *out)
+{
+	__m128i acc = _mm_setzero_si128();
+	uint32_t shift = 0;
+
+	for (int j = 0; j < BLOCK_ROWS; j++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(d + LANES*j));
+
+		acc = _mm_or_si128(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(shift)));
+		shift += b;
+		if (shift >= 32) {
+			_mm_storeu_si128((__m128i *)out, acc);
+			out += LANES;
+			shift -= 32;
+			acc = shift ? _mm_srl_epi32(v, _mm_cvtsi32_si128(b - shift)) :
+				_mm_setzero_si128();
+		}
+	}
+}
+
+static inline __attribute__((always_inline))
+void unpack_width(const uint32_t *in, const uint32_t b, uint32_t first, uint32_t *out)
+{
+	const __m128i mask = _mm_set1_epi32((int)((1u << b) - 1));
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i prev = _mm_set1_epi32((int)first);
+	__m128i word = b ? _mm_loadu_si128((const __m128i *)in) : _mm_setzero_si128();
+	uint32_t shift = 0;
+
+	for (int j = 0; j < BLOCK_ROWS; j++) {
+		__m128i z = _mm_srl_epi32(word, _mm_cvtsi32_si128(shift));
+
+		shift += b;
+		if (shift >= 32) {
+			shift -= 32;
+			in += LANES;
+			// the last row ends on a word boundary, nothing to load after it
+			if (j + 1 < BLOCK_ROWS)
+				word = _mm_loadu_si128((const __m128i *)in);
+			if (shift)
+				z = _mm_or_si128(z, _mm_sll_epi32(word, _mm_cvtsi32_si128(b - shift)));
+		}
+		z = _mm_and_si128(z, mask);
+		z = _mm_xor_si128(_mm_srli_epi32(z, 1),
+				_mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, one)));
+		prev = _mm_add_epi32(prev, z);
+		_mm_storeu_si128((__m128i *)(out + LANES*j), prev);
+	}
+}
+
+#define WIDTH_CASES(call) \
+	case 0: call(0); break; case 1: call(1); break; case 2: call(2); break; \
+	case 3: call(3); break; case 4: call(4); break; case 5: call(5); break; \
+	case 6: call(6); break; case 7: call(7); break; case 8: call(8); break; \
+	case 9: call(9); break; case 10: call(10); break; case 11: call(11); break; \
+	case 12: call(12); break; case 13: call(13); break; case 14: call(14); break; \
+	case 15: call(15); break; case 16: call(16); break; case 17: call(17); break; \
+	case 18: call(18); break; case 19: call(19); break; case 20: call(20); break; \
+	case 21: call(21); break; case 22: call(22); break; case 23: call(23); break; \
+	case 24: call(24); break; case 25: call(25); break; case 26: call(26); break; \
+	case 27: call(27); break; case 28: call(28); break; case 29: call(29); break; \
+	case 30: call(30); break; case 31: call(31); break;
+
+static void block_pack(const uint32_t *d, uint32_t b, uint32_t *out)
+{
+#define PACK(w)	pack_width(d, w, out)
+	switch (b) {
+	WIDTH_CASES(PACK)
+	}
+#undef PACK
+}
+
+static void block_unpack(const uint32_t *in, uint32_t b, uint32_t first, uint32_t *out)
+{
+#define UNPACK(w)	unpack_width(in, w, first, out)
+	switch (b) {
+	WIDTH_CASES(UNPACK)
+	}
+#undef UNPACK
+}
+#else
+static uint32_t block_deltas(const uint32_t *in, uint32_t *d)
+{
+	uint32_t any = 0;
+
+	for (int i = 0; i < CODEC_BLOCK; i++) {
+		d[i] = zigzag(in[i] - (i < LANES ? in[0] : in[i - LANES]));
+		any |= d[i];
+	}
+	return any;
+}
+
+static void block_pack(const uint32_t *d, uint32_t b, uint32_t *out)
+{
+	for (int l = 0; l < LANES; l++) {
+		uint32_t acc = 0, shift = 0, w = 0;
+
+		for (int j = 0; j < BLOCK_ROWS; j++) {
+			uint32_t v = d[LANES*j + l];
+
+			acc |= v << shift;
+			shift += b;
+			if (shift >= 32) {
+				out[LANES*w++ + l] = acc;
+				shift -= 32;
+				acc = shift ? v >> (b - shift) : 0;
+			}
+		}
+	}
+}
+
+static void block_unpack(const uint32_t *in, uint32_t b, uint32_t first, uint32_t *out)
+{
+	const uint32_t mask = (uint32_t)((1ull << b) - 1);
+
+	for (int l = 0; l < LANES; l++) {
+		uint32_t prev = first, shift = 0, w = 0;
+
+		for (int j = 0; j < BLOCK_ROWS; j++) {
+			uint32_t z = b ? in[LANES*w + l] >> shift : 0;
+
+			shift += b;
+			if (shift >= 32) {
+				shift -= 32;
+				w++;
+				if (shift)
+					z |= in[LANES*w + l] << (b - shift);
+			}
+			prev += unzigzag(z & mask);
+			out[LANES*j + l] = prev;
+		}
+	}
+}
+#endif
+
+const char *codec_name(void)
+{
+#ifdef CODEC_SSE2
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+/*-----------------------------------------------
+ *            Vectors
+ *-----------------------------------------------*/
+
+void codec_stats_init(struct codec_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+size_t codec_encode(const uint32_t *in, size_t n, uint32_t *out, struct codec_stats *stats)
+{
+	uint64_t start = monotonic_ns();
+	uint32_t d[CODEC_BLOCK];
+	uint32_t *o = out;
+	size_t i = 0, raw_blocks = 0;
+
+	for (; i + CODEC_BLOCK <= n; i += CODEC_BLOCK) {
+		uint32_t b = bit_width(block_deltas(in + i, d));
+
+		// b == 32 would take 2 + 128 words, more than raw
+		if (b >= 32) {
+			*o++ = CODEC_RAW;
+			memcpy(o, in + i, CODEC_BLOCK*sizeof(uint32_t));
+			o += CODEC_BLOCK;
+			raw_blocks++;
+			continue;
+		}
+		*o++ = b;
+		*o++ = in[i];
+		block_pack(d, b, o);
+		o += LANES*b;
+	}
+	memcpy(o, in + i, (n - i)*sizeof(uint32_t));
+	o += n - i;
+
+	if (stats != NULL) {
+		stats->vectors++;
+		stats->raw_bytes += n*sizeof(uint32_t);
+		stats->wire_bytes += (o - out)*sizeof(uint32_t);
+		stats->blocks += n / CODEC_BLOCK;
+		stats->raw_blocks += raw_blocks;
+		stats->encode_ns += monotonic_ns() - start;
+	}
+	return (o - out)*sizeof(uint32_t);
+}
+
+int codec_decode(const uint32_t *in, size_t bytes, uint32_t *out, size_t n,
+		struct codec_stats *stats)
+{
+	uint64_t start = monotonic_ns();
+	const uint32_t *end = in + bytes / sizeof(uint32_t);
+	size_t i = 0;
+	int rc = 0;
+
+	for (; i + CODEC_BLOCK <= n; i += CODEC_BLOCK) {
+		uint32_t b;
+
+		if (in >= end)
+			break;
+		b = *in++;
+		if (b == CODEC_RAW) {
+			if (end - in < CODEC_BLOCK)
+				break;
+			memcpy(out + i, in, CODEC_BLOCK*sizeof(uint32_t));
+			in += CODEC_BLOCK;
+			continue;
+		}
+		if ((b >= 32) || (end - in < 1 + (ptrdiff_t)(LANES*b)))
+			break;
+		block_unpack(in + 1, b, in[0], out + i);
+		in += 1 + LANES*b;
+	}
+	if ((i + CODEC_BLOCK <= n) || (end - in != (ptrdiff_t)(n - i)) ||
+			(bytes % sizeof(uint32_t)))
+		rc = -1;
+	else
+		memcpy(out + i, in, (n - i)*sizeof(uint32_t));
+
+	if (stats != NULL) {
+		if (rc)
+			stats->errors++;
+		stats->decode_ns += monotonic_ns() - start;
+	}
+	return rc;
+}
+
+void codec_report(const struct codec_stats *stats, double elapsed_us, FILE *out)
+{
+	double ratio = stats->wire_bytes ? (double)stats->raw_bytes / stats->wire_bytes : 0.0;
+	uint64_t n = stats->vectors ? stats->vectors : 1;
+
+	fprintf(out, "Link codec (%s) : %llu vectors, %.2f MB -> %.2f MB on the wire "
+			"(ratio %.2f, %llu of %llu blocks raw)",
+			codec_name(), (unsigned long long)stats->vectors,
+			stats->raw_bytes / 1e6, stats->wire_bytes / 1e6, ratio,
+			(unsigned long long)stats->raw_blocks, (unsigned long long)stats->blocks);
+	if (stats->errors)
+		fprintf(out, ", %llu decode errors", (unsigned long long)stats->errors);
+	fprintf(out, "\n  encode %.3f usec, decode %.3f usec per vector",
+			stats->encode_ns / 1e3 / n, stats->decode_ns / 1e3 / n);
+	if (elapsed_us > 0.0)
+		// MB/s : bytes per usec
+		fprintf(out, ", throughput %.2f MB/s effective, %.2f MB/s wire",
+				stats->raw_bytes / elapsed_us, stats->wire_bytes / elapsed_us);
+	fprintf(out, "\n");
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * CPU COMPUTE BACKEND
+ *
+ * CPU implementation of the kernel.cu interface : buffers are plain host
+ * memory (64 bytes aligned) and vector_add runs with the best SIMD variant
+ * supported by the CPU, on the calling thread or split in chunks over a
+ * worker pool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kernel.h>
+#include <cpu_kernel.h>
+#include <worker_pool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_KERNEL_X86
+#elif defined(__powerpc64__) && defined(__VSX__)
+#include <sys/auxv.h>
+#include <altivec.h>
+/* altivec.h turns bool, vector and pixel into keywords */
+#undef bool
+#undef vector
+#undef pixel
+#define bool _Bool
+#define CPU_KERNEL_VSX
+#ifndef PPC_FEATURE_HAS_VSX
+#define PPC_FEATURE_HAS_VSX	0x00000080
+#endif
+#endif
+
+typedef void (*vector_add_fn)(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size);
+
+/*-----------------------------------------------
+ *            Kernels
+ *-----------------------------------------------*/
+
+void cpu_vector_add_scalar(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	for (size_t i = 0; i < vector_size; i++)
+		obuff[i] = ibuff[i] + ibuff[i];
+}
+
+#ifdef CPU_KERNEL_X86
+__attribute__((target("sse4.2")))
+static void vector_add_sse4(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= vector_size; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(ibuff + i));
+		_mm_storeu_si128((__m128i *)(obuff + i), _mm_add_epi32(v, v));
+	}
+	for (; i < vector_size; i++)
+		obuff[i] = ibuff[i] + ibuff[i];
+}
+
+__attribute__((target("avx2")))
+static void vector_add_avx2(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= vector_size; i += 16) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)(ibuff + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(ibuff + i + 8));
+		_mm256_storeu_si256((__m256i *)(obuff + i), _mm256_add_epi32(v0, v0));
+		_mm256_storeu_si256((__m256i *)(obuff + i + 8), _mm256_add_epi32(v1, v1));
+	}
+	for (; i < vector_size; i++)
+		obuff[i] = ibuff[i] + ibuff[i];
+}
+
+__attribute__((target("avx512f")))
+static void vector_add_avx512(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= vector_size; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *)(ibuff + i));
+		_mm512_storeu_si512((void *)(obuff + i), _mm512_add_epi32(v, v));
+	}
+	// masked tail : no scalar loop
+	if (i < vector_size) {
+		__mmask16 m = (__mmask16)((1u << (vector_size - i)) - 1);
+		__m512i v = _mm512_maskz_loadu_epi32(m, ibuff + i);
+		_mm512_mask_storeu_epi32(obuff + i, m, _mm512_add_epi32(v, v));
+	}
+}
+#endif
+
+#ifdef CPU_KERNEL_VSX
+static void vector_add_vsx(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= vector_size; i += 8) {
+		__vector unsigned int v0 = vec_xl(0, (unsigned int *)(ibuff + i));
+		__vector unsigned int v1 = vec_xl(16, (unsigned int *)(ibuff + i));
+		vec_xst(vec_add(v0, v0), 0, (unsigned int *)(obuff + i));
+		vec_xst(vec_add(v1, v1), 16, (unsigned int *)(obuff + i));
+	}
+	for (; i < vector_size; i++)
+		obuff[i] = ibuff[i] + ibuff[i];
+}
+#endif
+
+/*-----------------------------------------------
+ *            Runtime dispatch
+ *-----------------------------------------------*/
+
+static const char *isa_names[CPU_ISA_MAX] = {
+	[CPU_ISA_SCALAR]	= "scalar",
+	[CPU_ISA_SSE4]		= "sse4",
+	[CPU_ISA_AVX2]		= "avx2",
+	[CPU_ISA_AVX512]	= "avx512",
+	[CPU_ISA_VSX]		= "vsx",
+};
+
+static void vector_add_resolve(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size);
+
+static vector_add_fn vector_add_impl = vector_add_resolve;
+static enum cpu_isa selected_isa = CPU_ISA_SCALAR;
+static struct worker_pool *kernel_pool = NULL;
+
+/* Kernel of an instruction set if it is built in and supported by this CPU */
+static vector_add_fn isa_kernel(enum cpu_isa isa)
+{
+	switch (isa) {
+	case CPU_ISA_SCALAR:
+		return cpu_vector_add_scalar;
+#ifdef CPU_KERNEL_X86
+	case CPU_ISA_SSE4:
+		return __builtin_cpu_supports("sse4.2") ? vector_add_sse4 : NULL;
+	case CPU_ISA_AVX2:
+		return __builtin_cpu_supports("avx2") ? vector_add_avx2 : NULL;
+	case CPU_ISA_AVX512:
+		return __builtin_cpu_supports("avx512f") ? vector_add_avx512 : NULL;
+#endif
+#ifdef CPU_KERNEL_VSX
+	case CPU_ISA_VSX:
+		return (getauxval(AT_HWCAP) & PPC_FEATURE_HAS_VSX) ? vector_add_vsx : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+/* Compares a kernel with the scalar reference, tails and misaligned buffers included */
+static int isa_check(vector_add_fn kernel)
+{
+	uint32_t in[67], out[67], ref[67];
+
+	for (size_t i = 0; i < 67; i++)
+		in[i] = (uint32_t)(i * 2654435761u);
+
+	for (size_t offset = 0; offset < 3; offset++) {
+		for (size_t n = 0; n + offset <= 67; n++) {
+			memset(out, 0xA5, sizeof(out));
+			memset(ref, 0xA5, sizeof(ref));
+			kernel(in + offset, out + offset, n);
+			cpu_vector_add_scalar(in + offset, ref + offset, n);
+			if (memcmp(out, ref, sizeof(out)))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+int cpu_kernel_select(const char *isa)
+{
+	vector_add_fn kernel = NULL;
+	int choice = -1;
+
+	if (isa == NULL) {
+		// best supported instruction set
+		for (int i = CPU_ISA_MAX - 1; i >= 0 && kernel == NULL; i--) {
+			kernel = isa_kernel(i);
+			choice = i;
+		}
+	} else {
+		for (int i = 0; i < CPU_ISA_MAX; i++) {
+			if (strcmp(isa, isa_names[i]) == 0)
+				choice = i;
+		}
+		if (choice < 0) {
+			fprintf(stderr, "err: unknown CPU kernel %s\n", isa);
+			return -1;
+		}
+		kernel = isa_kernel(choice);
+		if (kernel == NULL) {
+			fprintf(stderr, "err: CPU kernel %s not supported on this CPU\n", isa);
+			return -1;
+		}
+	}
+
+	if ((choice != CPU_ISA_SCALAR) && isa_check(kernel)) {
+		fprintf(stderr, "warning: CPU kernel %s differs from the scalar reference, "
+				"using scalar\n", isa_names[choice]);
+		kernel = cpu_vector_add_scalar;
+		choice = CPU_ISA_SCALAR;
+	}
+
+	selected_isa = choice;
+	__atomic_store_n(&vector_add_impl, kernel, __ATOMIC_RELEASE);
+	return 0;
+}
+
+const char *cpu_kernel_name(void)
+{
+	return isa_names[selected_isa];
+}
+
+static void vector_add_resolve(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	cpu_kernel_select(NULL);
+	vector_add_impl(ibuff, obuff, vector_size);
+}
+
+/*-----------------------------------------------
+ *            Multi-threaded kernels
+ *-----------------------------------------------*/
+
+/* Config 1 copies the vector in and out around the kernel */
+struct vector_add_job {
+	const uint32_t *copy_in;
+	const uint32_t *ibuff;
+	uint32_t *obuff;
+	uint32_t *copy_out;
+};
+
+/* Each chunk is copied in, computed and copied out while it is hot in cache */
+static void vector_add_chunk(void *arg, size_t begin, size_t end)
+{
+	struct vector_add_job *job = (struct vector_add_job *)arg;
+	size_t bytes = (end - begin)*sizeof(uint32_t);
+
+	if (job->copy_in)
+		memcpy((uint32_t *)job->ibuff + begin, job->copy_in + begin, bytes);
+	vector_add_impl(job->ibuff + begin, job->obuff + begin, end - begin);
+	if (job->copy_out)
+		memcpy(job->copy_out + begin, job->obuff + begin, bytes);
+}
+
+void cpu_kernel_set_pool(struct worker_pool *pool)
+{
+	// resolve before the workers use the kernel
+	if (vector_add_impl == vector_add_resolve)
+		cpu_kernel_select(NULL);
+	kernel_pool = pool;
+}
+
+void cpu_vector_add(const uint32_t *ibuff, uint32_t *obuff, size_t vector_size)
+{
+	struct vector_add_job job = { NULL, ibuff, obuff, NULL };
+
+	if (kernel_pool == NULL) {
+		vector_add_impl(ibuff, obuff, vector_size);
+		return;
+	}
+	worker_pool_run(kernel_pool, vector_add_chunk, &job, vector_size);
+}
+
+/*-----------------------------------------------
+ *            Backend (kernel.cu interface)
+ *-----------------------------------------------*/
+
+static void cpu_memory_allocation(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams)
+{
+	for (int stream = 0; stream < num_streams; stream++) {
+		buffer[stream] = buffer_pool_get(size);
+		if (buffer[stream] == NULL)
+			exit(EXIT_FAILURE);
+	}
+}
+
+static void cpu_init_buffers(uint32_t *buffer[MAX_STREAMS], int vector_size, int num_streams)
+{
+	for (int stream = 0; stream < num_streams; stream++) {
+		for (int i = 0; i < vector_size; i++)
+			buffer[stream][i] = i + 1000 * stream;
+	}
+}
+
+/* Config 1 : same copies as the GPU version around the kernel */
+static void cpu_run_new_stream_v1(uint32_t *bufferA, uint32_t *bufferB,
+		uint32_t *ibuff, uint32_t *obuff, int vector_size)
+{
+	struct vector_add_job job = { bufferA, ibuff, obuff, bufferB };
+
+	if (kernel_pool == NULL) {
+		vector_add_chunk(&job, 0, vector_size);
+		return;
+	}
+	worker_pool_run(kernel_pool, vector_add_chunk, &job, vector_size);
+}
+
+static void cpu_run_new_stream_v2(uint32_t *ibuff, uint32_t *obuff, int vector_size)
+{
+	cpu_vector_add(ibuff, obuff, vector_size);
+}
+
+static void cpu_free(uint32_t *buffer[MAX_STREAMS], int num_streams)
+{
+	for (int stream = 0; stream < num_streams; stream++) {
+		buffer_pool_put(buffer[stream]);
+		buffer[stream] = NULL;
+	}
+}
+
+const struct compute_backend cpu_backend = {
+	.name				= "cpu",
+	.memory_allocation_host		= cpu_memory_allocation,
+	.memory_allocation_device	= cpu_memory_allocation,
+	.init_buffers			= cpu_init_buffers,
+	.run_new_stream_v1		= cpu_run_new_stream_v1,
+	.run_new_stream_v2		= cpu_run_new_stream_v2,
+	.free_host			= cpu_free,
+	.free_device			= cpu_free,
+};
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * DESCRIPTOR RING
+ *
+ * Allocation of the single producer / single consumer ring shared by the
+ * host and the device. Fast path functions are inlined in desc_ring.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <desc_ring.h>
+#include <buffer_pool.h>
+
+struct desc_ring *desc_ring_alloc(uint32_t size)
+{
+	struct desc_ring *ring = NULL;
+	uint32_t entries = 1;
+
+	while (entries < size)
+		entries <<= 1;
+
+	// pool buffers are aligned on their size up to a page
+	ring = buffer_pool_get(sizeof(*ring) + entries*sizeof(struct desc_ring_desc));
+	if (ring == NULL)
+		return NULL;
+
+	ring->size = entries;
+	ring->mask = entries - 1;
+	return ring;
+}
+
+void desc_ring_free(struct desc_ring *ring)
+{
+	buffer_pool_put(ring);
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * DEVICE TIMING MODEL
+ *
+ * Makes the software devices (FPGA emulator of kernel_runner, software
+ * action) as slow as a real link : every transfer gets a deadline computed
+ * from a fixed latency, the bandwidth of each direction and an optional
+ * jitter. The deadline is enforced with clock_nanosleep() for the bulk of
+ * the time and a spin for the last SLEEP_SPIN_NS, so that sub
+ * microsecond models are still accurate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include <device_model.h>
+#include <time_utils.h>
+
+static const char *jitter_names[JITTER_MAX] = {
+	"none", "uniform", "normal", "exp"
+};
+
+void device_model_init(struct device_model *m)
+{
+	memset(m, 0, sizeof(*m));
+	m->spin_ns = SLEEP_SPIN_NS;
+	m->seed = 0x9e3779b97f4a7c15ull;
+}
+
+/* "2.5us", "300ns", "1ms", "0.5s", plain numbers are nanoseconds */
+static int parse_time_ns(const char *s, uint64_t *ns)
+{
+	char *end;
+	double v;
+
+	errno = 0;
+	v = strtod(s, &end);
+	if ((errno != 0) || (end == s) || (v < 0.0))
+		return -1;
+
+	if ((*end == '\0') || !strcmp(end, "ns"))
+		;
+	else if (!strcmp(end, "us"))
+		v *= 1e3;
+	else if (!strcmp(end, "ms"))
+		v *= 1e6;
+	else if (!strcmp(end, "s"))
+		v *= 1e9;
+	else
+		return -1;
+
+	*ns = (uint64_t)(v + 0.5);
+	return 0;
+}
+
+static int parse_gbps(const char *s, double *gbps)
+{
+	char *end;
+
+	errno = 0;
+	*gbps = strtod(s, &end);
+	if ((errno != 0) || (end == s) || (*end != '\0') || (*gbps < 0.0))
+		return -1;
+	return 0;
+}
+
+/* "<distribution>:<time>" */
+static int parse_jitter(const char *s, struct device_model *m)
+{
+	const char *colon = strchr(s, ':');
+	size_t len = colon ? (size_t)(colon - s) : strlen(s);
+
+	for (int i = 0; i < JITTER_MAX; i++) {
+		if ((strlen(jitter_names[i]) == len) && !strncmp(s, jitter_names[i], len)) {
+			m->jitter = (enum device_jitter)i;
+			if (i == JITTER_NONE) {
+				m->jitter_ns = 0;
+				return 0;
+			}
+			return colon ? parse_time_ns(colon + 1, &m->jitter_ns) : -1;
+		}
+	}
+	return -1;
+}
+
+static int parse_item(char *item, struct device_model *m)
+{
+	char *value = strchr(item, '=');
+
+	if (value == NULL) {
+		if (!strcasecmp(item, "ad9v3")) {
+			m->latency_ns = DEVICE_MODEL_AD9V3_LATENCY_NS;
+			m->read_gbps = DEVICE_MODEL_AD9V3_GBPS;
+			m->write_gbps = DEVICE_MODEL_AD9V3_GBPS;
+			return 0;
+		}
+		if (!strcasecmp(item, "none")) {
+			uint64_t seed = m->seed;
+
+			device_model_init(m);
+			m->seed = seed;
+			return 0;
+		}
+		return -1;
+	}
+
+	*value++ = '\0';
+	if (!strcmp(item, "latency"))
+		return parse_time_ns(value, &m->latency_ns);
+	if (!strcmp(item, "process"))
+		return parse_time_ns(value, &m->process_ns);
+	if (!strcmp(item, "spin"))
+		return parse_time_ns(value, &m->spin_ns);
+	if (!strcmp(item, "read"))
+		return parse_gbps(value, &m->read_gbps);
+	if (!strcmp(item, "write"))
+		return parse_gbps(value, &m->write_gbps);
+	if (!strcmp(item, "bw")) {
+		if (parse_gbps(value, &m->read_gbps))
+			return -1;
+		m->write_gbps = m->read_gbps;
+		return 0;
+	}
+	if (!strcmp(item, "jitter"))
+		return parse_jitter(value, m);
+	if (!strcmp(item, "seed")) {
+		char *end;
+
+		m->seed = strtoull(value, &end, 0);
+		return ((end == value) || (*end != '\0')) ? -1 : 0;
+	}
+	return -1;
+}
+
+int device_model_parse(const char *spec, struct device_model *m)
+{
+	char *copy, *item, *saveptr = NULL;
+	int rc = 0;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)) {
+		if (parse_item(item, m)) {
+			rc = -1;
+			break;
+		}
+	}
+	free(copy);
+	return rc;
+}
+
+/* The model is private to one device thread */
+static double uniform01(struct device_model *m)
+{
+	return xorshift_uniform01(&m->seed);
+}
+
+static double jitter_sample_ns(struct device_model *m)
+{
+	double scale = (double)m->jitter_ns, u;
+
+	switch (m->jitter) {
+	case JITTER_UNIFORM:
+		return uniform01(m) * scale;
+	case JITTER_NORMAL:
+		// Box-Muller, the second value is dropped
+		u = uniform01(m);
+		return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * uniform01(m)) * scale;
+	case JITTER_EXP:
+		return -log(1.0 - uniform01(m)) * scale;
+	default:
+		return 0.0;
+	}
+}
+
+uint64_t device_model_transfer_ns(struct device_model *m,
+		uint64_t read_bytes, uint64_t write_bytes)
+{
+	double read_ns = 0.0, write_ns = 0.0, ns;
+
+	// GB/s is bytes per nanosecond
+	if (m->read_gbps > 0.0)
+		read_ns = read_bytes / m->read_gbps;
+	if (m->write_gbps > 0.0)
+		write_ns = write_bytes / m->write_gbps;
+
+	ns = m->latency_ns + m->process_ns + (read_ns > write_ns ? read_ns : write_ns);
+	ns += jitter_sample_ns(m);
+	m->transfers++;
+	return (ns > 0.0) ? (uint64_t)(ns + 0.5) : 0;
+}
+
+void device_model_wait(struct device_model *m, uint64_t deadline_ns)
+{
+	uint64_t now = monotonic_ns();
+
+	if (now >= deadline_ns) {
+		if (now > deadline_ns) {
+			m->late++;
+			m->late_ns += now - deadline_ns;
+		}
+		return;
+	}
+
+	sleep_until_ns(deadline_ns, m->spin_ns);
+}
+
+void device_model_print(const struct device_model *m, FILE *out)
+{
+	fprintf(out, "Device model : latency %.2f us, read %.2f GB/s, write %.2f GB/s, "
+			"process %.2f us, jitter %s",
+			m->latency_ns / 1e3, m->read_gbps, m->write_gbps,
+			m->process_ns / 1e3, jitter_names[m->jitter]);
+	if (m->jitter != JITTER_NONE)
+		fprintf(out, " %.2f us", m->jitter_ns / 1e3);
+	fprintf(out, "\n");
+}
+
+void device_model_report(const struct device_model *m, FILE *out)
+{
+	fprintf(out, "Device model : %llu transfers, %llu slower than modeled",
+			(unsigned long long)m->transfers, (unsigned long long)m->late);
+	if (m->late)
+		fprintf(out, " (%.2f us late on average)", m->late_ns / 1e3 / m->late);
+	fprintf(out, "\n");
+}
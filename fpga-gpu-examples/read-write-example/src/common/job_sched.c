@@ -0,0 +1,438 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * JOB SCHEDULER
+ *
+ * Dispatcher thread between the client submission queues and the single
+ * producer side of the descriptor ring. A queue is a linked list protected
+ * by its mutex : clients append, the dispatcher unlinks the head. Only the
+ * dispatcher removes requests, so it can look at the heads without taking
+ * the locks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include <job_sched.h>
+#include <parse_utils.h>
+#include <time_utils.h>
+#include <trace.h>
+
+/* Polls of an idle dispatcher (or a waiting client) before yielding the CPU */
+#define SCHED_SPIN_POLLS	1000
+
+static const char *policy_names[SCHED_POLICY_MAX] = {
+	[SCHED_FAIR]		= "fair",
+	[SCHED_PRIORITY]	= "priority",
+};
+
+const char *job_sched_policy_name(enum sched_policy policy)
+{
+	if (policy >= SCHED_POLICY_MAX)
+		return "unknown";
+	return policy_names[policy];
+}
+
+/*-----------------------------------------------
+ *            Configuration
+ *-----------------------------------------------*/
+
+void job_sched_config_init(struct job_sched_config *cfg)
+{
+	cfg->policy = SCHED_FAIR;
+	cfg->small_bytes = 0;
+	cfg->depth = SCHED_DEFAULT_DEPTH;
+}
+
+/* "4096", "4k", "1M" */
+static int parse_size32(const char *s, uint32_t *value)
+{
+	uint64_t v;
+
+	if (parse_size(s, &v) || (v > UINT32_MAX))
+		return -1;
+	*value = (uint32_t)v;
+	return 0;
+}
+
+static int parse_item(const char *item, struct job_sched_config *cfg)
+{
+	for (int p = 0; p < SCHED_POLICY_MAX; p++) {
+		if (!strcmp(item, policy_names[p])) {
+			cfg->policy = (enum sched_policy)p;
+			return 0;
+		}
+	}
+	if (!strncmp(item, "small=", 6))
+		return parse_size32(item + 6, &cfg->small_bytes);
+	if (!strncmp(item, "depth=", 6))
+		return (parse_size32(item + 6, &cfg->depth) || (cfg->depth == 0)) ? -1 : 0;
+	return -1;
+}
+
+int job_sched_parse(const char *spec, struct job_sched_config *cfg)
+{
+	char *copy, *item, *saveptr = NULL;
+	int rc = 0;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)) {
+		if (parse_item(item, cfg)) {
+			rc = -1;
+			break;
+		}
+	}
+	free(copy);
+	return rc;
+}
+
+/*-----------------------------------------------
+ *            Client side
+ *-----------------------------------------------*/
+
+static inline struct sched_request *queue_head(struct sched_client *c)
+{
+	return __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+}
+
+void job_sched_submit(struct sched_client *c, struct sched_request *req,
+		const void *src, void *dst, uint32_t length)
+{
+	req->src = src;
+	req->dst = dst;
+	req->length = length;
+	req->status = DESC_STATUS_POSTED;
+	req->done = 0;
+	req->client = c;
+	req->next = NULL;
+	req->submit_ns = monotonic_ns();
+
+	// the request is complete before the dispatcher can see it
+	pthread_mutex_lock(&c->lock);
+	if (c->tail != NULL)
+		__atomic_store_n(&c->tail->next, req, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&c->head, req, __ATOMIC_RELEASE);
+	c->tail = req;
+	pthread_mutex_unlock(&c->lock);
+}
+
+uint32_t job_sched_wait(struct sched_request *req)
+{
+	uint32_t polls = 0;
+
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+		if (++polls > SCHED_SPIN_POLLS)
+			sched_yield();
+		else
+			cpu_relax();
+	}
+	return req->status;
+}
+
+/*-----------------------------------------------
+ *            Policies
+ *-----------------------------------------------*/
+
+static inline bool is_bulk(const struct job_sched *s, const struct sched_request *req)
+{
+	return (s->cfg.small_bytes != 0) && (req->length > s->cfg.small_bytes);
+}
+
+/* Small requests first : oldest head of the next clients up to small_bytes */
+static int pick_small(struct job_sched *s)
+{
+	for (int n = 0; n < s->num_clients; n++) {
+		int i = (s->small_cursor + n) % s->num_clients;
+		struct sched_request *req = queue_head(s->clients[i]);
+
+		if ((req != NULL) && !is_bulk(s, req)) {
+			s->small_cursor = (i + 1) % s->num_clients;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Deficit round robin, the cursor stays on a client while its deficit lasts */
+static int pick_fair(struct job_sched *s, bool bulk_ok)
+{
+	while (1) {
+		bool eligible = false;
+
+		for (int n = 0; n < s->num_clients; n++) {
+			struct sched_client *c = s->clients[s->cursor];
+			struct sched_request *req = queue_head(c);
+
+			if (req == NULL) {
+				// an idle client does not save up credit
+				c->deficit = 0;
+			} else if (bulk_ok || !is_bulk(s, req)) {
+				eligible = true;
+				if (c->deficit >= (int64_t)req->length)
+					return s->cursor;
+				c->deficit += (int64_t)SCHED_QUANTUM * c->weight;
+			}
+			s->cursor = (s->cursor + 1) % s->num_clients;
+		}
+		if (!eligible)
+			return -1;
+	}
+}
+
+/* Lowest priority value first, round robin between equal ones */
+static int pick_priority(struct job_sched *s, bool bulk_ok)
+{
+	int best = -1;
+
+	for (int n = 0; n < s->num_clients; n++) {
+		int i = (s->cursor + n) % s->num_clients;
+		struct sched_request *req = queue_head(s->clients[i]);
+
+		if ((req == NULL) || (!bulk_ok && is_bulk(s, req)))
+			continue;
+		if ((best < 0) || (s->clients[i]->priority < s->clients[best]->priority))
+			best = i;
+	}
+	if (best >= 0)
+		s->cursor = (best + 1) % s->num_clients;
+	return best;
+}
+
+/* Unlinks the head of the client chosen by the policy */
+static struct sched_request *pick(struct job_sched *s)
+{
+	// one descriptor is kept for the small requests
+	bool bulk_ok = (s->cfg.small_bytes == 0) || (s->bulk_in_flight + 1 < s->cfg.depth);
+	struct sched_request *req;
+	struct sched_client *c;
+	bool bypass = false;
+	int i = -1;
+
+	if (s->cfg.small_bytes != 0) {
+		i = pick_small(s);
+		bypass = (i >= 0);
+	}
+	if (i < 0)
+		i = (s->cfg.policy == SCHED_PRIORITY) ? pick_priority(s, bulk_ok) : pick_fair(s, bulk_ok);
+	if (i < 0)
+		return NULL;
+
+	c = s->clients[i];
+	req = queue_head(c);
+	// bypassed requests are still charged : the share does not change
+	c->deficit -= req->length;
+	c->bypassed += bypass;
+
+	pthread_mutex_lock(&c->lock);
+	c->head = req->next;
+	if (c->head == NULL)
+		c->tail = NULL;
+	pthread_mutex_unlock(&c->lock);
+	return req;
+}
+
+/*-----------------------------------------------
+ *            Dispatcher
+ *-----------------------------------------------*/
+
+static void retire(struct job_sched *s, uint64_t sequence)
+{
+	struct sched_request *req = s->in_flight[sequence & s->ring->mask];
+	struct sched_client *c = req->client;
+	uint64_t now = monotonic_ns();
+
+	req->status = desc_ring_status(s->ring, sequence);
+	latency_hist_record(&c->latency, now - req->submit_ns);
+	latency_hist_record(&c->queue, req->post_ns - req->submit_ns);
+	c->completed++;
+	c->bytes += req->length;
+	c->errors += (req->status != DESC_STATUS_DONE);
+	c->last_ns = now;
+	if (is_bulk(s, req))
+		s->bulk_in_flight--;
+	s->in_flight[sequence & s->ring->mask] = NULL;
+
+	// the client may reuse the request from now on
+	__atomic_store_n(&req->done, 1, __ATOMIC_RELEASE);
+}
+
+static bool queues_empty(struct job_sched *s)
+{
+	for (int i = 0; i < s->num_clients; i++) {
+		if (queue_head(s->clients[i]) != NULL)
+			return false;
+	}
+	return true;
+}
+
+static void *dispatcher(void *arg)
+{
+	struct job_sched *s = (struct job_sched *)arg;
+	uint32_t idle = 0;
+
+	trace_thread_start("scheduler");
+	while (1) {
+		uint64_t completed = desc_ring_completed(s->ring);
+		bool busy = false;
+
+		for (; s->retired < completed; s->retired++, busy = true)
+			retire(s, s->retired);
+
+		while (s->posted - s->retired < s->cfg.depth) {
+			struct sched_request *req = pick(s);
+			int64_t sequence;
+
+			if (req == NULL)
+				break;
+			req->post_ns = monotonic_ns();
+			sequence = desc_ring_post(s->ring, req->src, req->dst, req->length);
+			// depth is at most the ring size : never full
+			s->in_flight[sequence & s->ring->mask] = req;
+			s->bulk_in_flight += is_bulk(s, req);
+			s->posted++;
+			trace_instant(TRACE_FLAG_SET, sequence);
+			busy = true;
+		}
+
+		if (busy) {
+			idle = 0;
+			continue;
+		}
+		if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE) && (s->posted == s->retired) &&
+				queues_empty(s))
+			break;
+		if (++idle > SCHED_SPIN_POLLS)
+			sched_yield();
+		else
+			cpu_relax();
+	}
+	return NULL;
+}
+
+struct job_sched *job_sched_create(struct desc_ring *ring, const struct job_sched_config *cfg)
+{
+	struct job_sched *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+	s->in_flight = calloc(ring->size, sizeof(*s->in_flight));
+	if (s->in_flight == NULL) {
+		free(s);
+		return NULL;
+	}
+	s->ring = ring;
+	s->cfg = *cfg;
+	if (s->cfg.depth > ring->size)
+		s->cfg.depth = ring->size;
+	// the bypass needs one descriptor of its own
+	if ((s->cfg.small_bytes != 0) && (s->cfg.depth < 2))
+		s->cfg.depth = 2;
+	return s;
+}
+
+struct sched_client *job_sched_add_client(struct job_sched *s, const char *name,
+		int priority, uint32_t weight)
+{
+	struct sched_client *c;
+
+	if (s->running || (s->num_clients == SCHED_MAX_CLIENTS))
+		return NULL;
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->priority = priority;
+	c->weight = weight ? weight : 1;
+	pthread_mutex_init(&c->lock, NULL);
+	latency_hist_init(&c->latency, "latency");
+	latency_hist_init(&c->queue, "queue");
+	s->clients[s->num_clients++] = c;
+	return c;
+}
+
+int job_sched_start(struct job_sched *s)
+{
+	if (s->num_clients == 0)
+		return -1;
+	s->start_ns = monotonic_ns();
+	if (pthread_create(&s->thread, NULL, dispatcher, s)) {
+		fprintf(stderr, "err: failed to start the scheduler thread\n");
+		return -1;
+	}
+	s->running = 1;
+	return 0;
+}
+
+void job_sched_stop(struct job_sched *s)
+{
+	if (!s->running)
+		return;
+	__atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(s->thread, NULL);
+	s->running = 0;
+}
+
+void job_sched_destroy(struct job_sched *s)
+{
+	if (s == NULL)
+		return;
+	job_sched_stop(s);
+	for (int i = 0; i < s->num_clients; i++) {
+		pthread_mutex_destroy(&s->clients[i]->lock);
+		free(s->clients[i]);
+	}
+	free(s->in_flight);
+	free(s);
+}
+
+void job_sched_report(const struct job_sched *s, FILE *out)
+{
+	fprintf(out, "Scheduler (%s", job_sched_policy_name(s->cfg.policy));
+	if (s->cfg.small_bytes)
+		fprintf(out, ", requests up to %u bytes first", s->cfg.small_bytes);
+	fprintf(out, ", %u in flight) : %llu requests\n", s->cfg.depth,
+			(unsigned long long)s->retired);
+	fprintf(out, "  %-12s %4s %6s %9s %9s %9s %9s %9s %9s %11s %9s\n", "client", "prio",
+			"weight", "requests", "MB", "MB/s", "p50 us", "p99 us", "max us",
+			"queue p99", "bypassed");
+
+	for (int i = 0; i < s->num_clients; i++) {
+		const struct sched_client *c = s->clients[i];
+		uint64_t elapsed = c->last_ns > s->start_ns ? c->last_ns - s->start_ns : 0;
+
+		// MB/s : bytes per usec
+		fprintf(out, "  %-12s %4d %6u %9llu %9.2f %9.1f %9.3f %9.3f %9.3f %11.3f %9llu",
+				c->name, c->priority, c->weight, (unsigned long long)c->completed,
+				c->bytes / 1e6, elapsed ? c->bytes * 1e3 / elapsed : 0.0,
+				latency_hist_percentile(&c->latency, 50.0) / 1e3,
+				latency_hist_percentile(&c->latency, 99.0) / 1e3,
+				c->latency.max_ns / 1e3,
+				latency_hist_percentile(&c->queue, 99.0) / 1e3,
+				(unsigned long long)c->bypassed);
+		if (c->errors)
+			fprintf(out, " (%llu errors)", (unsigned long long)c->errors);
+		fprintf(out, "\n");
+	}
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * LATENCY HISTOGRAM
+ *
+ * Percentile extraction and printing of the log-linear histograms
+ * recorded by the runners. Recording is inlined in latency_histogram.h.
+ */
+
+#include <string.h>
+
+#include <latency_histogram.h>
+
+/* Lowest value stored in bucket b */
+static uint64_t bucket_low(uint32_t b)
+{
+	uint32_t group = b / LATENCY_HIST_SUB_COUNT;
+	uint64_t sub = b % LATENCY_HIST_SUB_COUNT;
+
+	if (group == 0)
+		return sub;
+	return (sub + LATENCY_HIST_SUB_COUNT) << (group - 1);
+}
+
+/* Highest value stored in bucket b */
+static uint64_t bucket_high(uint32_t b)
+{
+	uint32_t group = b / LATENCY_HIST_SUB_COUNT;
+
+	if (group == 0)
+		return bucket_low(b);
+	return bucket_low(b) + (1ull << (group - 1)) - 1;
+}
+
+void latency_hist_init(struct latency_histogram *h, const char *name)
+{
+	h->name = name;
+	latency_hist_reset(h);
+}
+
+void latency_hist_reset(struct latency_histogram *h)
+{
+	memset(h->counts, 0, sizeof(h->counts));
+	h->count = 0;
+	h->sum_ns = 0;
+	h->min_ns = UINT64_MAX;
+	h->max_ns = 0;
+}
+
+void latency_hist_merge(struct latency_histogram *dst, const struct latency_histogram *src)
+{
+	for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+		dst->counts[b] += src->counts[b];
+	dst->count += src->count;
+	dst->sum_ns += src->sum_ns;
+	if (src->min_ns < dst->min_ns)
+		dst->min_ns = src->min_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+}
+
+uint64_t latency_hist_percentile(const struct latency_histogram *h, double p)
+{
+	uint64_t rank, seen = 0;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (uint64_t)((p / 100.0) * (double)h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->count)
+		rank = h->count;
+
+	for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+		seen += h->counts[b];
+		if (seen >= rank) {
+			// a bucket is reported by its highest value, never above the real max
+			uint64_t v = bucket_high(b);
+			return v < h->max_ns ? v : h->max_ns;
+		}
+	}
+	return h->max_ns;
+}
+
+void latency_hist_report(const struct latency_histogram *h, FILE *out)
+{
+	if (h->count == 0) {
+		fprintf(out, "  %-12s: no sample\n", h->name);
+		return;
+	}
+
+	fprintf(out, "  %-12s: %llu samples, mean %.3f, min %.3f, p50 %.3f, p90 %.3f, "
+			"p99 %.3f, p99.9 %.3f, max %.3f usec\n",
+			h->name, (unsigned long long)h->count,
+			(double)h->sum_ns / h->count / 1000.0,
+			h->min_ns / 1000.0,
+			latency_hist_percentile(h, 50.0) / 1000.0,
+			latency_hist_percentile(h, 90.0) / 1000.0,
+			latency_hist_percentile(h, 99.0) / 1000.0,
+			latency_hist_percentile(h, 99.9) / 1000.0,
+			h->max_ns / 1000.0);
+}
+
+void latency_hist_dump(const struct latency_histogram *h, FILE *out)
+{
+	uint64_t seen = 0;
+
+	fprintf(out, "  %s histogram (usec) :\n", h->name);
+	for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+		if (h->counts[b] == 0)
+			continue;
+		seen += h->counts[b];
+		fprintf(out, "    [%12.3f, %12.3f] %10llu  %7.3f %%\n",
+				bucket_low(b) / 1000.0, bucket_high(b) / 1000.0,
+				(unsigned long long)h->counts[b],
+				100.0 * (double)seen / (double)h->count);
+	}
+}
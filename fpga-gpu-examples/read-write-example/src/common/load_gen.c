@@ -0,0 +1,187 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * OPEN LOOP LOAD
+ *
+ * Arrival schedule of the open loop mode of the runners. The schedule is
+ * kept as an offset from the start in double precision, so a constant rate
+ * does not drift with the rounding of every interval. Poisson gaps are drawn
+ * from the same xorshift64* generator as the device model jitter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include <load_gen.h>
+#include <time_utils.h>
+
+static const char *arrival_names[ARRIVAL_MAX] = {
+	[ARRIVAL_CONSTANT]	= "constant",
+	[ARRIVAL_POISSON]	= "poisson",
+};
+
+void load_gen_init(struct load_gen *gen)
+{
+	memset(gen, 0, sizeof(*gen));
+	gen->arrival = ARRIVAL_CONSTANT;
+	gen->seed = 0x9e3779b97f4a7c15ull;
+}
+
+/* "20000", "50k", "1.5M" */
+static int parse_rate(const char *s, double *rate)
+{
+	char *end;
+
+	errno = 0;
+	*rate = strtod(s, &end);
+	if ((errno != 0) || (end == s) || (*rate <= 0.0))
+		return -1;
+	if ((*end == 'k') || (*end == 'M'))
+		*rate *= (*end++ == 'k') ? 1e3 : 1e6;
+	return (*end == '\0') ? 0 : -1;
+}
+
+static int parse_item(const char *item, struct load_gen *gen)
+{
+	for (int i = 0; i < ARRIVAL_MAX; i++) {
+		if (!strcmp(item, arrival_names[i])) {
+			gen->arrival = (enum load_arrival)i;
+			return 0;
+		}
+	}
+	if (!strncmp(item, "seed=", 5)) {
+		char *end;
+
+		gen->seed = strtoull(item + 5, &end, 0);
+		// xorshift never leaves 0
+		return ((end == item + 5) || (*end != '\0') || (gen->seed == 0)) ? -1 : 0;
+	}
+	return parse_rate(item, &gen->rate);
+}
+
+int load_gen_parse(const char *spec, struct load_gen *gen)
+{
+	char *copy, *item, *saveptr = NULL;
+	int rc = 0;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)) {
+		if (parse_item(item, gen)) {
+			rc = -1;
+			break;
+		}
+	}
+	free(copy);
+	return (rc || !load_gen_enabled(gen)) ? -1 : 0;
+}
+
+/* The schedule is drawn by the HOST thread only */
+static double uniform01(struct load_gen *gen)
+{
+	return xorshift_uniform01(&gen->seed);
+}
+
+static double interval_ns(struct load_gen *gen)
+{
+	double mean = 1e9 / gen->rate;
+
+	if (gen->arrival == ARRIVAL_POISSON)
+		return -log(1.0 - uniform01(gen)) * mean;
+	return mean;
+}
+
+void load_gen_start(struct load_gen *gen, uint64_t now)
+{
+	gen->start_ns = now;
+	gen->offset_ns = 0.0;
+	gen->next_ns = now;
+	gen->issued = 0;
+	gen->behind = 0;
+	gen->last_ns = now;
+}
+
+uint64_t load_gen_pop(struct load_gen *gen, struct run_stats *stats, uint64_t now)
+{
+	uint64_t intended = gen->next_ns;
+
+	run_stats_record(stats, PHASE_QUEUE, intended, now);
+	// behind by a whole interval : the runner does not keep up
+	if (now - intended > 1e9 / gen->rate)
+		gen->behind++;
+	gen->issued++;
+
+	gen->offset_ns += interval_ns(gen);
+	gen->next_ns = gen->start_ns + (uint64_t)gen->offset_ns;
+	return intended;
+}
+
+void load_gen_wait(const struct load_gen *gen)
+{
+	sleep_until_ns(gen->next_ns, SLEEP_SPIN_NS);
+}
+
+void load_gen_complete(struct load_gen *gen, struct run_stats *stats,
+		uint64_t intended_ns, uint64_t now)
+{
+	run_stats_record(stats, PHASE_RESPONSE, intended_ns, now);
+	gen->last_ns = now;
+}
+
+void load_gen_print(const struct load_gen *gen, FILE *out)
+{
+	fprintf(out, "Open loop : %s arrivals at %.1f iterations/s (one every %.3f usec)\n",
+			arrival_names[gen->arrival], gen->rate, 1e6 / gen->rate);
+}
+
+static double achieved_rate(const struct load_gen *gen)
+{
+	uint64_t elapsed = gen->last_ns - gen->start_ns;
+
+	return elapsed ? gen->issued * 1e9 / elapsed : 0.0;
+}
+
+void load_gen_report(const struct load_gen *gen, FILE *out)
+{
+	fprintf(out, "Open loop %s : offered %.1f/s, achieved %.1f/s, "
+			"%llu of %llu arrivals issued more than one interval late\n",
+			arrival_names[gen->arrival], gen->rate, achieved_rate(gen),
+			(unsigned long long)gen->behind, (unsigned long long)gen->issued);
+}
+
+void load_gen_summary(const struct load_gen *gen, const struct run_stats *stats, FILE *out)
+{
+	const struct latency_histogram *r = &stats->phase[PHASE_RESPONSE];
+	const struct latency_histogram *q = &stats->phase[PHASE_QUEUE];
+
+	fprintf(out, "LOAD offered=%.1f achieved=%.1f resp_p50_ns=%llu resp_p90_ns=%llu "
+			"resp_p99_ns=%llu resp_p999_ns=%llu resp_max_ns=%llu queue_p99_ns=%llu\n",
+			gen->rate, achieved_rate(gen),
+			(unsigned long long)latency_hist_percentile(r, 50.0),
+			(unsigned long long)latency_hist_percentile(r, 90.0),
+			(unsigned long long)latency_hist_percentile(r, 99.0),
+			(unsigned long long)latency_hist_percentile(r, 99.9),
+			(unsigned long long)r->max_ns,
+			(unsigned long long)latency_hist_percentile(q, 99.0));
+}
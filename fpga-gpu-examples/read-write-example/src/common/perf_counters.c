@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * PERF COUNTERS
+ *
+ * perf_event_open() group of the host thread. There is no glibc wrapper, the
+ * system call is made directly. Values are read with PERF_FORMAT_GROUP :
+ * { nr, time_enabled, time_running, value[nr] }.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <perf_counters.h>
+
+struct counter_event {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+static const struct counter_event events[PERF_COUNTER_MAX] = {
+	[PERF_CYCLES]		= { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]	= { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_LLC_MISSES]	= { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_DTLB_MISSES]	= { "dTLB misses", PERF_TYPE_HW_CACHE,
+				    PERF_COUNT_HW_CACHE_DTLB |
+				    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[PERF_CONTEXT_SWITCHES]	= { "ctx switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+const char *perf_counter_name(enum perf_counter c)
+{
+	if (c >= PERF_COUNTER_MAX)
+		return "unknown";
+	return events[c].name;
+}
+
+static int open_event(const struct counter_event *e, int group_fd, bool user_only)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = e->type;
+	attr.config = e->config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// members follow the leader, which is started once the group is complete
+	attr.disabled = (group_fd == -1);
+	attr.exclude_kernel = user_only;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+int perf_counters_open(struct perf_counters *pc, FILE *out)
+{
+	int err = 0;
+
+	memset(pc, 0, sizeof(*pc));
+	pc->group_fd = -1;
+	for (int c = 0; c < PERF_COUNTER_MAX; c++) {
+		pc->fd[c] = -1;
+		pc->slot[c] = -1;
+	}
+
+	for (int c = 0; c < PERF_COUNTER_MAX; c++) {
+		int fd = open_event(&events[c], pc->group_fd, pc->user_only);
+
+		// perf_event_paranoid >= 2 : only user space may be counted
+		if ((fd < 0) && ((errno == EACCES) || (errno == EPERM)) && !pc->user_only) {
+			pc->user_only = true;
+			fd = open_event(&events[c], pc->group_fd, pc->user_only);
+		}
+		if (fd < 0) {
+			if (err == 0)
+				err = errno;
+			continue;
+		}
+		if (pc->group_fd == -1)
+			pc->group_fd = fd;
+		pc->fd[c] = fd;
+		pc->slot[c] = pc->nr++;
+	}
+
+	if (pc->group_fd == -1) {
+		fprintf(out, "Perf counters : not available (%s), "
+				"check perf_event_paranoid or the container seccomp profile\n",
+				strerror(err));
+		return -1;
+	}
+
+	fprintf(out, "Perf counters : host thread%s,", pc->user_only ? " (user space only)" : "");
+	for (int c = 0; c < PERF_COUNTER_MAX; c++) {
+		fprintf(out, " %s%s", events[c].name, perf_counter_available(pc, c) ? "" : " (n/a)");
+	}
+	fprintf(out, "\n");
+
+	ioctl(pc->group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(pc->group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return 0;
+}
+
+int perf_counters_read(struct perf_counters *pc, struct perf_values *v)
+{
+	uint64_t buf[3 + PERF_COUNTER_MAX];
+	ssize_t len = (3 + pc->nr) * sizeof(uint64_t);
+	double scale = 1.0;
+
+	memset(v, 0, sizeof(*v));
+	if (read(pc->group_fd, buf, len) != len)
+		return -1;
+
+	// group was time shared with other users of the PMU : extrapolate
+	if ((buf[2] != 0) && (buf[2] < buf[1])) {
+		scale = (double)buf[1] / buf[2];
+		pc->multiplexed = true;
+	}
+	for (int c = 0; c < PERF_COUNTER_MAX; c++) {
+		if (pc->slot[c] >= 0)
+			v->count[c] = (uint64_t)(buf[3 + pc->slot[c]] * scale);
+	}
+	return 0;
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+	// members first, the leader holds the group
+	for (int c = PERF_COUNTER_MAX - 1; c >= 0; c--) {
+		if (pc->fd[c] >= 0)
+			close(pc->fd[c]);
+		pc->fd[c] = -1;
+		pc->slot[c] = -1;
+	}
+	pc->group_fd = -1;
+	pc->nr = 0;
+}
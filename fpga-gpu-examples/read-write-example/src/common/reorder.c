@@ -0,0 +1,142 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * REORDER BUFFER
+ *
+ * Completion queue shared by the DMA engines and the reorder buffer of the
+ * host. Entries of the reorder buffer are indexed by sequence & mask : the
+ * engines never claim a descriptor beyond the window, so two transfers in
+ * the buffer never share an entry.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <reorder.h>
+#include <buffer_pool.h>
+#include <time_utils.h>
+
+static uint32_t round_pow2(uint32_t size)
+{
+	uint32_t entries = 1;
+
+	while (entries < size)
+		entries <<= 1;
+	return entries;
+}
+
+struct completion_queue *completion_queue_alloc(uint32_t size)
+{
+	struct completion_queue *cq;
+	uint32_t entries = round_pow2(size);
+
+	// shared with the engines, pool buffers come zeroed
+	cq = buffer_pool_get(sizeof(*cq) + entries*sizeof(struct completion));
+	if (cq == NULL)
+		return NULL;
+
+	cq->size = entries;
+	cq->mask = entries - 1;
+	return cq;
+}
+
+void completion_queue_free(struct completion_queue *cq)
+{
+	buffer_pool_put(cq);
+}
+
+int reorder_init(struct reorder_buf *rob, uint32_t window)
+{
+	memset(rob, 0, sizeof(*rob));
+	if ((window == 0) || (window > REORDER_MAX_WINDOW))
+		return -1;
+
+	rob->window = round_pow2(window);
+	rob->mask = rob->window - 1;
+	rob->entry = calloc(rob->window, sizeof(*rob->entry));
+	return (rob->entry == NULL) ? -1 : 0;
+}
+
+void reorder_free(struct reorder_buf *rob)
+{
+	free(rob->entry);
+	rob->entry = NULL;
+}
+
+int reorder_insert(struct reorder_buf *rob, const struct completion *c, uint64_t now)
+{
+	struct reorder_entry *e = &rob->entry[c->sequence & rob->mask];
+	uint64_t distance = c->sequence - rob->next;
+
+	if ((c->sequence < rob->next) || (distance >= rob->window) || e->valid) {
+		rob->rejected++;
+		return -1;
+	}
+
+	e->status = c->status;
+	e->arrival_ns = now;
+	e->valid = 1;
+	e->ahead = (c->sequence > rob->expected);
+	rob->arrived++;
+	if (e->ahead) {
+		rob->out_of_order++;
+		if (c->sequence - rob->expected > rob->max_distance)
+			rob->max_distance = c->sequence - rob->expected;
+	}
+	while ((rob->expected - rob->next < rob->window) &&
+			rob->entry[rob->expected & rob->mask].valid)
+		rob->expected++;
+	return 0;
+}
+
+bool reorder_release(struct reorder_buf *rob, struct completion_queue *cq,
+		struct desc_ring *ring, uint32_t *status)
+{
+	struct reorder_entry *e = &rob->entry[rob->next & rob->mask];
+	struct completion c;
+
+	while (completion_pop(cq, &c)) {
+		// a completion outside the window is a device bug : dropped and counted
+		reorder_insert(rob, &c, monotonic_ns());
+	}
+	if (!e->valid)
+		return false;
+
+	// held since its arrival while an older transfer was still running
+	if (e->ahead)
+		rob->hold_ns += monotonic_ns() - e->arrival_ns;
+	*status = e->status;
+	e->valid = 0;
+	rob->next++;
+	// the descriptor slot can be posted again
+	desc_ring_retire(ring);
+	return true;
+}
+
+void reorder_report(const struct reorder_buf *rob, FILE *out)
+{
+	fprintf(out, "Reorder buffer (window %u) : %llu completions, %llu out of order "
+			"(%.1f %%), up to %llu ahead, %.3f usec held on average",
+			rob->window, (unsigned long long)rob->arrived,
+			(unsigned long long)rob->out_of_order,
+			rob->arrived ? 100.0 * rob->out_of_order / rob->arrived : 0.0,
+			(unsigned long long)rob->max_distance,
+			rob->out_of_order ? rob->hold_ns / 1e3 / rob->out_of_order : 0.0);
+	if (rob->rejected)
+		fprintf(out, ", %llu outside the window", (unsigned long long)rob->rejected);
+	fprintf(out, "\n");
+}
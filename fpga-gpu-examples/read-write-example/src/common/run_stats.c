@@ -0,0 +1,176 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * RUN STATISTICS
+ *
+ * Per phase latency histograms of the runners main loop, and optionally the
+ * hardware counters of the host thread spent in each phase.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <run_stats.h>
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_ITERATION]	= "iteration",
+	[PHASE_WAIT]		= "wait",
+	[PHASE_COMPUTE]		= "compute",
+	[PHASE_FLAG_UPDATE]	= "flag update",
+	[PHASE_DECODE]		= "decode",
+	[PHASE_ENCODE]		= "encode",
+	[PHASE_QUEUE]		= "queue",
+	[PHASE_RESPONSE]	= "response",
+};
+
+const char *run_phase_name(enum run_phase phase)
+{
+	if (phase >= PHASE_COUNT)
+		return "unknown";
+	return phase_names[phase];
+}
+
+void run_stats_init(struct run_stats *stats)
+{
+	for (int p = 0; p < PHASE_COUNT; p++)
+		latency_hist_init(&stats->phase[p], run_phase_name(p));
+	stats->perf = NULL;
+	memset(stats->perf_phase, 0, sizeof(stats->perf_phase));
+}
+
+int run_stats_enable_perf(struct run_stats *stats, FILE *out)
+{
+	struct perf_counters *pc = malloc(sizeof(*pc));
+
+	if (pc == NULL)
+		return -1;
+	if (perf_counters_open(pc, out)) {
+		free(pc);
+		return -1;
+	}
+	stats->perf = pc;
+	perf_counters_read(pc, &stats->perf_last);
+	stats->perf_begin = stats->perf_last;
+	return 0;
+}
+
+void run_stats_disable_perf(struct run_stats *stats)
+{
+	if (stats->perf == NULL)
+		return;
+	perf_counters_close(stats->perf);
+	free(stats->perf);
+	stats->perf = NULL;
+}
+
+void run_stats_perf_begin(struct run_stats *stats)
+{
+	perf_counters_read(stats->perf, &stats->perf_last);
+	stats->perf_begin = stats->perf_last;
+}
+
+/*
+ * Chained phases count from the previous mark, the iteration from
+ * run_stats_begin()
+ */
+void run_stats_perf_mark(struct run_stats *stats, enum run_phase phase)
+{
+	struct perf_values now;
+	const struct perf_values *from;
+
+	if (perf_counters_read(stats->perf, &now))
+		return;
+	from = (phase == PHASE_ITERATION) ? &stats->perf_begin : &stats->perf_last;
+	for (int c = 0; c < PERF_COUNTER_MAX; c++)
+		stats->perf_phase[phase].count[c] += now.count[c] - from->count[c];
+	stats->perf_last = now;
+}
+
+static void perf_report(const struct run_stats *stats, FILE *out)
+{
+	const struct perf_counters *pc = stats->perf;
+
+	fprintf(out, "Perf counters per phase (host thread, average per phase%s) :\n",
+			pc->multiplexed ? ", multiplexed and scaled" : "");
+	fprintf(out, "  %-12s", "phase");
+	for (int c = 0; c < PERF_COUNTER_MAX; c++)
+		fprintf(out, " %14s", perf_counter_name(c));
+	fprintf(out, " %8s\n", "IPC");
+
+	for (int p = 0; p < PHASE_COUNT; p++) {
+		const struct perf_values *v = &stats->perf_phase[p];
+		uint64_t n = stats->phase[p].count;
+
+		// open loop intervals are recorded without reading the counters
+		if ((n == 0) || (p == PHASE_QUEUE) || (p == PHASE_RESPONSE))
+			continue;
+		fprintf(out, "  %-12s", run_phase_name(p));
+		for (int c = 0; c < PERF_COUNTER_MAX; c++) {
+			if (perf_counter_available(pc, c))
+				fprintf(out, " %14.1f", (double)v->count[c] / n);
+			else
+				fprintf(out, " %14s", "n/a");
+		}
+		if (perf_counter_available(pc, PERF_CYCLES) &&
+				perf_counter_available(pc, PERF_INSTRUCTIONS) &&
+				v->count[PERF_CYCLES])
+			fprintf(out, " %8.2f\n",
+					(double)v->count[PERF_INSTRUCTIONS] / v->count[PERF_CYCLES]);
+		else
+			fprintf(out, " %8s\n", "n/a");
+	}
+}
+
+void run_stats_report(const struct run_stats *stats, FILE *out, bool dump)
+{
+	fprintf(out, "Latency per phase :\n");
+	for (int p = 0; p < PHASE_COUNT; p++) {
+		if (stats->phase[p].count)
+			latency_hist_report(&stats->phase[p], out);
+	}
+	if (stats->perf != NULL)
+		perf_report(stats, out);
+
+	if (!dump)
+		return;
+	for (int p = 0; p < PHASE_COUNT; p++) {
+		if (stats->phase[p].count)
+			latency_hist_dump(&stats->phase[p], out);
+	}
+}
+
+void run_stats_summary(const struct run_stats *stats, FILE *out)
+{
+	const struct latency_histogram *h = &stats->phase[PHASE_ITERATION];
+
+	fprintf(out, "BENCH iterations=%llu mean_ns=%llu min_ns=%llu p50_ns=%llu "
+			"p90_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu\n",
+			(unsigned long long)h->count,
+			(unsigned long long)(h->count ? h->sum_ns / h->count : 0),
+			(unsigned long long)(h->count ? h->min_ns : 0),
+			(unsigned long long)latency_hist_percentile(h, 50.0),
+			(unsigned long long)latency_hist_percentile(h, 90.0),
+			(unsigned long long)latency_hist_percentile(h, 99.0),
+			(unsigned long long)latency_hist_percentile(h, 99.9),
+			(unsigned long long)h->max_ns);
+}
+
+void run_stats_merge(struct run_stats *dst, const struct run_stats *src)
+{
+	for (int p = 0; p < PHASE_COUNT; p++)
+		latency_hist_merge(&dst->phase[p], &src->phase[p]);
+}
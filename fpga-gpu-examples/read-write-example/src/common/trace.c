@@ -0,0 +1,175 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * TRACE
+ *
+ * Per thread event rings and their Chrome trace event JSON export. Host
+ * phases come from run_stats_mark(), device events from the FPGA emulator
+ * and the software action. Buffers come from the buffer pool so that they
+ * are pre-faulted before the first event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <trace.h>
+#include <run_stats.h>
+#include <buffer_pool.h>
+
+bool trace_on = false;
+__thread struct trace_buffer *trace_local = NULL;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buffer *trace_buffers = NULL;
+static uint32_t trace_events = TRACE_DEFAULT_EVENTS;
+static uint32_t trace_threads = 0;
+static uint64_t trace_start_ns = 0;
+
+static const char *event_names[TRACE_EVENT_MAX - TRACE_PHASE_MAX] = {
+	[TRACE_FLAG_SET - TRACE_PHASE_MAX]		= "flag set",
+	[TRACE_DEVICE_TRANSFER - TRACE_PHASE_MAX]	= "transfer",
+	[TRACE_DEVICE_COPY - TRACE_PHASE_MAX]		= "memcpy",
+	[TRACE_DEVICE_MODEL - TRACE_PHASE_MAX]		= "model wait",
+};
+
+static const char *event_name(uint32_t event)
+{
+	if (event < TRACE_PHASE_MAX)
+		return run_phase_name((enum run_phase)event);
+	if (event < TRACE_EVENT_MAX)
+		return event_names[event - TRACE_PHASE_MAX];
+	return "unknown";
+}
+
+int trace_init(uint32_t events)
+{
+	if ((PHASE_COUNT > TRACE_PHASE_MAX) || (events == 0))
+		return -1;
+
+	trace_events = 1;
+	while (trace_events < events)
+		trace_events <<= 1;
+	trace_start_ns = monotonic_ns();
+	__atomic_store_n(&trace_on, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+struct trace_buffer *trace_thread_buffer(void)
+{
+	struct trace_buffer *tb;
+
+	tb = calloc(1, sizeof(*tb));
+	if (tb == NULL)
+		return NULL;
+	tb->records = buffer_pool_get(trace_events * sizeof(struct trace_record));
+	if (tb->records == NULL) {
+		free(tb);
+		return NULL;
+	}
+	tb->mask = trace_events - 1;
+
+	pthread_mutex_lock(&trace_lock);
+	tb->tid = ++trace_threads;
+	snprintf(tb->name, sizeof(tb->name), "thread %u", tb->tid);
+	tb->next = trace_buffers;
+	trace_buffers = tb;
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_local = tb;
+	return tb;
+}
+
+void trace_thread_start(const char *name)
+{
+	struct trace_buffer *tb = trace_local;
+
+	if (!trace_on)
+		return;
+	if ((tb == NULL) && ((tb = trace_thread_buffer()) == NULL))
+		return;
+	snprintf(tb->name, sizeof(tb->name), "%s", name);
+}
+
+int trace_dump(const char *path)
+{
+	unsigned long long written = 0, dropped = 0;
+	bool first = true;
+	FILE *out;
+
+	out = fopen(path, "w");
+	if (out == NULL) {
+		fprintf(stderr, "err: failed to open trace file %s\n", path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	for (struct trace_buffer *tb = trace_buffers; tb != NULL; tb = tb->next) {
+		uint64_t head = __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE);
+		uint64_t count = (head > tb->mask + 1) ? tb->mask + 1 : head;
+
+		fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+				"\"args\": {\"name\": \"%s\"}}", first ? "" : ",\n", tb->tid, tb->name);
+		first = false;
+
+		for (uint64_t i = head - count; i < head; i++) {
+			const struct trace_record *r = &tb->records[i & tb->mask];
+			double ts = (double)(int64_t)(r->ts - trace_start_ns) / 1e3;
+
+			if (r->dur)
+				fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+						"\"dur\": %.3f, \"pid\": 1, \"tid\": %u, \"args\": {\"n\": %llu}}",
+						event_name(r->event), ts, r->dur / 1e3, tb->tid,
+						(unsigned long long)r->arg);
+			else
+				fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+						"\"pid\": 1, \"tid\": %u, \"args\": {\"n\": %llu}}",
+						event_name(r->event), ts, tb->tid, (unsigned long long)r->arg);
+		}
+		written += count;
+		dropped += head - count;
+	}
+	fprintf(out, "\n]}\n");
+	pthread_mutex_unlock(&trace_lock);
+
+	if (fclose(out)) {
+		fprintf(stderr, "err: failed to write trace file %s\n", path);
+		return -1;
+	}
+	printf("Trace : %llu events written to %s", written, path);
+	if (dropped)
+		printf(" (%llu oldest events overwritten, raise the ring size)", dropped);
+	printf("\n");
+	return 0;
+}
+
+void trace_free(void)
+{
+	__atomic_store_n(&trace_on, false, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&trace_lock);
+	while (trace_buffers != NULL) {
+		struct trace_buffer *tb = trace_buffers;
+
+		trace_buffers = tb->next;
+		buffer_pool_put(tb->records);
+		free(tb);
+	}
+	trace_threads = 0;
+	pthread_mutex_unlock(&trace_lock);
+}
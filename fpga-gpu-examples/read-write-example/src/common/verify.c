@@ -0,0 +1,231 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * RESULT VERIFICATION
+ *
+ * Weighted checksums of the kernel input and output, compared with the
+ * closed form of the kernel (C(out) = 2 * C(in)). The SIMD variants keep one
+ * weight per lane and add lanes * VERIFY_WEIGHT to them at every step, so
+ * a checksum costs one multiply and one add per element.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <verify.h>
+#include <time_utils.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERIFY_X86
+#endif
+
+typedef uint32_t (*checksum_fn)(const uint32_t *buff, size_t vector_size);
+
+/*-----------------------------------------------
+ *            Checksums
+ *-----------------------------------------------*/
+
+static inline uint32_t weight(size_t i)
+{
+	return ((uint32_t)i * VERIFY_WEIGHT) | 1;
+}
+
+uint32_t verify_checksum_scalar(const uint32_t *buff, size_t vector_size)
+{
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i < vector_size; i++)
+		sum += buff[i] * weight(i);
+	return sum;
+}
+
+#ifdef VERIFY_X86
+__attribute__((target("sse4.2")))
+static uint32_t checksum_sse4(const uint32_t *buff, size_t vector_size)
+{
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i step = _mm_set1_epi32(4 * VERIFY_WEIGHT);
+	__m128i w = _mm_setr_epi32(0, VERIFY_WEIGHT, 2 * VERIFY_WEIGHT, 3 * VERIFY_WEIGHT);
+	__m128i acc = _mm_setzero_si128();
+	uint32_t lanes[4], sum;
+	size_t i = 0;
+
+	for (; i + 4 <= vector_size; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buff + i));
+		acc = _mm_add_epi32(acc, _mm_mullo_epi32(v, _mm_or_si128(w, one)));
+		w = _mm_add_epi32(w, step);
+	}
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < vector_size; i++)
+		sum += buff[i] * weight(i);
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static uint32_t checksum_avx2(const uint32_t *buff, size_t vector_size)
+{
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i step = _mm256_set1_epi32(8 * VERIFY_WEIGHT);
+	__m256i w = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32(VERIFY_WEIGHT));
+	__m256i acc = _mm256_setzero_si256();
+	uint32_t lanes[8], sum = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= vector_size; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buff + i));
+		acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v, _mm256_or_si256(w, one)));
+		w = _mm256_add_epi32(w, step);
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	for (int l = 0; l < 8; l++)
+		sum += lanes[l];
+	for (; i < vector_size; i++)
+		sum += buff[i] * weight(i);
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static uint32_t checksum_avx512(const uint32_t *buff, size_t vector_size)
+{
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i step = _mm512_set1_epi32(16 * VERIFY_WEIGHT);
+	__m512i w = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(VERIFY_WEIGHT));
+	__m512i acc = _mm512_setzero_si512();
+	size_t i = 0;
+
+	for (; i + 16 <= vector_size; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *)(buff + i));
+		acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(v, _mm512_or_si512(w, one)));
+		w = _mm512_add_epi32(w, step);
+	}
+	// masked tail : the zeroed lanes add nothing
+	if (i < vector_size) {
+		__mmask16 m = (__mmask16)((1u << (vector_size - i)) - 1);
+		__m512i v = _mm512_maskz_loadu_epi32(m, buff + i);
+		acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(v, _mm512_or_si512(w, one)));
+	}
+	return (uint32_t)_mm512_reduce_add_epi32(acc);
+}
+#endif
+
+/*-----------------------------------------------
+ *            Runtime dispatch
+ *-----------------------------------------------*/
+
+static uint32_t checksum_resolve(const uint32_t *buff, size_t vector_size);
+
+static checksum_fn checksum_impl = checksum_resolve;
+static const char *checksum_name = "scalar";
+
+/* Compares a variant with the scalar reference, tails and misaligned buffers included */
+static int checksum_check(checksum_fn fn)
+{
+	uint32_t in[67];
+
+	for (size_t i = 0; i < 67; i++)
+		in[i] = (uint32_t)(i * 2654435761u);
+	for (size_t offset = 0; offset < 3; offset++) {
+		for (size_t n = 0; n + offset <= 67; n++) {
+			if (fn(in + offset, n) != verify_checksum_scalar(in + offset, n))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void checksum_select(void)
+{
+	checksum_fn fn = verify_checksum_scalar;
+	const char *name = "scalar";
+
+#ifdef VERIFY_X86
+	if (__builtin_cpu_supports("avx512f")) {
+		fn = checksum_avx512;
+		name = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		fn = checksum_avx2;
+		name = "avx2";
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		fn = checksum_sse4;
+		name = "sse4";
+	}
+#endif
+	if ((fn != verify_checksum_scalar) && checksum_check(fn)) {
+		fprintf(stderr, "warning: %s checksum differs from the scalar reference, "
+				"using scalar\n", name);
+		fn = verify_checksum_scalar;
+		name = "scalar";
+	}
+	checksum_name = name;
+	__atomic_store_n(&checksum_impl, fn, __ATOMIC_RELEASE);
+}
+
+static uint32_t checksum_resolve(const uint32_t *buff, size_t vector_size)
+{
+	checksum_select();
+	return checksum_impl(buff, vector_size);
+}
+
+uint32_t verify_checksum(const uint32_t *buff, size_t vector_size)
+{
+	return checksum_impl(buff, vector_size);
+}
+
+const char *verify_checksum_name(void)
+{
+	if (checksum_impl == checksum_resolve)
+		checksum_select();
+	return checksum_name;
+}
+
+/*-----------------------------------------------
+ *            Checking
+ *-----------------------------------------------*/
+
+void verify_init(struct verify_stats *v)
+{
+	memset(v, 0, sizeof(*v));
+	// select out of the timed loop
+	verify_checksum_name();
+}
+
+bool verify_vector_add(struct verify_stats *v, const uint32_t *ibuff,
+		const uint32_t *obuff, size_t vector_size, uint64_t iteration)
+{
+	uint64_t start = monotonic_ns();
+	bool ok = verify_checksum(obuff, vector_size) == 2 * verify_checksum(ibuff, vector_size);
+
+	v->checked++;
+	if (!ok && (v->mismatches++ == 0))
+		v->first_mismatch = iteration;
+	v->ns += monotonic_ns() - start;
+	return ok;
+}
+
+void verify_report(const struct verify_stats *v, FILE *out)
+{
+	fprintf(out, "Verify : %llu vectors checked, %llu mismatches",
+			(unsigned long long)v->checked, (unsigned long long)v->mismatches);
+	if (v->mismatches)
+		fprintf(out, " (first at iteration %llu)", (unsigned long long)v->first_mismatch);
+	fprintf(out, ", %s checksum %.3f usec per vector\n", checksum_name,
+			v->checked ? v->ns / 1e3 / v->checked : 0.0);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * WAIT POLICIES
+ *
+ * Strategies used by the host to wait for a completion flag written by the
+ * FPGA (or by a software device). Each policy trades wake-up latency against
+ * host CPU consumption. Statistics are kept to compare them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <wait_policy.h>
+
+static const char *policy_names[WAIT_POLICY_MAX] = {
+	"spin", "yield", "backoff", "block"
+};
+
+/* Doorbell shared by all software devices of the process */
+static uint32_t doorbell_seq = 0;
+static uint32_t doorbell_waiters = 0;
+static uint64_t doorbell_ns = 0;
+
+static long futex(uint32_t *uaddr, int op, uint32_t val,
+		const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+void wait_policy_init(struct wait_policy *wp, enum wait_policy_type type)
+{
+	memset(wp, 0, sizeof(*wp));
+	wp->type = type;
+	wp->spin_limit = 128;
+	wp->backoff_min_ns = 1000;
+	wp->backoff_max_ns = 64000;
+	wp->block_timeout_ns = 50000;
+}
+
+int wait_policy_parse(const char *name, enum wait_policy_type *type)
+{
+	for (int i = 0; i < WAIT_POLICY_MAX; i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			*type = (enum wait_policy_type)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *wait_policy_name(enum wait_policy_type type)
+{
+	return (type < WAIT_POLICY_MAX) ? policy_names[type] : "unknown";
+}
+
+void wait_policy_start(struct wait_policy *wp)
+{
+	wp->run_start_ns = monotonic_ns();
+	wp->run_start_cpu_ns = thread_cpu_ns();
+}
+
+void wait_policy_stop(struct wait_policy *wp)
+{
+	wp->run_ns = monotonic_ns() - wp->run_start_ns;
+	wp->run_cpu_ns = thread_cpu_ns() - wp->run_start_cpu_ns;
+}
+
+void wait_policy_report(const struct wait_policy *wp, FILE *out)
+{
+	fprintf(out, "Wait policy %s : %llu waits, %llu polls, %f usec average wait\n",
+			wait_policy_name(wp->type),
+			(unsigned long long)wp->waits, (unsigned long long)wp->polls,
+			wp->waits ? (double)wp->wait_ns / wp->waits / 1000.0 : 0.0);
+
+	if (wp->wake_samples) {
+		fprintf(out, "  wake-up latency : %f usec average, %f usec max (%llu samples)\n",
+				(double)wp->wake_ns_total / wp->wake_samples / 1000.0,
+				(double)wp->wake_ns_max / 1000.0,
+				(unsigned long long)wp->wake_samples);
+	} else {
+		fprintf(out, "  wake-up latency : n/a (device does not notify the host)\n");
+	}
+
+	if (wp->run_ns) {
+		fprintf(out, "  host CPU        : %.1f %% of one core (%llu usec CPU for %llu usec)\n",
+				100.0 * (double)wp->run_cpu_ns / (double)wp->run_ns,
+				(unsigned long long)(wp->run_cpu_ns / 1000),
+				(unsigned long long)(wp->run_ns / 1000));
+	}
+}
+
+void wait_policy_notify(void)
+{
+	__atomic_store_n(&doorbell_ns, monotonic_ns(), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&doorbell_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&doorbell_waiters, __ATOMIC_SEQ_CST))
+		futex(&doorbell_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+}
+
+void wait_begin(struct wait_policy *wp, struct wait_state *ws)
+{
+	(void)wp;
+	ws->start_ns = monotonic_ns();
+	ws->polls = 0;
+	ws->sleep_ns = 0;
+	ws->start_seq = __atomic_load_n(&doorbell_seq, __ATOMIC_ACQUIRE);
+	ws->seq = ws->start_seq;
+}
+
+void wait_relax(struct wait_policy *wp, struct wait_state *ws)
+{
+	struct timespec ts;
+
+	ws->polls++;
+	if ((wp->type == WAIT_SPIN) || (ws->polls < wp->spin_limit)) {
+		cpu_relax();
+		goto out;
+	}
+
+	switch (wp->type) {
+	case WAIT_SPIN_YIELD:
+		sched_yield();
+		break;
+	case WAIT_BACKOFF:
+		if (ws->sleep_ns == 0)
+			ws->sleep_ns = wp->backoff_min_ns;
+		ts.tv_sec = 0;
+		ts.tv_nsec = ws->sleep_ns;
+		nanosleep(&ts, NULL);
+		if (ws->sleep_ns < wp->backoff_max_ns)
+			ws->sleep_ns *= 2;
+		if (ws->sleep_ns > wp->backoff_max_ns)
+			ws->sleep_ns = wp->backoff_max_ns;
+		break;
+	case WAIT_BLOCK:
+		// returns at once if the device rang since the condition was checked
+		ts.tv_sec = 0;
+		ts.tv_nsec = wp->block_timeout_ns;
+		__atomic_add_fetch(&doorbell_waiters, 1, __ATOMIC_SEQ_CST);
+		futex(&doorbell_seq, FUTEX_WAIT_PRIVATE, ws->seq, &ts);
+		__atomic_sub_fetch(&doorbell_waiters, 1, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		cpu_relax();
+		break;
+	}
+
+out:
+	if (wp->type == WAIT_BLOCK)
+		ws->seq = __atomic_load_n(&doorbell_seq, __ATOMIC_ACQUIRE);
+}
+
+void wait_end(struct wait_policy *wp, struct wait_state *ws)
+{
+	uint64_t now = monotonic_ns();
+
+	wp->waits++;
+	wp->polls += ws->polls;
+	wp->wait_ns += now - ws->start_ns;
+
+	// the device rang during this wait : the last ring is the completion we waited for
+	if (__atomic_load_n(&doorbell_seq, __ATOMIC_ACQUIRE) != ws->start_seq) {
+		uint64_t rang = __atomic_load_n(&doorbell_ns, __ATOMIC_RELAXED);
+		uint64_t latency = (now > rang) ? now - rang : 0;
+
+		wp->wake_samples++;
+		wp->wake_ns_total += latency;
+		if (latency > wp->wake_ns_max)
+			wp->wake_ns_max = latency;
+	}
+}
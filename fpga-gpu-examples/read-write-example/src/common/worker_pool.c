@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * WORKER POOL
+ *
+ * Threads used to split the CPU kernels of large vectors. Workers spin
+ * for a short time waiting for the next job (jobs come once per
+ * iteration) and sleep on a futex when the host loop is idle longer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <worker_pool.h>
+#include <time_utils.h>
+#include <affinity.h>
+
+static long futex(uint32_t *uaddr, int op, uint32_t val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/* Claims chunks until the job is exhausted */
+static void run_chunks(struct worker_pool *pool)
+{
+	size_t chunk;
+
+	while ((chunk = __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED)) < pool->chunks) {
+		size_t begin = chunk * pool->chunk_items;
+		size_t end = begin + pool->chunk_items;
+
+		pool->fn(pool->arg, begin, end < pool->items ? end : pool->items);
+	}
+}
+
+/* Waits until generation moves away from seen, returns the new generation */
+static uint32_t wait_job(struct worker_pool *pool, uint32_t seen)
+{
+	uint64_t start = monotonic_ns();
+	uint32_t polls = 0, gen;
+
+	while ((gen = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE)) == seen) {
+		if ((++polls % 64) || (monotonic_ns() - start < WORKER_POOL_SPIN_NS)) {
+			cpu_relax();
+			continue;
+		}
+		__atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&pool->generation, __ATOMIC_SEQ_CST) == seen)
+			futex(&pool->generation, FUTEX_WAIT_PRIVATE, seen);
+		__atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+	}
+	return gen;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker_pool *pool = (struct worker_pool *)arg;
+	uint32_t seen = 0;
+
+	while (1) {
+		seen = wait_job(pool, seen);
+		if (pool->stop)
+			break;
+		run_chunks(pool);
+		// job fields are not touched anymore by this worker
+		__atomic_add_fetch(&pool->finished, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/* Publishes the job fields written by the caller and wakes the workers up */
+static void publish(struct worker_pool *pool)
+{
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST))
+		futex(&pool->generation, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+struct worker_pool *worker_pool_create(int num_threads, size_t chunk_items)
+{
+	struct worker_pool *pool = NULL;
+
+	if ((num_threads < 1) || (num_threads > WORKER_POOL_MAX_THREADS)) {
+		fprintf(stderr, "err: worker pool size should be between 1 and %d\n",
+				WORKER_POOL_MAX_THREADS);
+		return NULL;
+	}
+
+	if (posix_memalign((void **)&pool, WORKER_POOL_CACHE_LINE, sizeof(*pool)))
+		return NULL;
+	memset(pool, 0, sizeof(*pool));
+	pool->num_threads = num_threads;
+	pool->chunk_items = chunk_items ? chunk_items : WORKER_POOL_DEFAULT_CHUNK;
+
+	// the calling thread is the first member of the pool
+	for (int i = 1; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_main, pool)) {
+			fprintf(stderr, "err: failed to start worker %d\n", i);
+			pool->num_threads = i;
+			worker_pool_destroy(pool);
+			return NULL;
+		}
+		affinity_pin(pool->threads[i], AFFINITY_WORKERS, i - 1);
+	}
+	return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	pool->stop = 1;
+	publish(pool);
+	for (int i = 1; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	free(pool);
+}
+
+void worker_pool_run(struct worker_pool *pool, worker_fn fn, void *arg, size_t items)
+{
+	// not worth waking the workers up for a single chunk
+	if ((pool->num_threads == 1) || (items <= pool->chunk_items)) {
+		fn(arg, 0, items);
+		return;
+	}
+
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->items = items;
+	pool->chunks = (items + pool->chunk_items - 1) / pool->chunk_items;
+	pool->next_chunk = 0;
+	pool->finished = 0;
+	publish(pool);
+
+	run_chunks(pool);
+
+	while (__atomic_load_n(&pool->finished, __ATOMIC_ACQUIRE) != (uint32_t)(pool->num_threads - 1))
+		cpu_relax();
+}
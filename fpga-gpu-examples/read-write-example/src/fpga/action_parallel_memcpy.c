@@ -0,0 +1,467 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software model of the parallel_memcpy action (buffer_switch_action_AD9V3).
+ *
+ * When read_flag[0] is set to 1, the action reads the vector located at the
+ * address stored in read_flag[1..8] into one of its two internal buffers and
+ * sets the flag back to 0. When write_flag[0] is set to 1, it writes the
+ * other internal buffer at the address stored in write_flag[1..8] and sets
+ * the flag back to 0. Reads and writes run concurrently, each flag is
+ * cleared as soon as its own transfer is over. Internal buffers are switched
+ * between each iteration and the action stops after max_iteration
+ * read/writes.
+ *
+ * With PARALLEL_MEMCPY_MODE_RING, the action consumes max_iteration
+ * descriptors from the ring located at job->queue instead of polling the
+ * flags : each descriptor is read from src into an internal buffer and
+ * written back at dst. The host can post many transfers in advance and no
+ * flag round trip is needed between two transfers (software action only).
+ *
+ * With PARALLEL_MEMCPY_MODE_BATCH, job->queue is a table of transfers : the
+ * action goes through the whole table once and stops, so a single start
+ * moves many vectors. The table is fetched at once, the transfers then
+ * stream back to back : with a timing model, the latency is paid once per
+ * table and the link time once per entry.
+ *
+ * With an emulated card DRAM (see include/card_dram.h), inputs are read
+ * through it : an input still resident in the card is not read again from
+ * the host, the timing model only counts its write.
+ *
+ * The software action is as fast as memcpy unless a timing model is given in
+ * the PARALLEL_MEMCPY_MODEL environment variable (e.g. "ad9v3", see
+ * include/device_model.h) : each transfer then lasts as long as on the card.
+ *
+ * The hardware action runs concurrently with the host. To behave the same
+ * way, the software action runs in its own thread so that snap_action_start()
+ * returns immediately (run with SNAP_CONFIG=CPU). The host waits for it with
+ * parallel_memcpy_wait_idle() before tearing down.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <libsnap.h>
+#include <linux/types.h>	/* __be64 */
+#include <asm/byteorder.h>
+
+#include <snap_internal.h>
+#include <snap_tools.h>
+#include <action_create_vector.h>
+#include <desc_ring.h>
+#include <wait_policy.h>
+#include <device_model.h>
+#include <buffer_pool.h>
+#include <trace.h>
+#include <codec.h>
+#include <affinity.h>
+#include <card_dram.h>
+
+/* Copy of the job registers used by the action thread */
+static struct parallel_memcpy_job sw_job;
+static struct device_model sw_model;
+static bool sw_model_ready = false;
+static bool sw_running = false;
+static unsigned int sw_threads = 0;	/* not over yet, see parallel_memcpy_wait_idle() */
+/* Internal buffers, kept from one start to the next */
+static uint32_t *sw_buffer[2];
+static size_t sw_buffer_size = 0;
+
+static int mmio_write32(struct snap_card *card,
+			uint64_t offs, uint32_t data)
+{
+	act_trace("  %s(%p, %llx, %x)\n", __func__, card,
+		  (long long)offs, data);
+	return 0;
+}
+
+static int mmio_read32(struct snap_card *card,
+		       uint64_t offs, uint32_t *data)
+{
+	act_trace("  %s(%p, %llx, %x)\n", __func__, card,
+		  (long long)offs, *data);
+	return 0;
+}
+
+/* Flag byte 0 is written last by the host, address bytes are valid once it is seen */
+static bool flag_is_set(uint8_t *flag)
+{
+	return __atomic_load_n(&flag[0], __ATOMIC_ACQUIRE) == 1;
+}
+
+static void flag_clear(uint8_t *flag)
+{
+	__atomic_store_n(&flag[0], 0, __ATOMIC_RELEASE);
+}
+
+/* Address is stored little endian in bytes 1..8 of the flag */
+static void *flag_addr(const uint8_t *flag)
+{
+	uint64_t addr = 0;
+
+	for (int i = 0; i < (int)sizeof(uint64_t); i++){
+		addr |= (uint64_t)flag[i+1] << 8*i;
+	}
+	return (void *)(unsigned long)addr;
+}
+
+/* Input of a transfer into an internal buffer, returns the bytes read from the host */
+static uint64_t input_read(void *dst, const void *src, uint32_t length)
+{
+	if (!card_dram_enabled()) {
+		memcpy(dst, src, length);
+		return length;
+	}
+	return (card_dram_read(dst, src, length) == CARD_DRAM_HIT) ? 0 : length;
+}
+
+/* One direction of the flags protocol */
+struct flag_side {
+	uint8_t *flag;
+	uint64_t count;		/* transfers completed */
+	bool busy;
+	uint64_t deadline;	/* end of the transfer in flight */
+	uint64_t t0, t1;	/* start and end of its copy */
+};
+
+static void side_start(struct flag_side *side, bool timed, uint64_t read_bytes,
+		       uint64_t write_bytes)
+{
+	uint64_t now;
+
+	side->t1 = trace_begin();
+	trace_complete(TRACE_DEVICE_COPY, side->t0, side->t1, side->count);
+	side->busy = true;
+	if (!timed)
+		return;
+	// the deadline is polled, device_model_wait() would hold the other side
+	side->deadline += device_model_transfer_ns(&sw_model, read_bytes, write_bytes);
+	now = monotonic_ns();
+	if (now > side->deadline) {
+		sw_model.late++;
+		sw_model.late_ns += now - side->deadline;
+	}
+}
+
+/* Clears the flag once the transfer in flight has lasted as long as the model */
+static bool side_finish(struct flag_side *side, bool timed)
+{
+	if (!side->busy || (timed && (monotonic_ns() < side->deadline)))
+		return false;
+	if (timed)
+		trace_end(TRACE_DEVICE_MODEL, side->t1, side->count);
+	side->busy = false;
+	flag_clear(side->flag);
+	wait_policy_notify();
+	trace_end(TRACE_DEVICE_TRANSFER, side->t0, side->count);
+	side->count++;
+	return true;
+}
+
+/*
+ * Flags protocol : max_iteration reads and max_iteration writes with
+ * internal buffer switch. Read i fills buffer[i%2] and write i sends
+ * buffer[(i+1)%2], the vector of read i-1. Both directions of the link run
+ * on their own, each flag is cleared as soon as its transfer is over : a
+ * read only waits for its flag and for write i-1 to have sent its buffer,
+ * a write for its flag and for read i-1.
+ */
+static void run_flags(struct parallel_memcpy_job *js, uint32_t *buffer[2])
+{
+	uint64_t n = js->max_iteration;
+	size_t size = js->vector_size*sizeof(uint32_t);
+	bool timed = device_model_enabled(&sw_model);
+	struct flag_side rd = { .flag = (uint8_t *)(unsigned long)js->read_flag.addr };
+	struct flag_side wr = { .flag = (uint8_t *)(unsigned long)js->write_flag.addr };
+
+	while ((rd.count < n) || (wr.count < n)) {
+		bool progress = false;
+
+		if (!rd.busy && (rd.count < n) && (wr.count >= rd.count) && flag_is_set(rd.flag)) {
+			rd.t0 = trace_begin();
+			rd.deadline = timed ? monotonic_ns() : 0;
+			act_trace("  read %llu %p\n", (unsigned long long)rd.count,
+				  flag_addr(rd.flag));
+			side_start(&rd, timed, input_read(buffer[rd.count%2],
+							  flag_addr(rd.flag), size), 0);
+			progress = true;
+		}
+		if (!wr.busy && (wr.count < n) && (rd.count >= wr.count) && flag_is_set(wr.flag)) {
+			wr.t0 = trace_begin();
+			wr.deadline = timed ? monotonic_ns() : 0;
+			act_trace("  write %llu %p\n", (unsigned long long)wr.count,
+				  flag_addr(wr.flag));
+			memcpy(flag_addr(wr.flag), buffer[(wr.count+1)%2], size);
+			side_start(&wr, timed, 0, size);
+			progress = true;
+		}
+		progress |= side_finish(&rd, timed);
+		progress |= side_finish(&wr, timed);
+		if (!progress)
+			sched_yield();
+	}
+}
+
+/* Descriptor ring : max_iteration transfers through the internal buffers */
+static void run_ring(struct parallel_memcpy_job *js, uint32_t *buffer[2])
+{
+	struct desc_ring *ring = (struct desc_ring *)(unsigned long)js->queue.addr;
+	size_t size = codec_bound(js->vector_size);
+	struct desc_ring_desc *desc;
+	bool timed = device_model_enabled(&sw_model);
+
+	for (uint64_t i = 0; i < js->max_iteration; i++) {
+		uint64_t deadline = 0, read_bytes, t0, t1;
+
+		while ((desc = desc_ring_peek(ring)) == NULL)
+			sched_yield();
+		t0 = trace_begin();
+
+		act_trace("  descriptor %llu src %llx dst %llx length %u\n",
+			  (unsigned long long)desc->sequence,
+			  (unsigned long long)desc->src,
+			  (unsigned long long)desc->dst, desc->length);
+
+		if (desc->length > size) {
+			desc_ring_complete(ring, desc, DESC_STATUS_ERROR);
+			wait_policy_notify();
+			continue;
+		}
+
+		if (timed)
+			deadline = monotonic_ns();
+		read_bytes = input_read(buffer[i%2], (void *)(unsigned long)desc->src,
+					desc->length);
+		if (timed)
+			deadline += device_model_transfer_ns(&sw_model, read_bytes, desc->length);
+		memcpy((void *)(unsigned long)desc->dst, buffer[i%2], desc->length);
+		t1 = trace_begin();
+		trace_complete(TRACE_DEVICE_COPY, t0, t1, desc->sequence);
+		if (timed) {
+			device_model_wait(&sw_model, deadline);
+			trace_end(TRACE_DEVICE_MODEL, t1, desc->sequence);
+		}
+
+		desc_ring_complete(ring, desc, DESC_STATUS_DONE);
+		wait_policy_notify();
+		trace_end(TRACE_DEVICE_TRANSFER, t0, desc->sequence);
+	}
+}
+
+/* Job table : every entry through the internal buffers, done is set by the caller */
+static void run_batch(struct parallel_memcpy_job *js, struct parallel_memcpy_table *table,
+		      uint32_t *buffer[2])
+{
+	size_t size = js->vector_size*sizeof(uint32_t);
+	bool timed = device_model_enabled(&sw_model);
+	uint64_t deadline = 0, read_bytes, t0 = trace_begin(), t1;
+
+	for (uint64_t i = 0; i < table->count; i++) {
+		struct parallel_memcpy_entry *e = &table->entry[i];
+
+		if (e->length > size) {
+			e->status = DESC_STATUS_ERROR;
+			continue;
+		}
+		read_bytes = input_read(buffer[i%2], (void *)(unsigned long)e->src, e->length);
+		if (timed) {
+			uint64_t ns = device_model_transfer_ns(&sw_model, read_bytes, e->length);
+
+			// only the first transfer waits for the link latency
+			if (deadline == 0)
+				deadline = monotonic_ns();
+			else
+				ns = (ns > sw_model.latency_ns) ? ns - sw_model.latency_ns : 0;
+			deadline += ns;
+		}
+		memcpy((void *)(unsigned long)e->dst, buffer[i%2], e->length);
+		e->status = DESC_STATUS_DONE;
+	}
+	t1 = trace_begin();
+	trace_complete(TRACE_DEVICE_COPY, t0, t1, table->count);
+	if (timed) {
+		device_model_wait(&sw_model, deadline);
+		trace_end(TRACE_DEVICE_MODEL, t1, table->count);
+	}
+	trace_end(TRACE_DEVICE_TRANSFER, t0, table->count);
+}
+
+static void *action_thread(void *arg)
+{
+	struct parallel_memcpy_job *js = (struct parallel_memcpy_job *)arg;
+	struct parallel_memcpy_table *table = NULL;
+
+	if (js->mode == PARALLEL_MEMCPY_MODE_BATCH)
+		table = (struct parallel_memcpy_table *)(unsigned long)js->queue.addr;
+
+	affinity_pin(pthread_self(), AFFINITY_DEVICE, 0);
+	trace_thread_start("sw action");
+
+	switch (js->mode) {
+	case PARALLEL_MEMCPY_MODE_RING:
+		run_ring(js, sw_buffer);
+		break;
+	case PARALLEL_MEMCPY_MODE_BATCH:
+		run_batch(js, table, sw_buffer);
+		break;
+	default:
+		run_flags(js, sw_buffer);
+		break;
+	}
+
+	__atomic_store_n(&sw_running, false, __ATOMIC_RELEASE);
+	// the action can be started again as soon as the host sees the table done
+	if (table != NULL) {
+		__atomic_store_n(&table->done, table->count, __ATOMIC_RELEASE);
+		wait_policy_notify();
+	}
+	// last access to anything of the host
+	__atomic_sub_fetch(&sw_threads, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void parallel_memcpy_wait_idle(void)
+{
+	while (__atomic_load_n(&sw_threads, __ATOMIC_ACQUIRE) != 0)
+		sched_yield();
+}
+
+/* Main program of the software action */
+static int action_main(struct snap_sim_action *action,
+		       void *job, unsigned int job_len)
+{
+	struct parallel_memcpy_job *js = (struct parallel_memcpy_job *)job;
+	const char *model_spec = getenv(DEVICE_MODEL_ENV);
+	size_t size = js->vector_size*sizeof(uint32_t);
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	act_trace("%s(%p, %p, %d) vector_size=%llu max_iteration=%llu "
+		  "jobsize %ld bytes\n", __func__, action, job, job_len,
+		  (unsigned long long)js->vector_size,
+		  (unsigned long long)js->max_iteration, sizeof(*js));
+
+	action->job.retc = SNAP_RETC_FAILURE;
+
+	if ((js->mode == PARALLEL_MEMCPY_MODE_RING) && (js->queue.addr == 0)) {
+		fprintf(stderr, "err: descriptor ring mode without a ring\n");
+		return 0;
+	}
+
+	if ((js->mode == PARALLEL_MEMCPY_MODE_BATCH) && (js->queue.addr == 0)) {
+		fprintf(stderr, "err: batch mode without a job table\n");
+		return 0;
+	}
+
+	if (js->vector_size > MAX_SIZE) {
+		fprintf(stderr, "err: vector_size %llu exceeds action buffers (%d)\n",
+			(unsigned long long)js->vector_size, MAX_SIZE);
+		return 0;
+	}
+
+	if (__atomic_load_n(&sw_running, __ATOMIC_ACQUIRE)) {
+		fprintf(stderr, "err: parallel_memcpy action is already running\n");
+		return 0;
+	}
+
+	// once per process : batch jobs start the action again and again
+	if (!sw_model_ready) {
+		device_model_init(&sw_model);
+		if ((model_spec != NULL) && device_model_parse(model_spec, &sw_model)) {
+			fprintf(stderr, "err: invalid %s %s\n", DEVICE_MODEL_ENV, model_spec);
+			return 0;
+		}
+		if (device_model_enabled(&sw_model))
+			device_model_print(&sw_model, stderr);
+		sw_model_ready = true;
+	}
+
+	// descriptors can carry encoded vectors, a bit bigger than raw ones
+	if (js->mode == PARALLEL_MEMCPY_MODE_RING)
+		size = codec_bound(js->vector_size);
+	// taken from the pool of the host process on the first start, out of
+	// the timed loop : batch jobs start the action once per table
+	if (size > sw_buffer_size) {
+		buffer_pool_put(sw_buffer[0]);
+		buffer_pool_put(sw_buffer[1]);
+		sw_buffer[0] = buffer_pool_get(size);
+		sw_buffer[1] = buffer_pool_get(size);
+		if ((sw_buffer[0] == NULL) || (sw_buffer[1] == NULL)) {
+			fprintf(stderr, "err: parallel_memcpy action failed to allocate "
+					"its internal buffers\n");
+			buffer_pool_put(sw_buffer[0]);
+			buffer_pool_put(sw_buffer[1]);
+			sw_buffer[0] = sw_buffer[1] = NULL;
+			sw_buffer_size = 0;
+			return 0;
+		}
+		sw_buffer_size = size;
+	}
+
+	// job registers can be rewritten by the host once the action is started
+	memcpy(&sw_job, js, sizeof(sw_job));
+	__atomic_store_n(&sw_running, true, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&sw_threads, 1, __ATOMIC_RELEASE);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, &action_thread, &sw_job)) {
+		fprintf(stderr, "err: failed to start parallel_memcpy action thread\n");
+		__atomic_store_n(&sw_running, false, __ATOMIC_RELEASE);
+		__atomic_sub_fetch(&sw_threads, 1, __ATOMIC_RELEASE);
+		pthread_attr_destroy(&attr);
+		return 0;
+	}
+	pthread_attr_destroy(&attr);
+
+	// update the return code to the SNAP job manager
+	action->job.retc = SNAP_RETC_SUCCESS;
+	return 0;
+}
+
+/* This is the switch call when software action is called */
+/* NO CHANGE TO BE APPLIED BELOW OTHER THAN ADAPTING THE ACTION_TYPE NAME */
+static struct snap_sim_action action = {
+	.vendor_id = SNAP_VENDOR_ID_ANY,
+	.device_id = SNAP_DEVICE_ID_ANY,
+	.action_type = PARALLEL_MEMCPY_ACTION_TYPE, // Adapt with your ACTION NAME
+
+	.job = { .retc = SNAP_RETC_FAILURE, },
+	.state = ACTION_IDLE,
+	.main = action_main,
+	.priv_data = NULL,	/* this is passed back as void *card */
+	.mmio_write32 = mmio_write32,
+	.mmio_read32 = mmio_read32,
+
+	.next = NULL,
+};
+
+static void _init(void) __attribute__((constructor));
+
+static void _init(void)
+{
+	snap_action_register(&action);
+}
@@ -41,6 +41,14 @@
 #include <action_create_vector.h>
 #include <snap_hls_if.h>
 
+#include <wait_policy.h>
+#include <run_stats.h>
+#include <cpu_kernel.h>
+#include <worker_pool.h>
+#include <buffer_pool.h>
+#include <verify.h>
+#include <affinity.h>
+
 // Function that fills the MMIO registers / data structure 
 // these are all data exchanged between the application and the action
 static void snap_prepare_parallel_memcpy(struct snap_job *cjob,
@@ -77,8 +85,9 @@ static void update_flag(uint8_t **flag, uint8_t flag_value, uint64_t addr){
 	for (int i = 0; i < (int)sizeof(uint64_t); i++){
 		(*flag)[i+1] = (addr >> 8*i) & 0xFF;
 	}
-	(*flag)[0] = (uint8_t)flag_value;
-
+	// address must be visible before the action sees the flag
+	__atomic_store_n(&(*flag)[0], (uint8_t)flag_value, __ATOMIC_RELEASE);
+	trace_instant(TRACE_FLAG_SET, addr);
 }
 
 static void usage(const char *prog)
@@ -86,15 +95,33 @@ static void usage(const char *prog)
 	printf("\n Usage: %s [-h] [-v, --verbose]\n"
 		"  -s, --vector_size <N>     	size of the uint32_t buffer array.\n"
 		"  -n, --num_iteration <N>   	number of iterations in a run.\n"
+		"  -W, --wait_policy <name>  	how to wait for the FPGA : spin, yield (default), backoff or block.\n"
+		"  -L, --latency_dump        	print the latency histograms of every phase.\n"
+		"  -e, --perf_counters       	count cycles, instructions, cache and TLB misses per phase.\n"
+		"  -X, --verify              	check every result with a checksum, without printing in the loop.\n"
+		"  -c, --compute <name>      	cpu (best SIMD kernel, default) or cpu:<isa> with isa scalar, sse4, avx2, avx512 or vsx.\n"
+		"  -t, --threads <N>         	threads computing each vector with the cpu backend (1 to %d, default is 1).\n"
+		"  -k, --chunk_size <N>      	elements computed by a thread at a time (default is %d).\n"
+		"  -P, --buffer_pool <spec>  	buffer pool pages and options : thp (default), 2m, 1g,\n"
+		"                            	mlock, prefault (default) or noprefault (comma separated).\n"
+		"  -A, --affinity <item>     	pin threads, bind buffers : host=, device=, workers= with a cpu list,\n"
+		"                            	near or node<N>, mem=near|node<N>, device_node=<N>, auto (repeatable).\n"
+		"  -T, --trace <file>        	write a Chrome trace of the host and device threads.\n"
+		"  -B, --bench_output        	print a machine readable summary line (used by bench_sweep).\n"
 		"\n"
 		"WARNING ! This code only works with vector_size < 131072 \n"
 		"because of FPGA in-memory limitations on this version of the image).\n"
 		"\n"
+		"Useful parameters (to be placed before the command):\n"
+		"----------------------------------------------------\n"
+		"SNAP_CONFIG=FPGA hardware execution   (default mode)\n"
+		"SNAP_CONFIG=CPU  software execution\n"
+		"\n"
 		"Example usage:\n"
 		"-----------------------\n"
 		"action_runner -s 1024 -n 10 -v\n"
 		"\n",
-		prog);
+		prog, WORKER_POOL_MAX_THREADS, WORKER_POOL_DEFAULT_CHUNK);
 }
 
 
@@ -109,6 +136,17 @@ static void usage(const char *prog)
  * Options that can be set using command line:
  * 	- n : Number of iterations
  * 	- s : Size of the uint32_t buffer array
+ * 	- W : Wait policy used to poll the FPGA flags
+ * 	- L : Print the latency histograms of every phase
+ * 	- e : Hardware performance counters per phase
+ * 	- X : Check every result with a checksum (no output in the loop)
+ * 	- c : CPU kernel used to compute the result (cpu or cpu:<isa>)
+ * 	- t : Threads of the cpu kernel
+ * 	- k : Chunk size (elements) of the cpu kernel threads
+ * 	- P : Buffer pool configuration (huge pages, mlock, prefault)
+ * 	- T : Chrome trace file of the host and device events
+ * 	- A : Thread and buffer placement (CPUs, NUMA node), repeatable
+ * 	- B : Print a machine readable summary line (bench_sweep)
  * 	- v : Enable verbosity (for results checking)
  *
  * WARNING ! This code only works with vector_size < 131072
@@ -127,6 +165,17 @@ int main(int argc, char *argv[])
 	struct parallel_memcpy_job mjob;
 	const char *num_iteration = NULL;
 	const char *in_size = NULL;
+	const char *wait_policy = NULL;
+	const char *compute_name = NULL;
+	const char *threads_arg = NULL, *chunk_arg = NULL;
+	const char *buffer_pool_arg = NULL, *trace_path = NULL;
+	struct buffer_pool_config buffer_cfg;
+	struct affinity_config affinity_cfg;
+	int num_threads = 1;
+	long chunk_size = WORKER_POOL_DEFAULT_CHUNK;
+	struct worker_pool *pool = NULL;
+	struct wait_policy wait;
+	enum wait_policy_type wait_type = WAIT_SPIN_YIELD;
 	uint32_t *bufferA;
 	uint32_t *bufferB;
 	uint64_t addr_read = 0x0ull;
@@ -138,23 +187,39 @@ int main(int argc, char *argv[])
 	unsigned long long int lcltime = 0x0ull;
 	uint32_t type = SNAP_ADDRTYPE_HOST_DRAM;
 	int max_iteration = 0, vector_size = 0;
-	bool verbose = false;
-	//int flags[MAX_STREAMS] = {1};
+	bool verbose = false, latency_dump = false, perf_counters = false, verify = false, bench_output = false;
+	struct run_stats stats;
+	struct verify_stats check;
+	uint64_t iteration_start = 0, t = 0;
 	int exit_code = EXIT_SUCCESS;
 	snap_action_flag_t action_irq = (SNAP_ACTION_DONE_IRQ | SNAP_ATTACH_IRQ);
 
+	// -A can be repeated
+	affinity_config_init(&affinity_cfg);
+
 	// collecting the command line arguments
 	while (1) {
 		int option_index = 0;
 		static struct option long_options[] = {
 			{ "vector_size",	 required_argument, NULL, 's' },
 			{ "num_iteration",	 required_argument, NULL, 'n' },
+			{ "wait_policy",	 required_argument, NULL, 'W' },
+			{ "latency_dump",	 no_argument, NULL, 'L' },
+			{ "perf_counters",	 no_argument, NULL, 'e' },
+			{ "verify",	 no_argument, NULL, 'X' },
+			{ "bench_output",	 no_argument, NULL, 'B' },
+			{ "compute",	 required_argument, NULL, 'c' },
+			{ "threads",	 required_argument, NULL, 't' },
+			{ "chunk_size",	 required_argument, NULL, 'k' },
+			{ "buffer_pool",	 required_argument, NULL, 'P' },
+			{ "trace",	 required_argument, NULL, 'T' },
+			{ "affinity",	 required_argument, NULL, 'A' },
 			{ "verbose",	 no_argument, NULL, 'v' },
 			{ "help", no_argument, NULL, 'h' },
 			{ 0, no_argument, NULL, 0 },};		
 
 		ch = getopt_long(argc, argv,
-				"s:n:vh",
+				"s:n:W:LeXBc:t:k:P:T:A:vh",
 				long_options, &option_index);
 		if (ch == -1)
 			break;
@@ -167,6 +232,42 @@ int main(int argc, char *argv[])
 			case 'n':
 				num_iteration = optarg;
 				break;
+			case 'W':
+				wait_policy = optarg;
+				break;
+			case 'L':
+				latency_dump = true;
+				break;
+			case 'e':
+				perf_counters = true;
+				break;
+			case 'X':
+				verify = true;
+				break;
+			case 'B':
+				bench_output = true;
+				break;
+			case 'c':
+				compute_name = optarg;
+				break;
+			case 't':
+				threads_arg = optarg;
+				break;
+			case 'k':
+				chunk_arg = optarg;
+				break;
+			case 'P':
+				buffer_pool_arg = optarg;
+				break;
+			case 'T':
+				trace_path = optarg;
+				break;
+			case 'A':
+				if (affinity_parse(optarg, &affinity_cfg)){
+					printf("Invalid affinity %s \n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'v':
 				verbose = true;
 				break;		
@@ -207,23 +308,86 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (threads_arg != NULL) {
+		num_threads = atoi(threads_arg);
+		if ((num_threads < 1) || (num_threads > WORKER_POOL_MAX_THREADS)){
+			printf("Number of threads should be between 1 and %d \n",WORKER_POOL_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (chunk_arg != NULL) {
+		chunk_size = atol(chunk_arg);
+		if (chunk_size <= 0){
+			printf("Chunk size should be superior to 0\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	buffer_pool_config_init(&buffer_cfg);
+	if ((buffer_pool_arg != NULL) && buffer_pool_parse(buffer_pool_arg, &buffer_cfg)){
+		printf("Invalid buffer pool configuration %s \n",buffer_pool_arg);
+		exit(EXIT_FAILURE);
+	}
+	// before the first buffer : the pool is bound to the node, or first
+	// touched from the pinned HOST thread
+	if (affinity_init(&affinity_cfg)){
+		exit(EXIT_FAILURE);
+	}
+	buffer_cfg.numa_node = affinity_numa_node();
+	buffer_pool_init(&buffer_cfg);
+
+	if (trace_path != NULL){
+		trace_init(TRACE_DEFAULT_EVENTS);
+		trace_thread_start("host");
+	}
+
+	if ((wait_policy != NULL) && wait_policy_parse(wait_policy, &wait_type)){
+		printf("Unknown wait policy %s \n",wait_policy);
+		exit(EXIT_FAILURE);
+	}
+	wait_policy_init(&wait, wait_type);
+	run_stats_init(&stats);
+	// counters are optional : the run goes on without them
+	if (perf_counters){
+		run_stats_enable_perf(&stats, stdout);
+	}
+	verify_init(&check);
+
+	if ((compute_name != NULL) && strcmp(compute_name, "cpu") &&
+			strncmp(compute_name, "cpu:", 4)){
+		printf("Unknown compute backend %s \n",compute_name);
+		exit(EXIT_FAILURE);
+	}
+	if (cpu_kernel_select((compute_name && compute_name[3] == ':') ? compute_name + 4 : NULL)){
+		exit(EXIT_FAILURE);
+	}
+	if (num_threads > 1){
+		pool = worker_pool_create(num_threads, chunk_size);
+		if (pool == NULL){
+			exit(EXIT_FAILURE);
+		}
+		cpu_kernel_set_pool(pool);
+	}
 
 	size_t size = vector_size*sizeof(uint32_t);
 
-	bufferA = snap_malloc(size);
-	bufferB = snap_malloc(size);
-	memset(bufferA, 0x0, size);
-	memset(bufferB, 0x0, size);	
+	bufferA = buffer_pool_get(size);
+	bufferB = buffer_pool_get(size);
+	if ((bufferA == NULL) || (bufferB == NULL)){
+		goto out_error;
+	}
 
 	for (int i = 0; i < vector_size; i++){
 		bufferB[i] = i;
 	}
 
 
-	write_flag = snap_malloc(64);
-	read_flag = snap_malloc(64);
-	memset(write_flag, 0x0, 64);
-	memset(read_flag, 0x0, 64);	
+	write_flag = buffer_pool_get(64);
+	read_flag = buffer_pool_get(64);
+	if ((write_flag == NULL) || (read_flag == NULL)){
+		goto out_error;
+	}
 
 	addr_read = (unsigned long)bufferB;
 	addr_write = (unsigned long)bufferA;
@@ -234,11 +398,12 @@ int main(int argc, char *argv[])
 	printf("PARAMETERS:\n"
 			"  vector_size:      %d\n"
 			"  max_iteration:    %d\n"
+			"  cpu kernel:       %s\n"
 			"  addr_read:        %016llx\n"
 			"  addr_write:       %016llx\n"
 			"  addr_read_flag:   %016llx\n"
 			"  addr_write_flag:  %016llx\n",
-			vector_size, max_iteration,
+			vector_size, max_iteration, cpu_kernel_name(),
 			(long long)addr_read,(long long)addr_write,
 			(long long)addr_read_flag,(long long)addr_write_flag); 
 
@@ -294,6 +459,7 @@ int main(int argc, char *argv[])
 	update_flag(&write_flag, 1, addr_write);
 
 	gettimeofday(&begin_time, NULL);
+	wait_policy_start(&wait);
 
 
 	/////////////////////////////////////////////////////////////////////////
@@ -302,21 +468,27 @@ int main(int argc, char *argv[])
 
 
 	for (int iteration = 0; iteration < max_iteration; iteration++){
+		iteration_start = t = run_stats_begin(&stats);
 
 		//FPGA is writing data in buffer
-		while((read_flag[0] == 1) || (write_flag[0] == 1)){ 
-			sleep(0.000002);
-		}
+		wait_until(&wait,
+				(__atomic_load_n(&read_flag[0], __ATOMIC_ACQUIRE) != 1) &&
+				(__atomic_load_n(&write_flag[0], __ATOMIC_ACQUIRE) != 1));
+		t = run_stats_mark(&stats, PHASE_WAIT, t);
 
-		for (int i = 0; i<vector_size; i++){
-			bufferB[i] = 2*bufferA[i];
-		}
+		cpu_vector_add(bufferA, bufferB, vector_size);
 
 		if (verbose){
 			printf("Writting : [%d,%d, ... ,%d]\n",bufferA[0],bufferA[1],bufferA[vector_size-1]); 
 			printf("Received : [%d,%d, ... ,%d]\n",bufferB[0],bufferB[1],bufferB[vector_size-1]); 
 		}
+		t = run_stats_mark(&stats, PHASE_COMPUTE, t);
 
+		// out of the phases, only the iteration includes it
+		if (verify){
+			verify_vector_add(&check, bufferA, bufferB, vector_size, iteration);
+			t = monotonic_ns();
+		}
 
 		addr_read = (unsigned long)bufferB;
 		addr_write = (unsigned long)bufferA;
@@ -324,11 +496,14 @@ int main(int argc, char *argv[])
 		// FPGA can write new data	
 		update_flag(&read_flag, 1, addr_read);
 		update_flag(&write_flag, 1, addr_write);
+		run_stats_mark(&stats, PHASE_FLAG_UPDATE, t);
 
+		run_stats_mark(&stats, PHASE_ITERATION, iteration_start);
 	}
 
 
 	gettimeofday(&end_time, NULL);
+	wait_policy_stop(&wait);
 
 	switch(cjob.retc) {
 		case SNAP_RETC_SUCCESS:
@@ -353,23 +528,41 @@ int main(int argc, char *argv[])
 	lcltime = (long long)(timediff_usec(&end_time, &begin_time));
 	fprintf(stdout, "SNAP action average processing time for %u iteration is %f usec\n",
 			max_iteration, (float)lcltime/(float)(max_iteration));
+	run_stats_report(&stats, stdout, latency_dump);
+	if (bench_output){
+		run_stats_summary(&stats, stdout);
+	}
+	run_stats_disable_perf(&stats);
+	if (verify){
+		verify_report(&check, stdout);
+	}
+	wait_policy_report(&wait, stdout);
 
 	// Detach action + disallocate the card
 	snap_detach_action(action);
 	snap_card_free(card);
 
-	free(bufferA);
-	free(bufferB);
-	free(read_flag);
-	free(write_flag);
+	affinity_report(bufferA, stdout);
+	buffer_pool_put(bufferA);
+	buffer_pool_put(bufferB);
+	buffer_pool_put(read_flag);
+	buffer_pool_put(write_flag);
+	if (trace_path != NULL){
+		trace_dump(trace_path);
+	}
+	trace_free();
+	buffer_pool_report(stdout);
+	buffer_pool_destroy();
+	cpu_kernel_set_pool(NULL);
+	worker_pool_destroy(pool);
 	exit(exit_code);
 
 out_error1:
 	snap_card_free(card);
 out_error:
-	__free(bufferA);
-	__free(bufferB);
-	__free(read_flag);
-	__free(write_flag);
+	trace_free();
+	buffer_pool_destroy();
+	cpu_kernel_set_pool(NULL);
+	worker_pool_destroy(pool);
 	exit(EXIT_FAILURE);
 }
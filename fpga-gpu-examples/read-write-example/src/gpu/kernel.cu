@@ -33,12 +33,12 @@ __global__ void vector_add(uint32_t *ibuff, uint32_t *obuff, const int vector_si
 	}
 }
 
-void memory_allocation_gpu(uint32_t *buffer[MAX_STREAMS], size_t size){
+void memory_allocation_gpu(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams){
 	int result=0, device_id=0;
 
 	printf("Memory allocation GPU\n");
 	cudaDeviceGetAttribute (&result, cudaDevAttrConcurrentManagedAccess, device_id);
-	for (int stream = 0; stream < MAX_STREAMS; stream++){
+	for (int stream = 0; stream < num_streams; stream++){
 		checkCuda(cudaMallocManaged(&buffer[stream],size));
 		if (result) {
 			checkCuda(cudaMemAdvise(buffer[stream],size,cudaMemAdviseSetPreferredLocation,device_id));
@@ -47,17 +47,22 @@ void memory_allocation_gpu(uint32_t *buffer[MAX_STREAMS], size_t size){
 	}
 }
 
-void memory_allocation_host(uint32_t *buffer[MAX_STREAMS], size_t size){
+// Host buffers come from the buffer pool and are pinned for the GPU DMA
+void memory_allocation_host(uint32_t *buffer[MAX_STREAMS], size_t size, int num_streams){
 
-	for (int stream = 0; stream < MAX_STREAMS; stream++){
-		checkCuda(cudaHostAlloc(&buffer[stream], size, cudaHostAllocDefault));
+	for (int stream = 0; stream < num_streams; stream++){
+		buffer[stream] = (uint32_t *)buffer_pool_get_pages(size);
+		if (buffer[stream] == NULL){
+			exit(EXIT_FAILURE);
+		}
+		checkCuda(cudaHostRegister(buffer[stream], size, cudaHostRegisterDefault));
 	}
 }
 
-void init_buffers(uint32_t *buffer[MAX_STREAMS], int vector_size){
+void init_buffers(uint32_t *buffer[MAX_STREAMS], int vector_size, int num_streams){
 	int numBlocks, numThreadsPerBlock = 1024;
 	cudaDeviceGetAttribute(&numBlocks, cudaDevAttrMultiProcessorCount, 0);	
-	for (int stream = 0; stream < MAX_STREAMS; stream++){
+	for (int stream = 0; stream < num_streams; stream++){
 		init_data<<<4*numBlocks, numThreadsPerBlock>>>(buffer[stream],vector_size, stream);
 	}
 	cudaDeviceSynchronize();
@@ -94,14 +99,26 @@ void run_new_stream_v3(uint32_t *ibuff, uint32_t *obuff, int vector_size, int st
 }
 
 
-void free_host(uint32_t *buffer[MAX_STREAMS]){
-	for (int i = 0; i < MAX_STREAMS; i++){
-		cudaFreeHost(buffer[i]);
+void free_host(uint32_t *buffer[MAX_STREAMS], int num_streams){
+	for (int i = 0; i < num_streams; i++){
+		cudaHostUnregister(buffer[i]);
+		buffer_pool_put(buffer[i]);
 	}
 }
 
-void free_device(uint32_t *buffer[MAX_STREAMS]){
-	for (int i = 0; i < MAX_STREAMS; i++){
+void free_device(uint32_t *buffer[MAX_STREAMS], int num_streams){
+	for (int i = 0; i < num_streams; i++){
 		cudaFree(buffer[i]);
 	}
 }
+
+const struct compute_backend gpu_backend = {
+	"gpu",
+	memory_allocation_host,
+	memory_allocation_gpu,
+	init_buffers,
+	run_new_stream_v1,
+	run_new_stream_v2,
+	free_host,
+	free_device,
+};
@@ -1,57 +1,1037 @@
 #include <kernel.h>
+#include <wait_policy.h>
+#include <desc_ring.h>
+#include <run_stats.h>
+#include <worker_pool.h>
+#include <device_model.h>
+#include <verify.h>
+#include <codec.h>
+#include <affinity.h>
+#include <load_gen.h>
+#include <job_sched.h>
+#include <reorder.h>
 
-uint32_t *bufferA[MAX_STREAMS], *bufferB[MAX_STREAMS];
-uint32_t *addr_read, *addr_write;
-int flags[MAX_STREAMS] = {1};
-int max_iteration = 0;
-int vector_size = 0;
-pthread_mutex_t lock;
+/* Emulated devices of one process (-D), each with its own host pipeline */
+#define MAX_DEVICES 16
+/* DMA engines of one emulated device (-E) */
+#define MAX_DMA_ENGINES 8
 
-void *fpga_emulator(void *sleep_time);
+struct pipeline;
+
+/* One DMA engine of the emulator, with its own internal buffer and model draws */
+struct dma_engine {
+	struct pipeline *p;
+	int id;
+	char name[48];			/* trace thread */
+	struct device_model model;
+	uint32_t *buffer;		/* internal buffer */
+	uint64_t transfers;
+	pthread_t thread;
+};
+
+/*
+ * Emulated FPGA and the host pipeline driving it. The emulator thread and
+ * the host loop only share this context, so several devices can run side
+ * by side in one process.
+ *
+ * A slot is handed over with its flag : the host sets it (release) once the
+ * slot input is written, the emulator clears it (release) once the output
+ * is written, and each side reads it with acquire before using the buffers.
+ */
+struct pipeline {
+	int device;
+	char host_name[32], device_name[32];	/* trace threads */
+
+	/* configuration */
+	int vector_size;
+	int num_streams;
+	int max_iteration;
+	bool host_buffering, fpga_emulation, verbose, verify, perf_counters;
+	const struct compute_backend *compute;
+	struct device_model model;
+	struct load_gen load;
+
+	/* buffers */
+	uint32_t *ibuff[MAX_STREAMS], *obuff[MAX_STREAMS];
+	uint32_t *bufferA[MAX_STREAMS], *bufferB[MAX_STREAMS];
+	uint32_t *addr_read[MAX_STREAMS], *addr_write[MAX_STREAMS];
+	int flags[MAX_STREAMS];
+	struct desc_ring *ring;			/* -R, NULL with the flags */
+	struct codec_stats *link_codec;		/* -z, NULL without */
+	struct codec_stats codec;
+	uint32_t *wire_out[MAX_STREAMS], *wire_in[MAX_STREAMS];
+	size_t wire_len[MAX_STREAMS];
+	uint64_t issue_ns[MAX_STREAMS];		/* open loop, intended issue time */
+	uint32_t *dev_buffer[2];		/* emulator internal buffers */
+
+	/* -E : descriptors complete out of order, released by the reorder buffer */
+	int num_engines;			/* 0 : one in order emulator */
+	uint32_t window;			/* -O, reorder buffer entries */
+	struct dma_engine engine[MAX_DMA_ENGINES];
+	struct completion_queue *cq;
+	struct reorder_buf rob;
+
+	/* results of the host loop */
+	struct run_stats stats;
+	struct verify_stats check;
+	struct wait_policy wait;
+	unsigned long ring_errors;
+	unsigned long long int lcltime;		/* usec */
+
+	pthread_t emulator, host;
+};
+
+void *fpga_emulator(void *pipeline);
+void *fpga_emulator_ring(void *pipeline);
+void *fpga_dma_engine(void *dma);
+
+/*-----------------------------------------------
+ *          Function: Thread placement
+ *-----------------------------------------------
+ * The first device takes the HOST and device CPUs
+ * of -A, the next ones share the worker CPUs : two
+ * per device, host thread first.
+ */
+
+static void pin_thread(const struct pipeline *p, pthread_t thread, enum affinity_role role){
+	if (p->device == 0){
+		affinity_pin(thread, role, 0);
+	} else {
+		affinity_pin(thread, AFFINITY_WORKERS,
+				2*(p->device - 1) + (role == AFFINITY_DEVICE));
+	}
+}
 
 /*-----------------------------------------------
  *          Function: FPGA Emulator
  *-----------------------------------------------
  * Emulate how FPGA would behave as if it called
- * on the main application runner. This function 
+ * on the main application runner. This function
  * is run on a seperate stream.
  *
- * sleep_time: emulates the action processing time
+ * Each buffer slot has its own flag and its own read/write
+ * addresses. Slots are processed in order : while the host
+ * computes slot k, the emulator can already fill slot k+1.
+ *
+ * pipeline: device context, each transfer ends at the
+ * deadline given by its timing model
  */
 
-void *fpga_emulator(void *sleep_time){
+void *fpga_emulator(void *pipeline){
+	struct pipeline *p = (struct pipeline *)pipeline;
+	struct device_model *model = &p->model;
+	bool timed = device_model_enabled(model);
 	int i = 0;
-	size_t size = vector_size*sizeof(uint32_t);
-	uint32_t *buffer1 = malloc(size);
-	uint32_t *buffer2 = malloc(size);
+	size_t size = p->vector_size*sizeof(uint32_t);
+	uint32_t *buffer1 = p->dev_buffer[0];
+	uint32_t *buffer2 = p->dev_buffer[1];
 
 	buffer1[0] = 1;
 	buffer2[0] = 1;
 
 	printf("Starting read_write_controller\n");
-	while (i<max_iteration) {
-		sleep(*((float*)sleep_time));
-		if (flags[i%MAX_STREAMS] == 1){
+	pin_thread(p, pthread_self(), AFFINITY_DEVICE);
+	trace_thread_start(p->device_name);
+	while (i<p->max_iteration) {
+		int stream = i%p->num_streams;
+
+		if (__atomic_load_n(&p->flags[stream], __ATOMIC_ACQUIRE) == 1){
+			uint64_t deadline = 0;
+			uint64_t t0 = trace_begin(), t1;
+
+			if (timed){
+				deadline = monotonic_ns() + device_model_transfer_ns(model, size, size);
+			}
 			//pointer switch
 			switch (i%2){
 				case 0:
-					memcpy(buffer1,addr_read,size);
-					memcpy(addr_write,buffer2,size);
+					memcpy(buffer1,p->addr_read[stream],size);
+					memcpy(p->addr_write[stream],buffer2,size);
 					break;
 				case 1:
-					memcpy(buffer2,addr_read,size);
-					memcpy(addr_write,buffer1,size);
+					memcpy(buffer2,p->addr_read[stream],size);
+					memcpy(p->addr_write[stream],buffer1,size);
 					break;
 			}
-			// updating flag (mutex protected)
-			pthread_mutex_lock(&lock);
-			flags[i%MAX_STREAMS] = 0;
-			pthread_mutex_unlock(&lock);
+			t1 = trace_begin();
+			trace_complete(TRACE_DEVICE_COPY, t0, t1, i);
+			if (timed){
+				device_model_wait(model, deadline);
+				trace_end(TRACE_DEVICE_MODEL, t1, i);
+			}
+			// the slot output is written before the host can see the flag
+			__atomic_store_n(&p->flags[stream], 0, __ATOMIC_RELEASE);
+			wait_policy_notify();
+			trace_end(TRACE_DEVICE_TRANSFER, t0, i);
 
 			i++;
+		} else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/*-----------------------------------------------
+ *     Function: FPGA Emulator (descriptor ring)
+ *-----------------------------------------------
+ * Same as fpga_emulator but transfers are taken from
+ * the descriptor ring : each descriptor is read from
+ * src into an internal buffer and written back at dst.
+ * The host posts the transfers of all free slots in
+ * advance, there is no flag to set between them.
+ *
+ * pipeline: device context (ring and timing model)
+ */
+
+void *fpga_emulator_ring(void *pipeline){
+	struct pipeline *p = (struct pipeline *)pipeline;
+	struct device_model *model = &p->model;
+	bool timed = device_model_enabled(model);
+	// room for encoded vectors (-z), which can be a bit bigger than raw ones
+	size_t size = codec_bound(p->vector_size);
+	uint32_t **buffer = p->dev_buffer;
+	struct desc_ring_desc *desc;
+
+	printf("Starting read_write_controller (descriptor ring)\n");
+	pin_thread(p, pthread_self(), AFFINITY_DEVICE);
+	trace_thread_start(p->device_name);
+	for (int i = 0; i < p->max_iteration; i++){
+		while ((desc = desc_ring_peek(p->ring)) == NULL){
+			sched_yield();
+		}
+
+		if (desc->length > size){
+			desc_ring_complete(p->ring, desc, DESC_STATUS_ERROR);
+			wait_policy_notify();
+			continue;
+		}
+
+		uint64_t deadline = 0;
+		uint64_t t0 = trace_begin(), t1;
+
+		if (timed){
+			deadline = monotonic_ns() + device_model_transfer_ns(model, desc->length, desc->length);
+		}
+		memcpy(buffer[i%2],(void *)(unsigned long)desc->src,desc->length);
+		memcpy((void *)(unsigned long)desc->dst,buffer[i%2],desc->length);
+		t1 = trace_begin();
+		trace_complete(TRACE_DEVICE_COPY, t0, t1, i);
+		if (timed){
+			device_model_wait(model, deadline);
+			trace_end(TRACE_DEVICE_MODEL, t1, i);
+		}
+
+		desc_ring_complete(p->ring, desc, DESC_STATUS_DONE);
+		wait_policy_notify();
+		trace_end(TRACE_DEVICE_TRANSFER, t0, i);
+	}
+	return NULL;
+}
+
+/*-----------------------------------------------
+ *     Function: FPGA DMA engine (descriptor ring)
+ *-----------------------------------------------
+ * One of the -E engines sharing the descriptor ring
+ * of a device. Engines claim descriptors in sequence
+ * order but each one moves its transfer at its own
+ * pace, so they complete in any order : a completion
+ * tagged with the descriptor sequence number is
+ * pushed to the completion queue and the host puts
+ * the transfers back in order. A descriptor is only
+ * claimed once its reorder buffer entry is free.
+ *
+ * dma: engine context (pipeline, timing model)
+ */
+
+void *fpga_dma_engine(void *dma){
+	struct dma_engine *e = (struct dma_engine *)dma;
+	struct pipeline *p = e->p;
+	struct device_model *model = &e->model;
+	bool timed = device_model_enabled(model);
+	size_t size = codec_bound(p->vector_size);
+	uint32_t *buffer = e->buffer;
+	struct desc_ring_desc *desc;
+
+	pin_thread(p, pthread_self(), AFFINITY_DEVICE);
+	trace_thread_start(e->name);
+	// every engine stops once the last transfer of the run is claimed
+	while (__atomic_load_n(&p->ring->fetch, __ATOMIC_RELAXED) < (uint64_t)p->max_iteration){
+		uint32_t status = DESC_STATUS_DONE;
+		uint64_t sequence, deadline = 0;
+		uint64_t t0, t1;
+
+		desc = desc_ring_claim(p->ring, desc_ring_completed(p->ring) + p->window);
+		if (desc == NULL){
+			sched_yield();
+			continue;
+		}
+		sequence = desc->sequence;
+		t0 = trace_begin();
+
+		if (desc->length > size){
+			status = DESC_STATUS_ERROR;
+		} else {
+			if (timed){
+				deadline = monotonic_ns() + device_model_transfer_ns(model, desc->length, desc->length);
+			}
+			memcpy(buffer,(void *)(unsigned long)desc->src,desc->length);
+			memcpy((void *)(unsigned long)desc->dst,buffer,desc->length);
+			t1 = trace_begin();
+			trace_complete(TRACE_DEVICE_COPY, t0, t1, sequence);
+			if (timed){
+				device_model_wait(model, deadline);
+				trace_end(TRACE_DEVICE_MODEL, t1, sequence);
+			}
+		}
+
+		completion_push(p->cq, sequence, status, e->id);
+		wait_policy_notify();
+		trace_end(TRACE_DEVICE_TRANSFER, t0, sequence);
+		e->transfers++;
+	}
+	return NULL;
+}
+
+/* Transfer of an iteration is over : in order from the ring, or released by the reorder buffer */
+static bool transfer_done(struct pipeline *p, uint64_t sequence, uint32_t *status){
+	if (p->num_engines > 0){
+		return reorder_release(&p->rob, p->cq, p->ring, status);
+	}
+	if (desc_ring_completed(p->ring) <= sequence){
+		return false;
+	}
+	*status = desc_ring_status(p->ring, sequence);
+	return true;
+}
+
+/*-----------------------------------------------
+ *     Function: Post a slot (descriptor ring)
+ *-----------------------------------------------
+ * Gives the transfer of a slot to the emulator. With
+ * the link codec, the slot output has been encoded in
+ * wire_out by encode_slot() : the emulator moves the
+ * encoded bytes and sends them back in wire_in, which
+ * decode_slot() turns into the next slot input.
+ */
+
+static void encode_slot(struct pipeline *p, int stream){
+	p->wire_len[stream] = codec_encode(p->addr_read[stream], p->vector_size,
+			p->wire_out[stream], p->link_codec);
+}
+
+static void decode_slot(struct pipeline *p, int stream){
+	codec_decode(p->wire_in[stream], p->wire_len[stream], p->addr_write[stream],
+			p->vector_size, p->link_codec);
+}
+
+static void post_slot(struct pipeline *p, int stream, size_t size){
+	if (p->link_codec != NULL){
+		desc_ring_post(p->ring, p->wire_out[stream], p->wire_in[stream], p->wire_len[stream]);
+	} else {
+		desc_ring_post(p->ring, p->addr_read[stream], p->addr_write[stream], size);
+	}
+	trace_instant(TRACE_FLAG_SET, stream);
+}
+
+/* Flags : the slot input is written before the emulator can see the flag */
+static void set_flag(struct pipeline *p, int stream){
+	__atomic_store_n(&p->flags[stream], 1, __ATOMIC_RELEASE);
+	trace_instant(TRACE_FLAG_SET, stream);
+}
+
+/*-----------------------------------------------
+ *     Function: Issue arrivals (open loop)
+ *-----------------------------------------------
+ * Gives the emulator every arrival that is due and
+ * has a free slot : iteration j takes the slot of
+ * iteration j - num_streams once it is computed, so
+ * only iterations below limit can be issued. The
+ * others wait, which the QUEUE phase accounts for.
+ * Returns the number of iterations issued so far.
+ */
+
+static int issue_arrivals(struct pipeline *p, int issued, int limit, size_t size){
+	uint64_t now = monotonic_ns();
+
+	if (limit > p->max_iteration){
+		limit = p->max_iteration;
+	}
+	while ((issued < limit) && (p->load.next_ns <= now)){
+		int stream = issued % p->num_streams;
+
+		p->issue_ns[stream] = load_gen_pop(&p->load, &p->stats, now);
+		if (p->ring != NULL){
+			if (p->link_codec != NULL){
+				encode_slot(p, stream);
+			}
+			post_slot(p, stream, size);
+		} else if (p->fpga_emulation){
+			set_flag(p, stream);
+		}
+		issued++;
+		now = monotonic_ns();
+	}
+	return issued;
+}
+
+/*-----------------------------------------------
+ *     Function: Device setup
+ *-----------------------------------------------
+ * Allocates the buffers of a device (GPU / HOST
+ * buffers, descriptor ring, codec buffers), gives
+ * it the first slots and starts its emulator.
+ */
+
+/*
+ * Internal buffers of the emulator, room for encoded vectors (-z). Taken
+ * before it starts so that a failed allocation stops the run.
+ */
+static int emulator_buffers(struct pipeline *p){
+	size_t size = codec_bound(p->vector_size);
+
+	p->dev_buffer[0] = buffer_pool_get(size);
+	p->dev_buffer[1] = buffer_pool_get(size);
+	if ((p->dev_buffer[0] == NULL) || (p->dev_buffer[1] == NULL)){
+		fprintf(stderr, "Error allocating the emulator buffers \n");
+		return 1;
+	}
+	return 0;
+}
+
+/* Same draw on every device would make their jitter identical */
+static uint64_t device_seed(uint64_t seed, int device){
+	seed += (uint64_t)device * 0x2545f4914f6cdd1dull;
+	// xorshift never leaves 0
+	return seed ? seed : 1;
+}
+
+static void pipeline_init(struct pipeline *p, int device, int num_devices){
+	p->device = device;
+	if (num_devices > 1){
+		snprintf(p->host_name, sizeof(p->host_name), "host %d", device);
+		snprintf(p->device_name, sizeof(p->device_name), "fpga emulator %d", device);
+	} else {
+		snprintf(p->host_name, sizeof(p->host_name), "host");
+		snprintf(p->device_name, sizeof(p->device_name), "fpga emulator");
+	}
+	p->model.seed = device_seed(p->model.seed, device);
+	p->load.seed = device_seed(p->load.seed, device);
+	if (p->link_codec != NULL){
+		codec_stats_init(&p->codec);
+		p->link_codec = &p->codec;
+	}
+	run_stats_init(&p->stats);
+	verify_init(&p->check);
+}
+
+static int pipeline_setup(struct pipeline *p, bool use_ring){
+	const struct compute_backend *compute = p->compute;
+	size_t size = p->vector_size*sizeof(uint32_t);
+
+	////////////////////////////////////////////////////////////////
+	//               MEMORY ALLOCATION ON GPU
+	////////////////////////////////////////////////////////////////
+
+	compute->memory_allocation_device(p->ibuff,size,p->num_streams);
+	compute->memory_allocation_device(p->obuff,size,p->num_streams);
+
+	if (!p->host_buffering){
+		if (p->fpga_emulation){
+			compute->init_buffers(p->obuff,p->vector_size,p->num_streams);
+		} else {
+			compute->init_buffers(p->ibuff,p->vector_size,p->num_streams);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+	//               MEMORY ALLOCATION ON HOST
+	////////////////////////////////////////////////////////////////
+
+	if (p->host_buffering){
+		compute->memory_allocation_host(p->bufferA,size,p->num_streams);
+		compute->memory_allocation_host(p->bufferB,size,p->num_streams);
+
+		for (int i = 0; i < p->vector_size; i++){
+			for (int stream = 0; stream < p->num_streams; stream++){
+				p->bufferA[stream][i] = 1;
+				p->bufferB[stream][i] = i + 1000*stream;
+			}
+		}
+	}
+
+	if (!p->fpga_emulation){
+		return 0;
+	}
+
+	if (use_ring){
+		p->ring = desc_ring_alloc(DESC_RING_DEFAULT_SIZE);
+		if (p->ring == NULL){
+			fprintf(stderr, "Error allocating descriptor ring \n");
+			return 1;
+		}
+	}
+	if (p->num_engines > 0){
+		// the window bounds the completions not yet consumed
+		p->cq = completion_queue_alloc(p->window);
+		if ((p->cq == NULL) || reorder_init(&p->rob, p->window)){
+			fprintf(stderr, "Error allocating the reorder buffer \n");
+			return 1;
+		}
+		p->window = p->rob.window;
+	}
+	if (p->link_codec != NULL){
+		for (int stream = 0; stream < p->num_streams; stream++){
+			p->wire_out[stream] = buffer_pool_get(codec_bound(p->vector_size));
+			p->wire_in[stream] = buffer_pool_get(codec_bound(p->vector_size));
+			if ((p->wire_out[stream] == NULL) || (p->wire_in[stream] == NULL)){
+				fprintf(stderr, "Error allocating codec buffers \n");
+				return 1;
+			}
+		}
+	}
+
+	// All slots are given to the FPGA before starting (in open
+	// loop, they are given when their iterations arrive)
+	for (int stream = 0; stream < p->num_streams && stream < p->max_iteration; stream++){
+		if (p->host_buffering){
+			p->addr_read[stream] = p->bufferB[stream];
+			p->addr_write[stream] = p->bufferA[stream];
+		}else{
+			p->addr_read[stream] = p->obuff[stream];
+			p->addr_write[stream] = p->ibuff[stream];
+		}
+		if (load_gen_enabled(&p->load)){
+			continue;
+		}
+		if (p->ring != NULL){
+			if (p->link_codec != NULL){
+				encode_slot(p, stream);
+			}
+			post_slot(p, stream, size);
+		} else {
+			set_flag(p, stream);
 		}
 	}
-	return NULL;	
+
+	// the context is complete before the emulator starts
+	if (p->num_engines > 0){
+		printf("Starting read_write_controller (%d DMA engines)\n", p->num_engines);
+		for (int e = 0; e < p->num_engines; e++){
+			struct dma_engine *engine = &p->engine[e];
+
+			engine->p = p;
+			engine->id = e;
+			snprintf(engine->name, sizeof(engine->name), "%s dma %d", p->device_name, e);
+			engine->model = p->model;
+			engine->model.seed = device_seed(p->model.seed, MAX_DEVICES*(e + 1));
+			engine->buffer = buffer_pool_get(codec_bound(p->vector_size));
+			if (engine->buffer == NULL){
+				fprintf(stderr, "Error allocating the DMA engine buffers \n");
+				return 1;
+			}
+			if (pthread_create(&engine->thread, NULL, &fpga_dma_engine, engine)){
+				fprintf(stderr, "Error creating DMA engine thread \n");
+				return 1;
+			}
+		}
+		return 0;
+	}
+	if (emulator_buffers(p)){
+		return 1;
+	}
+	if (pthread_create(&p->emulator, NULL, (p->ring != NULL) ? &fpga_emulator_ring : &fpga_emulator,
+				(void *) p)){
+		fprintf(stderr, "Error creating FPGA Emulator thread \n");
+		return 1;
+	}
+	return 0;
+}
+
+/* Waits for the emulator, the model statistics of the engines are added up */
+static void pipeline_join(struct pipeline *p){
+	if (p->num_engines == 0){
+		pthread_join(p->emulator, NULL);
+		return;
+	}
+	for (int e = 0; e < p->num_engines; e++){
+		pthread_join(p->engine[e].thread, NULL);
+		p->model.transfers += p->engine[e].model.transfers;
+		p->model.late += p->engine[e].model.late;
+		p->model.late_ns += p->engine[e].model.late_ns;
+	}
+}
+
+static void pipeline_free(struct pipeline *p){
+	if (p->link_codec != NULL){
+		for (int stream = 0; stream < p->num_streams; stream++){
+			buffer_pool_put(p->wire_out[stream]);
+			buffer_pool_put(p->wire_in[stream]);
+		}
+	}
+	desc_ring_free(p->ring);
+	p->ring = NULL;
+	if (p->num_engines > 0){
+		completion_queue_free(p->cq);
+		reorder_free(&p->rob);
+		for (int e = 0; e < p->num_engines; e++){
+			buffer_pool_put(p->engine[e].buffer);
+		}
+	}
+	buffer_pool_put(p->dev_buffer[0]);
+	buffer_pool_put(p->dev_buffer[1]);
+
+	if (p->host_buffering){
+		p->compute->free_host(p->bufferA,p->num_streams);
+		p->compute->free_host(p->bufferB,p->num_streams);
+	}
+
+	p->compute->free_device(p->ibuff,p->num_streams);
+	p->compute->free_device(p->obuff,p->num_streams);
+}
+
+/*-----------------------------------------------
+ *     Function: Host pipeline
+ *-----------------------------------------------
+ * Loop of one device : waits for each slot, computes
+ * it and gives it back to the emulator. Run by the
+ * main thread with a single device, by a thread of
+ * its own for each device otherwise.
+ */
+
+static void *run_pipeline(void *pipeline){
+	struct pipeline *p = (struct pipeline *)pipeline;
+	const struct compute_backend *compute = p->compute;
+	struct run_stats *stats = &p->stats;
+	struct timeval begin_time, end_time;
+	uint64_t iteration_start = 0, t = 0;
+	size_t size = p->vector_size*sizeof(uint32_t);
+	int stream =0, issued = 0;
+	uint32_t *tmp = NULL;
+
+	trace_thread_start(p->host_name);
+	// counters are optional : the run goes on without them
+	if (p->perf_counters){
+		run_stats_enable_perf(stats, stdout);
+	}
+
+	gettimeofday(&begin_time, NULL);
+	wait_policy_start(&p->wait);
+	if (load_gen_enabled(&p->load)){
+		load_gen_print(&p->load, stdout);
+		load_gen_start(&p->load, monotonic_ns());
+	}
+
+	for (int iteration = 0; iteration < p->max_iteration; iteration++){
+		const uint32_t *check_in, *check_out;
+
+		stream = iteration % p->num_streams;
+		if (load_gen_enabled(&p->load)){
+			// idle until this iteration arrives, unless it already has
+			issued = issue_arrivals(p, issued, iteration + p->num_streams, size);
+			while (issued == iteration){
+				load_gen_wait(&p->load);
+				issued = issue_arrivals(p, issued, iteration + p->num_streams, size);
+			}
+		}
+		iteration_start = t = run_stats_begin(stats);
+
+		if (p->ring != NULL){
+			uint32_t status = DESC_STATUS_FREE;
+
+			//FPGA is writing data in buffer
+			wait_until(&p->wait, transfer_done(p, iteration, &status));
+			if (status != DESC_STATUS_DONE){
+				p->ring_errors++;
+			}
+		} else if (p->fpga_emulation){
+			//FPGA is writing data in buffer
+			wait_until(&p->wait, __atomic_load_n(&p->flags[stream], __ATOMIC_ACQUIRE) != 1);
+		}
+		if (p->fpga_emulation){
+			t = run_stats_mark(stats, PHASE_WAIT, t);
+		}
+		if (p->link_codec != NULL){
+			decode_slot(p, stream);
+			t = run_stats_mark(stats, PHASE_DECODE, t);
+		}
+
+		if (p->host_buffering){
+			//Running kernel on GPU with HOST buffering (Config 1)
+			compute->run_new_stream_v1(p->bufferA[stream],p->bufferB[stream],p->ibuff[stream],p->obuff[stream],p->vector_size);
+			check_in = p->bufferA[stream];
+			check_out = p->bufferB[stream];
+
+			// Setting parameters for the newt iteration
+			if (!p->fpga_emulation){
+				tmp = p->bufferA[stream];
+				p->bufferA[stream] = p->bufferB[stream];
+				p->bufferB[stream] = tmp;
+			}
+
+			if (p->verbose){
+				printf("Writting : [%d,%d, ... ,%d]\n",p->bufferA[stream][0],p->bufferA[stream][1],p->bufferA[stream][p->vector_size-1]);
+				printf("Received : [%d,%d, ... ,%d]\n",p->bufferB[stream][0],p->bufferB[stream][1],p->bufferB[stream][p->vector_size-1]);
+			}
+
+		} else {
+			//Running kernel on GPU without HOST buffering (Config 2)
+			compute->run_new_stream_v2(p->ibuff[stream],p->obuff[stream],p->vector_size);
+			check_in = p->ibuff[stream];
+			check_out = p->obuff[stream];
+
+			if (!p->fpga_emulation){
+				tmp = p->ibuff[stream];
+				p->ibuff[stream] = p->obuff[stream];
+				p->obuff[stream] = tmp;
+			}
+
+			if (p->verbose) {
+				printf("Writting : [%d,%d, ... ,%d]\n",p->ibuff[stream][0],p->ibuff[stream][1],p->ibuff[stream][p->vector_size-1]);
+				printf("Received : [%d,%d, ... ,%d]\n",p->obuff[stream][0],p->obuff[stream][1],p->obuff[stream][p->vector_size-1]);
+			}
+		}
+		t = run_stats_mark(stats, PHASE_COMPUTE, t);
+		if (load_gen_enabled(&p->load)){
+			load_gen_complete(&p->load, stats, p->issue_ns[stream], t);
+		}
+
+		// out of the phases, only the iteration includes it
+		if (p->verify){
+			verify_vector_add(&p->check, check_in, check_out, p->vector_size, iteration);
+			t = monotonic_ns();
+		}
+
+		// FPGA can read/write new data in this slot (only if it
+		// still has an iteration to run on it)
+		if (load_gen_enabled(&p->load)){
+			// the slot is free : the arrival waiting for it can go
+			int before = issued;
+
+			issued = issue_arrivals(p, issued, iteration + p->num_streams + 1, size);
+			if (issued != before){
+				run_stats_mark(stats, PHASE_FLAG_UPDATE, t);
+			}
+		} else if (p->fpga_emulation && (iteration + p->num_streams < p->max_iteration)){
+			if (p->ring != NULL){
+				if (p->link_codec != NULL){
+					encode_slot(p, stream);
+					t = run_stats_mark(stats, PHASE_ENCODE, t);
+				}
+				post_slot(p, stream, size);
+			} else {
+				set_flag(p, stream);
+			}
+			run_stats_mark(stats, PHASE_FLAG_UPDATE, t);
+		}
+
+		run_stats_mark(stats, PHASE_ITERATION, iteration_start);
+	}
+
+	gettimeofday(&end_time, NULL);
+	wait_policy_stop(&p->wait);
+	p->lcltime = (long long)(timediff_usec(&end_time, &begin_time));
+	return NULL;
+}
+
+/* Everything the run of one device measured, returns 1 if a result or a transfer is wrong */
+static int pipeline_report(struct pipeline *p, bool latency_dump, bool bench_output){
+	int rc = 0;
+
+	printf("Completed %d iterations successfully\n", p->max_iteration);
+
+	// Display the time of the action excecution
+	fprintf(stdout, "GPU average processing time for %u iteration is %f usec with config %d (pipeline depth %d)\n",
+			p->max_iteration, (float)p->lcltime/(float)(p->max_iteration),
+			p->host_buffering ? 1 : 2, p->num_streams);
+	run_stats_report(&p->stats, stdout, latency_dump);
+	if (bench_output){
+		run_stats_summary(&p->stats, stdout);
+		if (load_gen_enabled(&p->load)){
+			load_gen_summary(&p->load, &p->stats, stdout);
+		}
+	}
+	run_stats_disable_perf(&p->stats);
+	if (p->verify){
+		verify_report(&p->check, stdout);
+		if (p->check.mismatches){
+			rc = 1;
+		}
+	}
+	if (load_gen_enabled(&p->load)){
+		load_gen_report(&p->load, stdout);
+	}
+	if (p->fpga_emulation){
+		wait_policy_report(&p->wait, stdout);
+		if (device_model_enabled(&p->model)){
+			device_model_report(&p->model, stdout);
+		}
+	}
+	if (p->num_engines > 0){
+		fprintf(stdout, "DMA engines :");
+		for (int e = 0; e < p->num_engines; e++){
+			fprintf(stdout, " %llu", (unsigned long long)p->engine[e].transfers);
+		}
+		fprintf(stdout, " transfers\n");
+		reorder_report(&p->rob, stdout);
+	}
+	if (p->ring_errors){
+		fprintf(stdout, "%lu descriptors completed with an error\n", p->ring_errors);
+		rc = 1;
+	}
+	if (p->link_codec != NULL){
+		codec_report(p->link_codec, (double)p->lcltime, stdout);
+		if (p->link_codec->errors){
+			rc = 1;
+		}
+	}
+	return rc;
+}
+
+/*
+ * Whole run of several devices : aggregate throughput, then the merged
+ * histograms for bench_sweep (the open loop rates are added up)
+ */
+static void devices_report(struct pipeline *pipes, int num_devices,
+		unsigned long long int lcltime, bool bench_output){
+	unsigned long long int slowest = 0;
+	double bytes = 0.0;
+	long iterations = 0;
+
+	for (int d = 0; d < num_devices; d++){
+		iterations += pipes[d].max_iteration;
+		bytes += (double)pipes[d].max_iteration*pipes[d].vector_size*sizeof(uint32_t);
+		if (pipes[d].lcltime > slowest){
+			slowest = pipes[d].lcltime;
+		}
+	}
+	fprintf(stdout, "%d devices : %ld iterations in %llu usec, %.1f iterations/s (%.1f per device), "
+			"%.3f GB/s, slowest device %llu usec\n",
+			num_devices, iterations, lcltime,
+			lcltime ? iterations*1e6/lcltime : 0.0,
+			lcltime ? iterations*1e6/lcltime/num_devices : 0.0,
+			lcltime ? bytes/lcltime/1e3 : 0.0, slowest);
+
+	if (bench_output){
+		struct run_stats all;
+		struct load_gen load = pipes[0].load;
+
+		run_stats_init(&all);
+		for (int d = 0; d < num_devices; d++){
+			run_stats_merge(&all, &pipes[d].stats);
+		}
+		run_stats_summary(&all, stdout);
+		if (load_gen_enabled(&load)){
+			for (int d = 1; d < num_devices; d++){
+				load.rate += pipes[d].load.rate;
+				load.issued += pipes[d].load.issued;
+				if (pipes[d].load.last_ns > load.last_ns){
+					load.last_ns = pipes[d].load.last_ns;
+				}
+			}
+			load_gen_summary(&load, &all, stdout);
+		}
+	}
+}
+
+/*-----------------------------------------------
+ *     Function: Shared device clients
+ *-----------------------------------------------
+ * Independent request streams sharing the emulator
+ * through the job scheduler (-Q). Each client thread
+ * keeps up to window requests of its own size in
+ * flight and, with -X, checks that every vector came
+ * back unchanged from the emulator.
+ */
+
+struct client_thread {
+	char name[24];
+	int size;			/* elements, -s by default */
+	int priority;
+	uint32_t weight;
+	int window;			/* requests in flight, 1 to MAX_STREAMS */
+	int requests;
+	bool verify;
+	unsigned long mismatches;
+	uint32_t *src[MAX_STREAMS], *dst[MAX_STREAMS];
+	struct sched_client *client;
+	pthread_t thread;
+};
+
+/* size=<N>,prio=<N>,weight=<N>,window=<N>,name=<s> */
+static int parse_client(const char *spec, struct client_thread *ct, int index){
+	char *copy, *item, *saveptr = NULL;
+	int rc = 0;
+
+	memset(ct, 0, sizeof(*ct));
+	snprintf(ct->name, sizeof(ct->name), "client%d", index);
+	ct->weight = 1;
+	ct->window = 1;
+
+	copy = strdup(spec);
+	if (copy == NULL){
+		return -1;
+	}
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL;
+			item = strtok_r(NULL, ",", &saveptr)){
+		if (!strncmp(item, "size=", 5)){
+			ct->size = atoi(item + 5);
+			rc |= (ct->size <= 0);
+		} else if (!strncmp(item, "prio=", 5)){
+			ct->priority = atoi(item + 5);
+		} else if (!strncmp(item, "weight=", 7)){
+			rc |= (atoi(item + 7) <= 0);
+			ct->weight = atoi(item + 7);
+		} else if (!strncmp(item, "window=", 7)){
+			ct->window = atoi(item + 7);
+			rc |= (ct->window < 1) || (ct->window > MAX_STREAMS);
+		} else if (!strncmp(item, "name=", 5)){
+			snprintf(ct->name, sizeof(ct->name), "%s", item + 5);
+		} else {
+			rc = -1;
+		}
+	}
+	free(copy);
+	return rc ? -1 : 0;
+}
+
+static void *client_main(void *arg){
+	struct client_thread *ct = (struct client_thread *)arg;
+	struct sched_request req[MAX_STREAMS];
+	uint32_t **src = ct->src, **dst = ct->dst;
+	size_t size = ct->size*sizeof(uint32_t);
+
+	trace_thread_start(ct->name);
+	for (int w = 0; w < ct->window; w++){
+		for (int i = 0; i < ct->size; i++){
+			src[w][i] = i;
+		}
+	}
+
+	// request i reuses the buffers of request i - window once it is done
+	for (int i = 0; i < ct->requests + ct->window; i++){
+		int w = i % ct->window;
+
+		if ((i >= ct->window) && (job_sched_wait(&req[w]) == DESC_STATUS_DONE) &&
+				ct->verify && memcmp(src[w], dst[w], size)){
+			ct->mismatches++;
+		}
+		if (i < ct->requests){
+			src[w][0] = i;
+			job_sched_submit(ct->client, &req[w], src[w], dst[w], size);
+		}
+	}
+	return NULL;
+}
+
+/* Buffers of the requests in flight, taken before any client starts */
+static int client_buffers(struct client_thread *ct){
+	for (int w = 0; w < ct->window; w++){
+		ct->src[w] = buffer_pool_get(ct->size*sizeof(uint32_t));
+		ct->dst[w] = buffer_pool_get(ct->size*sizeof(uint32_t));
+		if ((ct->src[w] == NULL) || (ct->dst[w] == NULL)){
+			fprintf(stderr, "Error allocating the buffers of %s \n", ct->name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void client_free(struct client_thread *ct){
+	for (int w = 0; w < ct->window; w++){
+		buffer_pool_put(ct->src[w]);
+		buffer_pool_put(ct->dst[w]);
+		ct->src[w] = ct->dst[w] = NULL;
+	}
+}
+
+static int run_clients(struct pipeline *p, struct client_thread *clients,
+		int num_clients, const struct job_sched_config *sched_cfg){
+	struct job_sched *sched = NULL;
+	struct timeval begin_time, end_time;
+	unsigned long long int lcltime;
+	int rc = 0;
+
+	p->ring = desc_ring_alloc(DESC_RING_DEFAULT_SIZE);
+	if (p->ring != NULL){
+		sched = job_sched_create(p->ring, sched_cfg);
+	}
+	if (sched == NULL){
+		fprintf(stderr, "Error allocating the scheduler \n");
+		desc_ring_free(p->ring);
+		return 1;
+	}
+
+	// the emulator stops after the requests of all the clients
+	p->max_iteration = 0;
+	for (int c = 0; c < num_clients; c++){
+		clients[c].client = job_sched_add_client(sched, clients[c].name,
+				clients[c].priority, clients[c].weight);
+		p->max_iteration += clients[c].requests;
+	}
+
+	// nothing is started before every buffer is there
+	rc = emulator_buffers(p);
+	for (int c = 0; (c < num_clients) && (rc == 0); c++){
+		rc = client_buffers(&clients[c]);
+	}
+	if (rc){
+		goto out;
+	}
+
+	printf("Running FPGA Emulator \n");
+	if (pthread_create(&p->emulator, NULL, &fpga_emulator_ring, (void *) p)){
+		fprintf(stderr, "Error creating FPGA Emulator thread \n");
+		rc = 1;
+		goto out;
+	}
+	if (job_sched_start(sched)){
+		exit(EXIT_FAILURE);
+	}
+	// the dispatcher takes the place of the HOST loop
+	affinity_pin(sched->thread, AFFINITY_HOST, 0);
+
+	printf("Starting %d clients \n", num_clients);
+	gettimeofday(&begin_time, NULL);
+	for (int c = 0; c < num_clients; c++){
+		if (pthread_create(&clients[c].thread, NULL, &client_main, &clients[c])){
+			fprintf(stderr, "Error creating client thread \n");
+			exit(EXIT_FAILURE);
+		}
+		affinity_pin(clients[c].thread, AFFINITY_WORKERS, c);
+	}
+	for (int c = 0; c < num_clients; c++){
+		pthread_join(clients[c].thread, NULL);
+	}
+	job_sched_stop(sched);
+	gettimeofday(&end_time, NULL);
+	pthread_join(p->emulator, NULL);
+
+	lcltime = (long long)(timediff_usec(&end_time, &begin_time));
+	printf("Completed %d requests of %d clients in %llu usec\n",
+			p->max_iteration, num_clients, lcltime);
+	job_sched_report(sched, stdout);
+	for (int c = 0; c < num_clients; c++){
+		if (clients[c].mismatches){
+			fprintf(stdout, "%s : %lu vectors differ from the ones sent\n",
+					clients[c].name, clients[c].mismatches);
+			rc = 1;
+		}
+		if (sched->clients[c]->errors){
+			rc = 1;
+		}
+	}
+
+out:
+	for (int c = 0; c < num_clients; c++){
+		client_free(&clients[c]);
+	}
+	buffer_pool_put(p->dev_buffer[0]);
+	buffer_pool_put(p->dev_buffer[1]);
+	job_sched_destroy(sched);
+	desc_ring_free(p->ring);
+	p->ring = NULL;
+	return rc;
 }
 
 static void usage(const char *prog)
@@ -59,18 +1039,52 @@ static void usage(const char *prog)
 	printf("\n Usage: %s [-h] [-v, --verbose]\n"
 			"  -s, --vector_size <N>     	size of the uint32_t buffer array.\n"
 			"  -n, --num_iteration <N>   	number of iterations in a run.\n"
-			"  -w, --wait_time <duration> 	emulates FPGA processing time.\n"
+			"  -w, --wait_time <duration> 	emulates FPGA processing time (seconds, fractions allowed).\n"
+			"  -m, --device_model <spec> 	timing model of the FPGA emulator, e.g. ad9v3 or\n"
+			"                            	latency=2us,bw=1.9,jitter=exp:500ns (see README).\n"
 			"  -H, --host_buffering      	enable host buffering to test config 1 (default is config 2).\n"
 			"  -f, --fpga_emulation		enable FPGA emulation.\n"
-			"\n"
-			"WARNING ! This code only works with MAX_STREAMS=1 at this stage\n"
-			"(MAX_STREAMS is defined in includes/kernel.h)\n"
+			"  -p, --pipeline_depth <N>  	number of buffer slots in flight (1 to %d, default is 1).\n"
+			"  -D, --devices <N>         	emulated devices, each one with its own host pipeline thread\n"
+			"                            	(1 to %d, default is 1).\n"
+			"  -W, --wait_policy <name>  	how to wait for the FPGA emulator : spin, yield (default), backoff or block.\n"
+			"  -R, --desc_ring           	FPGA emulator takes transfers from a descriptor ring instead of flags.\n"
+			"  -z, --codec               	delta + bit packing encoding of the transfers (with -f -R).\n"
+			"  -E, --dma_engines <N>     	DMA engines of the emulator completing the descriptors out of order\n"
+			"                            	(with -f -R, 1 to %d).\n"
+			"  -O, --reorder_window <N>  	reorder buffer entries, transfers claimed ahead of the oldest\n"
+			"                            	one still running (with -E, 1 to %d, default is %d).\n"
+			"  -L, --latency_dump        	print the latency histograms of every phase.\n"
+			"  -e, --perf_counters       	count cycles, instructions, cache and TLB misses per phase.\n"
+			"  -X, --verify              	check every result with a checksum, without printing in the loop.\n"
+			"  -c, --compute <name>      	compute backend : gpu (default when built with CUDA), cpu or cpu:<isa>\n"
+			"                            	(isa is scalar, sse4, avx2, avx512 or vsx, best one by default).\n"
+			"  -t, --threads <N>         	threads computing each vector with the cpu backend (1 to %d, default is 1).\n"
+			"  -k, --chunk_size <N>      	elements computed by a thread at a time (default is %d).\n"
+			"  -P, --buffer_pool <spec>  	buffer pool pages and options : thp (default), 2m, 1g,\n"
+			"                            	mlock, prefault (default) or noprefault (comma separated).\n"
+			"  -A, --affinity <item>     	pin threads, bind buffers : host=, device=, workers= with a cpu list,\n"
+			"                            	near or node<N>, mem=near|node<N>, device_node=<N>, auto (repeatable).\n"
+			"  -T, --trace <file>        	write a Chrome trace of the host and device threads.\n"
+			"  -r, --rate <spec>         	open loop : iterations requested at a fixed rate whatever the\n"
+			"                            	completions, e.g. 20000 or 50k,poisson (iterations per second).\n"
+			"  -B, --bench_output        	print a machine readable summary line (used by bench_sweep).\n"
+			"  -Q, --client <spec>       	client sharing the emulator through the scheduler (with -f -R),\n"
+			"                            	size=<N>,prio=<N>,weight=<N>,window=<N>,name=<s> (repeatable).\n"
+			"  -q, --scheduler <spec>    	policy of the clients : fair (default) or priority,\n"
+			"                            	small=<bytes> first, depth=<N> descriptors in flight.\n"
 			"\n"
 			"Example usage:\n"
 			"-----------------------\n"
 			"kernel_runner -s 1024 -n 10 -v\n"
+			"kernel_runner -s 131072 -n 10000 -f -p 4\n"
+			"kernel_runner -s 131072 -n 10000 -f -m ad9v3 -c cpu\n"
+			"kernel_runner -s 131072 -n 10000 -f -m ad9v3 -c cpu -D 4\n"
+			"kernel_runner -s 131072 -n 10000 -f -R -p 8 -E 4 -m ad9v3,jitter=exp:20us -c cpu\n"
+			"kernel_runner -s 131072 -n 1000 -f -R -Q size=256 -Q size=131072 -q priority,small=4096\n"
 			"\n",
-			prog);
+			prog, MAX_STREAMS, MAX_DEVICES, MAX_DMA_ENGINES, REORDER_MAX_WINDOW, REORDER_MAX_WINDOW,
+			WORKER_POOL_MAX_THREADS, WORKER_POOL_DEFAULT_CHUNK);
 }
 
 /*-----------------------------------------------
@@ -84,25 +1098,62 @@ static void usage(const char *prog)
  * 	- n : Number of iterations
  * 	- s : Size of the uint32_t buffer array
  * 	- w : Wait time (used to emulate FPGA)
+ * 	- m : Timing model of the FPGA emulator
  * 	- H : Enable HOST buffering (config 1)
  * 	- v : Enable verbosity (for results checking)
  * 	- f : Enable FPGA Emulation
- *
- * WARNING ! This code only works with MAX_STREAMS=1 at this stage
- * (MAX_STREAMS is defined in includes/kernel.h)
+ * 	- p : Pipeline depth (number of buffer slots, up to MAX_STREAMS)
+ * 	- D : Number of emulated devices, each with its own host pipeline
+ * 	- W : Wait policy used to poll the FPGA emulator flags
+ * 	- R : FPGA emulator uses the descriptor ring instead of the flags
+ * 	- z : Encode the transfers of the descriptor ring (delta + bit packing)
+ * 	- E : DMA engines of the emulator, descriptors complete out of order
+ * 	- O : Reorder buffer window of the DMA engines
+ * 	- L : Print the latency histograms of every phase
+ * 	- e : Hardware performance counters per phase
+ * 	- X : Check every result with a checksum (no output in the loop)
+ * 	- c : Compute backend (gpu, cpu or cpu:<isa>)
+ * 	- t : Threads of the cpu compute backend
+ * 	- k : Chunk size (elements) of the cpu compute backend threads
+ * 	- P : Buffer pool configuration (huge pages, mlock, prefault)
+ * 	- T : Chrome trace file of the host and device events
+ * 	- A : Thread and buffer placement (CPUs, NUMA node), repeatable
+ * 	- r : Open loop arrival rate (constant or poisson)
+ * 	- B : Print a machine readable summary line (bench_sweep)
+ * 	- Q : Client sharing the emulator through the scheduler, repeatable
+ * 	- q : Scheduler policy of the clients (fair or priority)
  */
 
 
 int main(int argc, char*argv[]){
 
-	uint32_t *ibuff[MAX_STREAMS], *obuff[MAX_STREAMS];
-	int ch; 
-	float sleep_time = 0;
+	int ch;
+	struct pipeline base, *pipes = NULL;
 	bool host_buffering = false, verbose = false, fpga_emulation = false;
+	bool use_ring = false, use_codec = false, latency_dump = false, perf_counters = false, verify = false, bench_output = false;
 	const char *num_iteration = NULL, *in_size = NULL, *wait_time = NULL;
-	struct timeval begin_time, end_time; 
+	const char *pipeline_depth = NULL, *wait_policy = NULL, *compute_name = NULL;
+	const char *model_spec = NULL, *rate_spec = NULL, *sched_spec = NULL, *devices_arg = NULL;
+	const char *engines_arg = NULL, *window_arg = NULL;
+	struct client_thread clients[SCHED_MAX_CLIENTS];
+	struct job_sched_config sched_cfg;
+	int num_clients = 0, num_devices = 1, rc = 0;
+	const struct compute_backend *compute = NULL;
+	const char *threads_arg = NULL, *chunk_arg = NULL;
+	const char *buffer_pool_arg = NULL, *trace_path = NULL;
+	struct buffer_pool_config buffer_cfg;
+	struct affinity_config affinity_cfg;
+	int num_threads = 1;
+	long chunk_size = WORKER_POOL_DEFAULT_CHUNK;
+	struct worker_pool *pool = NULL;
+	enum wait_policy_type wait_type = WAIT_SPIN_YIELD;
+	struct timeval begin_time, end_time;
 	unsigned long long int lcltime = 0x0ull;
-	size_t size;
+
+	// -A can be repeated
+	affinity_config_init(&affinity_cfg);
+	memset(&base, 0, sizeof(base));
+	base.num_streams = 1;
 
 	while (1) {
 		int option_index = 0;
@@ -110,14 +1161,35 @@ int main(int argc, char*argv[]){
 			{ "vector_size",	 required_argument, NULL, 's' },
 			{ "num_iteration",	 required_argument, NULL, 'n' },
 			{ "wait_time",		required_argument, NULL, 'w' },
+			{ "device_model",	required_argument, NULL, 'm' },
 			{ "host_buffering",	 no_argument, NULL, 'H' },
 			{ "verbosity",	 	no_argument, NULL, 'v' },
 			{ "fpga_emulation",	no_argument, NULL, 'f' },
+			{ "pipeline_depth",	required_argument, NULL, 'p' },
+			{ "devices",		required_argument, NULL, 'D' },
+			{ "wait_policy",	required_argument, NULL, 'W' },
+			{ "desc_ring",		no_argument, NULL, 'R' },
+			{ "codec",		no_argument, NULL, 'z' },
+			{ "dma_engines",	required_argument, NULL, 'E' },
+			{ "reorder_window",	required_argument, NULL, 'O' },
+			{ "latency_dump",	no_argument, NULL, 'L' },
+			{ "perf_counters",	no_argument, NULL, 'e' },
+			{ "verify",	no_argument, NULL, 'X' },
+			{ "rate",		required_argument, NULL, 'r' },
+			{ "bench_output",	no_argument, NULL, 'B' },
+			{ "client",		required_argument, NULL, 'Q' },
+			{ "scheduler",		required_argument, NULL, 'q' },
+			{ "compute",		required_argument, NULL, 'c' },
+			{ "threads",		required_argument, NULL, 't' },
+			{ "chunk_size",		required_argument, NULL, 'k' },
+			{ "buffer_pool",	required_argument, NULL, 'P' },
+			{ "trace",	required_argument, NULL, 'T' },
+			{ "affinity",	required_argument, NULL, 'A' },
 			{ "help", no_argument, NULL, 'h' },
-			{ 0, no_argument, NULL, 0 },};		
+			{ 0, no_argument, NULL, 0 },};
 
 		ch = getopt_long(argc, argv,
-				"s:n:w:Hvfh",
+				"s:n:w:m:Hvfp:D:W:RzE:O:LeXr:BQ:q:c:t:k:P:T:A:h",
 				long_options, &option_index);
 		if (ch == -1)
 			break;
@@ -133,15 +1205,89 @@ int main(int argc, char*argv[]){
 			case 'w':
 				wait_time = optarg;
 				break;
+			case 'm':
+				model_spec = optarg;
+				break;
 			case 'H':
 				host_buffering = true;
-				break;		
+				break;
 			case 'v':
 				verbose = true;
-				break;		
+				break;
 			case 'f':
 				fpga_emulation = true;
 				break;
+			case 'p':
+				pipeline_depth = optarg;
+				break;
+			case 'D':
+				devices_arg = optarg;
+				break;
+			case 'W':
+				wait_policy = optarg;
+				break;
+			case 'R':
+				use_ring = true;
+				break;
+			case 'z':
+				use_codec = true;
+				break;
+			case 'E':
+				engines_arg = optarg;
+				break;
+			case 'O':
+				window_arg = optarg;
+				break;
+			case 'L':
+				latency_dump = true;
+				break;
+			case 'e':
+				perf_counters = true;
+				break;
+			case 'X':
+				verify = true;
+				break;
+			case 'r':
+				rate_spec = optarg;
+				break;
+			case 'B':
+				bench_output = true;
+				break;
+			case 'Q':
+				if (num_clients == SCHED_MAX_CLIENTS){
+					printf("At most %d clients \n",SCHED_MAX_CLIENTS);
+					exit(EXIT_FAILURE);
+				}
+				if (parse_client(optarg, &clients[num_clients], num_clients)){
+					printf("Invalid client %s \n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				num_clients++;
+				break;
+			case 'q':
+				sched_spec = optarg;
+				break;
+			case 'c':
+				compute_name = optarg;
+				break;
+			case 't':
+				threads_arg = optarg;
+				break;
+			case 'k':
+				chunk_arg = optarg;
+				break;
+			case 'P':
+				buffer_pool_arg = optarg;
+				break;
+			case 'T':
+				trace_path = optarg;
+				break;
+			case 'A':
+				if (affinity_parse(optarg, &affinity_cfg)){
+					printf("Invalid affinity %s \n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'h':
 				usage(argv[0]);
 				exit(EXIT_SUCCESS);
@@ -149,7 +1295,7 @@ int main(int argc, char*argv[]){
 			default:
 				usage(argv[0]);
 				exit(EXIT_FAILURE);
-				break;	
+				break;
 		}
 	}
 
@@ -158,75 +1304,226 @@ int main(int argc, char*argv[]){
 		exit(EXIT_FAILURE);}
 
 	if (in_size != NULL) {
-		vector_size = atoi(in_size);
+		base.vector_size = atoi(in_size);
 	}
 
 	if (num_iteration != NULL) {
-		max_iteration = atoi(num_iteration);
+		base.max_iteration = atoi(num_iteration);
 	}
 
-	if (wait_time != NULL) {
-		sleep_time = atof(wait_time);
-		printf("sleep : %f \n",sleep_time);
+	if (pipeline_depth != NULL) {
+		base.num_streams = atoi(pipeline_depth);
+		if ((base.num_streams < 1) || (base.num_streams > MAX_STREAMS)){
+			printf("Pipeline depth should be between 1 and %d \n",MAX_STREAMS);
+			exit(EXIT_FAILURE);
+		}
 	}
 
+	if (devices_arg != NULL) {
+		num_devices = atoi(devices_arg);
+		if ((num_devices < 1) || (num_devices > MAX_DEVICES)){
+			printf("Number of devices should be between 1 and %d \n",MAX_DEVICES);
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	size = vector_size*sizeof(uint32_t);
+	base.window = REORDER_MAX_WINDOW;
+	if (engines_arg != NULL) {
+		base.num_engines = atoi(engines_arg);
+		if ((base.num_engines < 1) || (base.num_engines > MAX_DMA_ENGINES)){
+			printf("Number of DMA engines should be between 1 and %d \n",MAX_DMA_ENGINES);
+			exit(EXIT_FAILURE);
+		}
+		if (!fpga_emulation || !use_ring){
+			printf("DMA engines take their transfers from the descriptor ring (-f -R)\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (window_arg != NULL) {
+		base.window = atoi(window_arg);
+		if ((base.window < 1) || (base.window > REORDER_MAX_WINDOW)){
+			printf("Reorder window should be between 1 and %d \n",REORDER_MAX_WINDOW);
+			exit(EXIT_FAILURE);
+		}
+		if (engines_arg == NULL){
+			printf("The reorder window is only used by the DMA engines (-E)\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	////////////////////////////////////////////////////////////////
-	//               MEMORY ALLOCATION ON GPU
-	////////////////////////////////////////////////////////////////
+	if (threads_arg != NULL) {
+		num_threads = atoi(threads_arg);
+		if ((num_threads < 1) || (num_threads > WORKER_POOL_MAX_THREADS)){
+			printf("Number of threads should be between 1 and %d \n",WORKER_POOL_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	memory_allocation_gpu(ibuff,size);
-	memory_allocation_gpu(obuff,size);
+	if (chunk_arg != NULL) {
+		chunk_size = atol(chunk_arg);
+		if (chunk_size <= 0){
+			printf("Chunk size should be superior to 0\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// the worker pool of the cpu backend runs one vector at a time
+	if ((num_devices > 1) && (num_threads > 1)){
+		printf("Threads (-t) are shared by the whole process, use one thread per device with -D\n");
+		exit(EXIT_FAILURE);
+	}
+
+	buffer_pool_config_init(&buffer_cfg);
+	if ((buffer_pool_arg != NULL) && buffer_pool_parse(buffer_pool_arg, &buffer_cfg)){
+		printf("Invalid buffer pool configuration %s \n",buffer_pool_arg);
+		exit(EXIT_FAILURE);
+	}
+	// before the first buffer : the pool is bound to the node, or first
+	// touched from the pinned HOST thread
+	if (affinity_init(&affinity_cfg)){
+		exit(EXIT_FAILURE);
+	}
+	buffer_cfg.numa_node = affinity_numa_node();
+	buffer_pool_init(&buffer_cfg);
+
+	if (trace_path != NULL){
+		trace_init(TRACE_DEFAULT_EVENTS);
+		trace_thread_start("host");
+	}
+
+	load_gen_init(&base.load);
+	if ((rate_spec != NULL) && load_gen_parse(rate_spec, &base.load)){
+		printf("Invalid rate %s \n",rate_spec);
+		exit(EXIT_FAILURE);
+	}
+
+	device_model_init(&base.model);
+	if ((model_spec != NULL) && device_model_parse(model_spec, &base.model)){
+		printf("Invalid device model %s \n",model_spec);
+		exit(EXIT_FAILURE);
+	}
+	if (wait_time != NULL) {
+		double sleep_time = atof(wait_time);
 
-	if (!host_buffering){
+		if (sleep_time < 0){
+			printf("Wait time should be positive\n");
+			exit(EXIT_FAILURE);
+		}
+		base.model.process_ns = (uint64_t)(sleep_time * 1e9);
+		printf("sleep : %f \n",sleep_time);
+	}
+	if (device_model_enabled(&base.model)){
 		if (fpga_emulation){
-			init_buffers(obuff,vector_size);
+			device_model_print(&base.model, stdout);
 		} else {
-			init_buffers(ibuff,vector_size);
+			printf("The device model is only used by the FPGA emulator (-f)\n");
 		}
 	}
 
-	////////////////////////////////////////////////////////////////
-	//               MEMORY ALLOCATION ON HOST
-	////////////////////////////////////////////////////////////////
 
-	if (host_buffering){	
-		memory_allocation_host(bufferA,size);
-		memory_allocation_host(bufferB,size);
+	if (use_codec){
+		if (!fpga_emulation || !use_ring){
+			printf("The link codec encodes the descriptor ring transfers (-f -R)\n");
+			exit(EXIT_FAILURE);
+		}
+		// each device counts its own, see pipeline_init()
+		base.link_codec = &base.codec;
+	}
 
-		for (int i = 0; i < vector_size; i++){
-			for (int stream = 0; stream < MAX_STREAMS; stream++){
-				bufferA[stream][i] = 1;
-				bufferB[stream][i] = i + 1000*stream;
+	job_sched_config_init(&sched_cfg);
+	if ((sched_spec != NULL) && job_sched_parse(sched_spec, &sched_cfg)){
+		printf("Invalid scheduler %s \n",sched_spec);
+		exit(EXIT_FAILURE);
+	}
+	if ((sched_spec != NULL) && (num_clients == 0)){
+		printf("The scheduler is only used by the clients (-Q)\n");
+		exit(EXIT_FAILURE);
+	}
+	if (num_clients > 0){
+		if (!fpga_emulation || !use_ring || use_codec || host_buffering ||
+				load_gen_enabled(&base.load) || (num_devices > 1) || (base.num_engines > 0)){
+			printf("Clients share the descriptor ring emulator (-f -R, without -H, -z, -r, -D or -E)\n");
+			exit(EXIT_FAILURE);
+		}
+		for (int c = 0; c < num_clients; c++){
+			if (clients[c].size == 0){
+				clients[c].size = base.vector_size;
+			}
+			if (clients[c].size > base.vector_size){
+				printf("Client %s vectors are bigger than the emulator buffer (-s)\n",
+						clients[c].name);
+				exit(EXIT_FAILURE);
 			}
+			clients[c].requests = base.max_iteration;
+			clients[c].verify = verify;
 		}
 	}
 
-	///////////////////////////////////////////////////////////////
-	//	 RUNNING FPGA EMULATOR ON SPECIFIC THREAD
-	///////////////////////////////////////////////////////////////
-	pthread_t thread;
+	if ((wait_policy != NULL) && wait_policy_parse(wait_policy, &wait_type)){
+		printf("Unknown wait policy %s \n",wait_policy);
+		exit(EXIT_FAILURE);
+	}
+	wait_policy_init(&base.wait, wait_type);
+	base.host_buffering = host_buffering;
+	base.fpga_emulation = fpga_emulation;
+	base.verbose = verbose;
+	base.verify = verify;
+	base.perf_counters = perf_counters;
 
-	if (fpga_emulation) {
+	if (num_clients > 0){
+		pipeline_init(&base, 0, 1);
+		rc = run_clients(&base, clients, num_clients, &sched_cfg);
 
-		if (host_buffering){
-			addr_read = bufferB[0];
-			addr_write = bufferA[0];
-		}else{
-			addr_read = obuff[0];
-			addr_write = ibuff[0];
+		affinity_report(NULL, stdout);
+		if (trace_path != NULL){
+			trace_dump(trace_path);
 		}
+		trace_free();
+		buffer_pool_report(stdout);
+		buffer_pool_destroy();
+		return rc;
+	}
 
-		printf("Running FPGA Emulator \n");
-		if (pthread_create(&thread, NULL, &fpga_emulator, (void *) &sleep_time)){
-			fprintf(stderr, "Error creating FPGA Emulator thread \n");
-			return 1;
+	compute = compute_backend_lookup(compute_name);
+	if (compute == NULL){
+		printf("Unknown or unsupported compute backend %s \n",
+				compute_name ? compute_name : "(default)");
+		exit(EXIT_FAILURE);
+	}
+	if (compute == &cpu_backend){
+		printf("Compute backend : cpu (%s kernel)\n", cpu_kernel_name());
+	} else {
+		printf("Compute backend : %s\n", compute->name);
+	}
+	if (num_threads > 1){
+		if (compute != &cpu_backend){
+			printf("Threads are only used by the cpu compute backend\n");
+		} else {
+			pool = worker_pool_create(num_threads, chunk_size);
+			if (pool == NULL){
+				exit(EXIT_FAILURE);
+			}
+			cpu_kernel_set_pool(pool);
 		}
+	}
+	base.compute = compute;
 
-		if (pthread_mutex_init(&lock, NULL) != 0){
-			printf("Mutex initialization failed.\n");
+	///////////////////////////////////////////////////////////////
+	//	 RUNNING FPGA EMULATORS ON SPECIFIC THREADS
+	///////////////////////////////////////////////////////////////
+
+	pipes = calloc(num_devices, sizeof(*pipes));
+	if (pipes == NULL){
+		fprintf(stderr, "Error allocating the devices \n");
+		return 1;
+	}
+	if (fpga_emulation){
+		printf("Running FPGA Emulator%s \n", num_devices > 1 ? "s" : "");
+	}
+	for (int d = 0; d < num_devices; d++){
+		pipes[d] = base;
+		pipeline_init(&pipes[d], d, num_devices);
+		if (pipeline_setup(&pipes[d], use_ring)){
 			return 1;
 		}
 	}
@@ -234,88 +1531,57 @@ int main(int argc, char*argv[]){
 	///////////////////////////////////////////////////////////////
 	//             RUNNING GPU KERNEL PIPELINING
 	//////////////////////////////////////////////////////////////
-	int stream =0,next_stream =0;
-	uint32_t *tmp = NULL;
 
 	printf("Starting pipelinning \n");
 	gettimeofday(&begin_time, NULL);
-
-	for (int iteration = 0; iteration < max_iteration; iteration++){
-		stream = iteration % MAX_STREAMS;	
-		next_stream = (iteration+1) % MAX_STREAMS;	
-
-		if (fpga_emulation){
-			//FPGA is writing data in buffer
-			while(flags[stream] == 1){ 
-				sleep(0.000001);
+	if (num_devices == 1){
+		run_pipeline(&pipes[0]);
+	} else {
+		for (int d = 0; d < num_devices; d++){
+			if (pthread_create(&pipes[d].host, NULL, &run_pipeline, &pipes[d])){
+				fprintf(stderr, "Error creating host pipeline thread \n");
+				exit(EXIT_FAILURE);
 			}
+			pin_thread(&pipes[d], pipes[d].host, AFFINITY_HOST);
 		}
-
-		if (host_buffering){
-			//Running kernel on GPU with HOST buffering (Config 1)
-			run_new_stream_v1(bufferA[stream],bufferB[stream],ibuff[stream],obuff[stream],vector_size);	   	
-
-			// Setting parameters for the newt iteration
-			if (fpga_emulation){
-				addr_read = bufferB[next_stream];
-				addr_write = bufferA[next_stream];
-			} else {
-				tmp = bufferA[stream];
-				bufferA[stream] = bufferB[stream];
-				bufferB[stream] = tmp;
-			}	
-
-			if (verbose){
-				printf("Writting : [%d,%d, ... ,%d]\n",bufferA[0][0],bufferA[0][1],bufferA[0][vector_size-1]); 
-				printf("Received : [%d,%d, ... ,%d]\n",bufferB[0][0],bufferB[0][1],bufferB[0][vector_size-1]); 
-			}
-
-		} else {
-			//Running kernel on GPU without HOST buffering (Config 2)
-			run_new_stream_v2(ibuff[stream],obuff[stream],vector_size);
-
-			if (fpga_emulation){
-				addr_read = obuff[next_stream];
-				addr_write = ibuff[next_stream];
-			} else {
-				tmp = ibuff[stream];
-				ibuff[stream] = obuff[stream];
-				obuff[stream] = tmp;
-			}	
-
-			if (verbose) {	   	
-				printf("Writting : [%d,%d, ... ,%d]\n",ibuff[0][0],ibuff[0][1],ibuff[0][vector_size-1]); 
-				printf("Received : [%d,%d, ... ,%d]\n",obuff[0][0],obuff[0][1],obuff[0][vector_size-1]); 
-			}
-		}	
-
-		if (fpga_emulation){
-			// FPGA can read/write new data	
-			pthread_mutex_lock(&lock);	
-			flags[stream] = 1;
-			pthread_mutex_unlock(&lock);
+		for (int d = 0; d < num_devices; d++){
+			pthread_join(pipes[d].host, NULL);
 		}
 	}
-
 	gettimeofday(&end_time, NULL);
+	lcltime = (long long)(timediff_usec(&end_time, &begin_time));
 
-	if (fpga_emulation){
-		pthread_join(thread, NULL);
+	for (int d = 0; d < num_devices; d++){
+		if (fpga_emulation){
+			pipeline_join(&pipes[d]);
+		}
 	}
 
-	printf("Completed %d iterations successfully\n", max_iteration);
-
-	// Display the time of the action excecution
-	lcltime = (long long)(timediff_usec(&end_time, &begin_time));
-	fprintf(stdout, "GPU average processing time for %u iteration is %f usec with config %d\n",
-			max_iteration, (float)lcltime/(float)(max_iteration),
-			host_buffering ? 1 : 2);
-
-	if (host_buffering){
-		free_host(bufferA);
-		free_host(bufferB);
+	for (int d = 0; d < num_devices; d++){
+		if (num_devices > 1){
+			printf("\nDevice %d :\n", d);
+		}
+		if (pipeline_report(&pipes[d], latency_dump, bench_output && (num_devices == 1))){
+			rc = 1;
+		}
 	}
+	if (num_devices > 1){
+		printf("\n");
+		devices_report(pipes, num_devices, lcltime, bench_output);
+	}
+	affinity_report((compute == &cpu_backend) ? pipes[0].ibuff[0] : NULL, stdout);
 
-	free_device(ibuff);
-	free_device(obuff);
+	for (int d = 0; d < num_devices; d++){
+		pipeline_free(&pipes[d]);
+	}
+	free(pipes);
+	if (trace_path != NULL){
+		trace_dump(trace_path);
+	}
+	trace_free();
+	buffer_pool_report(stdout);
+	buffer_pool_destroy();
+	cpu_kernel_set_pool(NULL);
+	worker_pool_destroy(pool);
+	return rc;
 }
@@ -39,6 +39,7 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include <snap_tools.h>
 #include <libsnap.h>
@@ -46,22 +47,35 @@
 #include <snap_hls_if.h>
 
 #include <kernel.h>
+#include <wait_policy.h>
+#include <desc_ring.h>
+#include <run_stats.h>
+#include <worker_pool.h>
+#include <verify.h>
+#include <codec.h>
+#include <affinity.h>
+#include <card_dram.h>
+#include <parse_utils.h>
+
+/* Vectors of a batch job table (-b) */
+#define MAX_BATCH_VECTORS (1 << 16)
 
 // Function that fills the MMIO registers / data structure 
 // // these are all data exchanged between the application and the action
 static void snap_prepare_parallel_memcpy(struct snap_job *cjob,
 		struct parallel_memcpy_job *mjob,
-		int size,int max_iteration,uint8_t type,
+		uint64_t size,uint64_t max_iteration,uint8_t type,
 		void *addr_read,void *addr_write,
-		void *addr_read_flag, void *addr_write_flag)
+		void *addr_read_flag, void *addr_write_flag,
+		struct desc_ring *ring, struct parallel_memcpy_table *table)
 {
 	fprintf(stderr, "  prepare parallel_memcpy job of %ld bytes size\n", sizeof(*mjob));
 
 	assert(sizeof(*mjob) <= SNAP_JOBSIZE);
 	memset(mjob, 0, sizeof(*mjob));
 
-	mjob->vector_size = (uint64_t)size;
-	mjob->max_iteration = (uint64_t)max_iteration;
+	mjob->vector_size = size;
+	mjob->max_iteration = max_iteration;
 
 	// Setting output params : where result will be written in host memory
 	snap_addr_set(&mjob->read, addr_read, size*sizeof(uint32_t), type,
@@ -76,6 +90,25 @@ static void snap_prepare_parallel_memcpy(struct snap_job *cjob,
 	snap_addr_set(&mjob->write_flag, addr_write_flag, 64, type,
 			SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC |SNAP_ADDRFLAG_END);
 
+	// Descriptor ring replaces the flags (software action only)
+	if (ring != NULL) {
+		mjob->mode = PARALLEL_MEMCPY_MODE_RING;
+		snap_addr_set(&mjob->queue, ring,
+				sizeof(*ring) + ring->size*sizeof(struct desc_ring_desc), type,
+				SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC | SNAP_ADDRFLAG_DST |
+				SNAP_ADDRFLAG_END);
+	}
+
+	// Job table : one start goes through all of its transfers (software action only)
+	if (table != NULL) {
+		mjob->mode = PARALLEL_MEMCPY_MODE_BATCH;
+		mjob->max_iteration = table->count;
+		snap_addr_set(&mjob->queue, table,
+				sizeof(*table) + table->count*sizeof(struct parallel_memcpy_entry), type,
+				SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC | SNAP_ADDRFLAG_DST |
+				SNAP_ADDRFLAG_END);
+	}
+
 	snap_job_set(cjob, mjob, sizeof(*mjob), NULL, 0);
 }
 
@@ -83,8 +116,275 @@ static void update_flag(uint8_t **flag, uint8_t flag_value, uint64_t addr){
 	for (int i = 0; i < (int)sizeof(uint64_t); i++){
 		(*flag)[i+1] = (addr >> 8*i) & 0xFF;
 	}
-	(*flag)[0] = (uint8_t)flag_value;
+	// address must be visible before the action sees the flag
+	__atomic_store_n(&(*flag)[0], (uint8_t)flag_value, __ATOMIC_RELEASE);
+	trace_instant(TRACE_FLAG_SET, addr);
+}
+
+// Hands one buffer slot over to the FPGA : the action will read the result
+// of the slot (read_buff) and write a new vector into it (write_buff)
+static void arm_slot(uint8_t **read_flag, uint8_t **write_flag,
+		uint32_t *read_buff, uint32_t *write_buff){
+	update_flag(read_flag, 1, (unsigned long)read_buff);
+	update_flag(write_flag, 1, (unsigned long)write_buff);
+}
+
+static bool flags_cleared(const uint8_t *read_flag, const uint8_t *write_flag){
+	return (__atomic_load_n(&read_flag[0], __ATOMIC_ACQUIRE) != 1) &&
+		(__atomic_load_n(&write_flag[0], __ATOMIC_ACQUIRE) != 1);
+}
+
+/*
+ * Full duplex flags (-F) : the read side (the FPGA reads the output of a
+ * slot) and the write side (the FPGA writes the input of a slot) are
+ * tracked on their own. Transfer j of a side uses slot j % slots, it is
+ * handed over as soon as the side is free and compute j - slots is over,
+ * whatever the other side is doing.
+ */
+enum duplex_side { SIDE_READ = 0, SIDE_WRITE, SIDE_MAX };
+
+struct duplex {
+	uint8_t *flag[SIDE_MAX];
+	uint32_t **buff[SIDE_MAX];
+	int slots;
+	uint64_t limit;			/* transfers of the run */
+	uint64_t armed[SIDE_MAX];	/* transfers handed over */
+	uint64_t done[SIDE_MAX];	/* transfers completed */
+	uint64_t early[SIDE_MAX];	/* handed over while the other side was busy */
+	uint64_t last[SIDE_MAX];	/* iterations that waited for this side */
+};
+
+static void duplex_init(struct duplex *d, uint8_t *read_flag, uint8_t *write_flag,
+		uint32_t **read_buff, uint32_t **write_buff, int slots, uint64_t limit){
+	memset(d, 0, sizeof(*d));
+	d->flag[SIDE_READ] = read_flag;
+	d->flag[SIDE_WRITE] = write_flag;
+	d->buff[SIDE_READ] = read_buff;
+	d->buff[SIDE_WRITE] = write_buff;
+	d->slots = slots;
+	d->limit = limit;
+}
+
+// Retires the completed transfers, hands the next ones over up to allowed - 1
+static void duplex_poll(struct duplex *d, uint64_t allowed){
+	for (int side = 0; side < SIDE_MAX; side++){
+		int other = !side;
+
+		if ((d->armed[side] > d->done[side]) &&
+				(__atomic_load_n(&d->flag[side][0], __ATOMIC_ACQUIRE) != 1)){
+			d->done[side]++;
+			if (d->done[other] >= d->done[side]){
+				d->last[side]++;
+			}
+		}
+		if ((d->armed[side] == d->done[side]) && (d->armed[side] < allowed) &&
+				(d->armed[side] < d->limit)){
+			// the other side still moves a previous transfer
+			if (d->done[other] < d->armed[side]){
+				d->early[side]++;
+			}
+			update_flag(&d->flag[side], 1,
+					(unsigned long)d->buff[side][d->armed[side] % d->slots]);
+			d->armed[side]++;
+		}
+	}
+}
+
+// Both transfers of the iteration are over : its input has landed and its
+// output slot has been read
+static bool duplex_ready(struct duplex *d, uint64_t iteration){
+	duplex_poll(d, iteration + d->slots);
+	return (d->done[SIDE_READ] > iteration) && (d->done[SIDE_WRITE] > iteration);
+}
+
+static void duplex_report(const struct duplex *d, FILE *out){
+	fprintf(out, "Full duplex : %llu reads and %llu writes handed over while the other side was busy, "
+			"iterations waited %llu times for a read and %llu times for a write\n",
+			(unsigned long long)d->early[SIDE_READ], (unsigned long long)d->early[SIDE_WRITE],
+			(unsigned long long)d->last[SIDE_READ], (unsigned long long)d->last[SIDE_WRITE]);
+}
+
+/*
+ * Link codec (-z, descriptor ring only) : the output of a slot is encoded in
+ * out[slot] and the action moves the encoded bytes. It sends them back in
+ * in[slot], which is decoded into the next input of the slot.
+ */
+struct link_slots {
+	uint32_t *out[MAX_STREAMS], *in[MAX_STREAMS];
+	size_t len[MAX_STREAMS];
+	struct codec_stats stats;
+};
+
+static void encode_slot(struct link_slots *link, int stream,
+		const uint32_t *read_buff, int vector_size){
+	link->len[stream] = codec_encode(read_buff, vector_size, link->out[stream], &link->stats);
+}
+
+static void decode_slot(struct link_slots *link, int stream,
+		uint32_t *write_buff, int vector_size){
+	codec_decode(link->in[stream], link->len[stream], write_buff, vector_size, &link->stats);
+}
+
+static void post_slot(struct desc_ring *ring, struct link_slots *link, int stream,
+		uint32_t *read_buff, uint32_t *write_buff, size_t size){
+	if (link != NULL){
+		desc_ring_post(ring, link->out[stream], link->in[stream], link->len[stream]);
+	} else {
+		desc_ring_post(ring, read_buff, write_buff, size);
+	}
+	trace_instant(TRACE_FLAG_SET, stream);
+}
 
+// Tiles out of the dataset are read from / written to the scratch buffer
+static uint32_t *tile_addr(uint32_t *dataset, uint32_t *scratch,
+		int64_t tile, uint64_t num_tiles, int vector_size){
+	if ((tile < 0) || ((uint64_t)tile >= num_tiles)){
+		return scratch;
+	}
+	return dataset + (uint64_t)tile*vector_size;
+}
+
+/*
+ * Tiled streaming (-S) : the dataset is cut in tiles of vector_size elements
+ * pushed back to back through the action. The action is a one iteration
+ * delay line (it writes what it read the iteration before), so each tile
+ * goes through it twice :
+ *  - even iteration 2i   : read tile i, write the result of tile i-2 in place
+ *  - odd iteration 2i+1  : write tile i in the GPU input buffer and read the
+ *                          result of tile i-1 from the GPU output buffer
+ * The GPU computes tile i while the action runs iteration 2i+2, which only
+ * touches the dataset. The action runs 2 x num_tiles + 3 iterations.
+ */
+static void run_tiles(struct wait_policy *wait, struct run_stats *stats,
+		uint8_t *read_flag, uint8_t *write_flag,
+		const struct compute_backend *compute, bool host_buffering,
+		uint32_t *ibuff, uint32_t *obuff, uint32_t *bufferA, uint32_t *bufferB,
+		uint32_t *dataset, uint32_t *scratch, uint64_t num_tiles, int vector_size){
+	// FPGA writes(reads) the GPU input(output) in these buffers
+	uint32_t *gpu_in = host_buffering ? bufferA : ibuff;
+	uint32_t *gpu_out = host_buffering ? bufferB : obuff;
+	uint64_t iteration_start = 0, t = 0;
+
+	// iteration 0 : first tile in, nothing to write back yet
+	arm_slot(&read_flag, &write_flag,
+			tile_addr(dataset, scratch, 0, num_tiles, vector_size), scratch);
+	wait_until(wait, flags_cleared(read_flag, write_flag));
+	arm_slot(&read_flag, &write_flag, gpu_out, gpu_in);
+
+	for (uint64_t i = 0; i < num_tiles; i++){
+		iteration_start = t = run_stats_begin(stats);
+
+		// iteration 2i+1 : tile i is in the GPU input buffer
+		wait_until(wait, flags_cleared(read_flag, write_flag));
+		t = run_stats_mark(stats, PHASE_WAIT, t);
+
+		arm_slot(&read_flag, &write_flag,
+				tile_addr(dataset, scratch, i + 1, num_tiles, vector_size),
+				tile_addr(dataset, scratch, (int64_t)i - 1, num_tiles, vector_size));
+		t = run_stats_mark(stats, PHASE_FLAG_UPDATE, t);
+
+		if (host_buffering){
+			compute->run_new_stream_v1(bufferA,bufferB,ibuff,obuff,vector_size);
+		} else {
+			compute->run_new_stream_v2(ibuff,obuff,vector_size);
+		}
+		t = run_stats_mark(stats, PHASE_COMPUTE, t);
+
+		// iteration 2i+2 : tile i+1 read, result of tile i-1 in place
+		wait_until(wait, flags_cleared(read_flag, write_flag));
+		t = run_stats_mark(stats, PHASE_WAIT, t);
+
+		arm_slot(&read_flag, &write_flag, gpu_out, gpu_in);
+		run_stats_mark(stats, PHASE_FLAG_UPDATE, t);
+		run_stats_mark(stats, PHASE_ITERATION, iteration_start);
+	}
+
+	// iteration 2N+2 : result of the last tile in place
+	wait_until(wait, flags_cleared(read_flag, write_flag));
+	arm_slot(&read_flag, &write_flag, scratch,
+			tile_addr(dataset, scratch, (int64_t)num_tiles - 1, num_tiles, vector_size));
+	wait_until(wait, flags_cleared(read_flag, write_flag));
+}
+
+/*
+ * Batch jobs (-b) : every iteration is one job moving num_vectors vectors.
+ * Vector k goes from out + k*vector_size (result of the previous job) to
+ * in + k*vector_size through the action, then the GPU computes all of
+ * them. The job table is filled once, each job only resets its done word,
+ * sets the job registers and starts the action : the start and the
+ * completion are paid once per table instead of a flag round trip per
+ * vector.
+ */
+static unsigned long run_batches(struct snap_action *action, struct snap_job *cjob,
+		struct wait_policy *wait, struct run_stats *stats, struct verify_stats *check,
+		const struct compute_backend *compute, struct parallel_memcpy_table *table,
+		uint32_t *batch_in, uint32_t *batch_out, int vector_size, int max_iteration,
+		bool verify){
+	uint64_t iteration_start = 0, t = 0;
+	unsigned long errors = 0;
+
+	for (int iteration = 0; iteration < max_iteration; iteration++){
+		iteration_start = t = run_stats_begin(stats);
+
+		__atomic_store_n(&table->done, 0, __ATOMIC_RELAXED);
+		if (snap_action_sync_execute_job_set_regs(action, cjob) != 0){
+			printf("error while setting registers");
+		}
+		snap_action_start(action);
+		t = run_stats_mark(stats, PHASE_FLAG_UPDATE, t);
+
+		wait_until(wait, __atomic_load_n(&table->done, __ATOMIC_ACQUIRE) == table->count);
+		t = run_stats_mark(stats, PHASE_WAIT, t);
+		for (uint64_t k = 0; k < table->count; k++){
+			if (table->entry[k].status != DESC_STATUS_DONE){
+				errors++;
+			}
+		}
+
+		for (uint64_t k = 0; k < table->count; k++){
+			compute->run_new_stream_v2(batch_in + k*vector_size, batch_out + k*vector_size,
+					vector_size);
+		}
+		t = run_stats_mark(stats, PHASE_COMPUTE, t);
+
+		// out of the phases, only the iteration includes it
+		if (verify){
+			for (uint64_t k = 0; k < table->count; k++){
+				verify_vector_add(check, batch_in + k*vector_size, batch_out + k*vector_size,
+						vector_size, iteration*table->count + k);
+			}
+		}
+		run_stats_mark(stats, PHASE_ITERATION, iteration_start);
+	}
+	return errors;
+}
+
+/*
+ * Uploads (evict : evicts) the count fixed inputs of the run to (from) the
+ * card DRAM : slot[k], or vector k of batch. Returns how many were.
+ */
+static int card_dram_inputs(uint32_t *const *slot, const uint32_t *batch, int count,
+		int vector_size, bool evict){
+	size_t size = vector_size*sizeof(uint32_t);
+	int done = 0;
+
+	for (int k = 0; k < count; k++){
+		const uint32_t *in = (batch != NULL) ? batch + (size_t)k*vector_size : slot[k];
+
+		if ((evict ? card_dram_evict(in, size) : card_dram_upload(in, size)) == 0){
+			done++;
+		}
+	}
+	return done;
+}
+
+// "8G", "512M", "100000" : number of uint32_t elements
+static int parse_elements(const char *arg, uint64_t *elements){
+	// a wrapped value would be an unrelated size
+	if (parse_size(arg, elements) || (*elements == 0)){
+		return -1;
+	}
+	return 0;
 }
 
 
@@ -94,25 +394,62 @@ static void usage(const char *prog)
 			"  -s, --vector_size <N>     	size of the uint32_t buffer arrays.\n"
 			"  -n, --num_iteration <N>   	number of iterations in a run.\n"
 			"  -H, --host_buffering      	enable host buffering to test config 1 (default is config 2).\n"
+			"  -p, --pipeline_depth <N>  	number of buffer slots in flight (1 to %d, default is 1).\n"
+			"  -S, --stream_size <N>     	stream N uint32_t (K, M or G suffix) through the action in tiles\n"
+			"                            	of vector_size elements, results are written in place.\n"
+			"  -b, --batch <N>           	each iteration is one job moving N vectors listed in a job table\n"
+			"                            	(software action only, SNAP_CONFIG=CPU).\n"
+			"  -W, --wait_policy <name>  	how to wait for the FPGA : spin, yield (default), backoff or block.\n"
+			"  -F, --full_duplex         	track the read and write flags on their own, each side is handed\n"
+			"                            	its next transfer as soon as it is free.\n"
+			"  -R, --desc_ring           	post transfers in a descriptor ring instead of the flags\n"
+			"                            	(software action only, SNAP_CONFIG=CPU).\n"
+			"  -z, --codec               	delta + bit packing encoding of the transfers (with -R).\n"
+			"  -L, --latency_dump        	print the latency histograms of every phase.\n"
+			"  -e, --perf_counters       	count cycles, instructions, cache and TLB misses per phase.\n"
+			"  -X, --verify              	check every result with a checksum, without printing in the loop.\n"
+			"  -c, --compute <name>      	compute backend : gpu (default when built with CUDA), cpu or cpu:<isa>\n"
+			"                            	(isa is scalar, sse4, avx2, avx512 or vsx, best one by default).\n"
+			"  -t, --threads <N>         	threads computing each vector with the cpu backend (1 to %d, default is 1).\n"
+			"  -k, --chunk_size <N>      	elements computed by a thread at a time (default is %d).\n"
+			"  -P, --buffer_pool <spec>  	buffer pool pages and options : thp (default), 2m, 1g,\n"
+			"                            	mlock, prefault (default) or noprefault (comma separated).\n"
+			"  -A, --affinity <item>     	pin threads, bind buffers : host=, device=, workers= with a cpu list,\n"
+			"                            	near or node<N>, mem=near|node<N>, device_node=<N>, auto (repeatable).\n"
+			"  -T, --trace <file>        	write a Chrome trace of the host and device threads.\n"
+			"  -M, --card_dram <spec>    	keep the inputs read by the action in an emulated card DRAM of one\n"
+			"                            	vector slots : size=<bytes> (K, M or G suffix, default 64M), key=hash|addr.\n"
+			"  -I, --fixed_input         	the action reads the same input vector of each slot at every\n"
+			"                            	iteration instead of the GPU results (no -S).\n"
+			"  -U, --upload              	upload the fixed inputs to the card DRAM before the run (-I and -M).\n"
+			"  -B, --bench_output        	print a machine readable summary line (used by bench_sweep).\n"
 			"\n"
  			"----------------------------------------------------\n"
-			"WARNING ! This code only works with MAX_STREAMS=1 at this stage\n"
-			"(MAX_STREAMS is defined in includes/kernel.h)\n"
-			"\n"
 			"WARNING ! This code only works with vector_size < 131072 \n"
 			"because of FPGA in-memory limitations on this version of the image).\n"
+			"Bigger datasets are streamed in tiles with -S.\n"
 			"\n"
 			"\n"
 			"REMARKS: Two config can be tested with this code: \n"
 			"Config 1 : Data is copied on the HOST before being sent to the GPU(-H to enable this config)\n"
 			"Config 2 : Data is copied directly from the HOST to the GPU (default config)\n"
+			"Config 3 : Config 1 or 2 with a pipeline depth > 1, the FPGA fills the next\n"
+			"           slot while the GPU computes the current one\n"
 			"----------------------------------------------------\n"
 			"\n"
+			"Useful parameters (to be placed before the command):\n"
+			"----------------------------------------------------\n"
+			"SNAP_CONFIG=FPGA hardware execution   (default mode)\n"
+			"SNAP_CONFIG=CPU  software execution\n"
+			"\n"
 			"Example usage:\n"
 			"-----------------------\n"
 			"main_application -s 1024 -n 10 -v\n"
+			"main_application -s 131072 -n 10000 -p 4\n"
+			"main_application -S 1G\n"
+			"main_application -s 1024 -n 100 -b 1000\n"
 			"\n",
-			prog);
+			prog, MAX_STREAMS, WORKER_POOL_MAX_THREADS, WORKER_POOL_DEFAULT_CHUNK);
 }
 
 /*-----------------------------------------------
@@ -125,16 +462,37 @@ static void usage(const char *prog)
  * Options that can be set using command line:
  * 	- n : Number of iterations
  * 	- s : Size of the uint32_t buffer arrays
- * 	- w : Wait time (used to emulate FPGA)
  * 	- H : Enable HOST buffering (config 1)
+ * 	- p : Pipeline depth (number of buffer slots, up to MAX_STREAMS)
+ * 	- S : Stream a dataset of any size through the action in tiles
+ * 	- b : Batch jobs, N vectors listed in a job table per action start
+ * 	- W : Wait policy used to poll the FPGA flags
+ * 	- F : Track the read and the write flag on their own (full duplex)
+ * 	- R : Use the descriptor ring instead of the flags (software action)
+ * 	- z : Encode the transfers of the descriptor ring (delta + bit packing)
+ * 	- L : Print the latency histograms of every phase
+ * 	- e : Hardware performance counters per phase
+ * 	- X : Check every result with a checksum (no output in the loop)
+ * 	- c : Compute backend (gpu, cpu or cpu:<isa>)
+ * 	- t : Threads of the cpu compute backend
+ * 	- k : Chunk size (elements) of the cpu compute backend threads
+ * 	- P : Buffer pool configuration (huge pages, mlock, prefault)
+ * 	- T : Chrome trace file of the host and device events
+ * 	- A : Thread and buffer placement (CPUs, NUMA node), repeatable
+ * 	- M : Emulated card DRAM keeping the inputs read by the action
+ * 	- I : Fixed input vectors, read again at every iteration
+ * 	- U : Upload the fixed inputs to the card DRAM before the run
+ * 	- B : Print a machine readable summary line (bench_sweep)
  * 	- v : Enable verbosity (for results checking)
- * 	- f : Enable FPGA Emulation
  *
- * WARNING ! This code only works with MAX_STREAMS=1 at this stage
- * (MAX_STREAMS is defined in includes/kernel.h)
+ * The action only knows one read_flag/write_flag pair, so slots are
+ * handed to the FPGA one after the other by rewriting the addresses
+ * stored in the flags. With more than one slot, the next slot is handed
+ * to the FPGA before the GPU starts working on the current one.
  *
  * WARNING ! This code only works with vector_size < 131072
  * because of FPGA in-memory limitations on this version of the image.
+ * Bigger datasets are cut in tiles of vector_size elements with -S.
  */
 
 int main(int argc, char *argv[])
@@ -149,6 +507,23 @@ int main(int argc, char *argv[])
 	struct parallel_memcpy_job mjob;
 	const char *num_iteration = NULL;
 	const char *in_size = NULL;
+	const char *pipeline_depth = NULL;
+	const char *stream_arg = NULL;
+	const char *batch_arg = NULL;
+	const char *wait_policy = NULL;
+	const char *compute_name = NULL;
+	const struct compute_backend *compute = NULL;
+	const char *threads_arg = NULL, *chunk_arg = NULL;
+	const char *buffer_pool_arg = NULL, *trace_path = NULL;
+	const char *card_dram_arg = NULL;
+	struct card_dram_config card_dram_cfg;
+	struct buffer_pool_config buffer_cfg;
+	struct affinity_config affinity_cfg;
+	int num_threads = 1;
+	long chunk_size = WORKER_POOL_DEFAULT_CHUNK;
+	struct worker_pool *pool = NULL;
+	struct wait_policy wait;
+	enum wait_policy_type wait_type = WAIT_SPIN_YIELD;
 	uint32_t *ibuff[MAX_STREAMS];
 	uint32_t *obuff[MAX_STREAMS];
 	uint32_t *bufferA[MAX_STREAMS];
@@ -158,15 +533,33 @@ int main(int argc, char *argv[])
 	uint64_t addr_read_flag = 0x0ull;
 	uint64_t addr_write_flag = 0x0ull;
 	uint8_t *write_flag = NULL, *read_flag = NULL;
+	struct desc_ring *ring = NULL;
+	struct link_slots link_buffers, *link = NULL;
+	struct duplex duplex_state, *duplex = NULL;
+	struct parallel_memcpy_table *table = NULL;
+	uint32_t *batch_in = NULL, *batch_out = NULL;
+	uint32_t *fixed_in[MAX_STREAMS] = { NULL }, *batch_fixed = NULL;
+	bool fixed_input = false, upload = false;
+	int num_vectors = 0;
+	unsigned long batch_errors = 0;
+	bool use_ring = false, use_codec = false, full_duplex = false;
+	unsigned long ring_errors = 0;
 	struct timeval etime, stime, begin_time, end_time;
 	unsigned long long int lcltime = 0x0ull;
 	uint32_t type = SNAP_ADDRTYPE_HOST_DRAM;
-	int max_iteration = 0, vector_size = 0;
-	bool host_buffering = false, verbose = false;
-	//int flags[MAX_STREAMS] = {1};
+	int max_iteration = 0, vector_size = 0, num_streams = 1;
+	uint64_t stream_size = 0, num_tiles = 0, job_iterations = 0, stream_errors = 0;
+	uint32_t *dataset = NULL, *scratch = NULL;
+	bool host_buffering = false, verbose = false, latency_dump = false, perf_counters = false, verify = false, bench_output = false;
+	struct run_stats stats;
+	struct verify_stats check;
+	uint64_t iteration_start = 0, t = 0;
 	int exit_code = EXIT_SUCCESS;
 	snap_action_flag_t action_irq = (SNAP_ACTION_DONE_IRQ | SNAP_ATTACH_IRQ);
 
+	// -A can be repeated
+	affinity_config_init(&affinity_cfg);
+
 	// collecting the command line arguments
 	while (1) {
 		int option_index = 0;
@@ -174,12 +567,32 @@ int main(int argc, char *argv[])
 			{ "vector_size",	 required_argument, NULL, 's' },
 			{ "num_iteration",	 required_argument, NULL, 'n' },
 			{ "host_buffering",	 no_argument, NULL, 'H' },
+			{ "pipeline_depth",	 required_argument, NULL, 'p' },
+			{ "stream_size",	 required_argument, NULL, 'S' },
+			{ "batch",	 required_argument, NULL, 'b' },
+			{ "wait_policy",	 required_argument, NULL, 'W' },
+			{ "full_duplex",	 no_argument, NULL, 'F' },
+			{ "desc_ring",	 no_argument, NULL, 'R' },
+			{ "codec",	 no_argument, NULL, 'z' },
+			{ "latency_dump",	 no_argument, NULL, 'L' },
+			{ "perf_counters",	 no_argument, NULL, 'e' },
+			{ "verify",	 no_argument, NULL, 'X' },
+			{ "bench_output",	 no_argument, NULL, 'B' },
+			{ "compute",	 required_argument, NULL, 'c' },
+			{ "threads",	 required_argument, NULL, 't' },
+			{ "chunk_size",	 required_argument, NULL, 'k' },
+			{ "buffer_pool",	 required_argument, NULL, 'P' },
+			{ "trace",	 required_argument, NULL, 'T' },
+			{ "affinity",	 required_argument, NULL, 'A' },
+			{ "card_dram",	 required_argument, NULL, 'M' },
+			{ "fixed_input",	 no_argument, NULL, 'I' },
+			{ "upload",	 no_argument, NULL, 'U' },
 			{ "verbose",	 no_argument, NULL, 'v' },
 			{ "help", no_argument, NULL, 'h' },
 			{ 0, no_argument, NULL, 0 },};		
 
 		ch = getopt_long(argc, argv,
-				"s:n:Hvh",
+				"s:n:Hp:S:b:W:FRzLeXBc:t:k:P:T:A:M:IUvh",
 				long_options, &option_index);
 		if (ch == -1)
 			break;
@@ -195,6 +608,69 @@ int main(int argc, char *argv[])
 			case 'H':
 				host_buffering = true;
 				break;		
+			case 'p':
+				pipeline_depth = optarg;
+				break;
+			case 'S':
+				stream_arg = optarg;
+				break;
+			case 'b':
+				batch_arg = optarg;
+				break;
+			case 'W':
+				wait_policy = optarg;
+				break;
+			case 'F':
+				full_duplex = true;
+				break;
+			case 'R':
+				use_ring = true;
+				break;
+			case 'z':
+				use_codec = true;
+				break;
+			case 'L':
+				latency_dump = true;
+				break;
+			case 'e':
+				perf_counters = true;
+				break;
+			case 'X':
+				verify = true;
+				break;
+			case 'B':
+				bench_output = true;
+				break;
+			case 'c':
+				compute_name = optarg;
+				break;
+			case 't':
+				threads_arg = optarg;
+				break;
+			case 'k':
+				chunk_arg = optarg;
+				break;
+			case 'P':
+				buffer_pool_arg = optarg;
+				break;
+			case 'T':
+				trace_path = optarg;
+				break;
+			case 'A':
+				if (affinity_parse(optarg, &affinity_cfg)){
+					printf("Invalid affinity %s \n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'M':
+				card_dram_arg = optarg;
+				break;
+			case 'I':
+				fixed_input = true;
+				break;
+			case 'U':
+				upload = true;
+				break;
 			case 'v':
 				verbose = true;
 				break;
@@ -224,7 +700,142 @@ int main(int argc, char *argv[])
 	if (num_iteration != NULL) {
 		max_iteration = atoi(num_iteration);
 	}
+	job_iterations = max_iteration;
 
+	if (stream_arg != NULL) {
+		if (parse_elements(stream_arg, &stream_size)){
+			printf("Invalid stream size %s \n",stream_arg);
+			exit(EXIT_FAILURE);
+		}
+		if (verify){
+			printf("Streaming checks the whole dataset at the end, -X is not used\n");
+			verify = false;
+		}
+		if (use_ring || (pipeline_depth != NULL)){
+			printf("Streaming uses the flags with a single buffer slot (no -R nor -p)\n");
+			exit(EXIT_FAILURE);
+		}
+		if (vector_size <= 0){
+			vector_size = MAX_SIZE;
+		}
+		num_tiles = stream_size / vector_size + (stream_size % vector_size != 0);
+		max_iteration = (num_tiles > INT_MAX) ? INT_MAX : (int)num_tiles;
+		job_iterations = 2*num_tiles + 3;
+	}
+
+	if (batch_arg != NULL) {
+		num_vectors = atoi(batch_arg);
+		if ((num_vectors < 1) || (num_vectors > MAX_BATCH_VECTORS)){
+			printf("Batch should be between 1 and %d vectors \n",MAX_BATCH_VECTORS);
+			exit(EXIT_FAILURE);
+		}
+		if ((stream_arg != NULL) || use_ring || use_codec || host_buffering ||
+				(pipeline_depth != NULL)){
+			printf("Batch jobs use their own buffers (no -S, -R, -z, -H nor -p)\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (full_duplex && ((stream_arg != NULL) || use_ring || use_codec || (batch_arg != NULL))){
+		printf("Full duplex tracks the flags of the buffer slots (no -S, -R, -z nor -b)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	card_dram_config_init(&card_dram_cfg);
+	if ((card_dram_arg != NULL) && card_dram_parse(card_dram_arg, &card_dram_cfg)){
+		printf("Invalid card DRAM configuration %s \n",card_dram_arg);
+		exit(EXIT_FAILURE);
+	}
+	if (fixed_input && (stream_arg != NULL)){
+		printf("Streaming reads every tile once, no -I\n");
+		exit(EXIT_FAILURE);
+	}
+	if (upload && (!fixed_input || (card_dram_arg == NULL))){
+		printf("Only the fixed inputs are uploaded to the card DRAM (-I and -M)\n");
+		exit(EXIT_FAILURE);
+	}
+	// the GPU rewrites its results in place : the address stays the same
+	if ((card_dram_arg != NULL) && !fixed_input && (card_dram_cfg.key == CARD_DRAM_KEY_ADDR)){
+		printf("A card DRAM keyed by address only holds inputs that never change (-I)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pipeline_depth != NULL) {
+		num_streams = atoi(pipeline_depth);
+		if ((num_streams < 1) || (num_streams > MAX_STREAMS)){
+			printf("Pipeline depth should be between 1 and %d \n",MAX_STREAMS);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (threads_arg != NULL) {
+		num_threads = atoi(threads_arg);
+		if ((num_threads < 1) || (num_threads > WORKER_POOL_MAX_THREADS)){
+			printf("Number of threads should be between 1 and %d \n",WORKER_POOL_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (chunk_arg != NULL) {
+		chunk_size = atol(chunk_arg);
+		if (chunk_size <= 0){
+			printf("Chunk size should be superior to 0\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	buffer_pool_config_init(&buffer_cfg);
+	if ((buffer_pool_arg != NULL) && buffer_pool_parse(buffer_pool_arg, &buffer_cfg)){
+		printf("Invalid buffer pool configuration %s \n",buffer_pool_arg);
+		exit(EXIT_FAILURE);
+	}
+	// before the first buffer : the pool is bound to the node, or first
+	// touched from the pinned HOST thread
+	if (affinity_init(&affinity_cfg)){
+		exit(EXIT_FAILURE);
+	}
+	buffer_cfg.numa_node = affinity_numa_node();
+	buffer_pool_init(&buffer_cfg);
+	// a slot holds the largest transfer : a vector, encoded with -z
+	card_dram_cfg.slot_size = use_codec ? codec_bound(vector_size) : vector_size*sizeof(uint32_t);
+	if ((card_dram_arg != NULL) && card_dram_init(&card_dram_cfg)){
+		exit(EXIT_FAILURE);
+	}
+
+	if (trace_path != NULL){
+		trace_init(TRACE_DEFAULT_EVENTS);
+		trace_thread_start("host");
+	}
+
+	if ((wait_policy != NULL) && wait_policy_parse(wait_policy, &wait_type)){
+		printf("Unknown wait policy %s \n",wait_policy);
+		exit(EXIT_FAILURE);
+	}
+	wait_policy_init(&wait, wait_type);
+	run_stats_init(&stats);
+	// counters are optional : the run goes on without them
+	if (perf_counters){
+		run_stats_enable_perf(&stats, stdout);
+	}
+	verify_init(&check);
+
+	compute = compute_backend_lookup(compute_name);
+	if (compute == NULL){
+		printf("Unknown or unsupported compute backend %s \n",
+				compute_name ? compute_name : "(default)");
+		exit(EXIT_FAILURE);
+	}
+	if (num_threads > 1){
+		if (compute != &cpu_backend){
+			printf("Threads are only used by the cpu compute backend\n");
+		} else {
+			pool = worker_pool_create(num_threads, chunk_size);
+			if (pool == NULL){
+				exit(EXIT_FAILURE);
+			}
+			cpu_kernel_set_pool(pool);
+		}
+	}
 
 	size_t size = vector_size*sizeof(uint32_t);
 
@@ -232,11 +843,11 @@ int main(int argc, char *argv[])
 	//               MEMORY ALLOCATION ON GPU
 	////////////////////////////////////////////////////////////////
 
-	memory_allocation_gpu(ibuff,size);
-	memory_allocation_gpu(obuff,size);
+	compute->memory_allocation_device(ibuff,size,num_streams);
+	compute->memory_allocation_device(obuff,size,num_streams);
 
 	if (!host_buffering){
-		init_buffers(obuff,vector_size);
+		compute->init_buffers(obuff,vector_size,num_streams);
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -244,21 +855,112 @@ int main(int argc, char *argv[])
 	////////////////////////////////////////////////////////////////
 
 	if (host_buffering){
-		memory_allocation_host(bufferA,size);
-		memory_allocation_host(bufferB,size);
+		compute->memory_allocation_host(bufferA,size,num_streams);
+		compute->memory_allocation_host(bufferB,size,num_streams);
 
 		// Data initialization
 		for (int i = 0; i < vector_size; i++){
-			for (int stream = 0; stream < MAX_STREAMS; stream++){
+			for (int stream = 0; stream < num_streams; stream++){
 				bufferB[stream][i] = i + 1000*stream;
 			}
 		}
 	}
 
-	write_flag = snap_malloc(64);
-	read_flag = snap_malloc(64);
-	memset(write_flag, 0x0, 64);
-	memset(read_flag, 0x0, 64);
+	write_flag = buffer_pool_get(64);
+	read_flag = buffer_pool_get(64);
+	if ((write_flag == NULL) || (read_flag == NULL)){
+		goto out_error;
+	}
+
+	if (stream_size){
+		// padded to whole tiles, the padding is never checked
+		if (num_tiles > SIZE_MAX / size){
+			printf("Stream of %llu elements is too large\n", (unsigned long long)stream_size);
+			goto out_error;
+		}
+		dataset = buffer_pool_get(num_tiles*size);
+		scratch = buffer_pool_get(size);
+		if ((dataset == NULL) || (scratch == NULL)){
+			goto out_error;
+		}
+		for (uint64_t i = 0; i < stream_size; i++){
+			dataset[i] = (uint32_t)i;
+		}
+		printf("Streaming %llu elements (%.1f MB) in %llu tiles of %d elements\n",
+				(unsigned long long)stream_size, stream_size*sizeof(uint32_t)/1e6,
+				(unsigned long long)num_tiles, vector_size);
+	}
+
+	if (fixed_input && !num_vectors){
+		// slot stream reads fixed_in[stream], never written
+		for (int stream = 0; stream < num_streams; stream++){
+			fixed_in[stream] = buffer_pool_get(size);
+			if (fixed_in[stream] == NULL){
+				goto out_error;
+			}
+			for (int i = 0; i < vector_size; i++){
+				fixed_in[stream][i] = i + 1000*stream;
+			}
+		}
+	}
+
+	if (num_vectors){
+		// vector k of a job : batch_out + k*vector_size to batch_in + k*vector_size
+		compute->memory_allocation_device(&batch_in, num_vectors*size, 1);
+		compute->memory_allocation_device(&batch_out, num_vectors*size, 1);
+		table = buffer_pool_get(sizeof(*table) +
+				num_vectors*sizeof(struct parallel_memcpy_entry));
+		if (table == NULL){
+			fprintf(stderr, "err: failed to allocate the job table\n");
+			goto out_error;
+		}
+		table->count = num_vectors;
+		for (int k = 0; k < num_vectors; k++){
+			table->entry[k].src = (unsigned long)(batch_out + (size_t)k*vector_size);
+			table->entry[k].dst = (unsigned long)(batch_in + (size_t)k*vector_size);
+			table->entry[k].length = size;
+			table->entry[k].status = DESC_STATUS_FREE;
+			for (int i = 0; i < vector_size; i++){
+				batch_out[(size_t)k*vector_size + i] = i + 1000*k;
+			}
+		}
+		// the same inputs at every job instead of the results of the previous one
+		if (fixed_input){
+			batch_fixed = buffer_pool_get((size_t)num_vectors*size);
+			if (batch_fixed == NULL){
+				goto out_error;
+			}
+			memcpy(batch_fixed, batch_out, (size_t)num_vectors*size);
+			for (int k = 0; k < num_vectors; k++){
+				table->entry[k].src = (unsigned long)(batch_fixed + (size_t)k*vector_size);
+			}
+		}
+		printf("Batch jobs of %d vectors (%.1f KB per job)\n", num_vectors, num_vectors*size/1e3);
+	}
+
+	if (use_ring){
+		ring = desc_ring_alloc(DESC_RING_DEFAULT_SIZE);
+		if (ring == NULL){
+			fprintf(stderr, "err: failed to allocate descriptor ring\n");
+			goto out_error;
+		}
+	}
+	if (use_codec){
+		if (!use_ring){
+			printf("The link codec encodes the descriptor ring transfers (-R)\n");
+			goto out_error;
+		}
+		link = &link_buffers;
+		codec_stats_init(&link->stats);
+		for (int stream = 0; stream < num_streams; stream++){
+			link->out[stream] = buffer_pool_get(codec_bound(vector_size));
+			link->in[stream] = buffer_pool_get(codec_bound(vector_size));
+			if ((link->out[stream] == NULL) || (link->in[stream] == NULL)){
+				fprintf(stderr, "err: failed to allocate codec buffers\n");
+				goto out_error;
+			}
+		}
+	}
 
 	////////////////////////////////////////////////////////////////
 	//               FPGA ACTION PREPARATION
@@ -266,7 +968,13 @@ int main(int argc, char *argv[])
 
 	// prepare params to be written in MMIO registers for action
 	type  = SNAP_ADDRTYPE_HOST_DRAM;
-	if (host_buffering){
+	if (table != NULL){
+		addr_read = (unsigned long)(fixed_input ? batch_fixed : batch_out);
+		addr_write = (unsigned long)batch_in;
+	} else if (fixed_input){
+		addr_read = (unsigned long)fixed_in[0];
+		addr_write = (unsigned long)(host_buffering ? bufferA[0] : ibuff[0]);
+	} else if (host_buffering){
 		addr_read = (unsigned long)bufferB[0];
 		addr_write = (unsigned long)bufferA[0];
 	} else {
@@ -281,11 +989,15 @@ int main(int argc, char *argv[])
 	printf("PARAMETERS:\n"
 			"  vector_size:      %d\n"
 			"  max_iteration:    %d\n"
+			"  pipeline_depth:   %d\n"
+			"  compute:          %s%s%s\n"
 			"  addr_read:        %016llx\n"
 			"  addr_write:       %016llx\n"
 			"  addr_read_flag:   %016llx\n"
 			"  addr_write_flag:  %016llx\n",
-			vector_size, max_iteration,
+			vector_size, max_iteration, num_streams, compute->name,
+			(compute == &cpu_backend) ? " " : "",
+			(compute == &cpu_backend) ? cpu_kernel_name() : "",
 			(long long)addr_read,(long long)addr_write,
 			(long long)addr_read_flag,(long long)addr_write_flag);	
 
@@ -309,9 +1021,17 @@ int main(int argc, char *argv[])
 		goto out_error1;
 	}
 	// Fill the stucture of data exchanged with the action
-	snap_prepare_parallel_memcpy(&cjob, &mjob,vector_size,max_iteration,type,
+	snap_prepare_parallel_memcpy(&cjob, &mjob,vector_size,job_iterations,type,
 			(void *)addr_read, (void *)addr_write, 
-			(void *)addr_read_flag,(void *)addr_write_flag);
+			(void *)addr_read_flag,(void *)addr_write_flag, ring, table);
+
+	// pinned in the card : even the first read of an input is a hit
+	if (upload){
+		int count = (table != NULL) ? num_vectors : num_streams;
+
+		printf("%d of %d inputs uploaded to the card DRAM\n",
+				card_dram_inputs(fixed_in, batch_fixed, count, vector_size, false), count);
+	}
 
 
 
@@ -320,72 +1040,164 @@ int main(int argc, char *argv[])
 	////////////////////////////////////////////////////////////////////////
 	gettimeofday(&stime, NULL);
 
-	int rc = 0;
-	rc =snap_action_sync_execute_job_set_regs(action, &cjob);
-	if (rc != 0){
-		printf("error while setting registers");
-	}
-	/* Start Action and wait for finish */
-	if (verbose){
-		printf("Starting FPGA action .. \n");
-	}
+	// batch jobs are started by run_batches(), once per job table
+	if (table == NULL){
+		int rc = 0;
+		rc =snap_action_sync_execute_job_set_regs(action, &cjob);
+		if (rc != 0){
+			printf("error while setting registers");
+		}
+		/* Start Action and wait for finish */
+		if (verbose){
+			printf("Starting FPGA action .. \n");
+		}
 
-	snap_action_start(action);
+		snap_action_start(action);
+	}
 
 	//--- Collect the timestamp AFTER the call of the action
 	gettimeofday(&etime, NULL);
 
+	// FPGA reads(writes) from(to) these buffers
+	uint32_t **fpga_read_buff = fixed_input ? fixed_in : host_buffering ? bufferB : obuff;
+	uint32_t **fpga_write_buff = host_buffering ? bufferA : ibuff;
+
 	// FPGA can read vector and write buffer
-	update_flag(&read_flag, 1, addr_read);
-	update_flag(&write_flag, 1, addr_write);
+	if ((dataset != NULL) || (table != NULL)){
+		// run_tiles() and run_batches() hand the vectors over themselves
+	} else if (ring != NULL){
+		// every slot is posted in advance, no flag round trip is needed
+		for (int stream = 0; stream < num_streams && stream < max_iteration; stream++){
+			if (link != NULL){
+				encode_slot(link, stream, fpga_read_buff[stream], vector_size);
+			}
+			post_slot(ring, link, stream, fpga_read_buff[stream], fpga_write_buff[stream], size);
+		}
+	} else {
+		update_flag(&read_flag, 1, addr_read);
+		update_flag(&write_flag, 1, addr_write);
+		if (full_duplex){
+			duplex = &duplex_state;
+			duplex_init(duplex, read_flag, write_flag, fpga_read_buff, fpga_write_buff,
+					num_streams, max_iteration);
+			duplex->armed[SIDE_READ] = duplex->armed[SIDE_WRITE] = 1;
+		}
+	}
 
 	gettimeofday(&begin_time, NULL);
 
 	///////////////////////////////////////////////////////////////
 	//             RUNNING GPU KERNEL PIPELINING
 	//////////////////////////////////////////////////////////////
-	int stream =0;
-	//int next_stream =0;
+	int stream = 0, next_stream = 0;
+	bool last_iteration = false;
 
-	for (int iteration = 0; iteration < max_iteration; iteration++){
-		stream = iteration % MAX_STREAMS;	
+	wait_policy_start(&wait);
 
-		//FPGA is writing data in buffer
-		while((read_flag[0] == 1) || (write_flag[0] == 1)){ 
-			sleep(0.000002);
-		}
+	if (dataset != NULL){
+		run_tiles(&wait, &stats, read_flag, write_flag, compute, host_buffering,
+				ibuff[0], obuff[0], host_buffering ? bufferA[0] : NULL,
+				host_buffering ? bufferB[0] : NULL,
+				dataset, scratch, num_tiles, vector_size);
+	} else if (table != NULL){
+		batch_errors = run_batches(action, &cjob, &wait, &stats, &check, compute, table,
+				batch_in, batch_out, vector_size, max_iteration, verify);
+	} else {
+		for (int iteration = 0; iteration < max_iteration; iteration++){
+			const uint32_t *check_in, *check_out;
 
-		if (host_buffering){
-			//Running kernel on GPU
-			run_new_stream_v1(bufferA[stream],bufferB[stream],ibuff[stream],obuff[stream],vector_size);	   	
-			// Uptdating read/write addresses for FPGA
-			addr_read = (unsigned long)bufferB[stream];
-			addr_write = (unsigned long)bufferA[stream];
-
-			if (verbose){
-				printf("Writting : [%d,%d, ... ,%d]\n",bufferA[0][0],bufferA[0][1],bufferA[0][vector_size-1]); 
-				printf("Received : [%d,%d, ... ,%d]\n",bufferB[0][0],bufferB[0][1],bufferB[0][vector_size-1]); 
+			stream = iteration % num_streams;	
+			next_stream = (iteration + 1) % num_streams;
+			last_iteration = (iteration + 1 == max_iteration);
+			iteration_start = t = run_stats_begin(&stats);
+
+			//FPGA is writing data in buffer
+			if (ring != NULL){
+				wait_until(&wait, desc_ring_completed(ring) > (uint64_t)iteration);
+				if (desc_ring_status(ring, iteration) != DESC_STATUS_DONE){
+					ring_errors++;
+				}
+			} else if (duplex != NULL){
+				// hands the next transfers over while waiting for this one
+				wait_until(&wait, duplex_ready(duplex, iteration));
+			} else {
+				wait_until(&wait,
+						(__atomic_load_n(&read_flag[0], __ATOMIC_ACQUIRE) != 1) &&
+						(__atomic_load_n(&write_flag[0], __ATOMIC_ACQUIRE) != 1));
 			}
-		} else {
-			//Running kernel on GPU
-			run_new_stream_v2(ibuff[stream],obuff[stream],vector_size);
-			// Updating read/write adresses for FPGA
-			addr_read = (unsigned long)obuff[stream];
-			addr_write = (unsigned long)ibuff[stream];
-
-			if (verbose) {	   	
-				printf("Writting : [%d,%d, ... ,%d]\n",ibuff[0][0],ibuff[0][1],ibuff[0][vector_size-1]); 
-				printf("Received : [%d,%d, ... ,%d]\n",obuff[0][0],obuff[0][1],obuff[0][vector_size-1]); 
+			t = run_stats_mark(&stats, PHASE_WAIT, t);
+			if (link != NULL){
+				decode_slot(link, stream, fpga_write_buff[stream], vector_size);
+				t = run_stats_mark(&stats, PHASE_DECODE, t);
 			}
-		}	
 
-		// FPGA can write new data	
-		update_flag(&read_flag, 1, addr_read);
-		update_flag(&write_flag, 1, addr_write);
+			// With more than one slot, the next slot is not used by the GPU :
+			// FPGA can fill it while the current slot is being computed
+			if ((ring == NULL) && (duplex == NULL) && (num_streams > 1) && !last_iteration){
+				arm_slot(&read_flag, &write_flag,
+						fpga_read_buff[next_stream], fpga_write_buff[next_stream]);
+				t = run_stats_mark(&stats, PHASE_FLAG_UPDATE, t);
+			}
+
+			if (host_buffering){
+				//Running kernel on GPU
+				compute->run_new_stream_v1(bufferA[stream],bufferB[stream],ibuff[stream],obuff[stream],vector_size);	   	
+				check_in = bufferA[stream];
+				check_out = bufferB[stream];
+
+				if (verbose){
+					printf("Writting : [%d,%d, ... ,%d]\n",bufferA[stream][0],bufferA[stream][1],bufferA[stream][vector_size-1]); 
+					printf("Received : [%d,%d, ... ,%d]\n",bufferB[stream][0],bufferB[stream][1],bufferB[stream][vector_size-1]); 
+				}
+			} else {
+				//Running kernel on GPU
+				compute->run_new_stream_v2(ibuff[stream],obuff[stream],vector_size);
+				check_in = ibuff[stream];
+				check_out = obuff[stream];
+
+				if (verbose) {	   	
+					printf("Writting : [%d,%d, ... ,%d]\n",ibuff[stream][0],ibuff[stream][1],ibuff[stream][vector_size-1]); 
+					printf("Received : [%d,%d, ... ,%d]\n",obuff[stream][0],obuff[stream][1],obuff[stream][vector_size-1]); 
+				}
+			}	
+			t = run_stats_mark(&stats, PHASE_COMPUTE, t);
+
+			// out of the phases, only the iteration includes it
+			if (verify){
+				verify_vector_add(&check, check_in, check_out, vector_size, iteration);
+				t = monotonic_ns();
+			}
 
+			// With a single slot, FPGA can only write new data once GPU is done
+			if ((ring == NULL) && (duplex == NULL) && (num_streams == 1) && !last_iteration){
+				arm_slot(&read_flag, &write_flag,
+						fpga_read_buff[next_stream], fpga_write_buff[next_stream]);
+				t = run_stats_mark(&stats, PHASE_FLAG_UPDATE, t);
+			}
+
+			// The slot is free again : post its next transfer
+			if ((ring != NULL) && (iteration + num_streams < max_iteration)){
+				if (link != NULL){
+					encode_slot(link, stream, fpga_read_buff[stream], vector_size);
+					t = run_stats_mark(&stats, PHASE_ENCODE, t);
+				}
+				post_slot(ring, link, stream, fpga_read_buff[stream], fpga_write_buff[stream], size);
+				t = run_stats_mark(&stats, PHASE_FLAG_UPDATE, t);
+			}
+
+			run_stats_mark(&stats, PHASE_ITERATION, iteration_start);
+		}
 	}
 
 	gettimeofday(&end_time, NULL);
+	wait_policy_stop(&wait);
+	// the software action is still running for a while after its last
+	// completion, nothing it uses can be reported on or freed before
+	parallel_memcpy_wait_idle();
+	if (upload){
+		card_dram_inputs(fixed_in, batch_fixed, (table != NULL) ? num_vectors : num_streams,
+				vector_size, true);
+	}
 
 	switch(cjob.retc) {
 		case SNAP_RETC_SUCCESS:
@@ -403,35 +1215,132 @@ int main(int argc, char *argv[])
 	}
 
 	// Display the time of the action call
-	fprintf(stdout, "SNAP registers set + action start took %lld usec\n",
-			(long long)timediff_usec(&etime, &stime));
+	if (table != NULL){
+		const struct latency_histogram *h = &stats.phase[PHASE_FLAG_UPDATE];
+
+		fprintf(stdout, "SNAP registers set + action start took %.3f usec on average (%llu jobs)\n",
+				h->count ? h->sum_ns/1e3/h->count : 0.0, (unsigned long long)h->count);
+	} else {
+		fprintf(stdout, "SNAP registers set + action start took %lld usec\n",
+				(long long)timediff_usec(&etime, &stime));
+	}
 
 	// Display the time of the action excecution
 	lcltime = (long long)(timediff_usec(&end_time, &begin_time));
-	fprintf(stdout, "SNAP action average processing time for %u iteration is %f usec with config %d\n",
+	fprintf(stdout, "SNAP action average processing time for %u iteration is %f usec with config %d (pipeline depth %d)\n",
 			max_iteration, (float)lcltime/(float)(max_iteration),
-			host_buffering ? 1 : 2);
+			host_buffering ? 1 : 2, num_streams);
+	if (table != NULL){
+		fprintf(stdout, "Batch jobs : %d vectors per job, %f usec per vector\n",
+				num_vectors, (float)lcltime/((float)max_iteration*num_vectors));
+	}
+	if (dataset != NULL){
+		// vector_add doubles every element
+		for (uint64_t i = 0; i < stream_size; i++){
+			if (dataset[i] != 2*(uint32_t)i){
+				stream_errors++;
+			}
+		}
+		fprintf(stdout, "Streamed %.1f MB in %lld usec : %.1f MB/s aggregate (in + out), "
+				"%llu wrong elements\n",
+				stream_size*sizeof(uint32_t)/1e6, lcltime,
+				2.0*stream_size*sizeof(uint32_t)/(double)lcltime,
+				(unsigned long long)stream_errors);
+		if (stream_errors){
+			exit_code = EXIT_FAILURE;
+		}
+	}
+	run_stats_report(&stats, stdout, latency_dump);
+	if (bench_output){
+		run_stats_summary(&stats, stdout);
+	}
+	run_stats_disable_perf(&stats);
+	if (verify){
+		verify_report(&check, stdout);
+		if (check.mismatches){
+			exit_code = EXIT_FAILURE;
+		}
+	}
+	wait_policy_report(&wait, stdout);
+	card_dram_report(stdout);
+	if (duplex != NULL){
+		duplex_report(duplex, stdout);
+	}
+	if (ring_errors){
+		fprintf(stdout, "%lu descriptors completed with an error\n", ring_errors);
+		exit_code = EXIT_FAILURE;
+	}
+	if (batch_errors){
+		fprintf(stdout, "%lu job table entries completed with an error\n", batch_errors);
+		exit_code = EXIT_FAILURE;
+	}
+	if (link != NULL){
+		codec_report(&link->stats, (double)lcltime, stdout);
+		if (link->stats.errors){
+			exit_code = EXIT_FAILURE;
+		}
+	}
 
 	// Detach action + disallocate the card
 	snap_detach_action(action);
 	snap_card_free(card);
 
 	if (host_buffering){
-		free_host(bufferA);
-		free_host(bufferB);
+		compute->free_host(bufferA,num_streams);
+		compute->free_host(bufferB,num_streams);
+	}
+	compute->free_device(ibuff,num_streams);
+	compute->free_device(obuff,num_streams);
+	if (num_vectors){
+		compute->free_device(&batch_in,1);
+		compute->free_device(&batch_out,1);
 	}
-	free_device(ibuff);
-	free_device(obuff);
-	free(read_flag);
-	free(write_flag);
+	buffer_pool_put(table);
+	buffer_pool_put(batch_fixed);
+	for (int stream = 0; stream < num_streams; stream++){
+		buffer_pool_put(fixed_in[stream]);
+	}
+	affinity_report(write_flag, stdout);
+	buffer_pool_put(read_flag);
+	buffer_pool_put(write_flag);
+	buffer_pool_put(dataset);
+	buffer_pool_put(scratch);
+	if (link != NULL){
+		for (int stream = 0; stream < num_streams; stream++){
+			buffer_pool_put(link->out[stream]);
+			buffer_pool_put(link->in[stream]);
+		}
+	}
+	desc_ring_free(ring);
+	if (trace_path != NULL){
+		trace_dump(trace_path);
+	}
+	trace_free();
+	card_dram_destroy();
+	buffer_pool_report(stdout);
+	buffer_pool_destroy();
+	cpu_kernel_set_pool(NULL);
+	worker_pool_destroy(pool);
 	exit(exit_code);
 
 out_error1:
 	snap_card_free(card);
 out_error:
-	__free(bufferA);
-	__free(bufferB);
-	__free(read_flag);
-	__free(write_flag);
+	if (host_buffering){
+		compute->free_host(bufferA,num_streams);
+		compute->free_host(bufferB,num_streams);
+	}
+	compute->free_device(ibuff,num_streams);
+	compute->free_device(obuff,num_streams);
+	if (num_vectors){
+		compute->free_device(&batch_in,1);
+		compute->free_device(&batch_out,1);
+	}
+	desc_ring_free(ring);
+	trace_free();
+	card_dram_destroy();
+	buffer_pool_destroy();
+	cpu_kernel_set_pool(NULL);
+	worker_pool_destroy(pool);
 	exit(EXIT_FAILURE);
 }
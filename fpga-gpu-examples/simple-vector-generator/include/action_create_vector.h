@@ -31,6 +31,8 @@ extern "C" {
 typedef struct gpu_example_job {
 	uint64_t vectorSize;	/* input data */
 	struct snap_addr out;   /* offset table */
+	uint64_t offset;	/* value of the first element, a tile of a larger vector */
+	struct snap_addr in;	/* NVME or CARD_DRAM : vector read from there */
 } gpu_example_job_t;
 
 #ifdef __cplusplus
@@ -0,0 +1,99 @@
+#ifndef __IO_SINK_H__
+#define __IO_SINK_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming output file.
+ *
+ * The result is written tile after tile while the next tiles are generated
+ * and computed : the sink owns depth tile buffers, the caller computes a
+ * tile in a free buffer and hands it over, the write runs in the background
+ * and the buffer is free again once it is on disk. Memory use is depth
+ * tiles whatever the size of the output.
+ *
+ * Writes go through io_uring (see uring.h) with the buffers registered once
+ * (IORING_OP_WRITE_FIXED). With direct, the file is opened with O_DIRECT :
+ * buffers are aligned and tiles padded to IO_SINK_ALIGN, the file is
+ * truncated to its real size when closed. When io_uring is not available
+ * (old kernel, seccomp), tiles are written with pwrite() as they are handed
+ * over.
+ */
+
+#define IO_SINK_MAX_DEPTH	64
+#define IO_SINK_DEFAULT_DEPTH	4
+/* O_DIRECT alignment of buffers, offsets and lengths */
+#define IO_SINK_ALIGN		4096
+
+struct io_sink {
+	int fd;
+	bool direct;
+	bool uring;			/* false : pwrite() fallback */
+	uint32_t depth;
+	size_t buffer_size;		/* tile bytes, padded with direct */
+	void *buffer[IO_SINK_MAX_DEPTH];
+	size_t length[IO_SINK_MAX_DEPTH];	/* of the write in flight */
+	int free_list[IO_SINK_MAX_DEPTH];
+	int num_free;
+	uint64_t offset;		/* of the next tile */
+
+	struct uring ring;
+
+	/* statistics */
+	uint64_t writes;
+	uint64_t bytes;
+	uint64_t errors;
+	uint32_t in_flight;
+	uint32_t max_in_flight;
+	uint64_t depth_sum;		/* in flight after each submission */
+	uint64_t waits;			/* no free buffer */
+	uint64_t wait_ns;
+	uint64_t start_ns, end_ns;
+};
+
+/* depth buffers of tile_bytes, depth is 1 to IO_SINK_MAX_DEPTH */
+int io_sink_open(struct io_sink *s, const char *path, size_t tile_bytes,
+		uint32_t depth, bool direct);
+
+/* Free buffer for the next tile, waits for a write to complete if needed */
+void *io_sink_buffer(struct io_sink *s);
+
+/* Writes len bytes of a buffer of io_sink_buffer() after the previous tile */
+int io_sink_write(struct io_sink *s, void *buffer, size_t len);
+
+/* Waits for every write, returns -1 if one of them failed */
+int io_sink_close(struct io_sink *s);
+
+/* Throughput and queue depth */
+void io_sink_report(const struct io_sink *s, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __IO_SINK_H__ */
@@ -0,0 +1,115 @@
+#ifndef __NVME_EMU_H__
+#define __NVME_EMU_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Emulated NVMe drive of the software action.
+ *
+ * SNAP_ADDRTYPE_NVME addresses are byte offsets on a drive attached to the
+ * card. The software action has no drive : a local file or block device
+ * stands in for it, given by the environment variable NVME_EMU_ENV as
+ *
+ *	<path>[,depth=<N>][,block=<bytes>][,direct]
+ *
+ * The drive is read in blocks into depth pooled buffers, and the blocks
+ * after the one being consumed are prefetched with io_uring (O_DIRECT with
+ * direct) : a sequential stream of jobs finds its data already read. A read
+ * outside the prefetched blocks restarts the prefetch there. Writes go
+ * straight to the drive and drop the prefetched blocks they overlap. When
+ * io_uring is not available, blocks are read with pread() when needed.
+ */
+
+#define NVME_EMU_ENV		"GPU_EXAMPLE_NVME"
+#define NVME_EMU_MAX_DEPTH	64
+#define NVME_EMU_DEFAULT_DEPTH	8
+#define NVME_EMU_DEFAULT_BLOCK	(1 << 20)
+/* O_DIRECT alignment of buffers, offsets and blocks */
+#define NVME_EMU_ALIGN		4096
+
+enum nvme_slot_state {
+	NVME_SLOT_FREE = 0,
+	NVME_SLOT_READING,
+	NVME_SLOT_READY,
+};
+
+struct nvme_slot {
+	enum nvme_slot_state state;
+	uint64_t block;
+	int32_t res;			/* bytes read or -errno */
+};
+
+struct nvme_emu {
+	int fd;				/* reads, O_DIRECT with direct */
+	int wfd;			/* writes */
+	bool direct;
+	bool uring;			/* false : pread() when needed */
+	uint64_t capacity;		/* bytes */
+	size_t block_size;
+	uint32_t depth;
+	void *buffer[NVME_EMU_MAX_DEPTH];
+	struct nvme_slot slot[NVME_EMU_MAX_DEPTH];
+	uint64_t next_block;		/* next one to prefetch */
+	uint32_t in_flight;
+	struct uring ring;
+
+	/* statistics */
+	uint64_t reads, read_bytes;	/* requests of the action */
+	uint64_t writes, write_bytes;
+	uint64_t blocks;		/* read from the drive */
+	uint64_t hits;			/* block read before it was needed */
+	uint64_t late;			/* block still being read */
+	uint64_t misses;		/* block not prefetched */
+	uint64_t dropped;		/* prefetched, never used */
+	uint64_t read_ns;		/* spent in nvme_emu_read() */
+	uint64_t stall_ns;		/* of read_ns, waiting for the drive */
+	uint64_t errors;
+};
+
+/* block_size is a multiple of NVME_EMU_ALIGN, depth 1 to NVME_EMU_MAX_DEPTH */
+int nvme_emu_open(struct nvme_emu *n, const char *path, size_t block_size,
+		uint32_t depth, bool direct);
+
+/* Opens the drive described by a NVME_EMU_ENV string */
+int nvme_emu_open_spec(struct nvme_emu *n, const char *spec);
+
+void nvme_emu_close(struct nvme_emu *n);
+
+/* len bytes at offset, -1 if they are beyond the drive or a read failed */
+int nvme_emu_read(struct nvme_emu *n, uint64_t offset, void *dst, size_t len);
+
+int nvme_emu_write(struct nvme_emu *n, uint64_t offset, const void *src, size_t len);
+
+/* Prefetch hits and misses, throughput */
+void nvme_emu_report(const struct nvme_emu *n, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __NVME_EMU_H__ */
@@ -0,0 +1,76 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Minimal io_uring, driven with the raw syscalls (no liburing needed).
+ *
+ * Used by one thread : the caller never has more requests in flight than
+ * entries, so the submission queue is never full. Buffers given to
+ * uring_init() are registered once and their reads and writes use the
+ * fixed opcodes, index is then the position of the buffer in that table.
+ */
+
+/* <linux/io_uring.h> is only needed by uring.c */
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct uring {
+	int fd;
+	uint32_t entries;
+	bool registered;		/* *_FIXED opcodes */
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	size_t sqes_size;
+	struct io_uring_sqe *sqes;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/*
+ * -1 with errno set if io_uring is not available. Registering the buffers
+ * is optional (RLIMIT_MEMLOCK), see registered
+ */
+int uring_init(struct uring *u, uint32_t entries, void * const *buffer,
+		uint32_t num_buffers, size_t buffer_size);
+void uring_exit(struct uring *u);
+
+/* Queues and submits one read or write, user_data comes back with its completion */
+int uring_submit(struct uring *u, bool write, int fd, void *buf, int index,
+		size_t len, uint64_t offset, uint64_t user_data);
+
+/*
+ * Next completion : res is the byte count or -errno. Returns false if none
+ * is there and wait is not set (or the wait failed)
+ */
+bool uring_complete(struct uring *u, bool wait, uint64_t *user_data, int32_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __URING_H__ */
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * STREAMING OUTPUT SINK
+ *
+ * One submission per tile, there are never more writes in flight than
+ * buffers. A buffer index is the user_data of its write and, with
+ * registered buffers, its buf_index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <io_sink.h>
+#include <time_utils.h>
+
+static size_t round_up(size_t n, size_t align)
+{
+	return (n + align - 1) / align * align;
+}
+
+/* Frees the buffers of the completed writes, waits for one if wait is set */
+static void sink_reap(struct io_sink *s, bool wait)
+{
+	uint64_t index;
+	int32_t res;
+
+	while ((s->in_flight > 0) && uring_complete(&s->ring, wait, &index, &res)) {
+		// a short write is not resubmitted : counted as an error
+		if ((res < 0) || ((size_t)res != s->length[index]))
+			s->errors++;
+		s->free_list[s->num_free++] = (int)index;
+		s->in_flight--;
+		wait = false;
+	}
+}
+
+/*-----------------------------------------------
+ *            Sink
+ *-----------------------------------------------*/
+
+int io_sink_open(struct io_sink *s, const char *path, size_t tile_bytes,
+		uint32_t depth, bool direct)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	if ((depth < 1) || (depth > IO_SINK_MAX_DEPTH) || (tile_bytes == 0))
+		return -1;
+	// every tile but the last one starts on an aligned offset
+	if (direct && (tile_bytes % IO_SINK_ALIGN)) {
+		fprintf(stderr, "err: O_DIRECT tiles must be a multiple of %d bytes\n", IO_SINK_ALIGN);
+		return -1;
+	}
+
+	s->direct = direct;
+	s->depth = depth;
+	s->buffer_size = direct ? round_up(tile_bytes, IO_SINK_ALIGN) : tile_bytes;
+	for (uint32_t i = 0; i < depth; i++) {
+		if (posix_memalign(&s->buffer[i], IO_SINK_ALIGN, s->buffer_size)) {
+			fprintf(stderr, "err: failed to allocate the output buffers\n");
+			goto out_error;
+		}
+	}
+
+	if (direct)
+		flags |= O_DIRECT;
+	s->fd = open(path, flags, 0644);
+	if (s->fd < 0) {
+		fprintf(stderr, "err: cannot open %s : %s\n", path, strerror(errno));
+		goto out_error;
+	}
+
+	s->uring = (uring_init(&s->ring, depth, s->buffer, depth, s->buffer_size) == 0);
+	if (!s->uring)
+		fprintf(stderr, "io_uring not available (%s), tiles are written with pwrite\n",
+				strerror(errno));
+	for (uint32_t i = 0; i < s->depth; i++)
+		s->free_list[s->num_free++] = (int)(s->depth - 1 - i);
+	s->start_ns = monotonic_ns();
+	return 0;
+
+out_error:
+	if (s->fd >= 0)
+		close(s->fd);
+	for (uint32_t i = 0; i < depth; i++)
+		free(s->buffer[i]);
+	return -1;
+}
+
+void *io_sink_buffer(struct io_sink *s)
+{
+	if (s->uring)
+		sink_reap(s, false);
+	if (s->num_free == 0) {
+		uint64_t t0 = monotonic_ns();
+
+		sink_reap(s, true);
+		s->waits++;
+		s->wait_ns += monotonic_ns() - t0;
+		if (s->num_free == 0)
+			return NULL;
+	}
+	return s->buffer[s->free_list[--s->num_free]];
+}
+
+int io_sink_write(struct io_sink *s, void *buffer, size_t len)
+{
+	size_t wlen = len;
+	int index = -1;
+
+	for (uint32_t i = 0; i < s->depth; i++) {
+		if (s->buffer[i] == buffer)
+			index = (int)i;
+	}
+	if ((index < 0) || (len > s->buffer_size))
+		return -1;
+
+	// O_DIRECT writes whole blocks, the tail is cut when the sink is closed
+	if (s->direct) {
+		wlen = round_up(len, IO_SINK_ALIGN);
+		memset((uint8_t *)buffer + len, 0, wlen - len);
+	}
+	s->length[index] = wlen;
+
+	if (s->uring) {
+		if (uring_submit(&s->ring, true, s->fd, buffer, index, wlen, s->offset, index) != 0) {
+			s->errors++;
+			s->free_list[s->num_free++] = index;
+			return -1;
+		}
+		s->in_flight++;
+		if (s->in_flight > s->max_in_flight)
+			s->max_in_flight = s->in_flight;
+		s->depth_sum += s->in_flight;
+	} else {
+		if (pwrite(s->fd, buffer, wlen, s->offset) != (ssize_t)wlen)
+			s->errors++;
+		s->free_list[s->num_free++] = index;
+		s->depth_sum++;
+		s->max_in_flight = 1;
+	}
+	s->offset += len;
+	s->writes++;
+	s->bytes += len;
+	return 0;
+}
+
+int io_sink_close(struct io_sink *s)
+{
+	if (s->uring) {
+		while (s->in_flight > 0) {
+			uint32_t before = s->in_flight;
+
+			sink_reap(s, true);
+			if (s->in_flight == before)
+				break;
+		}
+		uring_exit(&s->ring);
+	}
+	if (s->direct && (ftruncate(s->fd, s->offset) != 0))
+		s->errors++;
+	if (close(s->fd) != 0)
+		s->errors++;
+	s->fd = -1;
+	s->end_ns = monotonic_ns();
+
+	for (uint32_t i = 0; i < s->depth; i++) {
+		free(s->buffer[i]);
+		s->buffer[i] = NULL;
+	}
+	return s->errors ? -1 : 0;
+}
+
+void io_sink_report(const struct io_sink *s, FILE *out)
+{
+	double usec = (s->end_ns - s->start_ns) / 1e3;
+
+	fprintf(out, "Output sink (%s%s%s) : %llu tiles, %.1f MB in %.0f usec, %.1f MB/s, "
+			"queue depth %.2f average, %u max of %u, %llu waits for a free buffer (%.0f usec)",
+			s->uring ? "io_uring" : "pwrite",
+			s->ring.registered ? ", registered buffers" : "",
+			s->direct ? ", O_DIRECT" : "",
+			(unsigned long long)s->writes, s->bytes / 1e6, usec,
+			usec > 0.0 ? s->bytes / usec : 0.0,
+			s->writes ? (double)s->depth_sum / s->writes : 0.0,
+			s->max_in_flight, s->depth,
+			(unsigned long long)s->waits, s->wait_ns / 1e3);
+	if (s->errors)
+		fprintf(out, ", %llu errors", (unsigned long long)s->errors);
+	fprintf(out, "\n");
+}
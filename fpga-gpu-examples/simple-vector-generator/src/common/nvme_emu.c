@@ -0,0 +1,383 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * EMULATED NVME DRIVE
+ *
+ * Each slot holds one block of the drive. Blocks are prefetched in order
+ * from next_block into the free slots, a slot is freed once its block has
+ * been consumed up to its end, which prefetches the next one : the drive
+ * stays depth blocks ahead of the action. The slot index is the user_data
+ * of its read and, with registered buffers, its buf_index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include <nvme_emu.h>
+#include <time_utils.h>
+
+/*-----------------------------------------------
+ *            Prefetch
+ *-----------------------------------------------*/
+
+/* Marks the slots of the completed reads ready, waits for one if wait is set */
+static bool slots_reap(struct nvme_emu *n, bool wait)
+{
+	bool reaped = false;
+	uint64_t index;
+	int32_t res;
+
+	while ((n->in_flight > 0) && uring_complete(&n->ring, wait, &index, &res)) {
+		n->slot[index].state = NVME_SLOT_READY;
+		n->slot[index].res = res;
+		n->in_flight--;
+		reaped = true;
+		wait = false;
+	}
+	return reaped;
+}
+
+static void slot_fetch(struct nvme_emu *n, int i, uint64_t block)
+{
+	struct nvme_slot *s = &n->slot[i];
+	uint64_t offset = block * n->block_size;
+
+	s->block = block;
+	n->blocks++;
+	if (n->uring) {
+		s->state = NVME_SLOT_READING;
+		if (uring_submit(&n->ring, false, n->fd, n->buffer[i], i,
+					n->block_size, offset, i) == 0) {
+			n->in_flight++;
+			return;
+		}
+		s->res = -EIO;
+	} else {
+		ssize_t rc = pread(n->fd, n->buffer[i], n->block_size, offset);
+
+		s->res = (rc < 0) ? -errno : (int32_t)rc;
+	}
+	s->state = NVME_SLOT_READY;
+}
+
+/* Fills the free slots with the next blocks of the drive */
+static void prefetch_fill(struct nvme_emu *n)
+{
+	// without io_uring nothing is read ahead
+	if (!n->uring)
+		return;
+	for (uint32_t i = 0; i < n->depth; i++) {
+		if (n->next_block * n->block_size >= n->capacity)
+			return;
+		if (n->slot[i].state == NVME_SLOT_FREE)
+			slot_fetch(n, (int)i, n->next_block++);
+	}
+}
+
+static void slot_release(struct nvme_emu *n, int i)
+{
+	n->slot[i].state = NVME_SLOT_FREE;
+}
+
+/* Waits for the reads in flight and forgets every block */
+static void prefetch_drop(struct nvme_emu *n)
+{
+	while (n->in_flight > 0) {
+		if (!slots_reap(n, true))
+			break;
+	}
+	for (uint32_t i = 0; i < n->depth; i++) {
+		if (n->slot[i].state == NVME_SLOT_READY) {
+			n->dropped++;
+			slot_release(n, (int)i);
+		}
+	}
+}
+
+static int slot_find(const struct nvme_emu *n, uint64_t block)
+{
+	for (uint32_t i = 0; i < n->depth; i++) {
+		if ((n->slot[i].state != NVME_SLOT_FREE) && (n->slot[i].block == block))
+			return (int)i;
+	}
+	return -1;
+}
+
+/* Slot holding block once it is read */
+static int block_get(struct nvme_emu *n, uint64_t block)
+{
+	int i = slot_find(n, block);
+	uint64_t t0;
+
+	// the stream skipped these blocks, their slots can read ahead
+	for (uint32_t j = 0; (i >= 0) && (j < n->depth); j++) {
+		if ((n->slot[j].state == NVME_SLOT_READY) && (n->slot[j].block < block)) {
+			n->dropped++;
+			slot_release(n, (int)j);
+		}
+	}
+
+	if ((i >= 0) && (n->slot[i].state == NVME_SLOT_READY)) {
+		n->hits++;
+		return i;
+	}
+
+	t0 = monotonic_ns();
+	if (i < 0) {
+		// not a continuation of the stream : restart the prefetch here
+		n->misses++;
+		prefetch_drop(n);
+		n->next_block = block;
+		if (n->uring) {
+			prefetch_fill(n);
+			i = slot_find(n, block);
+		} else {
+			i = 0;
+			slot_fetch(n, i, n->next_block++);
+		}
+	} else {
+		n->late++;
+	}
+	while ((n->slot[i].state == NVME_SLOT_READING) && slots_reap(n, true))
+		;
+	n->stall_ns += monotonic_ns() - t0;
+	return (n->slot[i].state == NVME_SLOT_READY) ? i : -1;
+}
+
+/*-----------------------------------------------
+ *            Drive
+ *-----------------------------------------------*/
+
+static int drive_capacity(int fd, uint64_t *capacity)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+	if (S_ISBLK(st.st_mode))
+		return ioctl(fd, BLKGETSIZE64, capacity);
+	*capacity = st.st_size;
+	return 0;
+}
+
+int nvme_emu_open(struct nvme_emu *n, const char *path, size_t block_size,
+		uint32_t depth, bool direct)
+{
+	memset(n, 0, sizeof(*n));
+	n->fd = n->wfd = -1;
+	if ((depth < 1) || (depth > NVME_EMU_MAX_DEPTH) ||
+			(block_size == 0) || (block_size % NVME_EMU_ALIGN)) {
+		fprintf(stderr, "err: drive depth is 1 to %d, blocks a multiple of %d bytes\n",
+				NVME_EMU_MAX_DEPTH, NVME_EMU_ALIGN);
+		return -1;
+	}
+
+	n->direct = direct;
+	n->depth = depth;
+	n->block_size = block_size;
+	n->fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
+	if (n->fd >= 0)
+		n->wfd = open(path, O_WRONLY);
+	if ((n->fd < 0) || (n->wfd < 0) || (drive_capacity(n->fd, &n->capacity) != 0)) {
+		fprintf(stderr, "err: cannot open the drive %s : %s\n", path, strerror(errno));
+		goto out_error;
+	}
+
+	for (uint32_t i = 0; i < depth; i++) {
+		if (posix_memalign(&n->buffer[i], NVME_EMU_ALIGN, block_size)) {
+			fprintf(stderr, "err: failed to allocate the drive buffers\n");
+			goto out_error;
+		}
+	}
+
+	n->uring = (uring_init(&n->ring, depth, n->buffer, depth, block_size) == 0);
+	if (!n->uring)
+		fprintf(stderr, "io_uring not available (%s), the drive is read with pread\n",
+				strerror(errno));
+	return 0;
+
+out_error:
+	nvme_emu_close(n);
+	return -1;
+}
+
+int nvme_emu_open_spec(struct nvme_emu *n, const char *spec)
+{
+	char *copy = strdup(spec);
+	char *path, *key, *save = NULL;
+	size_t block_size = NVME_EMU_DEFAULT_BLOCK;
+	uint32_t depth = NVME_EMU_DEFAULT_DEPTH;
+	bool direct = false;
+	int rc;
+
+	if (copy == NULL)
+		return -1;
+	path = strtok_r(copy, ",", &save);
+	while ((key = strtok_r(NULL, ",", &save)) != NULL) {
+		if (strncmp(key, "depth=", 6) == 0)
+			depth = strtoul(key + 6, NULL, 0);
+		else if (strncmp(key, "block=", 6) == 0)
+			block_size = strtoull(key + 6, NULL, 0);
+		else if (strcmp(key, "direct") == 0)
+			direct = true;
+		else {
+			fprintf(stderr, "err: unknown drive parameter %s in %s\n", key, NVME_EMU_ENV);
+			free(copy);
+			return -1;
+		}
+	}
+
+	rc = (path == NULL) ? -1 : nvme_emu_open(n, path, block_size, depth, direct);
+	free(copy);
+	return rc;
+}
+
+void nvme_emu_close(struct nvme_emu *n)
+{
+	if (n->uring) {
+		prefetch_drop(n);
+		uring_exit(&n->ring);
+	}
+	for (uint32_t i = 0; i < n->depth; i++) {
+		free(n->buffer[i]);
+		n->buffer[i] = NULL;
+	}
+	if (n->fd >= 0)
+		close(n->fd);
+	if (n->wfd >= 0)
+		close(n->wfd);
+	n->fd = n->wfd = -1;
+}
+
+int nvme_emu_read(struct nvme_emu *n, uint64_t offset, void *dst, size_t len)
+{
+	uint8_t *p = dst;
+	uint64_t t0 = monotonic_ns();
+	int rc = 0;
+
+	if ((offset > n->capacity) || (len > n->capacity - offset))
+		return -1;
+
+	n->reads++;
+	while (len > 0) {
+		uint64_t block = offset / n->block_size;
+		size_t start = offset % n->block_size;
+		size_t chunk = n->block_size - start;
+		int i;
+
+		if (chunk > len)
+			chunk = len;
+		i = block_get(n, block);
+		// short reads only happen at the end of the drive
+		if ((i < 0) || (n->slot[i].res < (int32_t)(start + chunk))) {
+			n->errors++;
+			if (i >= 0)
+				slot_release(n, i);
+			rc = -1;
+			break;
+		}
+
+		memcpy(p, (uint8_t *)n->buffer[i] + start, chunk);
+		p += chunk;
+		offset += chunk;
+		len -= chunk;
+		n->read_bytes += chunk;
+
+		// consumed up to its end : the slot prefetches a later block
+		if ((start + chunk == n->block_size) || (offset == n->capacity)) {
+			slot_release(n, i);
+			prefetch_fill(n);
+		}
+	}
+	n->read_ns += monotonic_ns() - t0;
+	return rc;
+}
+
+int nvme_emu_write(struct nvme_emu *n, uint64_t offset, const void *src, size_t len)
+{
+	const uint8_t *p = src;
+	uint64_t first = offset / n->block_size;
+	uint64_t last = (offset + len - 1) / n->block_size;
+
+	if (len == 0)
+		return 0;
+
+	// prefetched copies of these blocks would be stale
+	for (uint32_t i = 0; i < n->depth; i++) {
+		struct nvme_slot *s = &n->slot[i];
+
+		if ((s->state == NVME_SLOT_FREE) || (s->block < first) || (s->block > last))
+			continue;
+		while ((s->state == NVME_SLOT_READING) && slots_reap(n, true))
+			;
+		slot_release(n, (int)i);
+	}
+
+	n->writes++;
+	while (len > 0) {
+		ssize_t rc = pwrite(n->wfd, p, len, offset);
+
+		if (rc <= 0) {
+			if ((rc < 0) && (errno == EINTR))
+				continue;
+			n->errors++;
+			return -1;
+		}
+		p += rc;
+		offset += rc;
+		len -= rc;
+		n->write_bytes += rc;
+	}
+	if (offset > n->capacity)
+		n->capacity = offset;
+	return 0;
+}
+
+void nvme_emu_report(const struct nvme_emu *n, FILE *out)
+{
+	double usec = n->read_ns / 1e3;
+	uint64_t needed = n->hits + n->late + n->misses;
+
+	fprintf(out, "Emulated NVMe (%s%s%s, %u x %zu KiB) : %llu reads, %.1f MB in %.0f usec, "
+			"%.1f MB/s, %llu blocks, %.1f %% prefetched in time, %llu late, %llu misses, "
+			"%.0f usec stalled",
+			n->uring ? "io_uring" : "pread",
+			n->ring.registered ? ", registered buffers" : "",
+			n->direct ? ", O_DIRECT" : "",
+			n->depth, n->block_size / 1024,
+			(unsigned long long)n->reads, n->read_bytes / 1e6, usec,
+			usec > 0.0 ? n->read_bytes / usec : 0.0,
+			(unsigned long long)n->blocks,
+			needed ? 100.0 * n->hits / needed : 0.0,
+			(unsigned long long)n->late, (unsigned long long)n->misses,
+			n->stall_ns / 1e3);
+	if (n->writes)
+		fprintf(out, ", %llu writes of %.1f MB", (unsigned long long)n->writes,
+				n->write_bytes / 1e6);
+	if (n->dropped)
+		fprintf(out, ", %llu blocks dropped", (unsigned long long)n->dropped);
+	if (n->errors)
+		fprintf(out, ", %llu errors", (unsigned long long)n->errors);
+	fprintf(out, "\n");
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2019 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * IO_URING
+ *
+ * Rings are mapped as described in io_uring_setup(2) : one mapping for both
+ * rings when the kernel has IORING_FEAT_SINGLE_MMAP (5.4), one for the
+ * submission entries. Each submission is handed to the kernel right away.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <uring.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *ring_map(int fd, size_t size, off_t what)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+void uring_exit(struct uring *u)
+{
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+	if ((u->cq_ring != NULL) && (u->cq_ring != u->sq_ring))
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->fd >= 0)
+		close(u->fd);
+	// entries and registered are kept for the reports
+	u->sqes = NULL;
+	u->sq_ring = u->cq_ring = NULL;
+	u->fd = -1;
+}
+
+int uring_init(struct uring *u, uint32_t entries, void * const *buffer,
+		uint32_t num_buffers, size_t buffer_size)
+{
+	struct io_uring_params p;
+	struct iovec iov[num_buffers ? num_buffers : 1];
+	uint8_t *sq, *cq;
+	int err;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->fd = sys_io_uring_setup(entries, &p);
+	if (u->fd < 0)
+		return -1;
+
+	u->entries = p.sq_entries;
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+
+	u->sq_ring = ring_map(u->fd, u->sq_ring_size, IORING_OFF_SQ_RING);
+	if (u->sq_ring == NULL)
+		goto out_error;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else if ((u->cq_ring = ring_map(u->fd, u->cq_ring_size, IORING_OFF_CQ_RING)) == NULL)
+		goto out_error;
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = ring_map(u->fd, u->sqes_size, IORING_OFF_SQES);
+	if (u->sqes == NULL)
+		goto out_error;
+
+	sq = u->sq_ring;
+	cq = u->cq_ring;
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// pinned once instead of at every request, needs RLIMIT_MEMLOCK
+	for (uint32_t i = 0; i < num_buffers; i++) {
+		iov[i].iov_base = buffer[i];
+		iov[i].iov_len = buffer_size;
+	}
+	u->registered = (num_buffers > 0) &&
+		(sys_io_uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, num_buffers) == 0);
+	return 0;
+
+out_error:
+	err = errno;
+	uring_exit(u);
+	errno = err;
+	return -1;
+}
+
+int uring_submit(struct uring *u, bool write, int fd, void *buf, int index,
+		size_t len, uint64_t offset, uint64_t user_data)
+{
+	unsigned tail = *u->sq_tail;
+	unsigned slot = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (u->registered) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = index;
+	} else {
+		sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	}
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	u->sq_array[slot] = slot;
+
+	// the entry must be visible before the kernel sees the new tail
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return (sys_io_uring_enter(u->fd, 1, 0, 0) < 0) ? -1 : 0;
+}
+
+bool uring_complete(struct uring *u, bool wait, uint64_t *user_data, int32_t *res)
+{
+	unsigned head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+
+	while (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (!wait)
+			return false;
+		if ((sys_io_uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) &&
+				(errno != EINTR))
+			return false;
+	}
+
+	cqe = &u->cqes[head & *u->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
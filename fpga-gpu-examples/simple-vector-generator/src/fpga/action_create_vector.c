@@ -15,7 +15,19 @@
  */
 
 /*
- * Example to use the FPGA to generate a vector of size vector_size
+ * Example to use the FPGA to generate a vector of size vectorSize : element
+ * i is offset + i, so that a large vector can be generated tile by tile
+ *
+ * With an input of type SNAP_ADDRTYPE_NVME, the vector is read from the
+ * drive of the card instead, at byte offset in.addr. An output of type
+ * SNAP_ADDRTYPE_NVME writes the vector to the drive at byte offset out.addr.
+ * The drive is emulated by a file, see nvme_emu.h.
+ *
+ * SNAP_ADDRTYPE_CARD_DRAM addresses are byte offsets in the DRAM of the
+ * card, emulated by an arena of CARD_DRAM_EMU_SIZE bytes mapped at the first
+ * use (pages are only allocated when touched). An output of that type leaves
+ * the vector in the card, an input of that type copies it from there : the
+ * host gets it back with a second job.
  */
 
 #include <stdio.h>
@@ -27,6 +39,7 @@
 #include <endian.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <libsnap.h>
 #include <linux/types.h>	/* __be64 */
 #include <asm/byteorder.h>
@@ -34,6 +47,16 @@
 #include <snap_internal.h>
 #include <snap_tools.h>
 #include <action_create_vector.h>
+#include <nvme_emu.h>
+
+/* Opened by the first job using it, closed at exit */
+static struct nvme_emu nvme;
+static bool nvme_opened;
+
+#define CARD_DRAM_EMU_SIZE	(1ull << 30)
+
+/* Mapped by the first job using it, kept for the next jobs */
+static uint8_t *card_dram;
 
 static int mmio_write32(struct snap_card *card,
 			uint64_t offs, uint32_t data)
@@ -51,13 +74,59 @@ static int mmio_read32(struct snap_card *card,
 	return 0;
 }
 
+static void nvme_exit(void)
+{
+	nvme_emu_report(&nvme, stdout);
+	nvme_emu_close(&nvme);
+}
+
+static struct nvme_emu *nvme_get(void)
+{
+	const char *spec = getenv(NVME_EMU_ENV);
+
+	if (nvme_opened)
+		return &nvme;
+	if (spec == NULL) {
+		fprintf(stderr, "err: no drive behind SNAP_ADDRTYPE_NVME, set %s\n",
+			NVME_EMU_ENV);
+		return NULL;
+	}
+	if (nvme_emu_open_spec(&nvme, spec) != 0)
+		return NULL;
+	nvme_opened = true;
+	atexit(nvme_exit);
+	return &nvme;
+}
+
+/* len bytes at offset addr of the card DRAM, NULL if they are beyond it */
+static uint32_t *card_dram_get(uint64_t addr, uint64_t len)
+{
+	void *p;
+
+	if ((addr > CARD_DRAM_EMU_SIZE) || (len > CARD_DRAM_EMU_SIZE - addr)) {
+		fprintf(stderr, "err: %llu bytes at %llx are beyond the %llu MB of card DRAM\n",
+			(unsigned long long)len, (unsigned long long)addr,
+			CARD_DRAM_EMU_SIZE >> 20);
+		return NULL;
+	}
+	if (card_dram == NULL) {
+		p = mmap(NULL, CARD_DRAM_EMU_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		card_dram = p;
+	}
+	return (uint32_t *)(card_dram + addr);
+}
+
 /* Main program of the software action */
 static int action_main(struct snap_sim_action *action,
 		       void *job, unsigned int job_len)
 {
-	struct vector_generator_job *js = (struct vector_generator_job *)job;
-	uint32_t *dst;
-	uint64_t len;
+	struct gpu_example_job *js = (struct gpu_example_job *)job;
+	struct nvme_emu *drive = NULL;
+	uint32_t *dst, *staging = NULL;
+	uint64_t len, offset;
 	size_t i;
 
 	/* No error checking ... */
@@ -67,18 +136,59 @@ static int action_main(struct snap_sim_action *action,
 
 
 	// get the parameters from the structure
-	len = js->vector_size;
+	len = js->vectorSize;
+	offset = js->offset;
 	dst = (uint32_t *)(unsigned long)js->out.addr;
 
-	// software action processing : Create a vector of size vector_size
-        for ( i = 0; i < len; i++ ) {
-                dst[i] = (uint32_t)i;
-        }
-
+	if ((js->in.type == SNAP_ADDRTYPE_NVME) || (js->out.type == SNAP_ADDRTYPE_NVME)) {
+		drive = nvme_get();
+		if (drive == NULL)
+			goto out_error;
+	}
+	if (js->out.type == SNAP_ADDRTYPE_CARD_DRAM) {
+		dst = card_dram_get(js->out.addr, len * sizeof(uint32_t));
+		if (dst == NULL)
+			goto out_error;
+	}
+	// the card buffers a vector going to its drive
+	if (js->out.type == SNAP_ADDRTYPE_NVME) {
+		staging = malloc(len * sizeof(uint32_t));
+		if (staging == NULL)
+			goto out_error;
+		dst = staging;
+	}
+
+	if (js->in.type == SNAP_ADDRTYPE_NVME) {
+		// storage to the output buffer, the host never touches the data
+		if (nvme_emu_read(drive, js->in.addr, dst, len * sizeof(uint32_t)) != 0)
+			goto out_error;
+	} else if (js->in.type == SNAP_ADDRTYPE_CARD_DRAM) {
+		const uint32_t *src = card_dram_get(js->in.addr, len * sizeof(uint32_t));
+
+		if (src == NULL)
+			goto out_error;
+		memcpy(dst, src, len * sizeof(uint32_t));
+	} else {
+		// software action processing : Create a vector of size vectorSize
+		for (i = 0; i < len; i++) {
+			dst[i] = (uint32_t)(offset + i);
+		}
+	}
+
+	if ((js->out.type == SNAP_ADDRTYPE_NVME) &&
+			(nvme_emu_write(drive, js->out.addr, dst, len * sizeof(uint32_t)) != 0))
+		goto out_error;
+
+	free(staging);
 	// update the return code to the SNAP job manager
 	action->job.retc = SNAP_RETC_SUCCESS;
 	return 0;
 
+out_error:
+	free(staging);
+	action->job.retc = SNAP_RETC_FAILURE;
+	return 0;
+
 }
 
 /* This is the switch call when software action is called */
@@ -86,7 +196,7 @@ static int action_main(struct snap_sim_action *action,
 static struct snap_sim_action action = {
 	.vendor_id = SNAP_VENDOR_ID_ANY,
 	.device_id = SNAP_DEVICE_ID_ANY,
-	.action_type = VECTOR_GENERATOR_ACTION_TYPE, // Adapt with your ACTION NAME
+	.action_type = GPU_EXAMPLE_ACTION_TYPE, // Adapt with your ACTION NAME
 
 	.job = { .retc = SNAP_RETC_FAILURE, },
 	.state = ACTION_IDLE,
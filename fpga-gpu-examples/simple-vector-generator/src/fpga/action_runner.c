@@ -50,7 +50,7 @@ static const char *mem_tab[] = { "HOST_DRAM", "CARD_DRAM", "TYPE_NVME" };
 // Function that fills the MMIO registers / data structure 
 // these are all data exchanged between the application and the action
 static void snap_prepare_vector_generator(struct snap_job *cjob,
-		struct vector_generator_job *mjob,
+		struct gpu_example_job *mjob,
 		int size,
 		void *addr_out,
 		uint32_t size_out,
@@ -61,7 +61,7 @@ static void snap_prepare_vector_generator(struct snap_job *cjob,
 	assert(sizeof(*mjob) <= SNAP_JOBSIZE);
 	memset(mjob, 0, sizeof(*mjob));
 
-	mjob->vector_size = size;
+	mjob->vectorSize = size;
 
 	// Setting output params : where result will be written in host memory
 	snap_addr_set(&mjob->out, addr_out, size_out, type_out,
@@ -108,7 +108,7 @@ int main(int argc, char *argv[])
 	struct snap_action *action = NULL;
 	char device[128];
 	struct snap_job cjob;
-	struct vector_generator_job mjob;
+	struct gpu_example_job mjob;
 	const char *input = NULL;
 	unsigned long timeout = 600;
 	uint64_t vector_size = 0;
@@ -218,7 +218,7 @@ int main(int argc, char *argv[])
 	}
 
 	// Attach the action that will be used on the allocated card
-	action = snap_attach_action(card, VECTOR_GENERATOR_ACTION_TYPE, action_irq, 60);
+	action = snap_attach_action(card, GPU_EXAMPLE_ACTION_TYPE, action_irq, 60);
 	if (action == NULL) {
 		fprintf(stderr, "err: failed to attach action %u: %s\n",
 				card_no, strerror(errno));
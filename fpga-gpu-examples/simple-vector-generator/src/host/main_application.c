@@ -21,7 +21,24 @@
  * Data is generated by the FPGA (vector of size N) and GPU get this data to
  * perform an addition of this vector with itself before sending back the result
  * in the HOST memory.
- * 
+ *
+ * With -T, the vector is generated, added and written to the output file one
+ * tile of N elements at a time : results go to the file through an io_uring
+ * sink while the next tiles are computed, so memory use stays at a few tiles
+ * whatever the vector size.
+ *
+ * Options :
+ * 	- i : vector size (elements)
+ * 	- o : output file
+ * 	- T : tile size (elements), streams the output to the file
+ * 	- q : tiles being written at the same time (queue depth)
+ * 	- O : output file opened with O_DIRECT
+ * 	- A : NVME reads the vector from the drive of the card instead of
+ * 	      generating it
+ * 	- a : byte offset of the vector on the drive
+ * 	- D : NVME writes the vector to the drive, at byte offset -d
+ * 	      CARD_DRAM leaves it in the DRAM of the card at byte offset -d,
+ * 	      a second job copies it back to the host with -o
  */
 
 #include <fcntl.h>
@@ -35,6 +52,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <stdbool.h>
 
 #include <snap_tools.h>
 #include <libsnap.h>
@@ -42,6 +60,7 @@
 #include <snap_hls_if.h>
 
 #include <kernel.h>
+#include <io_sink.h>
 
 int verbose_flag = 0;
 
@@ -54,16 +73,26 @@ static const char *mem_tab[] = { "HOST_DRAM", "CARD_DRAM", "TYPE_NVME" };
 static void snap_prepare_gpu_example(struct snap_job *cjob,
 				 struct gpu_example_job *mjob,
 	             int size,
+				 uint64_t offset,
+				 uint64_t addr_in,
+				 uint8_t type_in,
 				 void *addr_out,
 				 uint32_t size_out,
 				 uint8_t type_out)
 {
-	fprintf(stderr, "  prepare gpu_example job of %ld bytes size\n", sizeof(*mjob));
+	if (verbose_flag)
+		fprintf(stderr, "  prepare gpu_example job of %ld bytes size\n", sizeof(*mjob));
 
 	assert(sizeof(*mjob) <= SNAP_JOBSIZE);
 	memset(mjob, 0, sizeof(*mjob));
 
     mjob->vectorSize = size;
+	mjob->offset = offset;
+
+	// Setting input params : the vector is read from the card, not generated
+	if (type_in != SNAP_ADDRTYPE_HOST_DRAM)
+		snap_addr_set(&mjob->in, (void *)addr_in, size*sizeof(uint32_t), type_in,
+			      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
 	
     // Setting output params : where result will be written in host memory
 	snap_addr_set(&mjob->out, addr_out, size_out, type_out,
@@ -73,6 +102,63 @@ static void snap_prepare_gpu_example(struct snap_job *cjob,
 	snap_job_set(cjob, mjob, sizeof(*mjob), NULL, 0);
 }
 
+/*
+ * Generates, adds and writes the vector tile by tile : obuff holds the tile
+ * generated by the action, the GPU result goes straight to a buffer of the
+ * sink which writes it while the next tile is generated. With an NVMe input,
+ * tiles are read from the drive one after the other from addr_in.
+ */
+static int stream_output(struct snap_action *action, uint64_t vectorSize,
+			 uint64_t tile, uint64_t addr_in, uint8_t type_in,
+			 uint32_t *obuff, const char *output,
+			 uint32_t depth, bool direct, unsigned long timeout)
+{
+	struct snap_job cjob;
+	struct gpu_example_job mjob;
+	struct io_sink sink;
+	int rc = 0;
+
+	if (io_sink_open(&sink, output, tile*sizeof(uint32_t), depth, direct) != 0) {
+		fprintf(stderr, "err: cannot stream the output to %s\n", output);
+		return -1;
+	}
+
+	for (uint64_t first = 0; first < vectorSize; first += tile) {
+		uint64_t len = (vectorSize - first < tile) ? vectorSize - first : tile;
+		uint32_t *result;
+
+		snap_prepare_gpu_example(&cjob, &mjob, len, first,
+					 addr_in + first*sizeof(uint32_t), type_in, obuff,
+					 len*sizeof(uint32_t), SNAP_ADDRTYPE_HOST_DRAM);
+		if ((snap_action_sync_execute_job(action, &cjob, timeout) != 0) ||
+				(cjob.retc != SNAP_RETC_SUCCESS)) {
+			fprintf(stderr, "err: action failed on the tile at %llu\n",
+				(unsigned long long)first);
+			rc = -1;
+			break;
+		}
+
+		// waits for a write to complete when every buffer is in flight
+		result = io_sink_buffer(&sink);
+		if (result == NULL) {
+			rc = -1;
+			break;
+		}
+		cuda_add(obuff, obuff, result, len);
+		if (io_sink_write(&sink, result, len*sizeof(uint32_t)) != 0) {
+			rc = -1;
+			break;
+		}
+	}
+
+	if (io_sink_close(&sink) != 0) {
+		fprintf(stderr, "err: writing %s failed\n", output);
+		rc = -1;
+	}
+	io_sink_report(&sink, stdout);
+	return rc;
+}
+
 /* main program of the application for the hls_helloworld example        */
 /* This application will always be run on CPU and will call either       */
 /* a software action (CPU executed) or a hardware action (FPGA executed) */
@@ -91,9 +177,14 @@ int main(int argc, char *argv[])
 	unsigned long timeout = 600;
 	const char *space = "CARD_RAM";
     uint64_t vectorSize = 0;
+	uint64_t tile = 0;
+	uint32_t depth = IO_SINK_DEFAULT_DEPTH;
+	bool direct = false;
 	uint32_t  *obuff = NULL, *result = NULL;
 	uint32_t type_out = SNAP_ADDRTYPE_HOST_DRAM;
 	uint64_t addr_out = 0x0ull;
+	uint32_t type_in = SNAP_ADDRTYPE_HOST_DRAM;
+	uint64_t addr_in = 0x0ull;
 	int verify = 0;
 	int exit_code = EXIT_SUCCESS;
 	snap_action_flag_t action_irq = (SNAP_ACTION_DONE_IRQ | SNAP_ATTACH_IRQ);
@@ -104,10 +195,19 @@ int main(int argc, char *argv[])
 		static struct option long_options[] = {
 			{ "input",	 required_argument, NULL, 'i' },
 			{ "output",	 required_argument, NULL, 'o' },
+			{ "input_type",	 required_argument, NULL, 'A' },
+			{ "input_addr",	 required_argument, NULL, 'a' },
+			{ "output_type", required_argument, NULL, 'D' },
+			{ "output_addr", required_argument, NULL, 'd' },
+			{ "tile",	 required_argument, NULL, 'T' },
+			{ "queue_depth", required_argument, NULL, 'q' },
+			{ "direct",	 no_argument,	    NULL, 'O' },
+			{ "verbose",	 no_argument,	    NULL, 'v' },
+			{ 0,		 no_argument,	    NULL, 0   },
 		};
 
 		ch = getopt_long(argc, argv,
-                                 "C:i:o:A:a:D:d:s:t:XNVvh",
+                                 "C:i:o:A:a:D:d:s:t:T:q:OXNVvh",
 				 long_options, &option_index);
 		if (ch == -1)
 			break;
@@ -129,10 +229,24 @@ int main(int argc, char *argv[])
 				type_out = SNAP_ADDRTYPE_CARD_DRAM;
 			else if (strcmp(space, "HOST_DRAM") == 0)
 				type_out = SNAP_ADDRTYPE_HOST_DRAM;
+			else if (strcmp(space, "NVME") == 0)
+				type_out = SNAP_ADDRTYPE_NVME;
 			else {
 				exit(EXIT_FAILURE);
 			}
 			break;
+			/* input data */
+		case 'A':
+			if (strcmp(optarg, "NVME") == 0)
+				type_in = SNAP_ADDRTYPE_NVME;
+			else {
+				fprintf(stderr, "err: only NVME can be read, -A %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'a':
+			addr_in = strtoull(optarg, (char **)NULL, 0);
+			break;
 		case 'd':
 			addr_out = strtol(optarg, (char **)NULL, 0);
 			break;
@@ -142,6 +256,22 @@ int main(int argc, char *argv[])
                 case 't':
                         timeout = strtol(optarg, (char **)NULL, 0);
                         break;		
+		case 'T':
+			tile = strtoull(optarg, (char **)NULL, 0);
+			break;
+		case 'q':
+			depth = strtoul(optarg, (char **)NULL, 0);
+			if ((depth < 1) || (depth > IO_SINK_MAX_DEPTH)) {
+				fprintf(stderr, "err: queue depth is 1 to %d\n", IO_SINK_MAX_DEPTH);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'O':
+			direct = true;
+			break;
+		case 'v':
+			verbose_flag = 1;
+			break;
                 case 'X':
 			verify++;
 			break;
@@ -155,8 +285,29 @@ int main(int argc, char *argv[])
         vectorSize = atoi(input);
     }
 
+	if ((tile != 0) && (output == NULL)) {
+		fprintf(stderr, "err: -T streams the result to the output file, -o is needed\n");
+		exit(EXIT_FAILURE);
+	}
+	if (tile > vectorSize)
+		tile = vectorSize;
+	if ((type_out == SNAP_ADDRTYPE_NVME) && (output != NULL)) {
+		fprintf(stderr, "err: -D NVME leaves the vector on the drive, no -o\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((type_out == SNAP_ADDRTYPE_CARD_DRAM) && (tile != 0)) {
+		fprintf(stderr, "err: -T streams the tiles through the host, no -D CARD_DRAM\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* if output file is defined, use that as output */
-	if (output != NULL) {
+	if ((output != NULL) && (tile != 0)) {
+		// one tile for the action, the results live in the sink
+		obuff = snap_malloc(tile*sizeof(uint32_t));
+		memset(obuff, 0x0, tile*sizeof(uint32_t));
+		type_out = SNAP_ADDRTYPE_HOST_DRAM;
+		addr_out = (unsigned long)obuff;
+	} else if (output != NULL) {
 		size_t set_size = vectorSize*sizeof(uint32_t);
 
 		/* Allocate in host memory a buffer for the vector generated by the FPGA 
@@ -168,20 +319,27 @@ int main(int argc, char *argv[])
 		memset(obuff, 0x0, set_size);
 		memset(result, 0x0, set_size);
 
-		// prepare params to be written in MMIO registers for action
-		type_out = SNAP_ADDRTYPE_HOST_DRAM;
-		addr_out = (unsigned long)obuff;
+		// prepare params to be written in MMIO registers for action : a
+		// vector left in the card DRAM is copied to obuff by a second job
+		if (type_out != SNAP_ADDRTYPE_CARD_DRAM) {
+			type_out = SNAP_ADDRTYPE_HOST_DRAM;
+			addr_out = (unsigned long)obuff;
+		}
 	}
 
 
 	/* Display the parameters that will be used for the example */
 	printf("PARAMETERS:\n"
 	       "  input:       %s\n"
+	       "  type_in:     %s\n"
+	       "  addr_in:     %016llx\n"
 	       "  output:      %s\n"
 	       "  type_out:    %x %s\n"
 	       "  addr_out:    %016llx\n"
 	       "  size_out (bytes):    %lu\n",
-	       input  ? input  : "unknown", output ? output : "unknown",
+	       input  ? input  : "unknown",
+	       type_in == SNAP_ADDRTYPE_NVME ? mem_tab[type_in] : "generated",
+	       (long long)addr_in, output ? output : "unknown",
 	       type_out, mem_tab[type_out], (long long)addr_out,
 	       vectorSize*sizeof(uint32_t));
 
@@ -196,16 +354,54 @@ int main(int argc, char *argv[])
 	// Attach the action that will be used on the allocated card
 	action = snap_attach_action(card, GPU_EXAMPLE_ACTION_TYPE, action_irq, 60);
 
+	if (tile != 0) {
+		if (stream_output(action, vectorSize, tile, addr_in, type_in, obuff,
+				  output, depth, direct, timeout) != 0)
+			exit_code = EXIT_FAILURE;
+		snap_detach_action(action);
+		snap_card_free(card);
+		__free(obuff);
+		exit(exit_code);
+	}
+
 	// Fill the stucture of data exchanged with the action
-	snap_prepare_gpu_example(&cjob, &mjob,vectorSize,(void *)addr_out, vectorSize*sizeof(uint32_t), type_out);
+	snap_prepare_gpu_example(&cjob, &mjob,vectorSize,0,addr_in,type_in,(void *)addr_out, vectorSize*sizeof(uint32_t), type_out);
 
 	// Call the action will:
 	snap_action_sync_execute_job(action, &cjob, timeout);
+
+	// the GPU cannot reach the card DRAM : the action copies the vector back
+	if ((type_out == SNAP_ADDRTYPE_CARD_DRAM) && (output != NULL) &&
+	    (cjob.retc == SNAP_RETC_SUCCESS)) {
+		snap_prepare_gpu_example(&cjob, &mjob, vectorSize, 0, addr_out,
+					 SNAP_ADDRTYPE_CARD_DRAM, obuff,
+					 vectorSize*sizeof(uint32_t), SNAP_ADDRTYPE_HOST_DRAM);
+		snap_action_sync_execute_job(action, &cjob, timeout);
+	}
 	
 	// Detach action + disallocate the card
 	snap_detach_action(action);
 	snap_card_free(card);
 
+	// the GPU cannot reach the drive : the vector stays there
+	if ((type_out == SNAP_ADDRTYPE_NVME) ||
+	    ((type_out == SNAP_ADDRTYPE_CARD_DRAM) && (output == NULL))) {
+		if (cjob.retc != SNAP_RETC_SUCCESS)
+			exit_code = EXIT_FAILURE;
+		printf("vector of %llu elements %s %s at offset %llu\n",
+		       (unsigned long long)vectorSize,
+		       exit_code == EXIT_SUCCESS ? "written" : "NOT written",
+		       type_out == SNAP_ADDRTYPE_NVME ? "on the drive" : "in the card DRAM",
+		       (unsigned long long)addr_out);
+		exit(exit_code);
+	}
+	if (cjob.retc != SNAP_RETC_SUCCESS) {
+		fprintf(stderr, "err: action failed, no vector for the GPU\n");
+		__free(obuff);
+		__free(result);
+		exit(EXIT_FAILURE);
+	}
+
 	/***************************************************
  	 *              GPU related 
  	 ***************************************************/